@@ -53,7 +53,7 @@ export function build(b: Builder) {
     b.addTarget('mo5', 'windowed-exe', (t) => {
         t.setDir('src');
         t.setIdeFolder('src');
-        t.addSources([`main.c`, `mo5.c`, `keybuf.c`, `m6809.c`, `mo5rom.c`]);
+        t.addSources([`main.c`, `mo5.c`, `mo5expr.c`, `mo5cheat.c`, `mo5search.c`, `mo5trace.c`, `mo5cover.c`, `keybuf.c`, `basic.c`, `rewind.c`, `mo5snap.c`, `hash.c`, `worker.c`, `explore.c`, `mapfile.c`, `tapeout.c`, `catalog.c`, `archive.c`, `m6809.c`, `mo5rom.c`]);
         t.addDependencies(['common']);
         t.addIncludeDirectories({ dirs: ['../libs/sokol']});
     });
@@ -61,7 +61,7 @@ export function build(b: Builder) {
     b.addTarget(`mo5-ui`, 'windowed-exe', (t) => {
         t.setDir('src');
         t.setIdeFolder('src');
-        t.addSources([`main.c`, `mo5.c`, `mo5-ui-impl.cc`, `keybuf.c`, `m6809.c`, `mo5rom.c`]);
+        t.addSources([`main.c`, `mo5.c`, `mo5expr.c`, `mo5cheat.c`, `mo5search.c`, `mo5trace.c`, `mo5cover.c`, `mo5-ui-impl.cc`, `keybuf.c`, `basic.c`, `rewind.c`, `mo5snap.c`, `hash.c`, `worker.c`, `explore.c`, `mapfile.c`, `tapeout.c`, `catalog.c`, `archive.c`, `m6809.c`, `mo5rom.c`]);
         t.addCompileDefinitions({ EMU_USE_UI: '1' });
         t.addDependencies(['ui']);
         t.addIncludeDirectories({ dirs: ['../libs/sokol']});
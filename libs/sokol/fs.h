@@ -43,6 +43,7 @@ bool fs_failed(fs_channel_t chn);
 bool fs_pending(fs_channel_t chn);
 gfx_range_t fs_data(fs_channel_t chn);
 bool fs_ext(fs_channel_t chn, const char* str);
+const char* fs_filename(fs_channel_t chn);
 void fs_save_ini(const char* key, const char* payload);
 const char* fs_load_ini(const char* key);
 void fs_free_ini(const char* payload_or_null);
@@ -59,6 +59,20 @@ typedef uint8_t (*ui_dasm_read_t)(int layer, uint16_t addr, void* user_data);
 /* callback for checking if the current instruction contains a jump target */
 typedef bool (*ui_dasm_jumptarget_t)(void* win, uint16_t pc, uint16_t* out_addr, void* user_data);
 
+/* optional callback for the background color of an instruction line (e.g. a heat map), 0 for none */
+typedef uint32_t (*ui_dasm_color_t)(int layer, uint16_t addr, void* user_data);
+
+/* optional callback telling if an instruction is known to start at an address
+   (e.g. it was executed), lines are kept to these instruction boundaries
+*/
+typedef bool (*ui_dasm_opcode_t)(int layer, uint16_t addr, void* user_data);
+
+/* optional callback for the generation of the memory at addr: it must change
+   whenever the bytes there may have changed, decoded lines are cached while
+   the generations of their bytes stay the same
+*/
+typedef uint32_t (*ui_dasm_gen_t)(int layer, uint16_t addr, void* user_data);
+
 typedef uint8_t (*ui_dasm_in_cb_t)(void* user_data);
 typedef void (*ui_dasm_out_cb_t)(char c, void* user_data);
 typedef void (*ui_dasm_op_cb_t)(uint16_t addr, ui_dasm_in_cb_t in_cb, ui_dasm_out_cb_t out_cb, void* user_data);
@@ -68,6 +82,7 @@ typedef void (*ui_dasm_op_cb_t)(uint16_t addr, ui_dasm_in_cb_t in_cb, ui_dasm_ou
 #define UI_DASM_MAX_BINLEN (16)
 #define UI_DASM_NUM_LINES (512)
 #define UI_DASM_MAX_STACK (128)
+#define UI_DASM_CACHE_SIZE (1024)   /* decoded lines, must be a power of 2 */
 
 /* setup parameters for ui_dasm_init()
 
@@ -80,17 +95,37 @@ typedef struct {
     ui_dasm_read_t read_cb;
     ui_dasm_jumptarget_t jump_tgt_cb;
     ui_dasm_op_cb_t dasm_cb;
+    ui_dasm_color_t color_cb;
+    ui_dasm_opcode_t opcode_cb;
+    ui_dasm_gen_t gen_cb;
     void* user_data;
     int x, y;           /* initial window pos */
     int w, h;           /* initial window size or 0 for default size */
     bool open;          /* initial open state */
 } ui_dasm_desc_t;
 
+/* a decoded line in the cache, indexed by the low bits of its address */
+typedef struct {
+    bool valid;
+    bool jump;
+    uint8_t layer;
+    uint8_t num_bytes;
+    uint8_t str_len;
+    uint16_t addr;
+    uint16_t jump_addr;
+    uint32_t gen[2];    /* generations of the first and the last byte */
+    uint8_t bin[UI_DASM_MAX_BINLEN];
+    char str[UI_DASM_MAX_STRLEN];
+} ui_dasm_line_t;
+
 typedef struct {
     const char* title;
     ui_dasm_read_t read_cb;
     ui_dasm_jumptarget_t jump_tgt_cb;
     ui_dasm_op_cb_t dasm_cb;
+    ui_dasm_color_t color_cb;
+    ui_dasm_opcode_t opcode_cb;
+    ui_dasm_gen_t gen_cb;
     int cur_layer;
     int num_layers;
     const char* layers[UI_DASM_MAX_LAYERS];
@@ -106,11 +141,14 @@ typedef struct {
     char str_buf[UI_DASM_MAX_STRLEN];
     int bin_pos;
     uint8_t bin_buf[UI_DASM_MAX_BINLEN];
+    bool jump;          /* the last line jumps to jump_addr */
+    uint16_t jump_addr;
     int stack_num;
     int stack_pos;
     uint16_t stack[UI_DASM_MAX_STACK];
     uint16_t highlight_addr;
     uint32_t highlight_color;
+    ui_dasm_line_t cache[UI_DASM_CACHE_SIZE];
 } ui_dasm_t;
 
 void ui_dasm_init(ui_dasm_t* win, const ui_dasm_desc_t* desc);
@@ -143,6 +181,9 @@ void ui_dasm_init(ui_dasm_t* win, const ui_dasm_desc_t* desc) {
     win->read_cb = desc->read_cb;
     win->jump_tgt_cb = desc->jump_tgt_cb;
     win->dasm_cb = desc->dasm_cb;
+    win->color_cb = desc->color_cb;
+    win->opcode_cb = desc->opcode_cb;
+    win->gen_cb = desc->gen_cb;
     win->start_addr = desc->start_addr;
     win->user_data = desc->user_data;
     win->init_x = (float) desc->x;
@@ -187,18 +228,99 @@ static void _ui_dasm_out_cb(char c, void* user_data) {
     }
 }
 
-/* disassemble the next instruction */
-static void _ui_dasm_disasm(ui_dasm_t* win) {
+static bool _ui_dasm_is_opcode(ui_dasm_t* win, uint16_t addr) {
+    return win->opcode_cb && win->opcode_cb(win->cur_layer, addr, win->user_data);
+}
+
+/* check if the current instruction contains a jump target */
+static bool _ui_dasm_jumptarget(ui_dasm_t* win, uint16_t pc, uint16_t* out_addr) {
+    return win->jump_tgt_cb && win->jump_tgt_cb(win, pc, out_addr, win->user_data);
+}
+
+static uint32_t _ui_dasm_gen(ui_dasm_t* win, uint16_t addr) {
+    return win->gen_cb(win->cur_layer, addr, win->user_data);
+}
+
+/* decode the instruction at cur_addr, from the cache if its bytes didn't change */
+static void _ui_dasm_decode(ui_dasm_t* win) {
+    const uint16_t op_addr = win->cur_addr;
+    ui_dasm_line_t* line = 0;
+    uint32_t gen = 0;
+    if (win->gen_cb) {
+        line = &win->cache[op_addr & (UI_DASM_CACHE_SIZE - 1)];
+        gen = _ui_dasm_gen(win, op_addr);
+        if (line->valid && (line->addr == op_addr) && (line->layer == win->cur_layer) && (line->gen[0] == gen) &&
+            (line->gen[1] == _ui_dasm_gen(win, (uint16_t)(op_addr + line->num_bytes - 1))))
+        {
+            memcpy(win->bin_buf, line->bin, line->num_bytes);
+            win->bin_pos = line->num_bytes;
+            memcpy(win->str_buf, line->str, (size_t)line->str_len + 1);
+            win->str_pos = line->str_len;
+            win->jump = line->jump;
+            win->jump_addr = line->jump_addr;
+            win->cur_addr = (uint16_t)(op_addr + line->num_bytes);
+            return;
+        }
+    }
     win->str_pos = 0;
+    win->str_buf[0] = 0;
     win->bin_pos = 0;
     if(win->dasm_cb) {
         win->dasm_cb(win->cur_addr, _ui_dasm_in_cb, _ui_dasm_out_cb, win);
     }
+    win->jump = _ui_dasm_jumptarget(win, win->cur_addr, &win->jump_addr);
+    if (line && (win->bin_pos > 0)) {
+        line->valid = true;
+        line->jump = win->jump;
+        line->layer = (uint8_t)win->cur_layer;
+        line->num_bytes = (uint8_t)win->bin_pos;
+        line->str_len = (uint8_t)win->str_pos;
+        line->addr = op_addr;
+        line->jump_addr = win->jump_addr;
+        line->gen[0] = gen;
+        line->gen[1] = _ui_dasm_gen(win, (uint16_t)(op_addr + win->bin_pos - 1));
+        memcpy(line->bin, win->bin_buf, (size_t)win->bin_pos);
+        memcpy(line->str, win->str_buf, (size_t)win->str_pos + 1);
+    }
 }
 
-/* check if the current instruction contains a jump target */
-static bool _ui_dasm_jumptarget(ui_dasm_t* win, uint16_t pc, uint16_t* out_addr) {
-    return win->jump_tgt_cb && win->jump_tgt_cb(win, pc, out_addr, win->user_data);
+/* disassemble the next instruction, an unknown one running over a known
+   instruction start becomes data bytes up to it
+*/
+static void _ui_dasm_disasm(ui_dasm_t* win) {
+    const uint16_t op_addr = win->cur_addr;
+    _ui_dasm_decode(win);
+    if (win->opcode_cb && !_ui_dasm_is_opcode(win, op_addr)) {
+        for (int n = 1; n < win->bin_pos; n++) {
+            if (_ui_dasm_is_opcode(win, (uint16_t)(op_addr + n))) {
+                win->bin_pos = n;
+                win->cur_addr = (uint16_t)(op_addr + n);
+                win->jump = false;
+                win->str_pos = snprintf(win->str_buf, UI_DASM_MAX_STRLEN, "FCB $%02X", win->bin_buf[0]);
+                for (int i = 1; i < n; i++) {
+                    win->str_pos += snprintf(win->str_buf + win->str_pos, (size_t)(UI_DASM_MAX_STRLEN - win->str_pos), ",$%02X", win->bin_buf[i]);
+                }
+                break;
+            }
+        }
+    }
+}
+
+/* start of the known instruction holding addr, addr if there is none */
+static uint16_t _ui_dasm_op_start(ui_dasm_t* win, uint16_t addr) {
+    if (win->opcode_cb && !_ui_dasm_is_opcode(win, addr)) {
+        for (int back = 1; back < 5; back++) {
+            const uint16_t op_addr = (uint16_t)(addr - back);
+            if (_ui_dasm_is_opcode(win, op_addr)) {
+                win->cur_addr = op_addr;
+                _ui_dasm_disasm(win);
+                if (win->bin_pos > back) {
+                    return op_addr;
+                }
+            }
+        }
+    }
+    return addr;
 }
 
 /* push an address on the bookmark stack */
@@ -267,7 +389,7 @@ static void _ui_dasm_draw_disasm(ui_dasm_t* win) {
     clipper.Step();
 
     /* skip hidden lines */
-    win->cur_addr = win->start_addr;
+    win->cur_addr = _ui_dasm_op_start(win, win->start_addr);
     for (int line_i = 0; (line_i < clipper.DisplayStart) && (line_i < UI_DASM_NUM_LINES); line_i++) {
         _ui_dasm_disasm(win);
     }
@@ -278,6 +400,13 @@ static void _ui_dasm_draw_disasm(ui_dasm_t* win) {
         _ui_dasm_disasm(win);
         const int num_bytes = win->bin_pos;
 
+        /* background color */
+        const uint32_t bg_color = win->color_cb ? win->color_cb(win->cur_layer, op_addr, win->user_data) : 0;
+        if (bg_color) {
+            const ImVec2 pos = ImGui::GetCursorScreenPos();
+            ImGui::GetWindowDrawList()->AddRectFilled(pos, ImVec2(pos.x + ImGui::GetContentRegionAvail().x, pos.y + line_height), bg_color);
+        }
+
         /* highlight current hovered address */
         bool highlight = false;
         if (win->highlight_addr == op_addr) {
@@ -305,8 +434,8 @@ static void _ui_dasm_draw_disasm(ui_dasm_t* win) {
         }
 
         /* check for jump instruction and draw an arrow  */
-        uint16_t jump_addr = 0;
-        if (_ui_dasm_jumptarget(win, win->cur_addr, &jump_addr)) {
+        if (win->jump) {
+            const uint16_t jump_addr = win->jump_addr;
             ImGui::SameLine(line_start_x + cell_width*4 + glyph_width*2 + glyph_width*20);
             ImGui::PushID(line_i);
             if (ImGui::ArrowButton("##btn", ImGuiDir_Right)) {
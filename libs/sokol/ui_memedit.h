@@ -66,6 +66,8 @@ typedef void MemoryEditor;
 /* callbacks for reading and writing bytes */
 typedef uint8_t (*ui_memedit_read_t)(int layer, uint16_t addr, void* user_data);
 typedef void (*ui_memedit_write_t)(int layer, uint16_t addr, uint8_t data, void* user_data);
+/* optional callback for the background color of a byte (e.g. a heat map), 0 for none */
+typedef uint32_t (*ui_memedit_color_t)(int layer, uint16_t addr, void* user_data);
 
 /* setup parameters for ui_memedit_init()
 
@@ -76,6 +78,7 @@ typedef struct {
     const char* layers[UI_MEMEDIT_MAX_LAYERS];   /* memory system layer names */
     ui_memedit_read_t read_cb;
     ui_memedit_write_t write_cb;
+    ui_memedit_color_t color_cb;
     size_t max_addr;
     int num_cols;       /* initial number of cols, default is 16 */
     bool hide_ascii;    /* initially hide the ASCII column */
@@ -91,6 +94,7 @@ typedef struct {
     const char* title;
     ui_memedit_read_t read_cb;
     ui_memedit_write_t write_cb;
+    ui_memedit_color_t color_cb;
     void* user_data;
     float init_x, init_y;
     float init_w, init_h;
@@ -191,6 +195,7 @@ struct MemoryEditor
     int CurLayer;
     const char* Layers[UI_MEMEDIT_MAX_LAYERS];
     bool OptShowAddrInput;      // = true
+    ImU32 (*BgColorFn)(const ImU8* data, size_t off);  // = 0 // optional handler to return the background color of a byte, 0 for none
     /*--- END ui_memedit.h changes ---*/
 
     // Settings
@@ -256,6 +261,7 @@ struct MemoryEditor
 
         /*--- BEGIN ui_memedit.h changes ---*/
         OptShowAddrInput = true;
+        BgColorFn = NULL;
         NumLayers = 0;
         CurLayer = 0;
         for (int i = 0; i < UI_MEMEDIT_MAX_LAYERS; i++) {
@@ -410,6 +416,15 @@ struct MemoryEditor
                         byte_pos_x += (float)(n / OptMidColsCount) * s.SpacingBetweenMidCols;
                     ImGui::SameLine(byte_pos_x);
 
+                    /*--- BEGIN ui_memedit.h changes ---*/
+                    const ImU32 bg_color = BgColorFn ? BgColorFn(mem_data, addr) : 0;
+                    if (bg_color)
+                    {
+                        ImVec2 pos = ImGui::GetCursorScreenPos();
+                        draw_list->AddRectFilled(pos, ImVec2(pos.x + s.GlyphWidth * 2, pos.y + s.LineHeight), bg_color);
+                    }
+                    /*--- END ui_memedit.h changes ---*/
+
                     // Draw highlight
                     bool is_highlight_from_user_range = (addr >= HighlightMin && addr < HighlightMax);
                     bool is_highlight_from_user_func = (HighlightFn && HighlightFn(mem_data, addr));
@@ -891,6 +906,12 @@ static uint8_t _ui_memedit_readfn(const uint8_t* ptr, size_t off) {
     }
 }
 
+static ImU32 _ui_memedit_bgcolorfn(const uint8_t* ptr, size_t off) {
+    const ui_memedit_t* win = (ui_memedit_t*) ptr;
+    EMU_ASSERT(win && win->ed);
+    return win->color_cb(win->ed->CurLayer, (uint16_t)off, win->user_data);
+}
+
 static void _ui_memedit_writefn(uint8_t* ptr, size_t off, uint8_t val) {
     /* we'll treat the "data ptr" as "user data" */
     const ui_memedit_t* win = (ui_memedit_t*) ptr;
@@ -908,6 +929,7 @@ void ui_memedit_init(ui_memedit_t* win, const ui_memedit_desc_t* desc) {
     win->title = desc->title;
     win->read_cb = desc->read_cb;
     win->write_cb = desc->write_cb;
+    win->color_cb = desc->color_cb;
     win->user_data = desc->user_data;
     win->init_x = (float) desc->x;
     win->init_y = (float) desc->y;
@@ -923,6 +945,9 @@ void ui_memedit_init(ui_memedit_t* win, const ui_memedit_desc_t* desc) {
     win->ed->Open = win->open;
     win->ed->ReadFn = _ui_memedit_readfn;
     win->ed->WriteFn = _ui_memedit_writefn;
+    if (win->color_cb) {
+        win->ed->BgColorFn = _ui_memedit_bgcolorfn;
+    }
     win->ed->OptAddrDigitsCount = 4;
     for (int i = 0; i < UI_MEMEDIT_MAX_LAYERS; i++) {
         if (desc->layers[i]) {
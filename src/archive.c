@@ -0,0 +1,595 @@
+#include "archive.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#define ARCHIVE_FAST_BITS (9)
+#define ARCHIVE_MAX_BITS (15)
+#define ARCHIVE_CACHE_ENTRIES (8)
+// cached buffers without references are freed above this budget
+#define ARCHIVE_CACHE_BUDGET (16 * 1024 * 1024)
+// members are media images, the largest is a 4 sided floppy disk (1.3MB),
+// a whole cassette at 1200 bauds is smaller
+#define ARCHIVE_MAX_MEMBER_SIZE (2 * 1024 * 1024)
+
+// canonical huffman code, decoded with a lookup table for short codes and
+// bit by bit for longer ones
+typedef struct {
+    uint16_t count[ARCHIVE_MAX_BITS + 1];   // number of codes of each length
+    uint16_t symbol[288];                   // symbols ordered by code
+    uint16_t fast[1 << ARCHIVE_FAST_BITS];  // symbol << 4 | length, 0 if the code is longer
+} archive_huffman_t;
+
+typedef struct {
+    const uint8_t* src;
+    size_t src_size;
+    size_t src_pos;
+    uint32_t bit_buf;
+    int bit_count;
+    uint8_t* dst;
+    size_t dst_size;
+    size_t dst_pos;
+    bool error;
+} archive_inflate_t;
+
+typedef struct {
+    uint8_t* data;
+    size_t size;
+    uint32_t crc32;
+    char name[256];
+    int refs;           // references handed out, the cache itself doesn't count
+    uint32_t used;      // last use, for LRU eviction
+} archive_cache_entry_t;
+
+static struct {
+    uint32_t crc_table[256];
+    bool crc_valid;
+    archive_cache_entry_t entries[ARCHIVE_CACHE_ENTRIES];
+    uint32_t use_count;
+} state;
+
+static uint16_t _archive_get16(const uint8_t* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t _archive_get32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t _archive_crc32(const uint8_t* data, size_t size) {
+    if (!state.crc_valid) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+            }
+            state.crc_table[i] = c;
+        }
+        state.crc_valid = true;
+    }
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < size; i++) {
+        crc = state.crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffff;
+}
+
+// fill the bit buffer with at least num bits, false at the end of the input
+static bool _archive_need(archive_inflate_t* s, int num) {
+    while (s->bit_count < num) {
+        if (s->src_pos >= s->src_size) {
+            return false;
+        }
+        s->bit_buf |= (uint32_t)s->src[s->src_pos++] << s->bit_count;
+        s->bit_count += 8;
+    }
+    return true;
+}
+
+static int _archive_bits(archive_inflate_t* s, int num) {
+    if (!_archive_need(s, num)) {
+        s->error = true;
+        return 0;
+    }
+    const int val = (int)(s->bit_buf & ((1u << num) - 1));
+    s->bit_buf >>= num;
+    s->bit_count -= num;
+    return val;
+}
+
+static bool _archive_huffman_build(archive_huffman_t* h, const uint8_t* lengths, int num) {
+    memset(h, 0, sizeof(archive_huffman_t));
+    for (int i = 0; i < num; i++) {
+        h->count[lengths[i]]++;
+    }
+    // over-subscribed codes are invalid, incomplete codes are allowed
+    int left = 1;
+    for (int len = 1; len <= ARCHIVE_MAX_BITS; len++) {
+        left = (left << 1) - h->count[len];
+        if (left < 0) {
+            return false;
+        }
+    }
+    uint16_t offs[ARCHIVE_MAX_BITS + 2];
+    uint16_t next_code[ARCHIVE_MAX_BITS + 1];
+    offs[1] = 0;
+    int code = 0;
+    for (int len = 1; len <= ARCHIVE_MAX_BITS; len++) {
+        offs[len + 1] = offs[len] + h->count[len];
+        code = (code + ((len > 1) ? h->count[len - 1] : 0)) << 1;
+        next_code[len] = (uint16_t)code;
+    }
+    for (int sym = 0; sym < num; sym++) {
+        const int len = lengths[sym];
+        if (len == 0) {
+            continue;
+        }
+        h->symbol[offs[len]++] = (uint16_t)sym;
+        if (len <= ARCHIVE_FAST_BITS) {
+            // codes are stored starting with the most significant bit
+            const int c = next_code[len];
+            int rev = 0;
+            for (int k = 0; k < len; k++) {
+                rev |= ((c >> k) & 1) << (len - 1 - k);
+            }
+            for (int j = rev; j < (1 << ARCHIVE_FAST_BITS); j += (1 << len)) {
+                h->fast[j] = (uint16_t)((sym << 4) | len);
+            }
+        }
+        next_code[len]++;
+    }
+    return true;
+}
+
+static int _archive_decode(archive_inflate_t* s, const archive_huffman_t* h) {
+    _archive_need(s, ARCHIVE_FAST_BITS);
+    const uint16_t entry = h->fast[s->bit_buf & ((1 << ARCHIVE_FAST_BITS) - 1)];
+    const int len = entry & 15;
+    if ((entry != 0) && (len <= s->bit_count)) {
+        s->bit_buf >>= len;
+        s->bit_count -= len;
+        return entry >> 4;
+    }
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (int l = 1; l <= ARCHIVE_MAX_BITS; l++) {
+        code |= _archive_bits(s, 1);
+        const int count = h->count[l];
+        if ((code - count) < first) {
+            return h->symbol[index + (code - first)];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    s->error = true;
+    return 0;
+}
+
+static void _archive_stored(archive_inflate_t* s) {
+    // skip to the byte boundary, whole bytes may still be in the bit buffer
+    _archive_bits(s, s->bit_count & 7);
+    const int len = _archive_bits(s, 16);
+    const int nlen = _archive_bits(s, 16);
+    if (s->error || (len != (~nlen & 0xffff)) || ((s->dst_pos + (size_t)len) > s->dst_size)) {
+        s->error = true;
+        return;
+    }
+    int n = len;
+    while ((n > 0) && (s->bit_count >= 8)) {
+        s->dst[s->dst_pos++] = (uint8_t)_archive_bits(s, 8);
+        n--;
+    }
+    if ((s->src_pos + (size_t)n) > s->src_size) {
+        s->error = true;
+        return;
+    }
+    memcpy(&s->dst[s->dst_pos], &s->src[s->src_pos], (size_t)n);
+    s->src_pos += (size_t)n;
+    s->dst_pos += (size_t)n;
+}
+
+static void _archive_codes(archive_inflate_t* s, const archive_huffman_t* lencode, const archive_huffman_t* distcode) {
+    static const uint16_t len_base[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+    };
+    static const uint8_t len_extra[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+    };
+    static const uint16_t dist_base[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+    };
+    static const uint8_t dist_extra[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+    };
+    while (!s->error) {
+        int sym = _archive_decode(s, lencode);
+        if (sym < 256) {
+            if (s->dst_pos >= s->dst_size) {
+                s->error = true;
+                return;
+            }
+            s->dst[s->dst_pos++] = (uint8_t)sym;
+        } else if (sym == 256) {
+            return;
+        } else {
+            sym -= 257;
+            if (sym >= 29) {
+                s->error = true;
+                return;
+            }
+            const size_t len = len_base[sym] + (size_t)_archive_bits(s, len_extra[sym]);
+            const int dsym = _archive_decode(s, distcode);
+            if (dsym >= 30) {
+                s->error = true;
+                return;
+            }
+            const size_t dist = dist_base[dsym] + (size_t)_archive_bits(s, dist_extra[dsym]);
+            if (s->error || (dist > s->dst_pos) || ((s->dst_pos + len) > s->dst_size)) {
+                s->error = true;
+                return;
+            }
+            // the copy may overlap its own output
+            const uint8_t* from = &s->dst[s->dst_pos - dist];
+            uint8_t* to = &s->dst[s->dst_pos];
+            for (size_t i = 0; i < len; i++) {
+                to[i] = from[i];
+            }
+            s->dst_pos += len;
+        }
+    }
+}
+
+static void _archive_fixed(archive_inflate_t* s) {
+    uint8_t lengths[288 + 30];
+    memset(lengths, 8, 144);
+    memset(lengths + 144, 9, 112);
+    memset(lengths + 256, 7, 24);
+    memset(lengths + 280, 8, 8);
+    memset(lengths + 288, 5, 30);
+    archive_huffman_t lencode, distcode;
+    _archive_huffman_build(&lencode, lengths, 288);
+    _archive_huffman_build(&distcode, lengths + 288, 30);
+    _archive_codes(s, &lencode, &distcode);
+}
+
+static void _archive_dynamic(archive_inflate_t* s) {
+    static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    const int nlen = _archive_bits(s, 5) + 257;
+    const int ndist = _archive_bits(s, 5) + 1;
+    const int ncode = _archive_bits(s, 4) + 4;
+    if (s->error || (nlen > 286) || (ndist > 30)) {
+        s->error = true;
+        return;
+    }
+    uint8_t lengths[288 + 30] = {0};
+    for (int i = 0; i < ncode; i++) {
+        lengths[order[i]] = (uint8_t)_archive_bits(s, 3);
+    }
+    archive_huffman_t lencode, distcode;
+    if (!_archive_huffman_build(&lencode, lengths, 19)) {
+        s->error = true;
+        return;
+    }
+    int index = 0;
+    while (!s->error && (index < (nlen + ndist))) {
+        const int sym = _archive_decode(s, &lencode);
+        if (sym < 16) {
+            lengths[index++] = (uint8_t)sym;
+            continue;
+        }
+        uint8_t len = 0;
+        int repeat;
+        if (sym == 16) {
+            if (index == 0) {
+                s->error = true;
+                return;
+            }
+            len = lengths[index - 1];
+            repeat = 3 + _archive_bits(s, 2);
+        } else if (sym == 17) {
+            repeat = 3 + _archive_bits(s, 3);
+        } else {
+            repeat = 11 + _archive_bits(s, 7);
+        }
+        if ((index + repeat) > (nlen + ndist)) {
+            s->error = true;
+            return;
+        }
+        while (repeat-- > 0) {
+            lengths[index++] = len;
+        }
+    }
+    if (s->error || (lengths[256] == 0) ||
+        !_archive_huffman_build(&lencode, lengths, nlen) ||
+        !_archive_huffman_build(&distcode, lengths + nlen, ndist))
+    {
+        s->error = true;
+        return;
+    }
+    _archive_codes(s, &lencode, &distcode);
+}
+
+static bool _archive_inflate(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_size) {
+    archive_inflate_t s = {
+        .src = src,
+        .src_size = src_size,
+        .dst = dst,
+        .dst_size = dst_size,
+    };
+    int last;
+    do {
+        last = _archive_bits(&s, 1);
+        switch (_archive_bits(&s, 2)) {
+            case 0: _archive_stored(&s); break;
+            case 1: _archive_fixed(&s); break;
+            case 2: _archive_dynamic(&s); break;
+            default: s.error = true; break;
+        }
+    } while (!last && !s.error);
+    return !s.error && (s.dst_pos == dst_size);
+}
+
+static int _archive_strcasecmp(const char* a, const char* b) {
+    while (*a && (tolower((uint8_t)*a) == tolower((uint8_t)*b))) {
+        a++;
+        b++;
+    }
+    return tolower((uint8_t)*a) - tolower((uint8_t)*b);
+}
+
+static bool _archive_add_member(archive_t* ar, const archive_member_t* member) {
+    if ((member->method != 0) && (member->method != 8)) {
+        return true;
+    }
+    if ((member->method == 0) && (member->packed_size != member->size)) {
+        return false;
+    }
+    if ((member->offset > ar->size) || (member->packed_size > (ar->size - member->offset))) {
+        return false;
+    }
+    ar->members = (archive_member_t*) realloc(ar->members, (size_t)(ar->num_members + 1) * sizeof(archive_member_t));
+    ar->members[ar->num_members++] = *member;
+    return true;
+}
+
+static bool _archive_open_gzip(archive_t* ar) {
+    const uint8_t* p = ar->data;
+    const size_t size = ar->size;
+    if ((size < 18) || (p[2] != 8)) {
+        return false;
+    }
+    const uint8_t flags = p[3];
+    size_t pos = 10;
+    archive_member_t member = { .method = 8 };
+    if (flags & 4) {
+        pos += 2 + (size_t)_archive_get16(&p[pos]);
+    }
+    if (flags & 8) {
+        size_t n = 0;
+        while ((pos < size) && p[pos]) {
+            if (n < (sizeof(member.name) - 1)) {
+                member.name[n++] = (char)p[pos];
+            }
+            pos++;
+        }
+        pos++;
+    }
+    if (flags & 16) {
+        while ((pos < size) && p[pos]) {
+            pos++;
+        }
+        pos++;
+    }
+    if (flags & 2) {
+        pos += 2;
+    }
+    if ((pos + 8) > size) {
+        return false;
+    }
+    member.offset = pos;
+    member.packed_size = size - 8 - pos;
+    member.crc32 = _archive_get32(&p[size - 8]);
+    member.size = _archive_get32(&p[size - 4]);
+    return _archive_add_member(ar, &member);
+}
+
+static bool _archive_open_zip(archive_t* ar) {
+    const uint8_t* p = ar->data;
+    const size_t size = ar->size;
+    // the end of central directory record is followed by a comment of up to 64KB
+    if (size < 22) {
+        return false;
+    }
+    size_t eocd = size - 22;
+    const size_t min_eocd = (size > (22 + 0xffff)) ? (size - 22 - 0xffff) : 0;
+    while (_archive_get32(&p[eocd]) != 0x06054b50) {
+        if (eocd == min_eocd) {
+            return false;
+        }
+        eocd--;
+    }
+    const int num = _archive_get16(&p[eocd + 10]);
+    size_t pos = _archive_get32(&p[eocd + 16]);
+    for (int i = 0; i < num; i++) {
+        if (((pos + 46) > size) || (_archive_get32(&p[pos]) != 0x02014b50)) {
+            return false;
+        }
+        const size_t name_len = _archive_get16(&p[pos + 28]);
+        const size_t next = pos + 46 + name_len + _archive_get16(&p[pos + 30]) + _archive_get16(&p[pos + 32]);
+        const size_t local = _archive_get32(&p[pos + 42]);
+        if ((next > size) || ((local + 30) > size) || (_archive_get32(&p[local]) != 0x04034b50)) {
+            return false;
+        }
+        archive_member_t member = {
+            .method = _archive_get16(&p[pos + 10]),
+            .crc32 = _archive_get32(&p[pos + 16]),
+            .packed_size = _archive_get32(&p[pos + 20]),
+            .size = _archive_get32(&p[pos + 24]),
+            .offset = local + 30 + _archive_get16(&p[local + 26]) + _archive_get16(&p[local + 28]),
+        };
+        const size_t n = (name_len < sizeof(member.name)) ? name_len : (sizeof(member.name) - 1);
+        memcpy(member.name, &p[pos + 46], n);
+        member.name[n] = 0;
+        // skip directories and encrypted members
+        const bool is_dir = (n > 0) && (member.name[n - 1] == '/');
+        const bool encrypted = (_archive_get16(&p[pos + 8]) & 1) != 0;
+        if (!is_dir && !encrypted && !_archive_add_member(ar, &member)) {
+            return false;
+        }
+        pos = next;
+    }
+    return true;
+}
+
+bool archive_detect(const void* data, size_t size) {
+    const uint8_t* p = (const uint8_t*) data;
+    if (!p || (size < 4)) {
+        return false;
+    }
+    return ((p[0] == 0x1f) && (p[1] == 0x8b)) || (_archive_get32(p) == 0x04034b50);
+}
+
+bool archive_open(archive_t* ar, const void* data, size_t size) {
+    assert(ar);
+    archive_close(ar);
+    if (!archive_detect(data, size)) {
+        return false;
+    }
+    ar->data = (const uint8_t*) data;
+    ar->size = size;
+    const bool valid = (ar->data[0] == 0x1f) ? _archive_open_gzip(ar) : _archive_open_zip(ar);
+    if (!valid) {
+        archive_close(ar);
+    }
+    return valid;
+}
+
+void archive_close(archive_t* ar) {
+    assert(ar);
+    free(ar->members);
+    memset(ar, 0, sizeof(archive_t));
+}
+
+int archive_find(const archive_t* ar, const char* name) {
+    assert(ar && name);
+    for (int i = 0; i < ar->num_members; i++) {
+        if (0 == _archive_strcasecmp(ar->members[i].name, name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool archive_extract(const archive_t* ar, int index, uint8_t* dst) {
+    assert(ar && (index >= 0) && (index < ar->num_members) && dst);
+    const archive_member_t* member = &ar->members[index];
+    const uint8_t* src = &ar->data[member->offset];
+    if (member->method == 0) {
+        memcpy(dst, src, member->size);
+    } else if (!_archive_inflate(src, member->packed_size, dst, member->size)) {
+        return false;
+    }
+    return _archive_crc32(dst, member->size) == member->crc32;
+}
+
+static void _archive_cache_trim(void) {
+    size_t total = 0;
+    for (int i = 0; i < ARCHIVE_CACHE_ENTRIES; i++) {
+        total += state.entries[i].size;
+    }
+    while (total > ARCHIVE_CACHE_BUDGET) {
+        archive_cache_entry_t* lru = 0;
+        for (int i = 0; i < ARCHIVE_CACHE_ENTRIES; i++) {
+            archive_cache_entry_t* e = &state.entries[i];
+            if (e->data && (e->refs == 0) && (!lru || (e->used < lru->used))) {
+                lru = e;
+            }
+        }
+        if (!lru) {
+            return;
+        }
+        total -= lru->size;
+        free(lru->data);
+        memset(lru, 0, sizeof(archive_cache_entry_t));
+    }
+}
+
+const uint8_t* archive_cache_extract(const archive_t* ar, int index) {
+    assert(ar && (index >= 0) && (index < ar->num_members));
+    const archive_member_t* member = &ar->members[index];
+    state.use_count++;
+    // members are identified by name, size and CRC, not by the archive they are in
+    archive_cache_entry_t* slot = 0;
+    for (int i = 0; i < ARCHIVE_CACHE_ENTRIES; i++) {
+        archive_cache_entry_t* e = &state.entries[i];
+        if (e->data && (e->size == member->size) && (e->crc32 == member->crc32) && (0 == strcmp(e->name, member->name))) {
+            e->refs++;
+            e->used = state.use_count;
+            return e->data;
+        }
+        if (!e->data) {
+            if (!slot || slot->data) {
+                slot = e;
+            }
+        } else if ((e->refs == 0) && (!slot || (slot->data && (e->used < slot->used)))) {
+            slot = e;
+        }
+    }
+    if (member->size > ARCHIVE_MAX_MEMBER_SIZE) {
+        return 0;
+    }
+    // at least one byte, so that empty members have a buffer too
+    uint8_t* data = (uint8_t*) malloc(member->size ? member->size : 1);
+    if (!data) {
+        return 0;
+    }
+    if (!archive_extract(ar, index, data)) {
+        free(data);
+        return 0;
+    }
+    // all entries in use: the buffer isn't cached and freed on release
+    if (slot) {
+        free(slot->data);
+        *slot = (archive_cache_entry_t){
+            .data = data,
+            .size = member->size,
+            .crc32 = member->crc32,
+            .refs = 1,
+            .used = state.use_count,
+        };
+        memcpy(slot->name, member->name, sizeof(slot->name));
+        _archive_cache_trim();
+    }
+    return data;
+}
+
+void archive_cache_release(const uint8_t* data) {
+    if (!data) {
+        return;
+    }
+    for (int i = 0; i < ARCHIVE_CACHE_ENTRIES; i++) {
+        archive_cache_entry_t* e = &state.entries[i];
+        if (e->data == data) {
+            assert(e->refs > 0);
+            e->refs--;
+            _archive_cache_trim();
+            return;
+        }
+    }
+    free((void*)data);
+}
+
+void archive_cache_clear(void) {
+    for (int i = 0; i < ARCHIVE_CACHE_ENTRIES; i++) {
+        archive_cache_entry_t* e = &state.entries[i];
+        if (e->data && (e->refs == 0)) {
+            free(e->data);
+            memset(e, 0, sizeof(archive_cache_entry_t));
+        }
+    }
+}
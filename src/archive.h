@@ -0,0 +1,59 @@
+#pragma once
+/*
+    Read media images from .zip and .gz archives.
+
+    The archive is read in place (e.g. from a memory mapping), a member is
+    inflated straight into its final buffer. Zip archives with stored and
+    deflated members are supported (no zip64, no encryption), gzip files
+    hold a single member.
+
+    Extracted members are kept in a small cache of reference counted
+    buffers, so switching back and forth between the disks of a multi-disk
+    game doesn't inflate them again.
+*/
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    char name[256];         // path in the archive, for gzip the stored file name (may be empty)
+    size_t size;            // uncompressed size
+    uint32_t crc32;
+    // location of the compressed data
+    size_t offset;
+    size_t packed_size;
+    int method;             // 0: stored, 8: deflate
+} archive_member_t;
+
+typedef struct {
+    const uint8_t* data;    // archive content, must stay valid while the archive is used
+    size_t size;
+    int num_members;
+    archive_member_t* members;
+} archive_t;
+
+// true if data looks like a zip or gzip archive
+bool archive_detect(const void* data, size_t size);
+// parse the member directory, ar must be zero-initialized or closed
+bool archive_open(archive_t* ar, const void* data, size_t size);
+void archive_close(archive_t* ar);
+// index of a member by name (case insensitive), -1 if not found
+int archive_find(const archive_t* ar, const char* name);
+// inflate a member into dst (member size bytes), checks the CRC
+bool archive_extract(const archive_t* ar, int index, uint8_t* dst);
+// extract a member through the cache, returns a referenced buffer of
+// member size bytes, or null if the member is corrupted or larger than
+// any media image (the size comes from the archive, it isn't trusted)
+const uint8_t* archive_cache_extract(const archive_t* ar, int index);
+// release a buffer returned by archive_cache_extract()
+void archive_cache_release(const uint8_t* data);
+// free all cached buffers which are not referenced
+void archive_cache_clear(void);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
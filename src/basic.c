@@ -0,0 +1,261 @@
+#include "basic.h"
+#include <stdlib.h>
+#include <string.h>
+
+// program pointers in the direct page of the interpreter (DP = $21)
+#define BASIC_TXTTAB (0x2113)   // start of the program
+#define BASIC_VARTAB (0x2115)   // start of the variables, end of the program
+#define BASIC_ARYTAB (0x2117)   // start of the arrays
+#define BASIC_STKTOP (0x2119)   // top of the stack, below the string space
+#define BASIC_FRETOP (0x211b)   // bottom of the used string space
+#define BASIC_MEMSIZ (0x211f)   // top of the string space
+#define BASIC_DATPTR (0x2130)   // next DATA to READ
+
+// room left for the stack and the variables of a loaded program
+#define BASIC_MIN_FREE (256)
+#define BASIC_MAX_LINE_NUMBER (63999)
+
+#define BASIC_TOKEN_DATA (0x83)
+#define BASIC_TOKEN_REM (0x8c)
+#define BASIC_TOKEN_QUOTE (0x8d)
+#define BASIC_TOKEN_ELSE (0x8f)
+#define BASIC_TOKEN_PRINT (0xab)
+#define BASIC_TOKEN_FUNCTION (0xff)
+
+// keyword tables of the BASIC ROM ($C0A0), tokens from 0x80 in table order,
+// functions are stored as 0xFF followed by their token, 0 for unused tokens
+static const char* _basic_statements[] = {
+    "END", "FOR", "NEXT", "DATA", "DIM", "READ", 0, "GO", "RUN", "IF",
+    "RESTORE", "RETURN", "REM", "'", "STOP", "ELSE", "TRON", "TROFF", "DEFSTR",
+    "DEFINT", "DEFSNG", 0, "ON", "TUNE", "ERROR", "RESUME", "AUTO", "DELETE",
+    "LOCATE", "CLS", "CONSOLE", "PSET", "MOTOR", "SKIPF", "EXEC", "BEEP",
+    "COLOR", "LINE", "BOX", 0, "ATTRB", "DEF", "POKE", "PRINT", "CONT", "LIST",
+    "CLEAR", "DOS", 0, "NEW", "SAVE", "LOAD", "MERGE", "OPEN", "CLOSE",
+    "INPEN", "PEN", "PLAY", "TAB(", "TO", "SUB", "FN", "SPC(", "USING", "USR",
+    "ERL", "ERR", "OFF", "THEN", "NOT", "STEP", "+", "-", "*", "/", "^", "AND",
+    "OR", "XOR", "EQV", "IMP", "MOD", "@", ">", "=", "<",
+};
+static const char* _basic_functions[] = {
+    "SGN", "INT", "ABS", "FRE", "SQR", "LOG", "EXP", "COS", "SIN", "TAN",
+    "PEEK", "LEN", "STR$", "VAL", "ASC", "CHR$", "EOF", "CINT", 0, 0, "FIX",
+    "HEX$", 0, "STICK", "STRIG", "GR$", "LEFT$", "RIGHT$", "MID$", "INSTR",
+    "VARPTR", "RND", "INKEY$", "INPUT", "CSRLIN", "POINT", "SCREEN", "POS",
+    "PTRIG",
+};
+
+typedef struct {
+    int number;
+    int index;              // order in the listing, the last line with a number wins
+    size_t offset;          // tokenised line in the buffer
+    size_t size;
+} basic_line_t;
+
+typedef struct {
+    uint8_t* buf;
+    size_t size;
+    size_t cap;
+    basic_line_t* lines;
+    int num_lines;
+    int cap_lines;
+} basic_program_t;
+
+static void _basic_put(basic_program_t* prog, uint8_t byte) {
+    if (prog->size == prog->cap) {
+        prog->cap = prog->cap ? prog->cap * 2 : 4096;
+        prog->buf = (uint8_t*) realloc(prog->buf, prog->cap);
+    }
+    prog->buf[prog->size++] = byte;
+}
+
+// length of the keyword of a table at the start of src, 0 if none matches
+static size_t _basic_match(const char* keyword, const char* src, const char* end) {
+    const size_t len = strlen(keyword);
+    if (((size_t)(end - src) < len) || (0 != memcmp(keyword, src, len))) {
+        return 0;
+    }
+    return len;
+}
+
+// first keyword matching at the start of src, in the order the interpreter
+// searches them (statements, then functions), returns the keyword length
+static size_t _basic_keyword(const char* src, const char* end, int* token, bool* function) {
+    const int num_statements = (int)(sizeof(_basic_statements) / sizeof(_basic_statements[0]));
+    for (int i = 0; i < num_statements; i++) {
+        const size_t len = _basic_statements[i] ? _basic_match(_basic_statements[i], src, end) : 0;
+        if (len > 0) {
+            *token = 0x80 + i;
+            *function = false;
+            return len;
+        }
+    }
+    const int num_functions = (int)(sizeof(_basic_functions) / sizeof(_basic_functions[0]));
+    for (int i = 0; i < num_functions; i++) {
+        const size_t len = _basic_functions[i] ? _basic_match(_basic_functions[i], src, end) : 0;
+        if (len > 0) {
+            *token = 0x80 + i;
+            *function = true;
+            return len;
+        }
+    }
+    return 0;
+}
+
+// tokenise the text of a line (after its line number)
+static void _basic_crunch(basic_program_t* prog, const char* src, const char* end) {
+    bool quoted = false;    // inside a string
+    bool data = false;      // inside DATA, up to the next ':' (even in quotes, like the ROM)
+    while (src < end) {
+        const char c = *src;
+        if (quoted || (data && (c != ':'))) {
+            quoted = quoted && (c != '"');
+            _basic_put(prog, (uint8_t)*src++);
+            continue;
+        }
+        data = false;
+        if (c == '"') {
+            quoted = true;
+            _basic_put(prog, (uint8_t)*src++);
+            continue;
+        }
+        if (c == '?') {
+            _basic_put(prog, BASIC_TOKEN_PRINT);
+            src++;
+            continue;
+        }
+        int token;
+        bool function;
+        const size_t len = _basic_keyword(src, end, &token, &function);
+        if (len == 0) {
+            _basic_put(prog, (uint8_t)*src++);
+            continue;
+        }
+        src += len;
+        if (function) {
+            _basic_put(prog, BASIC_TOKEN_FUNCTION);
+        } else if ((token == BASIC_TOKEN_ELSE) || (token == BASIC_TOKEN_QUOTE)) {
+            // stored as a statement of its own
+            _basic_put(prog, ':');
+        }
+        _basic_put(prog, (uint8_t)token);
+        if ((token == BASIC_TOKEN_REM) || (token == BASIC_TOKEN_QUOTE)) {
+            while (src < end) {
+                _basic_put(prog, (uint8_t)*src++);
+            }
+        }
+        data = (token == BASIC_TOKEN_DATA);
+    }
+}
+
+// tokenise the lines of a listing, false if a line has no valid line number
+static bool _basic_parse(basic_program_t* prog, const char* text, size_t size) {
+    const char* end = text + size;
+    const char* src = text;
+    while (src < end) {
+        const char* eol = (const char*) memchr(src, '\n', (size_t)(end - src));
+        if (!eol) {
+            eol = end;
+        }
+        const char* line_end = eol;
+        while ((line_end > src) && ((line_end[-1] == '\r') || (line_end[-1] == ' ') || (line_end[-1] == '\t'))) {
+            line_end--;
+        }
+        while ((src < line_end) && ((*src == ' ') || (*src == '\t'))) {
+            src++;
+        }
+        if (src < line_end) {
+            if ((*src < '0') || (*src > '9')) {
+                return false;
+            }
+            int number = 0;
+            while ((src < line_end) && (*src >= '0') && (*src <= '9')) {
+                number = number * 10 + (*src++ - '0');
+                if (number > BASIC_MAX_LINE_NUMBER) {
+                    return false;
+                }
+            }
+            while ((src < line_end) && (*src == ' ')) {
+                src++;
+            }
+            if (prog->num_lines == prog->cap_lines) {
+                prog->cap_lines = prog->cap_lines ? prog->cap_lines * 2 : 256;
+                prog->lines = (basic_line_t*) realloc(prog->lines, (size_t)prog->cap_lines * sizeof(basic_line_t));
+            }
+            basic_line_t* line = &prog->lines[prog->num_lines];
+            line->number = number;
+            line->index = prog->num_lines++;
+            line->offset = prog->size;
+            _basic_crunch(prog, src, line_end);
+            line->size = prog->size - line->offset;
+        }
+        src = eol + 1;
+    }
+    return true;
+}
+
+static int _basic_compare(const void* a, const void* b) {
+    const basic_line_t* la = (const basic_line_t*) a;
+    const basic_line_t* lb = (const basic_line_t*) b;
+    if (la->number != lb->number) {
+        return la->number - lb->number;
+    }
+    return la->index - lb->index;
+}
+
+static uint16_t _basic_peek16(mo5_t* sys, uint16_t address) {
+    return (uint16_t)((mo5_mem_peek(sys, address) << 8) | mo5_mem_peek(sys, (uint16_t)(address + 1)));
+}
+
+static void _basic_poke16(mo5_t* sys, uint16_t address, uint16_t value) {
+    mo5_mem_poke(sys, address, (uint8_t)(value >> 8));
+    mo5_mem_poke(sys, (uint16_t)(address + 1), (uint8_t)value);
+}
+
+bool basic_load(mo5_t* sys, const char* text, size_t size) {
+    const uint16_t txttab = _basic_peek16(sys, BASIC_TXTTAB);
+    const uint16_t stktop = _basic_peek16(sys, BASIC_STKTOP);
+    // pointers are set once the interpreter started
+    if ((txttab < 0x2200) || (stktop <= txttab)) {
+        return false;
+    }
+    basic_program_t prog = {0};
+    bool success = _basic_parse(&prog, text, size);
+    if (success) {
+        qsort(prog.lines, (size_t)prog.num_lines, sizeof(basic_line_t), _basic_compare);
+        // a later line replaces an earlier one with the same number, an empty line deletes it
+        int num_lines = 0;
+        size_t program_size = 2;
+        for (int i = 0; i < prog.num_lines; i++) {
+            const basic_line_t* line = &prog.lines[i];
+            const bool replaced = ((i + 1) < prog.num_lines) && (prog.lines[i + 1].number == line->number);
+            if (!replaced && (line->size > 0)) {
+                prog.lines[num_lines++] = *line;
+                program_size += 4 + line->size + 1;
+            }
+        }
+        success = (txttab + program_size + BASIC_MIN_FREE) <= stktop;
+        if (success) {
+            uint16_t address = txttab;
+            for (int i = 0; i < num_lines; i++) {
+                const basic_line_t* line = &prog.lines[i];
+                const uint16_t next = (uint16_t)(address + 4 + line->size + 1);
+                _basic_poke16(sys, address, next);
+                _basic_poke16(sys, (uint16_t)(address + 2), (uint16_t)line->number);
+                for (size_t j = 0; j < line->size; j++) {
+                    mo5_mem_poke(sys, (uint16_t)(address + 4 + j), prog.buf[line->offset + j]);
+                }
+                mo5_mem_poke(sys, (uint16_t)(next - 1), 0);
+                address = next;
+            }
+            _basic_poke16(sys, address, 0);
+            // what CLEAR does: no variables, no arrays, no strings, READ from the start
+            const uint16_t vartab = (uint16_t)(address + 2);
+            _basic_poke16(sys, BASIC_VARTAB, vartab);
+            _basic_poke16(sys, BASIC_ARYTAB, vartab);
+            _basic_poke16(sys, BASIC_FRETOP, _basic_peek16(sys, BASIC_MEMSIZ));
+            _basic_poke16(sys, BASIC_DATPTR, (uint16_t)(txttab - 1));
+        }
+    }
+    free(prog.buf);
+    free(prog.lines);
+    return success;
+}
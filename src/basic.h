@@ -0,0 +1,24 @@
+#pragma once
+/*
+    Load a plain-text BASIC listing straight into the program area of the
+    MO5 BASIC, instead of typing it through the keyboard.
+
+    The listing is tokenised like the BASIC interpreter does when a line is
+    entered (same keyword table, same rules for strings, REM and DATA), the
+    lines are sorted by line number and linked, the program pointers are set
+    and the variables are cleared, as after NEW followed by typing the lines.
+*/
+#include "mo5.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// replace the program in RAM with a listing (one numbered line per text line),
+// BASIC must be idle at its prompt, returns false if BASIC isn't started, if a
+// line has no line number or if the program doesn't fit in memory
+bool basic_load(mo5_t* sys, const char* text, size_t size);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
@@ -0,0 +1,581 @@
+#include "catalog.h"
+#include "mo5.h"
+#include "hash.h"
+#include "mapfile.h"
+#include "worker.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <dirent.h>
+    #include <sys/stat.h>
+#endif
+
+#define CATALOG_MAGIC (0x4943354d)  // 'M5CI' in little endian
+#define CATALOG_VERSION (1)
+#define CATALOG_MAX_THREADS (64)
+#define CATALOG_MAX_PATH (1024)
+#define CATALOG_MAX_INFO (1024)
+
+// index file layout: header, records sorted by hash, record indices sorted
+// by name, string table
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_entries;
+    uint32_t strings_size;
+} catalog_header_t;
+
+typedef struct {
+    uint64_t hash;
+    uint64_t size;
+    int64_t mtime;
+    uint32_t path;      // string table offsets
+    uint32_t name;
+    uint32_t info;
+    uint32_t type;
+} catalog_record_t;
+
+struct catalog_t {
+    mapfile_t* file;    // mapped index, or null if data is owned
+    const uint8_t* data;
+    size_t size;
+    const catalog_header_t* header;
+    const catalog_record_t* records;
+    const uint32_t* by_name;
+    const char* strings;
+};
+
+// an image found by the directory walk
+typedef struct {
+    char* path;
+    uint64_t size;
+    int64_t mtime;
+    catalog_media_t type;
+    uint64_t hash;
+    char* info;
+} catalog_item_t;
+
+typedef struct {
+    catalog_item_t* items;
+    int num;
+    int cap;
+} catalog_items_t;
+
+typedef struct {
+    catalog_items_t* items;
+    int first;
+    int stride;
+} catalog_job_t;
+
+// sort key for the path and name indices
+typedef struct {
+    const char* key;
+    uint32_t index;
+} catalog_key_t;
+
+static int _catalog_strcasecmp(const char* a, const char* b) {
+    while (*a && (tolower((uint8_t)*a) == tolower((uint8_t)*b))) {
+        a++;
+        b++;
+    }
+    return tolower((uint8_t)*a) - tolower((uint8_t)*b);
+}
+
+static char* _catalog_strdup(const char* str) {
+    const size_t size = strlen(str) + 1;
+    char* dup = (char*) malloc(size);
+    memcpy(dup, str, size);
+    return dup;
+}
+
+static const char* _catalog_file_name(const char* path) {
+    const char* name = path;
+    for (const char* p = path; *p; p++) {
+        if ((*p == '/') || (*p == '\\')) {
+            name = p + 1;
+        }
+    }
+    return name;
+}
+
+static bool _catalog_media_type(const char* path, catalog_media_t* type) {
+    const char* ext = strrchr(_catalog_file_name(path), '.');
+    if (!ext) {
+        return false;
+    }
+    if (0 == _catalog_strcasecmp(ext, ".k7")) {
+        *type = CATALOG_TAPE;
+    } else if ((0 == _catalog_strcasecmp(ext, ".fd")) || (0 == _catalog_strcasecmp(ext, ".sap"))) {
+        *type = CATALOG_DISK;
+    } else if (0 == _catalog_strcasecmp(ext, ".rom")) {
+        *type = CATALOG_CARTRIDGE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void _catalog_add_item(catalog_items_t* items, const char* path, uint64_t size, int64_t mtime) {
+    catalog_media_t type;
+    if ((size == 0) || !_catalog_media_type(path, &type)) {
+        return;
+    }
+    if (items->num == items->cap) {
+        items->cap = items->cap ? items->cap * 2 : 256;
+        items->items = (catalog_item_t*) realloc(items->items, (size_t)items->cap * sizeof(catalog_item_t));
+    }
+    items->items[items->num++] = (catalog_item_t){
+        .path = _catalog_strdup(path),
+        .size = size,
+        .mtime = mtime,
+        .type = type,
+    };
+}
+
+#if defined(_WIN32)
+static void _catalog_walk(catalog_items_t* items, const char* dir) {
+    char pattern[CATALOG_MAX_PATH];
+    WCHAR wc_pattern[CATALOG_MAX_PATH];
+    snprintf(pattern, sizeof(pattern), "%s/*", dir);
+    if (0 == MultiByteToWideChar(CP_UTF8, 0, pattern, -1, wc_pattern, CATALOG_MAX_PATH)) {
+        return;
+    }
+    WIN32_FIND_DATAW fd;
+    HANDLE fh = FindFirstFileW(wc_pattern, &fd);
+    if (fh == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    do {
+        char name[CATALOG_MAX_PATH];
+        char path[CATALOG_MAX_PATH];
+        if ((0 == WideCharToMultiByte(CP_UTF8, 0, fd.cFileName, -1, name, sizeof(name), NULL, NULL)) ||
+            (0 == strcmp(name, ".")) || (0 == strcmp(name, "..")))
+        {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            _catalog_walk(items, path);
+        } else {
+            const uint64_t size = ((uint64_t)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+            const int64_t mtime = (int64_t)(((uint64_t)fd.ftLastWriteTime.dwHighDateTime << 32) | fd.ftLastWriteTime.dwLowDateTime);
+            _catalog_add_item(items, path, size, mtime);
+        }
+    } while (FindNextFileW(fh, &fd));
+    FindClose(fh);
+}
+#else
+static void _catalog_walk(catalog_items_t* items, const char* dir) {
+    DIR* d = opendir(dir);
+    if (!d) {
+        return;
+    }
+    struct dirent* de;
+    while ((de = readdir(d))) {
+        if ((0 == strcmp(de->d_name, ".")) || (0 == strcmp(de->d_name, ".."))) {
+            continue;
+        }
+        char path[CATALOG_MAX_PATH];
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        struct stat st;
+        if (0 != stat(path, &st)) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            _catalog_walk(items, path);
+        } else if (S_ISREG(st.st_mode)) {
+            _catalog_add_item(items, path, (uint64_t)st.st_size, (int64_t)st.st_mtime);
+        }
+    }
+    closedir(d);
+}
+#endif
+
+// append a file name from a tape header block or a directory entry as NAME.EXT
+static void _catalog_info_name(char* info, const uint8_t* name) {
+    char buf[16];
+    int n = 0;
+    for (int i = 0; i < 11; i++) {
+        if (i == 8) {
+            while ((n > 0) && (buf[n - 1] == ' ')) {
+                n--;
+            }
+            buf[n++] = '.';
+        }
+        buf[n++] = ((name[i] >= 0x20) && (name[i] < 0x7f)) ? (char)name[i] : '?';
+    }
+    while ((n > 0) && ((buf[n - 1] == ' ') || (buf[n - 1] == '.'))) {
+        n--;
+    }
+    buf[n] = 0;
+    const size_t len = strlen(info);
+    if ((n > 0) && ((len + (size_t)n + 3) < CATALOG_MAX_INFO)) {
+        snprintf(&info[len], CATALOG_MAX_INFO - len, "%s%s", len ? ", " : "", buf);
+    }
+}
+
+// names in the header blocks (type 0) of a tape
+static void _catalog_tape_info(const uint8_t* data, size_t size, char* info) {
+    for (size_t i = 0; (i + 16) <= size; i++) {
+        if ((data[i] == 0x01) && (data[i + 1] == 0x3c) && (data[i + 2] == 0x5a) && (data[i + 3] == 0x00)) {
+            _catalog_info_name(info, &data[i + 5]);
+            i += 15;
+        }
+    }
+}
+
+// file names in the directory of each face (track 20, sectors 3-16)
+static void _catalog_disk_info(const uint8_t* data, size_t size, char* info) {
+    const size_t face_size = MO5_DISK_TRACKS * MO5_DISK_SECTORS * MO5_DISK_SECTOR_SIZE;
+    for (int u = 0; (u < MO5_DISK_UNITS) && ((size_t)u * face_size < size); u++) {
+        for (int s = 2; s < MO5_DISK_SECTORS; s++) {
+            const size_t offset = ((size_t)(u * MO5_DISK_TRACKS + 20) * MO5_DISK_SECTORS + (size_t)s) * MO5_DISK_SECTOR_SIZE;
+            bool end = false;
+            for (int e = 0; (e < 8) && ((offset + (size_t)(e + 1) * 32) <= size); e++) {
+                const uint8_t* entry = &data[offset + (size_t)e * 32];
+                if (entry[0] == 0xff) {
+                    end = true;
+                    break;
+                }
+                // deleted entry
+                if (entry[0] != 0x00) {
+                    _catalog_info_name(info, entry);
+                }
+            }
+            if (end) {
+                break;
+            }
+        }
+    }
+}
+
+// .sap image: decode the directory track into an .fd layout (one face)
+static void _catalog_sap_info(const uint8_t* data, size_t size, char* info) {
+    if (!mo5_is_sap(data, size)) {
+        return;
+    }
+    const size_t fd_size = 21 * MO5_DISK_SECTORS * MO5_DISK_SECTOR_SIZE;
+    uint8_t* fd = (uint8_t*) calloc(1, fd_size);
+    for (size_t offset = MO5_SAP_HEADER_SIZE; (offset + MO5_SAP_RECORD_SIZE) <= size; offset += MO5_SAP_RECORD_SIZE) {
+        const uint8_t* record = &data[offset];
+        if ((record[2] == 20) && (record[3] >= 1) && (record[3] <= MO5_DISK_SECTORS)) {
+            uint8_t* dst = &fd[(size_t)(20 * MO5_DISK_SECTORS + record[3] - 1) * MO5_DISK_SECTOR_SIZE];
+            for (int i = 0; i < MO5_DISK_SECTOR_SIZE; i++) {
+                dst[i] = record[4 + i] ^ MO5_SAP_XOR;
+            }
+        }
+    }
+    _catalog_disk_info(fd, fd_size, info);
+    free(fd);
+}
+
+static void _catalog_read_item(catalog_item_t* item) {
+    char info[CATALOG_MAX_INFO] = "";
+    mapfile_t* file = mapfile_open(item->path);
+    if (file) {
+        const uint8_t* data = mapfile_ptr(file);
+        size_t size = mapfile_size(file);
+        switch (item->type) {
+            case CATALOG_TAPE:
+                _catalog_tape_info(data, size, info);
+                break;
+            case CATALOG_DISK:
+                if (0 == _catalog_strcasecmp(strrchr(item->path, '.'), ".sap")) {
+                    _catalog_sap_info(data, size, info);
+                } else {
+                    _catalog_disk_info(data, size, info);
+                }
+                break;
+            case CATALOG_CARTRIDGE:
+                // hashed like mo5_insert_cartridge() truncates the image
+                if (size > MO5_MAX_CARTRIDGE_SIZE) {
+                    size = MO5_MAX_CARTRIDGE_SIZE;
+                }
+                snprintf(info, sizeof(info), "%dK, %s", (int)((size + 1023) / 1024),
+                    (size > 0x4000) ? "bank switched" : "simple");
+                break;
+        }
+        item->size = mapfile_size(file);
+        item->hash = hash64(data, size, 0);
+        mapfile_close(file);
+    }
+    item->info = _catalog_strdup(info);
+}
+
+static void _catalog_job(void* user_data) {
+    const catalog_job_t* job = (const catalog_job_t*) user_data;
+    for (int i = job->first; i < job->items->num; i += job->stride) {
+        catalog_item_t* item = &job->items->items[i];
+        if (!item->info) {
+            _catalog_read_item(item);
+        }
+    }
+}
+
+static const char* _catalog_string(const catalog_t* catalog, uint32_t offset) {
+    return &catalog->strings[offset];
+}
+
+static int _catalog_compare_path(const void* a, const void* b) {
+    return strcmp(((const catalog_key_t*)a)->key, ((const catalog_key_t*)b)->key);
+}
+
+static int _catalog_compare_name(const void* a, const void* b) {
+    return _catalog_strcasecmp(((const catalog_key_t*)a)->key, ((const catalog_key_t*)b)->key);
+}
+
+static int _catalog_compare_hash(const void* a, const void* b) {
+    const catalog_item_t* ia = (const catalog_item_t*) a;
+    const catalog_item_t* ib = (const catalog_item_t*) b;
+    if (ia->hash != ib->hash) {
+        return (ia->hash < ib->hash) ? -1 : 1;
+    }
+    return strcmp(ia->path, ib->path);
+}
+
+// reuse hash and metadata of images which didn't change since the previous scan
+static void _catalog_reuse(catalog_items_t* items, const catalog_t* previous) {
+    const int num = catalog_num_entries(previous);
+    if (num == 0) {
+        return;
+    }
+    catalog_key_t* by_path = (catalog_key_t*) malloc((size_t)num * sizeof(catalog_key_t));
+    for (int i = 0; i < num; i++) {
+        by_path[i] = (catalog_key_t){ _catalog_string(previous, previous->records[i].path), (uint32_t)i };
+    }
+    qsort(by_path, (size_t)num, sizeof(catalog_key_t), _catalog_compare_path);
+    for (int i = 0; i < items->num; i++) {
+        catalog_item_t* item = &items->items[i];
+        const catalog_key_t key = { item->path, 0 };
+        const catalog_key_t* found = (const catalog_key_t*) bsearch(&key, by_path, (size_t)num, sizeof(catalog_key_t), _catalog_compare_path);
+        const catalog_record_t* rec = found ? &previous->records[found->index] : 0;
+        if (rec && (rec->size == item->size) && (rec->mtime == item->mtime)) {
+            item->hash = rec->hash;
+            item->info = _catalog_strdup(_catalog_string(previous, rec->info));
+        }
+    }
+    free(by_path);
+}
+
+static bool _catalog_validate(catalog_t* catalog) {
+    if (catalog->size < sizeof(catalog_header_t)) {
+        return false;
+    }
+    const catalog_header_t* header = (const catalog_header_t*) catalog->data;
+    if ((header->magic != CATALOG_MAGIC) || (header->version != CATALOG_VERSION)) {
+        return false;
+    }
+    const size_t num = header->num_entries;
+    const size_t size = sizeof(catalog_header_t) + num * (sizeof(catalog_record_t) + sizeof(uint32_t)) + header->strings_size;
+    if ((size != catalog->size) || (header->strings_size == 0)) {
+        return false;
+    }
+    catalog->header = header;
+    catalog->records = (const catalog_record_t*) (catalog->data + sizeof(catalog_header_t));
+    catalog->by_name = (const uint32_t*) (catalog->records + num);
+    catalog->strings = (const char*) (catalog->by_name + num);
+    if (catalog->strings[header->strings_size - 1] != 0) {
+        return false;
+    }
+    for (size_t i = 0; i < num; i++) {
+        const catalog_record_t* rec = &catalog->records[i];
+        if ((rec->path >= header->strings_size) || (rec->name >= header->strings_size) ||
+            (rec->info >= header->strings_size) || (rec->type > CATALOG_CARTRIDGE) ||
+            (catalog->by_name[i] >= num))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static catalog_t* _catalog_build(const catalog_items_t* items) {
+    size_t strings_size = 1;
+    for (int i = 0; i < items->num; i++) {
+        strings_size += strlen(items->items[i].path) + 1 + strlen(items->items[i].info) + 1;
+    }
+    const size_t num = (size_t)items->num;
+    const size_t size = sizeof(catalog_header_t) + num * (sizeof(catalog_record_t) + sizeof(uint32_t)) + strings_size;
+    uint8_t* data = (uint8_t*) calloc(1, size);
+    catalog_header_t* header = (catalog_header_t*) data;
+    catalog_record_t* records = (catalog_record_t*) (data + sizeof(catalog_header_t));
+    uint32_t* by_name = (uint32_t*) (records + num);
+    char* strings = (char*) (by_name + num);
+    header->magic = CATALOG_MAGIC;
+    header->version = CATALOG_VERSION;
+    header->num_entries = (uint32_t)num;
+    header->strings_size = (uint32_t)strings_size;
+    // offset 0 is the empty string
+    size_t pos = 1;
+    for (size_t i = 0; i < num; i++) {
+        const catalog_item_t* item = &items->items[i];
+        catalog_record_t* rec = &records[i];
+        rec->hash = item->hash;
+        rec->size = item->size;
+        rec->mtime = item->mtime;
+        rec->type = (uint32_t)item->type;
+        rec->path = (uint32_t)pos;
+        rec->name = (uint32_t)(pos + (size_t)(_catalog_file_name(item->path) - item->path));
+        strcpy(&strings[pos], item->path);
+        pos += strlen(item->path) + 1;
+        rec->info = (uint32_t)pos;
+        strcpy(&strings[pos], item->info);
+        pos += strlen(item->info) + 1;
+    }
+    catalog_key_t* keys = (catalog_key_t*) malloc((num ? num : 1) * sizeof(catalog_key_t));
+    for (size_t i = 0; i < num; i++) {
+        keys[i] = (catalog_key_t){ &strings[records[i].name], (uint32_t)i };
+    }
+    qsort(keys, num, sizeof(catalog_key_t), _catalog_compare_name);
+    for (size_t i = 0; i < num; i++) {
+        by_name[i] = keys[i].index;
+    }
+    free(keys);
+    catalog_t* catalog = (catalog_t*) calloc(1, sizeof(catalog_t));
+    catalog->data = data;
+    catalog->size = size;
+    const bool valid = _catalog_validate(catalog);
+    assert(valid);
+    (void)valid;
+    return catalog;
+}
+
+catalog_t* catalog_open(const char* path) {
+    assert(path);
+    mapfile_t* file = mapfile_open(path);
+    if (!file) {
+        return 0;
+    }
+    catalog_t* catalog = (catalog_t*) calloc(1, sizeof(catalog_t));
+    catalog->file = file;
+    catalog->data = mapfile_ptr(file);
+    catalog->size = mapfile_size(file);
+    if (!_catalog_validate(catalog)) {
+        catalog_close(catalog);
+        return 0;
+    }
+    return catalog;
+}
+
+catalog_t* catalog_scan(const catalog_scan_desc_t* desc) {
+    assert(desc && desc->root);
+    catalog_items_t items = {0};
+    _catalog_walk(&items, desc->root);
+    if (desc->previous) {
+        _catalog_reuse(&items, desc->previous);
+    }
+    int num_threads = desc->num_threads;
+    if (num_threads > items.num) {
+        num_threads = items.num;
+    }
+    if (num_threads > CATALOG_MAX_THREADS) {
+        num_threads = CATALOG_MAX_THREADS;
+    }
+    if (num_threads <= 1) {
+        const catalog_job_t job = { .items = &items, .first = 0, .stride = 1 };
+        _catalog_job((void*)&job);
+    } else {
+        catalog_job_t jobs[CATALOG_MAX_THREADS];
+        worker_t* workers[CATALOG_MAX_THREADS];
+        for (int i = 0; i < num_threads; i++) {
+            jobs[i] = (catalog_job_t){ .items = &items, .first = i, .stride = num_threads };
+            workers[i] = worker_start(_catalog_job, &jobs[i]);
+            if (!workers[i]) {
+                _catalog_job(&jobs[i]);
+            }
+        }
+        for (int i = 0; i < num_threads; i++) {
+            if (workers[i]) {
+                worker_join(workers[i]);
+            }
+        }
+    }
+    qsort(items.items, (size_t)items.num, sizeof(catalog_item_t), _catalog_compare_hash);
+    catalog_t* catalog = _catalog_build(&items);
+    for (int i = 0; i < items.num; i++) {
+        free(items.items[i].path);
+        free(items.items[i].info);
+    }
+    free(items.items);
+    return catalog;
+}
+
+bool catalog_save(const catalog_t* catalog, const char* path) {
+    assert(catalog && path);
+    FILE* fp = fopen(path, "wb");
+    if (!fp) {
+        return false;
+    }
+    const bool success = (fwrite(catalog->data, 1, catalog->size, fp) == catalog->size);
+    return (0 == fclose(fp)) && success;
+}
+
+void catalog_close(catalog_t* catalog) {
+    if (catalog) {
+        if (catalog->file) {
+            mapfile_close(catalog->file);
+        } else {
+            free((void*)catalog->data);
+        }
+        free(catalog);
+    }
+}
+
+int catalog_num_entries(const catalog_t* catalog) {
+    return catalog ? (int)catalog->header->num_entries : 0;
+}
+
+catalog_entry_t catalog_entry(const catalog_t* catalog, int index) {
+    assert((index >= 0) && (index < catalog_num_entries(catalog)));
+    const catalog_record_t* rec = &catalog->records[index];
+    return (catalog_entry_t){
+        .hash = rec->hash,
+        .size = rec->size,
+        .type = (catalog_media_t)rec->type,
+        .path = _catalog_string(catalog, rec->path),
+        .name = _catalog_string(catalog, rec->name),
+        .info = _catalog_string(catalog, rec->info),
+    };
+}
+
+int catalog_find_hash(const catalog_t* catalog, uint64_t hash) {
+    // first entry with this hash
+    int lo = 0;
+    int hi = catalog_num_entries(catalog);
+    while (lo < hi) {
+        const int mid = (lo + hi) / 2;
+        if (catalog->records[mid].hash < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return ((lo < catalog_num_entries(catalog)) && (catalog->records[lo].hash == hash)) ? lo : -1;
+}
+
+int catalog_find_name(const catalog_t* catalog, const char* name) {
+    assert(name);
+    int lo = 0;
+    int hi = catalog_num_entries(catalog) - 1;
+    while (lo <= hi) {
+        const int mid = (lo + hi) / 2;
+        const uint32_t index = catalog->by_name[mid];
+        const int cmp = _catalog_strcasecmp(_catalog_string(catalog, catalog->records[index].name), name);
+        if (cmp == 0) {
+            return (int)index;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return -1;
+}
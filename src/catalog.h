@@ -0,0 +1,66 @@
+#pragma once
+/*
+    Media catalogue: an index of the tape, disk and cartridge images in a
+    directory tree.
+
+    A scan walks the tree, hashes every image on a number of worker threads
+    (the same hash as mo5_media_hash(), so snapshots and the catalogue agree)
+    and extracts some metadata: the file names in the tape header blocks,
+    the disk directory, the cartridge size and type. Images whose size and
+    modification time didn't change since a previous scan are not read again.
+
+    The index file holds the entries sorted by hash, an index sorted by file
+    name and a string table, in host layout, so an index is used straight
+    from a memory mapping: opening it costs nothing, lookups by hash and by
+    name are binary searches. An index written on a host with a different
+    byte order is rejected and has to be rescanned.
+*/
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct catalog_t catalog_t;
+
+typedef enum {
+    CATALOG_TAPE,
+    CATALOG_DISK,
+    CATALOG_CARTRIDGE,
+} catalog_media_t;
+
+typedef struct {
+    uint64_t hash;          // content hash (see mo5_media_hash())
+    uint64_t size;          // file size in bytes
+    catalog_media_t type;
+    const char* path;       // path of the image, as found by the scan
+    const char* name;       // file name part of path
+    const char* info;       // tape and disk file names, or cartridge size and type
+} catalog_entry_t;
+
+typedef struct {
+    const char* root;               // directory to scan recursively
+    const catalog_t* previous;      // optional, reuse hashes of unchanged images
+    int num_threads;                // worker threads for hashing (<= 1: calling thread)
+} catalog_scan_desc_t;
+
+// map an index file, returns 0 if it doesn't exist or is not a valid index
+catalog_t* catalog_open(const char* path);
+// scan a directory tree into a new catalogue (may run on any thread)
+catalog_t* catalog_scan(const catalog_scan_desc_t* desc);
+// write a catalogue as an index file
+bool catalog_save(const catalog_t* catalog, const char* path);
+void catalog_close(catalog_t* catalog);
+int catalog_num_entries(const catalog_t* catalog);
+// entries are sorted by hash
+catalog_entry_t catalog_entry(const catalog_t* catalog, int index);
+// entry index of an image by content hash, -1 if not found
+int catalog_find_hash(const catalog_t* catalog, uint64_t hash);
+// entry index of an image by file name (case insensitive, without directory), -1 if not found
+int catalog_find_name(const catalog_t* catalog, const char* name);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
@@ -0,0 +1,55 @@
+#include "explore.h"
+#include "worker.h"
+#include <stdlib.h>
+#include <assert.h>
+
+#define EXPLORE_MAX_THREADS (64)
+
+typedef struct {
+    const explore_desc_t* desc;
+    int first;      // first fork index of this thread
+    int stride;     // number of threads
+} explore_job_t;
+
+static void _explore_job(void* user_data) {
+    const explore_job_t* job = (const explore_job_t*) user_data;
+    const explore_desc_t* desc = job->desc;
+    for (int i = job->first; i < desc->num_forks; i += job->stride) {
+        mo5_t* fork = &desc->forks[i];
+        for (int frame = 0; frame < desc->num_frames; frame++) {
+            if (desc->input_cb) {
+                desc->input_cb(fork, i, frame, desc->user_data);
+            }
+            mo5_step(fork, MO5_FRAME_US);
+        }
+    }
+}
+
+void explore_run(const explore_desc_t* desc) {
+    assert(desc && ((desc->num_forks == 0) || desc->forks));
+    int num_threads = desc->num_threads;
+    if (num_threads > desc->num_forks) {
+        num_threads = desc->num_forks;
+    }
+    if (num_threads > EXPLORE_MAX_THREADS) {
+        num_threads = EXPLORE_MAX_THREADS;
+    }
+    if (num_threads <= 1) {
+        const explore_job_t job = { .desc = desc, .first = 0, .stride = 1 };
+        _explore_job((void*)&job);
+        return;
+    }
+    explore_job_t jobs[EXPLORE_MAX_THREADS];
+    worker_t* workers[EXPLORE_MAX_THREADS];
+    for (int i = 0; i < num_threads; i++) {
+        jobs[i] = (explore_job_t){ .desc = desc, .first = i, .stride = num_threads };
+        workers[i] = worker_start(_explore_job, &jobs[i]);
+        if (!workers[i]) {
+            // no thread available, run this share on the calling thread
+            _explore_job(&jobs[i]);
+        }
+    }
+    for (int i = 0; i < num_threads; i++) {
+        worker_join(workers[i]);
+    }
+}
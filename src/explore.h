@@ -0,0 +1,35 @@
+#pragma once
+/*
+    Run many forks of a machine in parallel, e.g. to explore game paths
+    with a beam search: fork the main machine with mo5_fork(), let
+    explore_run() step every fork on its own input sequence, rank the
+    forks, discard the losers and fork the winners again. The best fork
+    can become the main machine with mo5_promote().
+
+    Forks are distributed over a fixed number of worker threads, each
+    fork is only ever stepped by one thread.
+*/
+#include "mo5.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// feed input into a fork before a frame is stepped, called on a worker thread
+typedef void (*explore_input_func_t)(mo5_t* fork, int fork_index, int frame, void* user_data);
+
+typedef struct {
+    mo5_t* forks;                   // forks created with mo5_fork()
+    int num_forks;
+    int num_frames;                 // frames to run each fork
+    int num_threads;                // number of worker threads (<= 1: run on the calling thread)
+    explore_input_func_t input_cb;  // optional
+    void* user_data;
+} explore_desc_t;
+
+// step all forks, returns when every fork has run num_frames frames
+void explore_run(const explore_desc_t* desc);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
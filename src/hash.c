@@ -0,0 +1,83 @@
+#include "hash.h"
+
+#define HASH_PRIME1 (0x9E3779B185EBCA87ULL)
+#define HASH_PRIME2 (0xC2B2AE3D27D4EB4FULL)
+#define HASH_PRIME3 (0x165667B19E3779F9ULL)
+#define HASH_PRIME4 (0x85EBCA77C2B2AE63ULL)
+#define HASH_PRIME5 (0x27D4EB2F165667C5ULL)
+
+static inline uint64_t _hash_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// little-endian loads, independent of host byte order and alignment
+static inline uint64_t _hash_read64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static inline uint32_t _hash_read32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t _hash_round(uint64_t acc, uint64_t input) {
+    acc += input * HASH_PRIME2;
+    acc = _hash_rotl(acc, 31);
+    return acc * HASH_PRIME1;
+}
+
+static inline uint64_t _hash_merge_round(uint64_t acc, uint64_t val) {
+    acc ^= _hash_round(0, val);
+    return acc * HASH_PRIME1 + HASH_PRIME4;
+}
+
+uint64_t hash64(const void* data, size_t size, uint64_t seed) {
+    const uint8_t* p = (const uint8_t*)data;
+    const uint8_t* end = p + size;
+    uint64_t h;
+    if (size >= 32) {
+        uint64_t v1 = seed + HASH_PRIME1 + HASH_PRIME2;
+        uint64_t v2 = seed + HASH_PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - HASH_PRIME1;
+        const uint8_t* limit = end - 32;
+        do {
+            v1 = _hash_round(v1, _hash_read64(p)); p += 8;
+            v2 = _hash_round(v2, _hash_read64(p)); p += 8;
+            v3 = _hash_round(v3, _hash_read64(p)); p += 8;
+            v4 = _hash_round(v4, _hash_read64(p)); p += 8;
+        } while (p <= limit);
+        h = _hash_rotl(v1, 1) + _hash_rotl(v2, 7) + _hash_rotl(v3, 12) + _hash_rotl(v4, 18);
+        h = _hash_merge_round(h, v1);
+        h = _hash_merge_round(h, v2);
+        h = _hash_merge_round(h, v3);
+        h = _hash_merge_round(h, v4);
+    } else {
+        h = seed + HASH_PRIME5;
+    }
+    h += (uint64_t)size;
+    while ((p + 8) <= end) {
+        h ^= _hash_round(0, _hash_read64(p));
+        h = _hash_rotl(h, 27) * HASH_PRIME1 + HASH_PRIME4;
+        p += 8;
+    }
+    if ((p + 4) <= end) {
+        h ^= (uint64_t)_hash_read32(p) * HASH_PRIME1;
+        h = _hash_rotl(h, 23) * HASH_PRIME2 + HASH_PRIME3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * HASH_PRIME5;
+        h = _hash_rotl(h, 11) * HASH_PRIME1;
+        p++;
+    }
+    h ^= h >> 33;
+    h *= HASH_PRIME2;
+    h ^= h >> 29;
+    h *= HASH_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
@@ -0,0 +1,18 @@
+#pragma once
+/*
+    64-bit content hash (xxHash64 algorithm), used to identify media
+    images by content, e.g. to reference them from snapshot files.
+*/
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// hash size bytes of data
+uint64_t hash64(const void* data, size_t size, uint64_t seed);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
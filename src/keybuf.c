@@ -6,11 +6,30 @@
 #include <assert.h>
 
 #define KEYBUF_MAX_KEYS (64 * 1024)
+#define KEYBUF_MAX_WAIT_TEXT (64)
+
+// adaptive mode: where the current key is
+typedef enum {
+    KEYBUF_READY,       // next key can be pressed
+    KEYBUF_HELD,        // pressed, waiting for the system to read it
+    KEYBUF_RELEASED,    // released, waiting for the system to see no key
+} keybuf_pace_t;
+
 typedef struct {
     bool valid;
     int cur_pos;
     int cur_delay_time;
     int key_delay_time;
+    bool adaptive;
+    keybuf_system_t system;
+    int scans_pressed;
+    int scans_released;
+    keybuf_pace_t pace;
+    uint8_t held_key;
+    uint32_t held_scans;    // key scans when the key was pressed
+    int pace_time;          // time spent in the current pace step
+    bool wait_pc;
+    char wait_text[KEYBUF_MAX_WAIT_TEXT];
     uint8_t buf[KEYBUF_MAX_KEYS];
 } keybuf_state_t;
 static keybuf_state_t state;
@@ -20,6 +39,12 @@ void keybuf_init(const keybuf_desc_t* desc) {
         .valid = true,
         .key_delay_time = desc->key_delay_frames * 16667,
     };
+    if (desc->system) {
+        state.adaptive = true;
+        state.system = *desc->system;
+        state.scans_pressed = (desc->scans_pressed > 0) ? desc->scans_pressed : 1;
+        state.scans_released = (desc->scans_released > 0) ? desc->scans_released : 1;
+    }
 }
 
 void keybuf_put(const char* text) {
@@ -28,6 +53,11 @@ void keybuf_put(const char* text) {
         return;
     }
     state.cur_delay_time = 0;
+    state.wait_pc = false;
+    state.wait_text[0] = 0;
+    if (state.adaptive) {
+        state.system.watch_pc(-1, state.system.user_data);
+    }
     int len = (int) strlen(text);
     if ((len+1) < KEYBUF_MAX_KEYS) {
         strcpy((char*)state.buf, text);
@@ -70,8 +100,8 @@ static bool _keybuf_extract(uint8_t delim, uint8_t* buf, int buf_size) {
 static uint8_t _keybuf_parse_cmd(void) {
     /* skip initial '{' */
     _keybuf_next();
-    uint8_t key[8];
-    uint8_t val[8];
+    uint8_t key[16];
+    uint8_t val[KEYBUF_MAX_WAIT_TEXT];
     if (_keybuf_extract(':', key, sizeof(key))) {
         if (_keybuf_extract('}', val, sizeof(val))) {
             if (strcmp((const char*)key, "wait") == 0) {
@@ -86,27 +116,100 @@ static uint8_t _keybuf_parse_cmd(void) {
                 int c = atoi((const char*)val);
                 return (uint8_t)c;
             }
+            else if (state.adaptive && (strcmp((const char*)key, "waitpc") == 0)) {
+                state.wait_pc = true;
+                state.system.watch_pc((int)(strtol((const char*)val, 0, 16) & 0xFFFF), state.system.user_data);
+                return 0;
+            }
+            else if (state.adaptive && (strcmp((const char*)key, "waitscreen") == 0)) {
+                strcpy(state.wait_text, (const char*)val);
+                return 0;
+            }
         }
     }
     return 0;
 }
 
+// next key or command, 0 if there's no key to press now
+static uint8_t _keybuf_next_key(void) {
+    uint8_t c = _keybuf_next();
+    if (c != 0) {
+        /* check for special ${:} command */
+        if (((c == '$') || (c == '#')) && (_keybuf_peek() == '{')) {
+            c = _keybuf_parse_cmd();
+        }
+        /* replace /n with 0x0D */
+        if (c == 0x0A) {
+            c = 0x0D;
+        }
+    }
+    return c;
+}
+
+static bool _keybuf_waiting(uint32_t frame_time_us) {
+    if (state.cur_delay_time > 0) {
+        state.cur_delay_time -= (int) frame_time_us;
+        return true;
+    }
+    if (state.wait_pc) {
+        if (!state.system.pc_reached(state.system.user_data)) {
+            return true;
+        }
+        state.wait_pc = false;
+        state.system.watch_pc(-1, state.system.user_data);
+    }
+    if (state.wait_text[0]) {
+        if (!state.system.screen_contains(state.wait_text, state.system.user_data)) {
+            return true;
+        }
+        state.wait_text[0] = 0;
+    }
+    return false;
+}
+
+static void _keybuf_pace(uint32_t frame_time_us) {
+    const keybuf_system_t* sys = &state.system;
+    state.pace_time += (int) frame_time_us;
+    if (state.pace == KEYBUF_HELD) {
+        const uint32_t scans = sys->key_scans(sys->user_data) - state.held_scans;
+        if ((scans < (uint32_t)state.scans_pressed) && (state.pace_time < state.key_delay_time)) {
+            return;
+        }
+        sys->key_up(state.held_key, sys->user_data);
+        state.pace = KEYBUF_RELEASED;
+        state.pace_time = 0;
+        return;
+    }
+    if (state.pace == KEYBUF_RELEASED) {
+        const uint32_t idle = sys->key_idle(sys->user_data);
+        if ((idle < (uint32_t)state.scans_released) && (state.pace_time < state.key_delay_time)) {
+            return;
+        }
+        state.pace = KEYBUF_READY;
+    }
+    if (_keybuf_waiting(frame_time_us)) {
+        return;
+    }
+    const uint8_t c = _keybuf_next_key();
+    if (c != 0) {
+        sys->key_down(c, sys->user_data);
+        state.held_key = c;
+        state.held_scans = sys->key_scans(sys->user_data);
+        state.pace = KEYBUF_HELD;
+        state.pace_time = 0;
+    }
+}
+
 uint8_t keybuf_get(uint32_t frame_time_us) {
     assert(state.valid);
+    if (state.adaptive) {
+        _keybuf_pace(frame_time_us);
+        return 0;
+    }
     uint8_t c = 0;
     if (state.cur_delay_time <= 0) {
         state.cur_delay_time = state.key_delay_time;
-        c = _keybuf_next();
-        if (c != 0) {
-            /* check for special ${:} command */
-            if (((c == '$') || (c == '#')) && (_keybuf_peek() == '{')) {
-                c = _keybuf_parse_cmd();
-            }
-            /* replace /n with 0x0D */
-            if (c == 0x0A) {
-                c = 0x0D;
-            }
-        }
+        c = _keybuf_next_key();
     }
     else {
         state.cur_delay_time -= (int) frame_time_us;
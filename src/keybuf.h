@@ -5,11 +5,39 @@
     Special embedded commands:
 
     ${wait:20} - wait 20 frames before continuing
+    ${waitpc:E3A5} - wait until the CPU executed the instruction at this (hex) address
+    ${waitscreen:READY} - wait until this text is on screen
+
+    Keys are fed at a fixed rate, or, when the emulator provides the system
+    hooks, adaptively: each key is held until the emulated system read it
+    pressed in its keyboard scans, and the next key is pressed once a scan
+    saw the key released, so typing runs at the speed of the software. The
+    fixed delay stays the upper bound for each step, for software which
+    doesn't scan the keyboard. ${waitpc} and ${waitscreen} need the hooks.
 */
 #include <stdint.h>
+#include <stdbool.h>
+
+// hooks into the emulated system for the adaptive mode
+typedef struct {
+    void (*key_down)(uint8_t key_code, void* user_data);
+    void (*key_up)(uint8_t key_code, void* user_data);
+    uint32_t (*key_scans)(void* user_data);     // running count of keyboard reads which found a key pressed
+    uint32_t (*key_idle)(void* user_data);      // keyboard reads since the last one which found a key pressed
+    void (*watch_pc)(int pc, void* user_data);  // start watching an address (-1: stop)
+    bool (*pc_reached)(void* user_data);        // the watched address was executed
+    bool (*screen_contains)(const char* text, void* user_data);
+    void* user_data;
+} keybuf_system_t;
 
 typedef struct {
     int key_delay_frames;
+    // adaptive mode (optional): a key is released once the system read it
+    // pressed scans_pressed times, the next key is pressed once the system
+    // read scans_released keys without one pressed
+    const keybuf_system_t* system;
+    int scans_pressed;
+    int scans_released;
 } keybuf_desc_t;
 
 // initialize the keybuf with a base-delay between keys in 60 Hz frames
@@ -17,4 +45,5 @@ void keybuf_init(const keybuf_desc_t* desc);
 // put a text for playback into keybuf
 void keybuf_put(const char* text);
 // get next key to feed into emulator, call once per frame, returns 0 if no key to feed
+// (in adaptive mode keys are pressed and released through the system hooks, returns 0)
 uint8_t keybuf_get(uint32_t frame_time_us);
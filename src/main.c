@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include "sokol_audio.h"
 #define SOKOL_ARGS_IMPL
@@ -7,13 +9,25 @@
 #include "sokol_app.h"
 #include "sokol_glue.h"
 #include "sokol_log.h"
+#include "sokol_time.h"
 #include "clock.h"
 #include "gfx.h"
 #include "fs.h"
 #define EMU_IMPL
 #include "clk.h"
 #include "mo5.h"
+#include "mo5cheat.h"
+#include "mo5trace.h"
 #include "keybuf.h"
+#include "basic.h"
+#include "rewind.h"
+#include "mo5snap.h"
+#include "worker.h"
+#include "mapfile.h"
+#include "tapeout.h"
+#include "catalog.h"
+#include "archive.h"
+#include <ctype.h>
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 #include "ui_util.h"
@@ -23,23 +37,121 @@
     #include "ui_memedit.h"
     #include "ui_kbd.h"
     #include "ui_dasm.h"
+    #include "m6809dasm.h"
     #include "ui_emu.h"
 #endif
 
 typedef struct {
   uint32_t   version;
   mo5_t      mo5;
+  // snapshot read from storage, applied to the machine on first load
+  mo5snap_image_t* image;
 } mo5_snapshot_t;
 
+// a snapshot slot being encoded and written, or decoded on a worker thread
+typedef struct {
+  worker_t* worker;
+  size_t slot;
+  bool save;
+  mo5snap_image_t* image;
+  mo5snap_data_t data;      // file content to decode
+  mo5snap_result_t result;
+} snapshot_job_t;
+
+// where written disk sectors are flushed to
+typedef enum {
+  DISK_WRITE_SIDECAR,   // journal next to the image (<image>.sectors)
+  DISK_WRITE_IMAGE,     // into the .fd image itself (.sap images use the sidecar)
+  DISK_WRITE_OFF,       // only kept in memory
+} disk_write_mode_t;
+
+// written disk sectors being flushed on a worker thread
+typedef struct {
+  worker_t* worker;
+  mo5_overlay_t* overlay;   // referenced, the machine writes to a copy meanwhile
+  uint32_t since;           // flush sectors written after this generation
+  uint32_t generation;      // overlay generation once flushed
+  disk_write_mode_t mode;
+  char path[1024];
+} disk_flush_job_t;
+
+// flush written disk sectors once the disk was idle for this many frames
+#define DISK_FLUSH_IDLE_FRAMES (60)
+
+// write incomplete tape output after this many frames without output
+#define TAPEOUT_IDLE_FRAMES (60)
+
+// worker threads hashing media images for the catalogue
+#define CATALOG_SCAN_THREADS (4)
+
+// adaptive typing: the monitor takes a key after reading it pressed twice
+// (debounce), and sees it released after a scan of all 58 keys
+#define KEYBUF_SCANS_PRESSED (2)
+#define KEYBUF_SCANS_RELEASED (58)
+
+// maximum number of frames the run-ahead can be configured to
+#define MAX_RUNAHEAD_FRAMES (4)
+// memory budget for the rewind history
+#define REWIND_BUDGET (16 * 1024 * 1024)
+// default length of the rewind history in seconds
+#define REWIND_DEFAULT_SECONDS (60)
+// instruction trace of trace=<file>, about 3 million instructions
+#define TRACE_SIZE (16 * 1024 * 1024)
+
 static struct {
   uint32_t frame_time_us;
   mo5_t mo5;
+  // tape or disk image to attach by reference (memory mapped) instead of loading it through fs
+  struct {
+    bool pending;
+    char path[1024];
+  } attach;
+  bool tapeout;   // tape output is written to a .k7 file
+  char cheats[1024];  // cheat file, loaded at start if given and saved from the UI
+  char trace[1024];   // instruction trace file, written at exit
+  struct {
+    catalog_t* current;     // media catalogue of the catalog=<dir> directory
+    worker_t* worker;       // background rescan
+    catalog_t* scanned;     // rescan result, written by the worker
+    char root[1024];
+    char index[1024];       // index file in the catalogue directory
+    char path[1024];        // last looked up media path
+  } catalog;
+  struct {
+    disk_write_mode_t mode;
+    char path[1024];        // attached disk image, empty if the disk is not backed by a file
+    uint32_t generation;    // overlay generation seen in the last frame
+    uint32_t flushed;       // overlay generation written to storage
+    int idle_frames;        // frames since the last disk write
+    disk_flush_job_t job;
+  } disk;
+  struct {
+    int frames;       // number of frames to run ahead (0: disabled)
+    float cost_ms;    // smoothed host time spent on run-ahead per frame
+    mo5_speculation_t spec;
+  } runahead;
+  struct {
+    bool enabled;
+    bool active;      // rewind key is held down
+    float cost_ms;    // smoothed host time spent on recording per frame
+    rewind_stats_t stats;
+    mo5_state_t state;
+  } rewind;
   #ifdef EMU_USE_UI
     ui_emu_t ui;
     mo5_snapshot_t snapshots[UI_SNAPSHOT_MAX_SLOTS];
+    snapshot_job_t snapshot_jobs[UI_SNAPSHOT_MAX_SLOTS];
   #endif
 } app = {0};
 
+static int8_t mem_read(uint16_t address) {
+  return mo5_mem_read(&app.mo5, address);
+}
+
+static void mem_write(uint16_t address, uint8_t value) {
+  mo5_mem_write(&app.mo5, address, value);
+}
+
 #ifdef EMU_USE_UI
 static void ui_draw_cb(const ui_draw_info_t* draw_info) {
     ui_emu_draw(&app.ui, &(ui_emu_frame_t){
@@ -51,9 +163,9 @@ static void ui_save_settings_cb(ui_settings_t* settings) {
   ui_emu_save_settings(&app.ui, settings);
 }
 
-static void ui_update_snapshot_screenshot(size_t slot) {
+static void ui_update_snapshot_screenshot(size_t slot, mo5_t* sys) {
   ui_snapshot_screenshot_t screenshot = {
-      .texture = ui_create_screenshot_texture(mo5_display_info(&app.snapshots[slot].mo5))
+      .texture = ui_create_screenshot_texture(mo5_display_info(sys))
   };
   ui_snapshot_screenshot_t prev_screenshot = ui_snapshot_set_screenshot(&app.ui.snapshot, slot, screenshot);
   if (prev_screenshot.texture) {
@@ -61,29 +173,621 @@ static void ui_update_snapshot_screenshot(size_t slot) {
   }
 }
 
+// render the screenshot of a snapshot read from storage on a scratch machine
+static void ui_update_snapshot_screenshot_from_image(size_t slot, const mo5snap_image_t* image) {
+  mo5_t* sys = (mo5_t*) calloc(1, sizeof(mo5_t));
+  mo5_init(sys, &(mo5_desc_t){ .mgetc = mem_read, .mputc = mem_write });
+  mo5_load_state(sys, &image->state);
+  mo5_draw_screen(sys);
+  ui_update_snapshot_screenshot(slot, sys);
+  mo5_discard(sys);
+  free(sys);
+}
+
+static void snapshot_save_job(void* user_data) {
+  snapshot_job_t* job = (snapshot_job_t*) user_data;
+  // written by snapshot_job_finish(), fs calls into JS on emscripten
+  job->data = mo5snap_encode(job->image);
+}
+
+static void snapshot_load_job(void* user_data) {
+  snapshot_job_t* job = (snapshot_job_t*) user_data;
+  job->result = mo5snap_decode(job->data.ptr, job->data.size, MO5SNAP_CHUNK_ALL, job->image);
+  free(job->data.ptr);
+  job->data = (mo5snap_data_t){0};
+}
+
+// called on the main thread once the worker is done
+static void snapshot_job_finish(snapshot_job_t* job) {
+  mo5_snapshot_t* snapshot = &app.snapshots[job->slot];
+  if (job->save && job->data.ptr) {
+    fs_save_snapshot("mo5", job->slot, (gfx_range_t){ .ptr = job->data.ptr, .size = job->data.size });
+    free(job->data.ptr);
+  }
+  // a slot saved in the meantime wins over the stored snapshot
+  if (!job->save && (job->result == MO5SNAP_OK) && !app.ui.snapshot.slots[job->slot].valid) {
+    ui_update_snapshot_screenshot_from_image(job->slot, job->image);
+    if (snapshot->image) {
+      mo5snap_image_discard(snapshot->image);
+      free(snapshot->image);
+    }
+    snapshot->image = job->image;
+  } else {
+    mo5snap_image_discard(job->image);
+    free(job->image);
+  }
+  *job = (snapshot_job_t){0};
+}
+
+static void snapshot_job_start(size_t slot, bool save, mo5snap_image_t* image, mo5snap_data_t data) {
+  snapshot_job_t* job = &app.snapshot_jobs[slot];
+  *job = (snapshot_job_t){ .slot = slot, .save = save, .image = image, .data = data };
+  worker_func_t func = save ? snapshot_save_job : snapshot_load_job;
+  job->worker = worker_start(func, job);
+  if (!job->worker) {
+    func(job);
+    snapshot_job_finish(job);
+  }
+}
+
+static void snapshot_job_wait(size_t slot) {
+  snapshot_job_t* job = &app.snapshot_jobs[slot];
+  if (job->worker) {
+    worker_join(job->worker);
+    snapshot_job_finish(job);
+  }
+}
+
+static void handle_snapshot_jobs(void) {
+  for (size_t slot = 0; slot < UI_SNAPSHOT_MAX_SLOTS; slot++) {
+    snapshot_job_t* job = &app.snapshot_jobs[slot];
+    if (job->worker && worker_done(job->worker)) {
+      snapshot_job_wait(slot);
+    }
+  }
+}
+
 static bool ui_load_snapshot(size_t slot) {
   bool success = false;
   if ((slot < UI_SNAPSHOT_MAX_SLOTS) && (app.ui.snapshot.slots[slot].valid)) {
-    success = mo5_load_snapshot(&app.mo5, app.snapshots[slot].version, &app.snapshots[slot].mo5);
+    mo5_snapshot_t* snapshot = &app.snapshots[slot];
+    if (snapshot->image) {
+      // media are referenced by hash, a mismatch still restores the machine state
+      const mo5snap_result_t res = mo5snap_apply(&app.mo5, snapshot->image);
+      success = (res == MO5SNAP_OK) || (res == MO5SNAP_MEDIA_MISMATCH);
+      if (success) {
+        mo5_draw_screen(&app.mo5);
+        snapshot->version = mo5_save_snapshot(&app.mo5, &snapshot->mo5);
+        mo5snap_image_discard(snapshot->image);
+        free(snapshot->image);
+        snapshot->image = 0;
+      }
+    } else {
+      success = mo5_load_snapshot(&app.mo5, snapshot->version, &snapshot->mo5);
+    }
   }
   return success;
 }
 
 static void ui_save_snapshot(size_t slot) {
   if (slot < UI_SNAPSHOT_MAX_SLOTS) {
-    app.snapshots[slot].version = mo5_save_snapshot(&app.mo5, &app.snapshots[slot].mo5);
-    ui_update_snapshot_screenshot(slot);
-    fs_save_snapshot("mo5", slot, (gfx_range_t){ .ptr = &app.snapshots[slot], sizeof(gfx_range_t) });
+    snapshot_job_wait(slot);
+    mo5_snapshot_t* snapshot = &app.snapshots[slot];
+    if (snapshot->image) {
+      mo5snap_image_discard(snapshot->image);
+      free(snapshot->image);
+      snapshot->image = 0;
+    }
+    snapshot->version = mo5_save_snapshot(&app.mo5, &snapshot->mo5);
+    ui_update_snapshot_screenshot(slot, &app.mo5);
+    // encoding and compression happen on a worker thread, the file is
+    // written on the main thread once it's done
+    mo5snap_image_t* image = (mo5snap_image_t*) calloc(1, sizeof(mo5snap_image_t));
+    mo5snap_capture(&app.mo5, image);
+    snapshot_job_start(slot, true, image, (mo5snap_data_t){0});
+  }
+}
+
+static void ui_fetch_snapshot_callback(const fs_snapshot_response_t* response) {
+  assert(response);
+  if (response->result != FS_RESULT_SUCCESS) {
+    return;
+  }
+  const size_t slot = response->snapshot_index;
+  assert(slot < UI_SNAPSHOT_MAX_SLOTS);
+  snapshot_job_wait(slot);
+  // the response data only lives until the callback returns
+  mo5snap_data_t data = { .ptr = malloc(response->data.size), .size = response->data.size };
+  memcpy(data.ptr, response->data.ptr, data.size);
+  mo5snap_image_t* image = (mo5snap_image_t*) calloc(1, sizeof(mo5snap_image_t));
+  snapshot_job_start(slot, false, image, data);
+}
+
+static void ui_load_snapshots_from_storage(void) {
+  for (size_t slot = 0; slot < UI_SNAPSHOT_MAX_SLOTS; slot++) {
+    fs_load_snapshot_async("mo5", slot, ui_fetch_snapshot_callback);
   }
 }
 #endif
 
-static int8_t mem_read(uint16_t address) {
-  return mo5_mem_read(&app.mo5, address);
+// Run the machine a few frames ahead with the current input, keep the
+// resulting picture in the framebuffer, then rewind to the real state.
+// This hides the frame(s) of input latency of the emulated software.
+static void run_ahead(void) {
+  if (app.runahead.frames <= 0) {
+    app.runahead.cost_ms = 0.0f;
+    return;
+  }
+  #ifdef EMU_USE_UI
+  if (app.ui.dbg.stopped) {
+    return;
+  }
+  #endif
+  const uint64_t start = stm_now();
+  if (!mo5_speculate_begin(&app.mo5, &app.runahead.spec)) {
+    // debugging, the real frames are shown
+    app.runahead.cost_ms = 0.0f;
+    return;
+  }
+  for (int i = 0; i < app.runahead.frames; i++) {
+    mo5_step(&app.mo5, MO5_FRAME_US);
+  }
+  mo5_speculate_end(&app.mo5, &app.runahead.spec);
+  const float cost_ms = (float)stm_ms(stm_since(start));
+  app.runahead.cost_ms += (cost_ms - app.runahead.cost_ms) * 0.05f;
 }
 
-static void mem_write(uint16_t address, uint8_t value) {
-  mo5_mem_write(&app.mo5, address, value);
+// record the machine state once per frame into the rewind history
+static void rewind_record(void) {
+  if (!app.rewind.enabled) {
+    return;
+  }
+  #ifdef EMU_USE_UI
+  if (app.ui.dbg.stopped) {
+    return;
+  }
+  #endif
+  const uint64_t start = stm_now();
+  mo5_save_state(&app.mo5, &app.rewind.state);
+  rewind_push(&app.rewind.state);
+  const float cost_ms = (float)stm_ms(stm_since(start));
+  app.rewind.cost_ms += (cost_ms - app.rewind.cost_ms) * 0.05f;
+  app.rewind.stats = rewind_stats();
+}
+
+// while the rewind key is held, go back one recorded frame per frame
+static void rewind_step_back(void) {
+  if (rewind_pop(&app.rewind.state)) {
+    mo5_load_state(&app.mo5, &app.rewind.state);
+    mo5_draw_screen(&app.mo5);
+  }
+  app.rewind.stats = rewind_stats();
+}
+
+static bool has_ext(const char* path, const char* ext) {
+  const char* dot = strrchr(path, '.');
+  if (!dot || strchr(dot, '/') || strchr(dot, '\\')) {
+    return false;
+  }
+  for (dot++; *dot && *ext; dot++, ext++) {
+    if (tolower(*dot) != *ext) {
+      return false;
+    }
+  }
+  return (*dot == 0) && (*ext == 0);
+}
+
+static bool is_media_name(const char* name) {
+  return has_ext(name, "k7") || has_ext(name, "fd") || has_ext(name, "sap") || has_ext(name, "rom");
+}
+
+// "game.zip#disk2.fd" selects a member of an archive, the archive path is
+// copied to dst, returns the member name or null
+static const char* split_archive_path(const char* path, char* dst, size_t size) {
+  snprintf(dst, size, "%s", path);
+  char* sep = strrchr(dst, '#');
+  if (sep) {
+    *sep = 0;
+    if (has_ext(dst, "zip") || has_ext(dst, "gz")) {
+      return path + (sep - dst) + 1;
+    }
+    *sep = '#';
+  }
+  return 0;
+}
+
+static bool is_archive_path(const char* path) {
+  char archive[1024];
+  split_archive_path(path, archive, sizeof(archive));
+  return has_ext(archive, "zip") || has_ext(archive, "gz");
+}
+
+// tape and disk images (also in archives) are mapped on native platforms,
+// on the web (and for cartridges) files are loaded through the fs channel
+static bool can_attach(const char* path) {
+  #if defined(__EMSCRIPTEN__)
+    (void)path;
+    return false;
+  #else
+    return (strlen(path) < sizeof(app.attach.path)) && (has_ext(path, "k7") || has_ext(path, "fd") || has_ext(path, "sap") || is_archive_path(path));
+  #endif
+}
+
+static void release_mapfile(void* user_data) {
+  mapfile_close((mapfile_t*)user_data);
+}
+
+static void disk_sidecar_path(char* dst, size_t size, const char* path) {
+  snprintf(dst, size, "%s.sectors", path);
+}
+
+static int disk_flush_compare(const void* a, const void* b) {
+  return ((const int*)a)[0] - ((const int*)b)[0];
+}
+
+// Write the sectors changed since the last flush, sorted by sector. The
+// sidecar is a journal of [u16 sector][256 bytes] records, later records win.
+static void disk_flush_job(void* user_data) {
+  disk_flush_job_t* job = (disk_flush_job_t*) user_data;
+  const int num = mo5_overlay_num_sectors(job->overlay);
+  // pairs of sector number and overlay index
+  int* order = (int*) malloc((size_t)(num ? num : 1) * 2 * sizeof(int));
+  int count = 0;
+  for (int i = 0; i < num; i++) {
+    int sector;
+    uint32_t generation;
+    mo5_overlay_sector(job->overlay, i, &sector, &generation);
+    if (generation > job->since) {
+      order[count * 2 + 0] = sector;
+      order[count * 2 + 1] = i;
+      count++;
+    }
+  }
+  qsort(order, (size_t)count, 2 * sizeof(int), disk_flush_compare);
+  FILE* fp = 0;
+  if (job->mode == DISK_WRITE_IMAGE) {
+    fp = fopen(job->path, "r+b");
+  } else {
+    char path[sizeof(job->path) + 16];
+    disk_sidecar_path(path, sizeof(path), job->path);
+    fp = fopen(path, "ab");
+  }
+  if (fp) {
+    for (int i = 0; i < count; i++) {
+      const int sector = order[i * 2 + 0];
+      const uint8_t* data = mo5_overlay_sector(job->overlay, order[i * 2 + 1], 0, 0);
+      if (job->mode == DISK_WRITE_IMAGE) {
+        fseek(fp, (long)sector * MO5_DISK_SECTOR_SIZE, SEEK_SET);
+      } else {
+        const uint8_t header[2] = { (uint8_t)sector, (uint8_t)(sector >> 8) };
+        fwrite(header, sizeof(header), 1, fp);
+      }
+      fwrite(data, MO5_DISK_SECTOR_SIZE, 1, fp);
+    }
+    fclose(fp);
+  }
+  free(order);
+}
+
+// sectors of a .sap image are encoded and checksummed, they are written
+// to the sidecar instead
+static disk_write_mode_t disk_write_mode(const char* path) {
+  if ((app.disk.mode == DISK_WRITE_IMAGE) && has_ext(path, "sap")) {
+    return DISK_WRITE_SIDECAR;
+  }
+  return app.disk.mode;
+}
+
+static void disk_flush_finish(disk_flush_job_t* job) {
+  // the disk may have been changed in the meantime
+  if (0 == strcmp(job->path, app.disk.path)) {
+    app.disk.flushed = job->generation;
+  }
+  mo5_overlay_release(job->overlay);
+  *job = (disk_flush_job_t){0};
+}
+
+static void disk_flush_start(void) {
+  disk_flush_job_t* job = &app.disk.job;
+  job->overlay = mo5_disk_overlay(&app.mo5);
+  job->generation = mo5_overlay_generation(job->overlay);
+  // an older overlay restored from a snapshot is written completely
+  job->since = (job->generation >= app.disk.flushed) ? app.disk.flushed : 0;
+  job->mode = disk_write_mode(app.disk.path);
+  strcpy(job->path, app.disk.path);
+  job->worker = worker_start(disk_flush_job, job);
+  if (!job->worker) {
+    disk_flush_job(job);
+    disk_flush_finish(job);
+  }
+}
+
+// flush written sectors in batches, never waits for the file IO
+static void handle_disk_flush(void) {
+  disk_flush_job_t* job = &app.disk.job;
+  if (job->worker) {
+    if (!worker_done(job->worker)) {
+      return;
+    }
+    worker_join(job->worker);
+    disk_flush_finish(job);
+  }
+  if ((app.disk.mode == DISK_WRITE_OFF) || (0 == app.disk.path[0])) {
+    return;
+  }
+  const uint32_t generation = mo5_overlay_generation(app.mo5.disk.overlay);
+  if (generation != app.disk.generation) {
+    app.disk.generation = generation;
+    app.disk.idle_frames = 0;
+  } else if ((generation != app.disk.flushed) && (++app.disk.idle_frames >= DISK_FLUSH_IDLE_FRAMES)) {
+    disk_flush_start();
+  }
+}
+
+// replay the sidecar journal of a disk image
+static void load_disk_sidecar(const char* path) {
+  char sidecar[sizeof(app.disk.path) + 16];
+  disk_sidecar_path(sidecar, sizeof(sidecar), path);
+  FILE* fp = fopen(sidecar, "rb");
+  if (!fp) {
+    return;
+  }
+  mo5_overlay_t* overlay = mo5_overlay_create();
+  uint8_t record[2 + MO5_DISK_SECTOR_SIZE];
+  while (fread(record, sizeof(record), 1, fp) == 1) {
+    const int sector = record[0] | (record[1] << 8);
+    if (sector < MO5_DISK_NUM_SECTORS) {
+      mo5_overlay_write(overlay, sector, &record[2]);
+    }
+  }
+  fclose(fp);
+  if (mo5_overlay_num_sectors(overlay) > 0) {
+    mo5_set_disk_overlay(&app.mo5, overlay);
+  }
+  mo5_overlay_release(overlay);
+}
+
+// add the cheats of the cheat file, the cheats before a bad line are kept
+static void load_cheats(void) {
+  mapfile_t* file = mapfile_open(app.cheats);
+  if (!file) {
+    return;
+  }
+  mo5cheat_load(&app.mo5, (const char*)mapfile_ptr(file), mapfile_size(file), 0);
+  mapfile_close(file);
+}
+
+#if defined(EMU_USE_UI)
+// saved from the cheat list window only
+static bool save_cheats(void) {
+  const size_t size = mo5cheat_save(&app.mo5, 0, 0) + 1;
+  char* text = (char*)malloc(size);
+  if (!text) {
+    return false;
+  }
+  mo5cheat_save(&app.mo5, text, size);
+  FILE* fp = fopen(app.cheats, "wb");
+  bool success = false;
+  if (fp) {
+    success = fwrite(text, 1, size - 1, fp) == (size - 1);
+    success &= (0 == fclose(fp));
+  }
+  free(text);
+  return success;
+}
+#endif
+
+static void save_trace(void) {
+  FILE* fp = fopen(app.trace, "wb");
+  if (!fp) {
+    return;
+  }
+  if (has_ext(app.trace, "bin")) {
+    mo5trace_write_binary(app.mo5.trace, fp);
+  } else {
+    #if defined(EMU_USE_UI)
+      mo5trace_write_text(app.mo5.trace, fp, m6809dasm_op, 0);
+    #else
+      mo5trace_write_text(app.mo5.trace, fp, 0, 0);
+    #endif
+  }
+  fclose(fp);
+}
+
+static void catalog_temp_path(char* dst, size_t size) {
+  snprintf(dst, size, "%s.tmp", app.catalog.index);
+}
+
+static void catalog_scan_job(void* user_data) {
+  (void)user_data;
+  app.catalog.scanned = catalog_scan(&(catalog_scan_desc_t){
+    .root = app.catalog.root,
+    .previous = app.catalog.current,
+    .num_threads = CATALOG_SCAN_THREADS,
+  });
+  char path[sizeof(app.catalog.index) + 8];
+  catalog_temp_path(path, sizeof(path));
+  catalog_save(app.catalog.scanned, path);
+}
+
+static void catalog_scan_finish(void) {
+  if (app.catalog.worker) {
+    worker_join(app.catalog.worker);
+    app.catalog.worker = 0;
+  }
+  // the old index is still mapped until now
+  catalog_close(app.catalog.current);
+  archive_cache_clear();
+  app.catalog.current = app.catalog.scanned;
+  app.catalog.scanned = 0;
+  char path[sizeof(app.catalog.index) + 8];
+  catalog_temp_path(path, sizeof(path));
+  remove(app.catalog.index);
+  rename(path, app.catalog.index);
+}
+
+// Open the catalogue index of a media directory, the mapped index is used
+// while the directory is rescanned in the background for added or changed
+// images. The first time the catalogue stays empty until the scan is done.
+static void init_catalog(const char* root) {
+  snprintf(app.catalog.root, sizeof(app.catalog.root), "%s", root);
+  snprintf(app.catalog.index, sizeof(app.catalog.index), "%s/mo5-catalog.idx", root);
+  app.catalog.current = catalog_open(app.catalog.index);
+  app.catalog.worker = worker_start(catalog_scan_job, 0);
+  if (!app.catalog.worker) {
+    catalog_scan_job(0);
+    catalog_scan_finish();
+  }
+}
+
+static void handle_catalog_scan(void) {
+  if (app.catalog.worker && worker_done(app.catalog.worker)) {
+    catalog_scan_finish();
+  }
+}
+
+// a media path which isn't an existing file is looked up in the catalogue,
+// by file name, or by content hash as 16 hex digits
+static const char* lookup_media(const char* path) {
+  FILE* fp = fopen(path, "rb");
+  if (fp) {
+    fclose(fp);
+    return path;
+  }
+  if (!app.catalog.current && app.catalog.worker) {
+    // without an index the name can only be resolved by the first scan
+    catalog_scan_finish();
+  }
+  if (!app.catalog.current) {
+    return path;
+  }
+  int index = catalog_find_name(app.catalog.current, path);
+  if ((index < 0) && (strlen(path) == 16)) {
+    char* end;
+    const uint64_t hash = strtoull(path, &end, 16);
+    if (*end == 0) {
+      index = catalog_find_hash(app.catalog.current, hash);
+    }
+  }
+  if (index < 0) {
+    return path;
+  }
+  snprintf(app.catalog.path, sizeof(app.catalog.path), "%s", catalog_entry(app.catalog.current, index).path);
+  return app.catalog.path;
+}
+
+static void release_archive_member(void* user_data) {
+  archive_cache_release((const uint8_t*)user_data);
+}
+
+// Insert a tape, disk or cartridge image from a zip or gzip archive, by
+// member name, or the first image in the archive. The member is inflated
+// straight into a cached buffer which the machine references, so inserting
+// it again (e.g. switching disks) doesn't inflate it again.
+static bool insert_archive_member(const void* data, size_t data_size, const char* archive_path, const char* member) {
+  archive_t ar = {0};
+  if (!archive_open(&ar, data, data_size)) {
+    return false;
+  }
+  int index = member ? archive_find(&ar, member) : -1;
+  for (int i = 0; !member && (index < 0) && (i < ar.num_members); i++) {
+    if (is_media_name(ar.members[i].name)) {
+      index = i;
+    }
+  }
+  // gzip members are usually named after the archive ("game.k7.gz")
+  char name[256] = "";
+  if ((index < 0) && !member && (ar.num_members == 1) && has_ext(archive_path, "gz")) {
+    index = 0;
+    const char* file_name = strrchr(archive_path, '/') ? strrchr(archive_path, '/') + 1 : archive_path;
+    snprintf(name, sizeof(name), "%.*s", (int)(strlen(file_name) - 3), file_name);
+  } else if (index >= 0) {
+    snprintf(name, sizeof(name), "%s", ar.members[index].name);
+  }
+  if ((index < 0) || !is_media_name(name)) {
+    archive_close(&ar);
+    return false;
+  }
+  const size_t size = ar.members[index].size;
+  const uint8_t* buf = archive_cache_extract(&ar, index);
+  archive_close(&ar);
+  if (!buf) {
+    return false;
+  }
+  const mo5_media_desc_t desc = {
+    .ptr = buf,
+    .size = size,
+    .release = release_archive_member,
+    .user_data = (void*)buf,
+  };
+  if (has_ext(name, "k7")) {
+    return mo5_attach_tape(&app.mo5, &desc);
+  }
+  if (has_ext(name, "fd") || has_ext(name, "sap")) {
+    // written sectors of a disk in an archive stay in memory
+    app.disk.path[0] = 0;
+    return mo5_attach_disk(&app.mo5, &desc);
+  }
+  const bool success = mo5_insert_cartridge(&app.mo5, (gfx_range_t){ .ptr = (void*)buf, .size = size });
+  archive_cache_release(buf);
+  return success;
+}
+
+static bool attach_archive_file(const char* path) {
+  char archive[1024];
+  const char* member = split_archive_path(path, archive, sizeof(archive));
+  mapfile_t* file = mapfile_open(archive);
+  if (!file) {
+    return false;
+  }
+  // the archive is only read while the member is inflated
+  const bool success = insert_archive_member(mapfile_ptr(file), mapfile_size(file), archive, member);
+  mapfile_close(file);
+  return success;
+}
+
+static bool attach_media_file(const char* path) {
+  if (is_archive_path(path)) {
+    return attach_archive_file(path);
+  }
+  mapfile_t* file = mapfile_open(path);
+  if (!file) {
+    return false;
+  }
+  const mo5_media_desc_t desc = {
+    .ptr = mapfile_ptr(file),
+    .size = mapfile_size(file),
+    .release = release_mapfile,
+    .user_data = file,
+  };
+  if (has_ext(path, "k7")) {
+    return mo5_attach_tape(&app.mo5, &desc);
+  }
+  bool success;
+  if (disk_write_mode(path) == DISK_WRITE_IMAGE) {
+    // the image file is written to, the machine reads a copy so the media
+    // (and its hash, which snapshots refer to) doesn't change underneath
+    success = mo5_insert_disk(&app.mo5, (gfx_range_t){ .ptr = (void*)desc.ptr, .size = desc.size });
+    mapfile_close(file);
+  } else {
+    success = mo5_attach_disk(&app.mo5, &desc);
+  }
+  if (!success) {
+    return false;
+  }
+  strcpy(app.disk.path, path);
+  if (disk_write_mode(path) == DISK_WRITE_SIDECAR) {
+    load_disk_sidecar(path);
+  }
+  // sectors from the sidecar are already stored
+  app.disk.generation = app.disk.flushed = mo5_overlay_generation(app.mo5.disk.overlay);
+  app.disk.idle_frames = 0;
+  return true;
+}
+
+static void attach_media_file_async(const char* path) {
+  strcpy(app.attach.path, path);
+  app.attach.pending = true;
 }
 
 static void audio_push(const float *samples, int num_samples, void *user_data) {
@@ -91,18 +795,120 @@ static void audio_push(const float *samples, int num_samples, void *user_data) {
   saudio_push(samples, num_samples);
 }
 
+static void keybuf_key_down(uint8_t key_code, void* user_data) {
+  (void)user_data;
+  mo5_key_down(&app.mo5, key_code);
+}
+
+static void keybuf_key_up(uint8_t key_code, void* user_data) {
+  (void)user_data;
+  mo5_key_up(&app.mo5, key_code);
+}
+
+static uint32_t keybuf_key_scans(void* user_data) {
+  (void)user_data;
+  return app.mo5.input.key_scans;
+}
+
+static uint32_t keybuf_key_idle(void* user_data) {
+  (void)user_data;
+  return app.mo5.input.key_idle;
+}
+
+static void keybuf_watch_pc(int pc, void* user_data) {
+  (void)user_data;
+  mo5_watch_pc(&app.mo5, pc);
+}
+
+static bool keybuf_pc_reached(void* user_data) {
+  (void)user_data;
+  return mo5_pc_reached(&app.mo5);
+}
+
+static bool keybuf_screen_contains(const char* text, void* user_data) {
+  (void)user_data;
+  char screen[MO5_SCREEN_TEXT_SIZE];
+  mo5_screen_text(&app.mo5, screen);
+  return 0 != strstr(screen, text);
+}
+
+static const keybuf_system_t keybuf_system = {
+  .key_down = keybuf_key_down,
+  .key_up = keybuf_key_up,
+  .key_scans = keybuf_key_scans,
+  .key_idle = keybuf_key_idle,
+  .watch_pc = keybuf_watch_pc,
+  .pc_reached = keybuf_pc_reached,
+  .screen_contains = keybuf_screen_contains,
+};
+
 static void init(void) {
+  // tape output goes to tapeout.k7 unless configured otherwise
+  app.tapeout = !sargs_equals("tapeout", "off");
+  if (app.tapeout) {
+    tapeout_init(&(tapeout_desc_t){
+      .path = sargs_exists("tapeout") ? sargs_value("tapeout") : "tapeout.k7",
+      .idle_frames = TAPEOUT_IDLE_FRAMES,
+    });
+  }
   // init MO5
   mo5_desc_t mo5_desc = {
     .mgetc = mem_read,
     .mputc = mem_write,
     .audio_callback = {.func = audio_push},
+    .tape_out = {.func = app.tapeout ? tapeout_put : 0},
+    .fast_tape = !sargs_equals("fasttape", "false"),
     #if defined(EMU_USE_UI)
       .debug = ui_mo5_get_debug(&app.ui),
     #endif
   };
   mo5_init(&app.mo5, &mo5_desc);
-  keybuf_init(&(keybuf_desc_t){.key_delay_frames = 7});
+  // cheats are applied by the machine, with or without the UI, without
+  // cheats= the UI saves them to mo5.cht but nothing is loaded at start
+  snprintf(app.cheats, sizeof(app.cheats), "%s", sargs_exists("cheats") ? sargs_value("cheats") : "mo5.cht");
+  if (sargs_exists("cheats")) {
+    load_cheats();
+  }
+  // trace=<file> records the instructions from the start and writes the last
+  // ones at exit, in binary for a .bin file, as text otherwise
+  if (sargs_exists("trace") && mo5trace_start(&app.mo5, TRACE_SIZE)) {
+    snprintf(app.trace, sizeof(app.trace), "%s", sargs_value("trace"));
+  }
+  if (sargs_equals("diskwrite", "image")) {
+    app.disk.mode = DISK_WRITE_IMAGE;
+  } else if (sargs_equals("diskwrite", "off")) {
+    app.disk.mode = DISK_WRITE_OFF;
+  }
+  // input= is typed at a fixed rate, "keys=adaptive" holds each key until
+  // the machine read it and honours ${waitpc} and ${waitscreen}
+  keybuf_init(&(keybuf_desc_t){
+    .key_delay_frames = 7,
+    .system = sargs_equals("keys", "adaptive") ? &keybuf_system : 0,
+    .scans_pressed = KEYBUF_SCANS_PRESSED,
+    .scans_released = KEYBUF_SCANS_RELEASED,
+  });
+  if (sargs_exists("runahead")) {
+    app.runahead.frames = atoi(sargs_value("runahead"));
+    if (app.runahead.frames < 0) {
+      app.runahead.frames = 0;
+    } else if (app.runahead.frames > MAX_RUNAHEAD_FRAMES) {
+      app.runahead.frames = MAX_RUNAHEAD_FRAMES;
+    }
+  }
+  int rewind_seconds = REWIND_DEFAULT_SECONDS;
+  if (sargs_exists("rewind")) {
+    rewind_seconds = atoi(sargs_value("rewind"));
+  }
+  if (rewind_seconds > 0) {
+    app.rewind.enabled = true;
+    rewind_init(&(rewind_desc_t){
+      .state_size = sizeof(mo5_state_t),
+      .budget = REWIND_BUDGET,
+      .max_entries = rewind_seconds * 60,
+      .keyframe_interval = 30,
+    });
+  }
+  stm_setup();
   clock_init();
   fs_init();
 
@@ -127,6 +933,20 @@ static void init(void) {
     });
     ui_emu_init(&app.ui, &(ui_emu_desc_t){
         .mo5 = &app.mo5,
+        .runahead = {
+          .frames = &app.runahead.frames,
+          .max_frames = MAX_RUNAHEAD_FRAMES,
+          .cost_ms = &app.runahead.cost_ms,
+        },
+        .rewind = {
+          .enabled = &app.rewind.enabled,
+          .stats = &app.rewind.stats,
+          .cost_ms = &app.rewind.cost_ms,
+        },
+        .cheats = {
+          .path = app.cheats,
+          .save_cb = save_cheats,
+        },
         .snapshot = {
           .load_cb = ui_load_snapshot,
           .save_cb = ui_save_snapshot,
@@ -138,15 +958,26 @@ static void init(void) {
           .cont = { .keycode = simgui_map_keycode(SAPP_KEYCODE_F5), .name = "F5" },
           .stop = { .keycode = simgui_map_keycode(SAPP_KEYCODE_F5), .name = "F5" },
           .step_over = { .keycode = simgui_map_keycode(SAPP_KEYCODE_F6), .name = "F6" },
+          .step_into = { .keycode = simgui_map_keycode(SAPP_KEYCODE_F7), .name = "F7" },
+          .step_out = { .keycode = simgui_map_keycode(SAPP_KEYCODE_F8), .name = "F8" },
         }
     });
     ui_emu_load_settings(&app.ui, ui_settings());
+    ui_load_snapshots_from_storage();
   #endif
 
+  if (sargs_exists("catalog")) {
+    init_catalog(sargs_value("catalog"));
+  }
   bool delay_input = false;
   if (sargs_exists("file")) {
     delay_input = true;
-    fs_load_file_async(FS_CHANNEL_IMAGES, sargs_value("file"));
+    const char* path = lookup_media(sargs_value("file"));
+    if (can_attach(path)) {
+      attach_media_file_async(path);
+    } else {
+      fs_load_file_async(FS_CHANNEL_IMAGES, path);
+    }
   }
   if (!delay_input) {
     if (sargs_exists("input")) {
@@ -158,17 +989,38 @@ static void init(void) {
 static void handle_file_loading(void) {
   fs_dowork();
   const uint32_t load_delay_frames = 60;
+  if (app.attach.pending && (clock_frame_count_60hz() > load_delay_frames)) {
+    app.attach.pending = false;
+    if (attach_media_file(app.attach.path)) {
+      if (sargs_exists("input")) {
+        keybuf_put(sargs_value("input"));
+      }
+    }
+  }
   if (fs_success(FS_CHANNEL_IMAGES) &&
       ((clock_frame_count_60hz() > load_delay_frames))) {
     bool load_success = false;
     if (fs_ext(FS_CHANNEL_IMAGES, "k7")) {
       load_success = mo5_insert_tape(&app.mo5, fs_data(FS_CHANNEL_IMAGES));
-    } else if (fs_ext(FS_CHANNEL_IMAGES, "fd")) {
+    } else if (fs_ext(FS_CHANNEL_IMAGES, "fd") || fs_ext(FS_CHANNEL_IMAGES, "sap")) {
       load_success = mo5_insert_disk(&app.mo5, fs_data(FS_CHANNEL_IMAGES));
+      // written sectors of a disk loaded through fs stay in memory
+      app.disk.path[0] = 0;
     } else if (fs_ext(FS_CHANNEL_IMAGES, "rom")) {
       load_success = mo5_insert_cartridge(&app.mo5, fs_data(FS_CHANNEL_IMAGES));
+    } else if (fs_ext(FS_CHANNEL_IMAGES, "bas")) {
+      // a plain-text listing goes straight into the program area, "input=RUN\n" starts it
+      const gfx_range_t data = fs_data(FS_CHANNEL_IMAGES);
+      load_success = basic_load(&app.mo5, (const char*)data.ptr, data.size);
+    } else if (fs_ext(FS_CHANNEL_IMAGES, "cht")) {
+      const gfx_range_t data = fs_data(FS_CHANNEL_IMAGES);
+      load_success = mo5cheat_load(&app.mo5, (const char*)data.ptr, data.size, 0);
+    } else if (fs_ext(FS_CHANNEL_IMAGES, "zip") || fs_ext(FS_CHANNEL_IMAGES, "gz")) {
+      const gfx_range_t data = fs_data(FS_CHANNEL_IMAGES);
+      load_success = insert_archive_member(data.ptr, data.size, fs_filename(FS_CHANNEL_IMAGES), 0);
     }
-    if (load_success) {
+    // cheats don't start a program, input= isn't typed again
+    if (load_success && !fs_ext(FS_CHANNEL_IMAGES, "cht")) {
       if (sargs_exists("input")) {
         keybuf_put(sargs_value("input"));
       }
@@ -187,11 +1039,25 @@ static void send_keybuf_input(void) {
 
 static void frame(void) {
   app.frame_time_us = clock_frame_time();
-  mo5_step(&app.mo5, app.frame_time_us);
+  if (app.rewind.active) {
+    rewind_step_back();
+  } else {
+    mo5_step(&app.mo5, app.frame_time_us);
+    rewind_record();
+    run_ahead();
+  }
 
   gfx_draw(mo5_display_info(&app.mo5));
 
   handle_file_loading();
+  handle_disk_flush();
+  handle_catalog_scan();
+  if (app.tapeout) {
+    tapeout_update();
+  }
+  #ifdef EMU_USE_UI
+    handle_snapshot_jobs();
+  #endif
   send_keybuf_input();
 }
 
@@ -204,6 +1070,12 @@ static void input(const sapp_event *event) {
 #endif
 
   const bool shift = event->modifiers & SAPP_MODIFIER_SHIFT;
+  if ((event->key_code == SAPP_KEYCODE_F9) &&
+      ((event->type == SAPP_EVENTTYPE_KEY_DOWN) || (event->type == SAPP_EVENTTYPE_KEY_UP))) {
+    // hold F9 to rewind
+    app.rewind.active = app.rewind.enabled && (event->type == SAPP_EVENTTYPE_KEY_DOWN);
+    return;
+  }
   switch (event->type) {
   case SAPP_EVENTTYPE_MOUSE_DOWN: {
       app.mo5.input.penbutton = true;
@@ -216,6 +1088,12 @@ static void input(const sapp_event *event) {
     app.mo5.input.ypen = (SCREEN_HEIGHT * ((float)event->mouse_y)/event->framebuffer_height) - 8;
   } break;
   case SAPP_EVENTTYPE_FILES_DROPPED: {
+    #if !defined(__EMSCRIPTEN__)
+    if (can_attach(sapp_get_dropped_file_path(0))) {
+      attach_media_file_async(sapp_get_dropped_file_path(0));
+      break;
+    }
+    #endif
     fs_load_dropped_file_async(FS_CHANNEL_IMAGES);
   } break;
   case SAPP_EVENTTYPE_CHAR: {
@@ -311,10 +1189,47 @@ static void input(const sapp_event *event) {
 }
 
 static void cleanup(void) {
+  // write the remaining sectors before quitting
+  if (app.disk.job.worker) {
+    worker_join(app.disk.job.worker);
+    disk_flush_finish(&app.disk.job);
+  }
+  if ((app.disk.mode != DISK_WRITE_OFF) && app.disk.path[0] &&
+      (mo5_overlay_generation(app.mo5.disk.overlay) != app.disk.flushed)) {
+    disk_flush_start();
+    if (app.disk.job.worker) {
+      worker_join(app.disk.job.worker);
+      disk_flush_finish(&app.disk.job);
+    }
+  }
+  if (app.tapeout) {
+    tapeout_discard();
+  }
+  if (app.catalog.worker) {
+    catalog_scan_finish();
+  }
+  catalog_close(app.catalog.current);
+  if (app.trace[0]) {
+    save_trace();
+  }
   #ifdef EMU_USE_UI
+    for (size_t i = 0; i < UI_SNAPSHOT_MAX_SLOTS; i++) {
+      snapshot_job_wait(i);
+    }
     ui_emu_discard(&app.ui);
     ui_discard();
+    for (size_t i = 0; i < UI_SNAPSHOT_MAX_SLOTS; i++) {
+      mo5_discard(&app.snapshots[i].mo5);
+      if (app.snapshots[i].image) {
+        mo5snap_image_discard(app.snapshots[i].image);
+        free(app.snapshots[i].image);
+      }
+    }
   #endif
+  mo5_discard(&app.mo5);
+  if (app.rewind.enabled) {
+    rewind_discard();
+  }
   saudio_shutdown();
   sg_shutdown();
 }
@@ -0,0 +1,166 @@
+#include "mapfile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#if defined(__EMSCRIPTEN__)
+    #define MAPFILE_NO_MMAP (1)
+#elif defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+struct mapfile_t {
+    const uint8_t* ptr;
+    size_t size;
+    bool mapped;
+    #if defined(_WIN32) && !defined(MAPFILE_NO_MMAP)
+    HANDLE file;
+    HANDLE mapping;
+    #endif
+};
+
+// fallback: read the whole file into a heap buffer
+static bool _mapfile_read(const char* path, mapfile_t* file) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    const long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (size < 0) {
+        fclose(fp);
+        return false;
+    }
+    uint8_t* buf = (uint8_t*) malloc((size_t)size + 1);
+    const size_t num_read = fread(buf, 1, (size_t)size, fp);
+    fclose(fp);
+    if (num_read != (size_t)size) {
+        free(buf);
+        return false;
+    }
+    file->ptr = buf;
+    file->size = (size_t)size;
+    file->mapped = false;
+    return true;
+}
+
+#if defined(MAPFILE_NO_MMAP)
+static bool _mapfile_map(const char* path, mapfile_t* file) {
+    (void)path; (void)file;
+    return false;
+}
+
+static void _mapfile_unmap(mapfile_t* file) {
+    (void)file;
+}
+#elif defined(_WIN32)
+static bool _mapfile_map(const char* path, mapfile_t* file) {
+    WCHAR wc_path[1024];
+    if (0 == MultiByteToWideChar(CP_UTF8, 0, path, -1, wc_path, sizeof(wc_path) / sizeof(WCHAR))) {
+        return false;
+    }
+    // disk images may be written back while mapped
+    HANDLE fh = CreateFileW(wc_path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fh == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(fh, &size) || (size.QuadPart == 0)) {
+        CloseHandle(fh);
+        return false;
+    }
+    HANDLE mh = CreateFileMappingW(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mh == NULL) {
+        CloseHandle(fh);
+        return false;
+    }
+    const void* ptr = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+    if (ptr == NULL) {
+        CloseHandle(mh);
+        CloseHandle(fh);
+        return false;
+    }
+    file->ptr = (const uint8_t*) ptr;
+    file->size = (size_t)size.QuadPart;
+    file->mapped = true;
+    file->file = fh;
+    file->mapping = mh;
+    return true;
+}
+
+static void _mapfile_unmap(mapfile_t* file) {
+    UnmapViewOfFile(file->ptr);
+    CloseHandle(file->mapping);
+    CloseHandle(file->file);
+}
+#else
+static bool _mapfile_map(const char* path, mapfile_t* file) {
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    // mmap can't map empty files
+    if ((fstat(fd, &st) != 0) || (st.st_size <= 0)) {
+        close(fd);
+        return false;
+    }
+    void* ptr = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping stays valid after closing the descriptor
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        return false;
+    }
+    file->ptr = (const uint8_t*) ptr;
+    file->size = (size_t)st.st_size;
+    file->mapped = true;
+    return true;
+}
+
+static void _mapfile_unmap(mapfile_t* file) {
+    munmap((void*)file->ptr, file->size);
+}
+#endif
+
+mapfile_t* mapfile_open(const char* path) {
+    assert(path);
+    mapfile_t* file = (mapfile_t*) calloc(1, sizeof(mapfile_t));
+    if (!_mapfile_map(path, file) && !_mapfile_read(path, file)) {
+        free(file);
+        return 0;
+    }
+    return file;
+}
+
+void mapfile_close(mapfile_t* file) {
+    if (file) {
+        if (file->mapped) {
+            _mapfile_unmap(file);
+        } else {
+            free((void*)file->ptr);
+        }
+        free(file);
+    }
+}
+
+const uint8_t* mapfile_ptr(const mapfile_t* file) {
+    assert(file);
+    return file->ptr;
+}
+
+size_t mapfile_size(const mapfile_t* file) {
+    assert(file);
+    return file->size;
+}
+
+bool mapfile_mapped(const mapfile_t* file) {
+    assert(file);
+    return file->mapped;
+}
@@ -0,0 +1,31 @@
+#pragma once
+/*
+    Read-only file mappings for media images.
+
+    Uses mmap on POSIX platforms and file mappings on Windows. Where
+    mapping isn't available (emscripten) or fails, the file is read into
+    a heap buffer instead.
+*/
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct mapfile_t mapfile_t;
+
+// map a file, returns 0 if the file can't be opened
+mapfile_t* mapfile_open(const char* path);
+// unmap the file (or free the heap copy)
+void mapfile_close(mapfile_t* file);
+// the file content
+const uint8_t* mapfile_ptr(const mapfile_t* file);
+size_t mapfile_size(const mapfile_t* file);
+// true if the file is memory mapped, false if it was read into a heap buffer
+bool mapfile_mapped(const mapfile_t* file);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
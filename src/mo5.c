@@ -1,10 +1,17 @@
 #include <string.h>
 #include "clk.h"
 #include "mo5.h"
+#include "mo5expr.h"
 #include "mo5rom.h"
+#include "mo5trace.h"
+#include "mo5cover.h"
+#include "hash.h"
 
 #define _MO5_FREQUENCY (1000000)
 #define _MO5_TAPE_DRIVE_CONNECTED (0x80)
+// monitor tape block read routine ($F101)
+#define _MO5_K7_LEADER_RET (0xF10D) // return address of the first bit trap (leader search)
+#define _MO5_K7_BLOCK_RTS (0xF167)  // final RTS of the routine
 // bump when game_t memory layout changes
 #define EMU_SNAPSHOT_VERSION           (0x0001)
 
@@ -13,27 +20,455 @@
     #define EMU_ASSERT(c) assert(c)
 #endif
 
+// reference counts of pages and media images are shared between forks
+// running on different threads
+#if defined(_MSC_VER)
+  #include <intrin.h>
+  #define _MO5_ATOMIC_INC(p) _InterlockedIncrement(p)
+  #define _MO5_ATOMIC_DEC(p) _InterlockedDecrement(p)
+  #define _MO5_ATOMIC_LOAD(p) _InterlockedOr(p, 0)
+  #define _MO5_ATOMIC_STORE(p, v) _InterlockedExchange(p, v)
+  #define _MO5_ATOMIC_CAS(p, expected, desired) (_InterlockedCompareExchange(p, desired, expected) == (expected))
+  #define _MO5_THREAD_LOCAL __declspec(thread)
+#else
+  #define _MO5_ATOMIC_INC(p) __atomic_add_fetch(p, 1, __ATOMIC_ACQ_REL)
+  #define _MO5_ATOMIC_DEC(p) __atomic_sub_fetch(p, 1, __ATOMIC_ACQ_REL)
+  #define _MO5_ATOMIC_LOAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+  #define _MO5_ATOMIC_STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+  #define _MO5_ATOMIC_CAS(p, expected, desired) __sync_bool_compare_and_swap(p, expected, desired)
+  #define _MO5_THREAD_LOCAL __thread
+#endif
+
+#if defined(_MSC_VER)
+  #define _MO5_FORCE_INLINE __forceinline
+#else
+  #define _MO5_FORCE_INLINE inline __attribute__((always_inline))
+#endif
+
+struct mo5_page_t {
+  long refs;
+  uint8_t data[MO5_PAGE_SIZE];
+};
+
+struct mo5_breakpoints_t {
+  uint32_t pc_bits[0x10000 / 32]; // enabled breakpoint addresses
+  mo5_breakpoint_t bp[MO5_MAX_BREAKPOINTS];
+  int num;
+  int num_enabled;
+  bool step;          // stop before the next instruction
+  bool step_out;      // stop once a return leaves the frame of out_s
+  uint16_t out_s;
+  bool returning;     // the instruction about to execute is a return
+  bool resume;        // the next run starts at the instruction it stopped at
+  bool hit;           // the last mo5_step() stopped
+  mo5_watchpoint_t wp[MO5_MAX_WATCHPOINTS];
+  int num_wp;
+  bool running;       // in the debug loop, watchpoints only see CPU accesses
+  uint16_t op_pc;     // instruction being executed
+  uint64_t op_cycle;
+  bool watch_stop;    // a watchpoint was hit by the instruction
+  mo5_watch_hit_t watch_hit;
+  bool replay;        // the history runs the machine to replay_to, breakpoints only note their hits
+  uint64_t replay_to;
+  bool replay_found;  // start of the last instruction at a breakpoint or after a watchpoint hit
+  uint64_t replay_hit;
+};
+
+// a byte forced by a cheat
+typedef struct {
+  uint16_t address;
+  uint8_t value;
+} _mo5_patch_t;
+
+struct mo5_cheats_t {
+  long refs;
+  int num;
+  int cap;
+  mo5_cheat_t *cheat;       // in the order they were added
+  _mo5_patch_t *patch;      // bytes of the enabled MO5_CHEAT_PATCH cheats, sorted by address
+  int num_patches;
+  _mo5_patch_t *freeze;     // bytes of the enabled MO5_CHEAT_FREEZE cheats, in cheat order
+  int num_freezes;
+};
+
+// snapshots of the machine for reverse execution, by increasing cycle in a ring
+struct mo5_history_t {
+  mo5_t *state;
+  int cap;
+  int first;          // oldest snapshot
+  int num;
+  bool dirty;         // the host changed the machine outside of the CPU loop
+  // host inputs at the end of the last slice, a change before the next
+  // slice starts a new snapshot
+  mc6809e_t cpu;
+  kbd_t kbd;
+  uint8_t input[sizeof(((mo5_t *)0)->input)];
+};
+
+// number of allocated RAM pages, for statistics
+static long _mo5_num_pages;
+// machine stepped by mo5_step() on this thread, used by the CPU callbacks of forks
+static _MO5_THREAD_LOCAL mo5_t *_mo5_cur;
+
+struct mo5_media_t {
+  long refs;
+  size_t size;
+  uint64_t hash;       // content hash, computed on first use
+  long hash_state;     // _MO5_HASH_*, media are shared between threads
+  bool modified;       // the machine wrote to the image
+  const uint8_t *ptr;  // image data, data[] or memory attached by the host
+  void (*release)(void *user_data);
+  void *user_data;
+  int32_t *sectors;    // disk images: offset of each [unit][track][sector], -1 if missing
+  // .sap disk images: sectors offsets point to the sector records, sectors
+  // are decoded on first access, by whichever machine (thread) reads first
+  uint8_t *sap_data;   // decoded sectors
+  long *sap_state;     // _MO5_SAP_* per sector
+  uint8_t data[];
+};
+
+// .sap disk images: a header, then records of 4 bytes (format, protection,
+// track, sector), 256 data bytes XORed with 0xB3 and a big endian CRC
+#define _MO5_SAP_UNDECODED (0)
+#define _MO5_SAP_VALID (1)
+#define _MO5_SAP_BAD_CRC (2)
+#define _MO5_SAP_DECODING (3)
+
+// media hash states
+#define _MO5_HASH_NONE (0)
+#define _MO5_HASH_VALID (1)
+#define _MO5_HASH_COMPUTING (2)
+
+// mapped when no cartridge is inserted
+static const uint8_t _mo5_empty_cartridge[MO5_MAX_CARTRIDGE_SIZE];
+
 static uint32_t _mo5_palette[256] = {
     0xFF000000, 0xFF0000F0, 0xFF00F000, 0xFF00F0F0, 0xFFF00000, 0xFFF000F0,
     0xFFF0F000, 0xFFF0F0F0, 0xFF636363, 0xFF6363F0, 0xFF63F063, 0xFF63F0F0,
     0xFFF06300, 0xFFF063F0, 0xFFF0F063, 0xFF0063F0,
 };
 
+// create a media image from a copy of data, padded with zeros to min_size
+static mo5_media_t *_mo5_media_create(gfx_range_t data, size_t min_size) {
+  const size_t size = (data.size > min_size) ? data.size : min_size;
+  mo5_media_t *media = (mo5_media_t *)malloc(sizeof(mo5_media_t) + size);
+  EMU_ASSERT(media);
+  media->refs = 1;
+  media->size = data.size;
+  media->hash = 0;
+  media->hash_state = _MO5_HASH_NONE;
+  media->modified = false;
+  media->ptr = media->data;
+  media->release = 0;
+  media->user_data = 0;
+  media->sectors = 0;
+  media->sap_data = 0;
+  media->sap_state = 0;
+  memcpy(media->data, data.ptr, data.size);
+  memset(media->data + data.size, 0, size - data.size);
+  return media;
+}
+
+// wrap host memory (e.g. a memory mapped file) without copying it
+static mo5_media_t *_mo5_media_attach(const mo5_media_desc_t *desc) {
+  mo5_media_t *media = (mo5_media_t *)calloc(1, sizeof(mo5_media_t));
+  EMU_ASSERT(media);
+  media->refs = 1;
+  media->size = desc->size;
+  media->ptr = (const uint8_t *)desc->ptr;
+  media->release = desc->release;
+  media->user_data = desc->user_data;
+  return media;
+}
+
+static mo5_media_t *_mo5_media_ref(mo5_media_t *media) {
+  if (media) {
+    _MO5_ATOMIC_INC(&media->refs);
+  }
+  return media;
+}
+
+static void _mo5_media_unref(mo5_media_t *media) {
+  if (media && (_MO5_ATOMIC_DEC(&media->refs) == 0)) {
+    if (media->release) {
+      media->release(media->user_data);
+    }
+    free(media->sectors);
+    free(media->sap_data);
+    free(media->sap_state);
+    free(media);
+  }
+}
+
+struct mo5_overlay_t {
+  long refs;
+  uint32_t generation;  // number of sector writes
+  int num;              // number of written sectors
+  int cap;
+  uint16_t slot[MO5_DISK_NUM_SECTORS]; // 1 + index of a written sector, 0 if clean
+  uint16_t *sector;     // per written sector: sector number
+  uint32_t *written;    // per written sector: generation of the last write
+  uint8_t *data;        // per written sector: MO5_DISK_SECTOR_SIZE bytes
+};
+
+mo5_overlay_t *mo5_overlay_create(void) {
+  mo5_overlay_t *overlay = (mo5_overlay_t *)calloc(1, sizeof(mo5_overlay_t));
+  EMU_ASSERT(overlay);
+  overlay->refs = 1;
+  return overlay;
+}
+
+static void _mo5_overlay_reserve(mo5_overlay_t *overlay, int cap) {
+  if (cap <= overlay->cap)
+    return;
+  overlay->sector = (uint16_t *)realloc(overlay->sector, cap * sizeof(uint16_t));
+  overlay->written = (uint32_t *)realloc(overlay->written, cap * sizeof(uint32_t));
+  overlay->data = (uint8_t *)realloc(overlay->data, (size_t)cap * MO5_DISK_SECTOR_SIZE);
+  EMU_ASSERT(overlay->sector && overlay->written && overlay->data);
+  overlay->cap = cap;
+}
+
+static mo5_overlay_t *_mo5_overlay_copy(const mo5_overlay_t *src) {
+  mo5_overlay_t *overlay = mo5_overlay_create();
+  _mo5_overlay_reserve(overlay, src->num);
+  memcpy(overlay->slot, src->slot, sizeof(overlay->slot));
+  memcpy(overlay->sector, src->sector, src->num * sizeof(uint16_t));
+  memcpy(overlay->written, src->written, src->num * sizeof(uint32_t));
+  memcpy(overlay->data, src->data, (size_t)src->num * MO5_DISK_SECTOR_SIZE);
+  overlay->num = src->num;
+  overlay->generation = src->generation;
+  return overlay;
+}
+
+static mo5_overlay_t *_mo5_overlay_ref(mo5_overlay_t *overlay) {
+  if (overlay) {
+    _MO5_ATOMIC_INC(&overlay->refs);
+  }
+  return overlay;
+}
+
+void mo5_overlay_release(mo5_overlay_t *overlay) {
+  if (overlay && (_MO5_ATOMIC_DEC(&overlay->refs) == 0)) {
+    free(overlay->sector);
+    free(overlay->written);
+    free(overlay->data);
+    free(overlay);
+  }
+}
+
+void mo5_overlay_write(mo5_overlay_t *overlay, int sector, const uint8_t *data) {
+  EMU_ASSERT(overlay && data && (sector >= 0) && (sector < MO5_DISK_NUM_SECTORS));
+  EMU_ASSERT(_MO5_ATOMIC_LOAD(&overlay->refs) == 1);
+  int i = overlay->slot[sector] - 1;
+  if (i < 0) {
+    if (overlay->num == overlay->cap) {
+      _mo5_overlay_reserve(overlay, overlay->cap ? overlay->cap * 2 : 16);
+    }
+    i = overlay->num++;
+    overlay->slot[sector] = (uint16_t)(i + 1);
+    overlay->sector[i] = (uint16_t)sector;
+  }
+  overlay->written[i] = ++overlay->generation;
+  memcpy(&overlay->data[(size_t)i * MO5_DISK_SECTOR_SIZE], data, MO5_DISK_SECTOR_SIZE);
+}
+
+const uint8_t *mo5_overlay_read(const mo5_overlay_t *overlay, int sector) {
+  EMU_ASSERT((sector >= 0) && (sector < MO5_DISK_NUM_SECTORS));
+  if (!overlay || (0 == overlay->slot[sector]))
+    return 0;
+  return &overlay->data[(size_t)(overlay->slot[sector] - 1) * MO5_DISK_SECTOR_SIZE];
+}
+
+uint32_t mo5_overlay_generation(const mo5_overlay_t *overlay) {
+  return overlay ? overlay->generation : 0;
+}
+
+int mo5_overlay_num_sectors(const mo5_overlay_t *overlay) {
+  return overlay ? overlay->num : 0;
+}
+
+const uint8_t *mo5_overlay_sector(const mo5_overlay_t *overlay, int index, int *sector, uint32_t *generation) {
+  EMU_ASSERT(overlay && (index >= 0) && (index < overlay->num));
+  if (sector)
+    *sector = overlay->sector[index];
+  if (generation)
+    *generation = overlay->written[index];
+  return &overlay->data[(size_t)index * MO5_DISK_SECTOR_SIZE];
+}
+
+static mo5_page_t *_mo5_page_alloc(void) {
+  mo5_page_t *page = (mo5_page_t *)malloc(sizeof(mo5_page_t));
+  EMU_ASSERT(page);
+  page->refs = 1;
+  _MO5_ATOMIC_INC(&_mo5_num_pages);
+  return page;
+}
+
+static void _mo5_page_unref(mo5_page_t *page) {
+  if (page && (_MO5_ATOMIC_DEC(&page->refs) == 0)) {
+    _MO5_ATOMIC_DEC(&_mo5_num_pages);
+    free(page);
+  }
+}
+
+// dst was just copied from src (fork or snapshot): take a reference to each
+// RAM page, both machines lose write ownership
+static void _mo5_pages_share(mo5_t *dst, mo5_t *src) {
+  for (int i = 0; i < MO5_RAM_PAGES; i++) {
+    EMU_ASSERT(dst->mem.page[i] == src->mem.page[i]);
+    if (dst->mem.page[i]) {
+      _MO5_ATOMIC_INC(&dst->mem.page[i]->refs);
+    }
+    dst->mem.page_flags[i] &= ~MO5_PAGE_PRIVATE;
+    src->mem.page_flags[i] &= ~MO5_PAGE_PRIVATE;
+  }
+}
+
+static void _mo5_pages_unref(mo5_t *mo5) {
+  for (int i = 0; i < MO5_RAM_PAGES; i++) {
+    _mo5_page_unref(mo5->mem.page[i]);
+    mo5->mem.page[i] = 0;
+    mo5->mem.page_flags[i] = 0;
+  }
+}
+
+// slow path of a RAM write: take ownership of a page, copy it if it's still shared
+static void _mo5_page_own(mo5_t *mo5, int index) {
+  mo5_page_t *page = mo5->mem.page[index];
+  if (_MO5_ATOMIC_LOAD(&page->refs) != 1) {
+    mo5_page_t *copy = _mo5_page_alloc();
+    memcpy(copy->data, page->data, MO5_PAGE_SIZE);
+    _mo5_page_unref(page);
+    mo5->mem.page[index] = copy;
+  }
+  mo5->mem.page_flags[index] |= MO5_PAGE_PRIVATE;
+}
+
+static inline uint8_t _mo5_ram_rd(const mo5_t *mo5, uint16_t offset) {
+  return mo5->mem.page[offset >> 12]->data[offset & (MO5_PAGE_SIZE - 1)];
+}
+
+static inline void _mo5_ram_wr(mo5_t *mo5, uint16_t offset, uint8_t value) {
+  const int index = offset >> 12;
+  if (0 == (mo5->mem.page_flags[index] & MO5_PAGE_PRIVATE)) {
+    _mo5_page_own(mo5, index);
+  }
+  mo5->mem.page[index]->data[offset & (MO5_PAGE_SIZE - 1)] = value;
+}
+
+static void _mo5_watch_access(mo5_t *mo5, uint16_t address, uint8_t value, bool write);
+static uint8_t _mo5_patch_rd(const mo5_t *mo5, uint16_t address, uint8_t value);
+
+// RAM accesses of the CPU: pages with a watched or a patched address take the slow path
+static inline uint8_t _mo5_cpu_ram_rd(mo5_t *mo5, uint16_t offset, uint16_t address) {
+  uint8_t value = _mo5_ram_rd(mo5, offset);
+  const uint8_t flags = mo5->mem.page_flags[offset >> 12];
+  if (flags & (MO5_PAGE_WATCHED | MO5_PAGE_PATCHED)) {
+    if (flags & MO5_PAGE_PATCHED) {
+      value = _mo5_patch_rd(mo5, address, value);
+    }
+    if (flags & MO5_PAGE_WATCHED) {
+      _mo5_watch_access(mo5, address, value, false);
+    }
+  }
+  return value;
+}
+
+static inline void _mo5_cpu_ram_wr(mo5_t *mo5, uint16_t offset, uint16_t address, uint8_t value) {
+  const int index = offset >> 12;
+  if (mo5->mem.page_flags[index] != MO5_PAGE_PRIVATE) {
+    if (mo5->mem.page_flags[index] & MO5_PAGE_WATCHED) {
+      _mo5_watch_access(mo5, address, value, true);
+    }
+    if (0 == (mo5->mem.page_flags[index] & MO5_PAGE_PRIVATE)) {
+      _mo5_page_own(mo5, index);
+    }
+  }
+  mo5->mem.page[index]->data[offset & (MO5_PAGE_SIZE - 1)] = value;
+}
+
+// bulk write into RAM at CPU address, one memcpy per page, watched pages
+// are written byte by byte like CPU writes
+static void _mo5_ram_copy(mo5_t *mo5, uint16_t offset, uint16_t address, const uint8_t *src, size_t num) {
+  EMU_ASSERT(((size_t)offset + num) <= MO5_RAM_SIZE);
+  while (num > 0) {
+    const int index = offset >> 12;
+    const size_t at = offset & (MO5_PAGE_SIZE - 1);
+    const size_t n = ((MO5_PAGE_SIZE - at) < num) ? (MO5_PAGE_SIZE - at) : num;
+    if (mo5->mem.page_flags[index] & MO5_PAGE_WATCHED) {
+      for (size_t i = 0; i < n; i++) {
+        _mo5_cpu_ram_wr(mo5, (uint16_t)(offset + i), (uint16_t)(address + i), src[i]);
+      }
+    } else {
+      if (0 == (mo5->mem.page_flags[index] & MO5_PAGE_PRIVATE)) {
+        _mo5_page_own(mo5, index);
+      }
+      memcpy(&mo5->mem.page[index]->data[at], src, n);
+    }
+    offset += (uint16_t)n;
+    address += (uint16_t)n;
+    src += n;
+    num -= n;
+  }
+}
+
+static void _mo5_media_ref_all(mo5_t *mo5) {
+  _mo5_media_ref(mo5->tape.media);
+  _mo5_media_ref(mo5->disk.media);
+  _mo5_media_ref(mo5->cartridge.media);
+  _mo5_overlay_ref(mo5->disk.overlay);
+}
+
+static void _mo5_media_unref_all(mo5_t *mo5) {
+  _mo5_media_unref(mo5->tape.media);
+  _mo5_media_unref(mo5->disk.media);
+  _mo5_media_unref(mo5->cartridge.media);
+  mo5_overlay_release(mo5->disk.overlay);
+}
+
+static void _mo5_set_cartridge(mo5_t *mo5, mo5_media_t *media) {
+  _mo5_media_unref(mo5->cartridge.media);
+  mo5->cartridge.media = media;
+  mo5->mem.cartridge = media ? media->ptr : _mo5_empty_cartridge;
+}
+
+// the whole CPU address space may have changed, see mo5_mem_generation()
+static void _mo5_mem_changed(mo5_t *mo5) {
+  for (int i = 0; i < 16; i++)
+    mo5->mem.gen[i]++;
+}
+
 static inline void _mo5_videoram(mo5_t *mo5) {
-  mo5->mem.video = mo5->mem.ram + ((mo5->mem.port[0] & 1) << 13);
+  const uint16_t video = (mo5->mem.port[0] & 1) << 13;
+  if (video != mo5->mem.video) {
+    mo5->mem.gen[0]++;
+    mo5->mem.gen[1]++;
+  }
+  mo5->mem.video = video;
   mo5->display.border_color = (mo5->mem.port[0] >> 1) & 0x0f;
 }
 
 static void _mo5_rombank(mo5_t *mo5) {
-  if ((mo5->cartridge.flags & 4) == 0) {
-    mo5->mem.rom_bank = (uint8_t *)(mo5rom - 0xc000);
-    return;
+  const uint8_t *rom_bank = mo5rom - 0xc000;
+  if (mo5->cartridge.flags & 4) {
+    rom_bank = mo5->mem.cartridge - 0xb000 + ((mo5->cartridge.flags & 0x03) << 14);
+    if (mo5->cartridge.type == 2)
+      if (mo5->cartridge.flags & 0x10)
+        rom_bank += 0x10000;
+  }
+  if (rom_bank != mo5->mem.rom_bank) {
+    // the cartridge pages 0xb000-0xefff are remapped
+    for (int i = 0xb; i < 0xf; i++)
+      mo5->mem.gen[i]++;
+    mo5->mem.rom_bank = rom_bank;
+  }
+}
+
+// the host changed the machine, the next slice starts a new snapshot
+static void _mo5_history_touch(mo5_t *mo5) {
+  if (mo5->history) {
+    mo5->history->dirty = true;
   }
-  mo5->mem.rom_bank =
-      mo5->mem.cartridge - 0xb000 + ((mo5->cartridge.flags & 0x03) << 14);
-  if (mo5->cartridge.type == 2)
-    if (mo5->cartridge.flags & 0x10)
-      mo5->mem.rom_bank += 0x10000;
 }
 
 // soft reset method ("reinit prog" button on original MO5)
@@ -48,17 +483,18 @@ void mo5_prog_init(mo5_t *mo5) {
   _mo5_rombank(mo5);
 
   m6809_reset(&mo5->cpu);
+  _mo5_history_touch(mo5);
 }
 
 void mo5_reset(mo5_t *mo5) {
   mo5->display.line_cycle = 0;
   mo5->display.line_number = 0;
-  for (size_t i = 0; i < sizeof(mo5->mem.ram); i++)
-    mo5->mem.ram[i] = -((i & 0x80) >> 7);
+  for (uint32_t i = 0; i < MO5_RAM_SIZE; i++)
+    _mo5_ram_wr(mo5, (uint16_t)i, -((i & 0x80) >> 7));
   for (size_t i = 0; i < sizeof(mo5->mem.port); i++)
     mo5->mem.port[i] = 0;
-  for (size_t i = 0; i < sizeof(mo5->mem.cartridge); i++)
-    mo5->mem.cartridge[i] = 0;
+  _mo5_set_cartridge(mo5, 0);
+  _mo5_mem_changed(mo5);
 
   mo5_prog_init(mo5);
 }
@@ -81,11 +517,11 @@ static void _mo5_screen_draw_border(mo5_t *mo5) {
 }
 
 static uint8_t _mo5_video_shape(mo5_t *mo5, int line) {
-  return mo5->mem.ram[0x2000 | line];
+  return _mo5_ram_rd(mo5, 0x2000 | line);
 }
 
 static uint8_t _mo5_video_color(mo5_t *mo5, int line) {
-  return mo5->mem.ram[line];
+  return _mo5_ram_rd(mo5, line);
 }
 
 static void _mo5_screen_draw(mo5_t *mo5) {
@@ -119,13 +555,33 @@ static void _mo5_diskerror(mo5_t *mo5, int n) {
   mo5->cpu.cc |= 0x01;           // indicateur d'erreur
 }
 
+static uint8_t _mo5_tape_byte(mo5_t *sys) {
+  if ((sys->tape.pos < 0) || ((size_t)sys->tape.pos >= sys->tape.size))
+    return 0;
+  return sys->tape.buf[sys->tape.pos];
+}
+
 static void _mo5_read_tape_byte(mo5_t *sys) {
   sys->tape.pos++;
-  sys->cpu.a = sys->tape.buf[sys->tape.pos];
+  sys->cpu.a = _mo5_tape_byte(sys);
   sys->cpu.mputc(0x2045, 0);
   sys->tape.bit = 0;
 }
 
+// Bytes written by muted machines (run-ahead, forks) are dropped, the
+// machine still sees a successful write.
+static void _mo5_write_tape_byte(mo5_t *sys) {
+  if (!sys->audio.muted) {
+    if (!sys->tape.out.func) {
+      _mo5_diskerror(sys, 53);
+      return;
+    }
+    sys->tape.out.func((uint8_t)sys->cpu.a, sys->tape.out.user_data);
+  }
+  sys->cpu.mputc(0x2045, 0);
+  sys->cpu.cc &= ~MC6809E_CF;
+}
+
 static void _mo5_read_tape_bit(mo5_t *sys) {
   // need to read 1 byte ?
   if (sys->tape.bit == 0) {
@@ -135,7 +591,7 @@ static void _mo5_read_tape_bit(mo5_t *sys) {
 
   // need to read 1 byte ?
   uint8_t byte = sys->cpu.mgetc(0x2045) << 1;
-  if ((sys->tape.buf[sys->tape.pos] & sys->tape.bit) == 0) {
+  if ((_mo5_tape_byte(sys) & sys->tape.bit) == 0) {
     sys->cpu.a = 0;
   } else {
     byte |= 0x01;
@@ -147,43 +603,312 @@ static void _mo5_read_tape_bit(mo5_t *sys) {
   sys->tape.bit = sys->tape.bit >> 1;
 }
 
-static void _mo5_read_sector(mo5_t *mo5) {
+// Read a whole tape block in one go when the bit trap is hit by the leader
+// search of the monitor's block read routine. A block is a leader of 0x01
+// bytes, the 0x3C 0x5A sync, the block type, a length byte (counting itself,
+// 0 means 256), the data and a checksum (data + checksum = 0). The block is
+// stored at Y like the routine does (length byte first), the block type and
+// checksum go to the caller's B and A on the stack, then the routine returns.
+// Returns false if no complete block follows, or if the trap came from
+// somewhere else (custom loaders), the caller then reads a single bit.
+static bool _mo5_read_tape_block(mo5_t *sys) {
+  mc6809e_t *cpu = &sys->cpu;
+  const uint16_t ret = (uint16_t)(((uint8_t)cpu->mgetc(cpu->s) << 8) | (uint8_t)cpu->mgetc(cpu->s + 1));
+  if ((ret != _MO5_K7_LEADER_RET) || (0 == sys->tape.buf))
+    return false;
+  const uint8_t *buf = sys->tape.buf;
+  const size_t size = sys->tape.size;
+  // skip what's left of a partially read byte
+  size_t i = (size_t)(sys->tape.pos + 1);
+  if (i >= sys->tape.no_block)
+    return false;
+  const size_t start = i;
+  size_t data = 0;
+  while (i < size) {
+    if (buf[i] != 0x01) {
+      i++;
+      continue;
+    }
+    while ((i < size) && (buf[i] == 0x01))
+      i++;
+    if (((i + 1) < size) && (buf[i] == 0x3c) && (buf[i + 1] == 0x5a)) {
+      data = i + 2;
+      break;
+    }
+  }
+  if ((data == 0) || ((data + 1) >= size)) {
+    // no later search can succeed either, don't scan the tape for every bit
+    sys->tape.no_block = start;
+    return false;
+  }
+  const uint8_t type = buf[data];
+  const uint8_t len = buf[data + 1];
+  const size_t count = (uint8_t)(len - 1);
+  if ((data + 1 + count) >= size) {
+    // the last block is truncated, later searches would find it again
+    sys->tape.no_block = start;
+    return false;
+  }
+  uint16_t y = cpu->y;
+  cpu->mputc(y++, len);
+  // flags as left by the routine: carry and half carry of the last ADDA
+  // (cleared by CLR if there is no data), then DEC <$41 reaching zero
+  uint8_t cc = (uint8_t)(cpu->cc & ~(MC6809E_CF | MC6809E_NF | MC6809E_VF)) | MC6809E_ZF;
+  uint8_t sum = 0;
+  for (size_t k = 0; k < count; k++) {
+    const uint8_t c = buf[data + 2 + k];
+    cpu->mputc(y++, c);
+    cc &= ~(MC6809E_CF | MC6809E_HF);
+    if ((sum + c) > 0xff)
+      cc |= MC6809E_CF;
+    if (((sum & 0xf) + (c & 0xf)) > 0xf)
+      cc |= MC6809E_HF;
+    sum += c;
+  }
+  // routine frame: 3,S=checksum (A) 4,S=block type (B), +2 for our return address
+  cpu->mputc(cpu->s + 5, sum);
+  cpu->mputc(cpu->s + 6, type);
+  cpu->mputc(0x2041, 0);
+  cpu->mputc(0x2045, 0);
+  cpu->a = (int8_t)(count ? sum : len);
+  cpu->b = (int8_t)0xff;
+  cpu->y = y;
+  cpu->cc = cc;
+  sys->tape.pos = (int)(data + 1 + count);
+  sys->tape.bit = 0;
+  // drop the bit routine's return address and continue at the final RTS
+  cpu->s += 2;
+  cpu->pc = _MO5_K7_BLOCK_RTS;
+  return true;
+}
+
+bool mo5_is_sap(const uint8_t *data, size_t size) {
+  static const char signature[] = "SYSTEME D'ARCHIVAGE PUKALL";
+  return (size >= MO5_SAP_HEADER_SIZE) && (data[0] == 1) &&
+         (0 == memcmp(&data[1], signature, sizeof(signature) - 1));
+}
+
+// index the sectors of a disk image, once per image, .sap sectors are
+// found by their record header (one face, unit 0)
+static void _mo5_disk_index(mo5_media_t *media) {
+  if (media->sectors)
+    return;
+  media->sectors = (int32_t *)malloc(MO5_DISK_NUM_SECTORS * sizeof(int32_t));
+  EMU_ASSERT(media->sectors);
+  if (!mo5_is_sap(media->ptr, media->size)) {
+    for (int i = 0; i < MO5_DISK_NUM_SECTORS; i++) {
+      const size_t offset = (size_t)i * MO5_DISK_SECTOR_SIZE;
+      const bool present = (offset + MO5_DISK_SECTOR_SIZE) <= media->size;
+      media->sectors[i] = present ? (int32_t)offset : -1;
+    }
+    return;
+  }
+  for (int i = 0; i < MO5_DISK_NUM_SECTORS; i++)
+    media->sectors[i] = -1;
+  for (size_t offset = MO5_SAP_HEADER_SIZE; (offset + MO5_SAP_RECORD_SIZE) <= media->size; offset += MO5_SAP_RECORD_SIZE) {
+    const int track = media->ptr[offset + 2];
+    const int sector = media->ptr[offset + 3];
+    if ((track < MO5_DISK_TRACKS) && (sector >= 1) && (sector <= MO5_DISK_SECTORS))
+      media->sectors[track * MO5_DISK_SECTORS + sector - 1] = (int32_t)offset;
+  }
+  media->sap_data = (uint8_t *)malloc(MO5_DISK_NUM_SECTORS * MO5_DISK_SECTOR_SIZE);
+  media->sap_state = (long *)calloc(MO5_DISK_NUM_SECTORS, sizeof(long));
+  EMU_ASSERT(media->sap_data && media->sap_state);
+}
+
+static uint16_t _mo5_sap_crc(const uint8_t *header, const uint8_t *data) {
+  static const uint16_t table[16] = {
+    0x0000, 0x1081, 0x2102, 0x3183, 0x4204, 0x5285, 0x6306, 0x7387,
+    0x8408, 0x9489, 0xa50a, 0xb58b, 0xc60c, 0xd68d, 0xe70e, 0xf78f
+  };
+  uint16_t crc = 0xffff;
+  for (int i = 0; i < 4 + MO5_DISK_SECTOR_SIZE; i++) {
+    const uint8_t c = (i < 4) ? header[i] : data[i - 4];
+    crc = (uint16_t)(((crc >> 4) & 0xfff) ^ table[(crc ^ c) & 0xf]);
+    crc = (uint16_t)(((crc >> 4) & 0xfff) ^ table[(crc ^ (c >> 4)) & 0xf]);
+  }
+  return crc;
+}
+
+// decode a .sap sector on first access, null if its CRC is wrong
+static const uint8_t *_mo5_sap_sector(mo5_media_t *media, int sector) {
+  long *state = &media->sap_state[sector];
+  uint8_t *data = &media->sap_data[(size_t)sector * MO5_DISK_SECTOR_SIZE];
+  if (_MO5_ATOMIC_CAS(state, _MO5_SAP_UNDECODED, _MO5_SAP_DECODING)) {
+    const uint8_t *record = &media->ptr[media->sectors[sector]];
+    for (int i = 0; i < MO5_DISK_SECTOR_SIZE; i++)
+      data[i] = record[4 + i] ^ MO5_SAP_XOR;
+    const uint16_t crc = (uint16_t)((record[4 + MO5_DISK_SECTOR_SIZE] << 8) | record[5 + MO5_DISK_SECTOR_SIZE]);
+    _MO5_ATOMIC_STORE(state, (_mo5_sap_crc(record, data) == crc) ? _MO5_SAP_VALID : _MO5_SAP_BAD_CRC);
+  }
+  // another machine may be decoding the same sector right now
+  long s;
+  while ((s = _MO5_ATOMIC_LOAD(state)) == _MO5_SAP_DECODING) {
+  }
+  return (s == _MO5_SAP_VALID) ? data : 0;
+}
+
+// copy a block into the CPU address space, plain RAM destinations
+// are copied in bulk, anything else goes through mo5_mem_write()
+static void _mo5_mem_copy(mo5_t *mo5, uint16_t address, const uint8_t *src, size_t num) {
+  const size_t end = (size_t)address + num;
+  for (size_t page = address >> 12; page <= ((end - 1) >> 12); page++)
+    mo5->mem.gen[page & 0xf]++;
+  if ((address >= 0x2000) && (end <= 0xa000)) {
+    _mo5_ram_copy(mo5, address + 0x2000, address, src, num);
+  } else if (end <= 0x2000) {
+    _mo5_ram_copy(mo5, mo5->mem.video + address, address, src, num);
+  } else {
+    for (size_t i = 0; i < num; i++)
+      mo5_mem_write(mo5, (uint16_t)(address + i), src[i]);
+  }
+}
+
+// number of the sector selected by the DOS variables ($2049 unit,
+// $204A-$204B track, $204C sector), -1 after reporting an error
+static int _mo5_disk_select(mo5_t *mo5) {
   // if(controller == 0) Warning(M_DSK_NOTSELECTED);
   // erreur 71=lecteur non prêt
   if (!mo5->disk.size) {
     _mo5_diskerror(mo5, 71);
-    return;
+    return -1;
   }
-  int u = mo5_mem_read(mo5, 0x2049);
+  int u = (uint8_t)mo5_mem_read(mo5, 0x2049);
   if (u > 03) {
     _mo5_diskerror(mo5, 53);
-    return;
+    return -1;
   }
-  int p = mo5_mem_read(mo5, 0x204a);
+  int p = (uint8_t)mo5_mem_read(mo5, 0x204a);
   if (p != 0) {
     _mo5_diskerror(mo5, 53);
-    return;
+    return -1;
   }
-  p = mo5_mem_read(mo5, 0x204b);
+  p = (uint8_t)mo5_mem_read(mo5, 0x204b);
   if (p > 79) {
     _mo5_diskerror(mo5, 53);
-    return;
+    return -1;
   }
-  int s = mo5_mem_read(mo5, 0x204c);
+  int s = (uint8_t)mo5_mem_read(mo5, 0x204c);
   if ((s == 0) || (s > 16)) {
     _mo5_diskerror(mo5, 53);
+    return -1;
+  }
+  return (u * MO5_DISK_TRACKS + p) * MO5_DISK_SECTORS + s - 1;
+}
+
+// content of a sector, written sectors come from the overlay, null after
+// reporting an error if the sector isn't in the image or its CRC is wrong
+static const uint8_t *_mo5_disk_data(mo5_t *mo5, int sector) {
+  const uint8_t *data = mo5_overlay_read(mo5->disk.overlay, sector);
+  if (data)
+    return data;
+  const int32_t pos = mo5->disk.sectors[sector];
+  if (pos < 0) {
+    _mo5_diskerror(mo5, 53);
+    return 0;
+  }
+  if (!mo5->disk.media->sap_data)
+    return &mo5->disk.buf[pos];
+  data = _mo5_sap_sector(mo5->disk.media, sector);
+  if (!data)
+    _mo5_diskerror(mo5, 53);
+  return data;
+}
+
+// write a sector into the overlay, a shared overlay is copied first
+static void _mo5_disk_write(mo5_t *mo5, int sector, const uint8_t *data) {
+  mo5_overlay_t *overlay = mo5->disk.overlay;
+  if (!overlay) {
+    overlay = mo5_overlay_create();
+  } else if (_MO5_ATOMIC_LOAD(&overlay->refs) != 1) {
+    overlay = _mo5_overlay_copy(overlay);
+    mo5_overlay_release(mo5->disk.overlay);
+  }
+  mo5->disk.overlay = overlay;
+  mo5_overlay_write(overlay, sector, data);
+}
+
+static uint16_t _mo5_disk_buffer(mo5_t *mo5) {
+  return (uint16_t)((mo5_mem_read(mo5, 0x204f) << 8) | (mo5_mem_read(mo5, 0x2050) & 0xff));
+}
+
+static void _mo5_read_sector(mo5_t *mo5) {
+  const int sector = _mo5_disk_select(mo5);
+  if (sector < 0)
+    return;
+  const uint8_t *data = _mo5_disk_data(mo5, sector);
+  if (data)
+    _mo5_mem_copy(mo5, _mo5_disk_buffer(mo5), data, MO5_DISK_SECTOR_SIZE);
+}
+
+// Read B consecutive sectors in one trap, for loaders and patched BIOS code.
+// Starts at the sector selected like for a single read, continues on the
+// next track after sector 16. The sector, track and buffer variables are
+// advanced past the sectors read, on error B holds the number of sectors
+// which were not read.
+static void _mo5_read_sectors(mo5_t *mo5) {
+  int count = (uint8_t)mo5->cpu.b;
+  while (count > 0) {
+    const int sector = _mo5_disk_select(mo5);
+    const uint8_t *data = (sector < 0) ? 0 : _mo5_disk_data(mo5, sector);
+    if (!data)
+      break;
+    const uint16_t address = _mo5_disk_buffer(mo5);
+    _mo5_mem_copy(mo5, address, data, MO5_DISK_SECTOR_SIZE);
+    const uint16_t next = address + MO5_DISK_SECTOR_SIZE;
+    mo5_mem_write(mo5, 0x204f, next >> 8);
+    mo5_mem_write(mo5, 0x2050, next & 0xff);
+    const int s = (uint8_t)mo5_mem_read(mo5, 0x204c);
+    if (s < MO5_DISK_SECTORS) {
+      mo5_mem_write(mo5, 0x204c, s + 1);
+    } else {
+      mo5_mem_write(mo5, 0x204c, 1);
+      mo5_mem_write(mo5, 0x204b, mo5_mem_read(mo5, 0x204b) + 1);
+    }
+    count--;
+  }
+  mo5->cpu.b = (int8_t)count;
+}
+
+// write the buffer to the selected sector, sectors past the end of a
+// short image can be written too
+static void _mo5_write_sector(mo5_t *mo5) {
+  const int sector = _mo5_disk_select(mo5);
+  if (sector < 0)
+    return;
+  uint8_t data[MO5_DISK_SECTOR_SIZE];
+  const uint16_t address = _mo5_disk_buffer(mo5);
+  for (int i = 0; i < MO5_DISK_SECTOR_SIZE; i++)
+    data[i] = (uint8_t)mo5_mem_read(mo5, (uint16_t)(address + i));
+  _mo5_disk_write(mo5, sector, data);
+}
+
+// format the unit selected by $2049: all sectors filled with 0xE5, track 20
+// holds an empty directory and a FAT with all blocks free except the two
+// blocks of track 20
+static void _mo5_format_disk(mo5_t *mo5) {
+  if (!mo5->disk.size) {
+    _mo5_diskerror(mo5, 71);
     return;
   }
-  s += 16 * p + 1280 * u;
-  if ((s << 8) > mo5->disk.size) {
+  const int u = (uint8_t)mo5_mem_read(mo5, 0x2049);
+  if (u > 03) {
     _mo5_diskerror(mo5, 53);
     return;
   }
-  uint16_t address =
-      (mo5_mem_read(mo5, 0x204f) << 8) | (mo5_mem_read(mo5, 0x2050) & 0xff);
-  int pos = (s - 1) << 8;
-  for (int i = 0; i < 256; i++) {
-    mo5_mem_write(mo5, address++, mo5->disk.buf[pos++]);
+  uint8_t empty[MO5_DISK_SECTOR_SIZE];
+  uint8_t directory[MO5_DISK_SECTOR_SIZE];
+  uint8_t fat[MO5_DISK_SECTOR_SIZE];
+  memset(empty, 0xe5, sizeof(empty));
+  memset(directory, 0xff, sizeof(directory));
+  memset(fat, 0xff, sizeof(fat));
+  fat[0] = 0;
+  fat[41] = fat[42] = 0xfe;
+  for (int p = 0; p < MO5_DISK_TRACKS; p++) {
+    for (int s = 0; s < MO5_DISK_SECTORS; s++) {
+      const uint8_t *data = (p != 20) ? empty : ((s == 1) ? fat : directory);
+      _mo5_disk_write(mo5, (u * MO5_DISK_TRACKS + p) * MO5_DISK_SECTORS + s, data);
+    }
   }
 }
 
@@ -217,17 +942,22 @@ static void _mo5_step_special_opcode(mo5_t *mo5, int io) {
     // read qd-fd sector
     _mo5_read_sector(mo5);
     break;
+  case 0x11F6:
+    // read several qd-fd sectors
+    _mo5_read_sectors(mo5);
+    break;
   case 0x15:
     // write qd-fd sector
-    _mo5_diskerror(mo5, 53);
+    _mo5_write_sector(mo5);
     break;
   case 0x18:
     // qd-fd format
-    _mo5_diskerror(mo5, 53);
+    _mo5_format_disk(mo5);
     break;
   case 0x41:
   case 0x11EC:
-    _mo5_read_tape_bit(mo5);
+    if (!(mo5->tape.fast && _mo5_read_tape_block(mo5)))
+      _mo5_read_tape_bit(mo5);
     break;
   case 0x42:
   case 0x11F1: // read tape byte (6809)
@@ -239,7 +969,7 @@ static void _mo5_step_special_opcode(mo5_t *mo5, int io) {
     break;
   case 0x45:
     // write tape byte
-    _mo5_diskerror(mo5, 53);
+    _mo5_write_tape_byte(mo5);
     break;
   case 0x4B:
   case 0x11FF:
@@ -256,14 +986,14 @@ static void _mo5_step_special_opcode(mo5_t *mo5, int io) {
   }
 }
 
-inline static int _mo5_mem_initLn(mo5_t *mo5) {
+inline static int _mo5_mem_initLn(const mo5_t *mo5) {
   // 11 microsecondes - 41 microsecondes - 12 microsecondes
   if (mo5->display.line_cycle < 23)
     return 0;
   return 0x20;
 }
 
-static int _mo5_mem_initN(mo5_t *mo5) {
+static int _mo5_mem_initN(const mo5_t *mo5) {
   // debut à 12 microsecondes ligne 56, fin
   // à 51 microsecondes ligne 255
   if (mo5->display.line_number < 56)
@@ -286,12 +1016,535 @@ static void _mo5_switch_memo5_bank(mo5_t *mo5, uint16_t address) {
   _mo5_rombank(mo5);
 }
 
-static void _mo5_step_n(mo5_t *mo5, uint32_t clock) {
+static void _mo5_breakpoints_update(mo5_breakpoints_t *bps) {
+  memset(bps->pc_bits, 0, sizeof(bps->pc_bits));
+  bps->num_enabled = 0;
+  for (int i = 0; i < bps->num; i++) {
+    if (bps->bp[i].enabled) {
+      bps->pc_bits[bps->bp[i].pc >> 5] |= 1u << (bps->bp[i].pc & 31);
+      bps->num_enabled++;
+    }
+  }
+}
+
+// keyboard bit of the port 0xa7c1: 0 if the key selected by the port is pressed
+static uint8_t _mo5_key_bit(const mo5_t *mo5, uint8_t key) {
+  const uint8_t line = (key >> 4) & 0x0F;
+  const uint8_t col = (key & 0x0F) >> 1;
+  return (mo5->kbd.scanout_column_masks[line] & (1 << col)) ? 0 : 0x80;
+}
+
+// page 0xaxxx: controller ROM and I/O registers, reads have no side effects
+// except the keyboard scan counting of mo5_mem_read()
+static uint8_t _mo5_io_read(const mo5_t *mo5, uint16_t address) {
+  switch (address) {
+  case 0xa7c0:
+    return mo5->mem.port[0] | _MO5_TAPE_DRIVE_CONNECTED | (mo5->input.penbutton << 5);
+  case 0xa7c1:
+    return (int8_t)(mo5->mem.port[1] | _mo5_key_bit(mo5, mo5->mem.port[1] & 0xfe));
+  case 0xa7c2:
+    return (int8_t)mo5->mem.port[2];
+  case 0xa7c3:
+    return (int8_t)(mo5->mem.port[3] | ~_mo5_mem_initN(mo5));
+  case 0xa7cb:
+    return (mo5->cartridge.flags & 0x3f) |
+           ((mo5->cartridge.flags & 0x80) >> 1) |
+           ((mo5->cartridge.flags & 0x40) << 1);
+  case 0xa7cc:
+    return (int8_t)((mo5->mem.port[0x0e] & 4) ? mo5->input.joys_position.value
+                                              : mo5->mem.port[0x0c]);
+  case 0xa7cd:
+    return (int8_t)((mo5->mem.port[0x0f] & 4)
+                        ? mo5->input.joy_action | mo5->mem.sound
+                        : mo5->mem.port[0x0d]);
+  case 0xa7ce:
+    return 4;
+  case 0xa7d8:
+    return ~_mo5_mem_initN(mo5); // disk state byte
+  case 0xa7e1:
+    return (int8_t)0xff; // printer error number 53 occurs when set to 0
+  case 0xa7e6:
+    return _mo5_mem_initLn(mo5) << 1;
+  case 0xa7e7:
+    return _mo5_mem_initN(mo5);
+  default:
+    if (address < 0xa7c0)
+      return (int8_t)(cd90640rom[address & 0x7ff]);
+    if (address < 0xa800)
+      return (int8_t)(mo5->mem.port[address & 0x3f]);
+    return 0;
+  }
+}
+
+// read memory without side effects (keyboard scans, bank switching, watchpoints)
+static uint8_t _mo5_peek(const mo5_t *mo5, uint16_t address) {
+  if (address < 0x2000) {
+    return _mo5_ram_rd(mo5, mo5->mem.video + address);
+  } else if (address < 0xa000) {
+    return _mo5_ram_rd(mo5, address + 0x2000);
+  } else if (address < 0xb000) {
+    return _mo5_io_read(mo5, address);
+  } else if ((address < 0xc000) && (0 == (mo5->cartridge.flags & 4))) {
+    // no cartridge mapped
+    return 0;
+  } else if (address < 0xf000) {
+    return mo5->mem.rom_bank[address];
+  }
+  return mo5rom[address - 0xc000];
+}
+
+// the byte at address in RAM or ROM, the rest of its 4KB page follows, null
+// for I/O registers and an unmapped cartridge
+static const uint8_t *_mo5_peek_ptr(const mo5_t *mo5, uint16_t address) {
+  if (address < 0x2000) {
+    return &mo5->mem.page[(mo5->mem.video + address) >> 12]->data[address & (MO5_PAGE_SIZE - 1)];
+  } else if (address < 0xa000) {
+    return &mo5->mem.page[(address + 0x2000) >> 12]->data[address & (MO5_PAGE_SIZE - 1)];
+  } else if (address >= 0xf000) {
+    return &mo5rom[address - 0xc000];
+  } else if ((address >= 0xc000) || ((address >= 0xb000) && (mo5->cartridge.flags & 4))) {
+    return &mo5->mem.rom_bank[address];
+  }
+  return 0;
+}
+
+// arithmetic of conditions wraps around on overflow, without undefined behavior
+#define _MO5_EXPR_WRAP(a, op, b) ((int32_t)(uint32_t)((int64_t)(a) op (int64_t)(b)))
+
+// condition of a breakpoint, an empty expression is true
+static bool _mo5_expr_eval(const mo5_t *mo5, const mo5_expr_t *expr) {
+  if (expr->num == 0) {
+    return true;
+  }
+  int32_t stack[MO5EXPR_MAX_DEPTH];
+  int sp = -1;
+  const uint16_t *code = expr->code;
+  const uint16_t *end = code + expr->num;
+  while (code < end) {
+    switch (*code++) {
+    case MO5EXPR_PUSH: stack[++sp] = *code++; break;
+    case MO5EXPR_REG_A: stack[++sp] = (uint8_t)mo5->cpu.a; break;
+    case MO5EXPR_REG_B: stack[++sp] = (uint8_t)mo5->cpu.b; break;
+    case MO5EXPR_REG_D: stack[++sp] = mo5->cpu.d; break;
+    case MO5EXPR_REG_X: stack[++sp] = mo5->cpu.x; break;
+    case MO5EXPR_REG_Y: stack[++sp] = mo5->cpu.y; break;
+    case MO5EXPR_REG_U: stack[++sp] = mo5->cpu.u; break;
+    case MO5EXPR_REG_S: stack[++sp] = mo5->cpu.s; break;
+    case MO5EXPR_REG_PC: stack[++sp] = mo5->cpu.pc; break;
+    case MO5EXPR_REG_CC: stack[++sp] = mo5->cpu.cc; break;
+    case MO5EXPR_REG_DP: stack[++sp] = (uint8_t)mo5->cpu.dp; break;
+    case MO5EXPR_LINE_NUMBER: stack[++sp] = mo5->display.line_number; break;
+    case MO5EXPR_LINE_CYCLE: stack[++sp] = mo5->display.line_cycle; break;
+    case MO5EXPR_PEEK: stack[sp] = _mo5_peek(mo5, (uint16_t)stack[sp]); break;
+    case MO5EXPR_PEEK_K: stack[++sp] = _mo5_peek(mo5, *code++); break;
+    case MO5EXPR_NOT: stack[sp] = !stack[sp]; break;
+    case MO5EXPR_COMPL: stack[sp] = ~stack[sp]; break;
+    case MO5EXPR_NEG: stack[sp] = _MO5_EXPR_WRAP(0, -, stack[sp]); break;
+    case MO5EXPR_BOOL: stack[sp] = stack[sp] != 0; break;
+    case MO5EXPR_AND_ELSE:
+      if (stack[sp] == 0) {
+        code = expr->code + *code;
+      } else {
+        sp--;
+        code++;
+      }
+      break;
+    case MO5EXPR_OR_ELSE:
+      if (stack[sp] != 0) {
+        stack[sp] = 1;
+        code = expr->code + *code;
+      } else {
+        sp--;
+        code++;
+      }
+      break;
+    case MO5EXPR_BIT_OR: sp--; stack[sp] |= stack[sp + 1]; break;
+    case MO5EXPR_BIT_XOR: sp--; stack[sp] ^= stack[sp + 1]; break;
+    case MO5EXPR_BIT_AND: sp--; stack[sp] &= stack[sp + 1]; break;
+    case MO5EXPR_EQ: sp--; stack[sp] = stack[sp] == stack[sp + 1]; break;
+    case MO5EXPR_NE: sp--; stack[sp] = stack[sp] != stack[sp + 1]; break;
+    case MO5EXPR_LT: sp--; stack[sp] = stack[sp] < stack[sp + 1]; break;
+    case MO5EXPR_LE: sp--; stack[sp] = stack[sp] <= stack[sp + 1]; break;
+    case MO5EXPR_GT: sp--; stack[sp] = stack[sp] > stack[sp + 1]; break;
+    case MO5EXPR_GE: sp--; stack[sp] = stack[sp] >= stack[sp + 1]; break;
+    case MO5EXPR_ADD: sp--; stack[sp] = _MO5_EXPR_WRAP(stack[sp], +, stack[sp + 1]); break;
+    case MO5EXPR_SUB: sp--; stack[sp] = _MO5_EXPR_WRAP(stack[sp], -, stack[sp + 1]); break;
+    case MO5EXPR_MUL: sp--; stack[sp] = _MO5_EXPR_WRAP(stack[sp], *, stack[sp + 1]); break;
+    case MO5EXPR_DIV: sp--; stack[sp] = stack[sp + 1] ? _MO5_EXPR_WRAP(stack[sp], /, stack[sp + 1]) : 0; break;
+    case MO5EXPR_MOD: sp--; stack[sp] = stack[sp + 1] ? _MO5_EXPR_WRAP(stack[sp], %, stack[sp + 1]) : 0; break;
+    case MO5EXPR_BIT_OR_K: stack[sp] |= *code++; break;
+    case MO5EXPR_BIT_XOR_K: stack[sp] ^= *code++; break;
+    case MO5EXPR_BIT_AND_K: stack[sp] &= *code++; break;
+    case MO5EXPR_EQ_K: stack[sp] = stack[sp] == *code++; break;
+    case MO5EXPR_NE_K: stack[sp] = stack[sp] != *code++; break;
+    case MO5EXPR_LT_K: stack[sp] = stack[sp] < *code++; break;
+    case MO5EXPR_LE_K: stack[sp] = stack[sp] <= *code++; break;
+    case MO5EXPR_GT_K: stack[sp] = stack[sp] > *code++; break;
+    case MO5EXPR_GE_K: stack[sp] = stack[sp] >= *code++; break;
+    case MO5EXPR_ADD_K: stack[sp] = _MO5_EXPR_WRAP(stack[sp], +, *code++); break;
+    case MO5EXPR_SUB_K: stack[sp] = _MO5_EXPR_WRAP(stack[sp], -, *code++); break;
+    case MO5EXPR_MUL_K: stack[sp] = _MO5_EXPR_WRAP(stack[sp], *, *code++); break;
+    case MO5EXPR_DIV_K: stack[sp] = *code ? stack[sp] / *code : 0; code++; break;
+    case MO5EXPR_MOD_K: stack[sp] = *code ? stack[sp] % *code : 0; code++; break;
+    default: EMU_ASSERT(false); return true;
+    }
+  }
+  EMU_ASSERT(sp == 0);
+  return stack[0] != 0;
+}
+
+// the instruction at pc leaves a subroutine or an interrupt handler
+static bool _mo5_is_return(mo5_t *mo5, uint16_t pc) {
+  const uint8_t op = _mo5_peek(mo5, pc);
+  if (op == 0x35) {
+    // PULS with PC
+    return 0 != (_mo5_peek(mo5, (uint16_t)(pc + 1)) & 0x80);
+  }
+  return (op == 0x39) || (op == 0x3b); // RTS, RTI
+}
+
+// the debug loop stops before the instruction at pc, temporary breakpoints are removed
+static void _mo5_break(mo5_breakpoints_t *bps) {
+  bps->hit = true;
+  bps->resume = true;
+  bps->step = false;
+  bps->step_out = false;
+  bps->returning = false;
+  if (!bps->watch_stop) {
+    bps->watch_hit.index = -1;
+  }
+  bps->watch_stop = false;
+  int num = 0;
+  for (int i = 0; i < bps->num; i++) {
+    if (!bps->bp[i].temporary) {
+      bps->bp[num++] = bps->bp[i];
+    }
+  }
+  if (num != bps->num) {
+    bps->num = num;
+    _mo5_breakpoints_update(bps);
+  }
+}
+
+// debug loop of a replay: stop at the target cycle, breakpoints and
+// watchpoints are neither counted nor stopping, their last hit is noted
+static bool _mo5_replay_stop(mo5_t *mo5, mo5_breakpoints_t *bps, uint64_t cycle) {
+  if (cycle >= bps->replay_to) {
+    bps->replay = false;
+    bps->watch_stop = false;
+    return true;
+  }
+  const uint16_t pc = mo5->cpu.pc;
+  bool hit = bps->watch_stop;
+  bps->watch_stop = false;
+  if (bps->pc_bits[pc >> 5] & (1u << (pc & 31))) {
+    for (int i = 0; i < bps->num; i++) {
+      const mo5_breakpoint_t *bp = &bps->bp[i];
+      if (bp->enabled && !bp->temporary && (bp->pc == pc) && _mo5_expr_eval(mo5, &bp->cond)) {
+        hit = true;
+      }
+    }
+  }
+  if (hit) {
+    bps->replay_found = true;
+    bps->replay_hit = cycle;
+  }
+  bps->op_pc = pc;
+  bps->op_cycle = cycle;
+  return false;
+}
+
+// debug loop: called before each instruction (c cycles into the slice), true
+// to stop before it
+static bool _mo5_debug_stop(mo5_t *mo5, uint32_t c) {
+  const uint16_t pc = mo5->cpu.pc;
+  if (pc == mo5->watch.pc) {
+    mo5->watch.reached = true;
+  }
+  mo5_breakpoints_t *bps = mo5->breakpoints;
+  if (!bps) {
+    return false;
+  }
+  if (bps->replay) {
+    return _mo5_replay_stop(mo5, bps, mo5->cycles + c);
+  }
+  if (bps->resume) {
+    // the instruction the machine stopped at, it was counted already
+    bps->resume = false;
+  } else {
+    bool stop = bps->step || bps->watch_stop || (bps->returning && (mo5->cpu.s > bps->out_s));
+    if (bps->pc_bits[pc >> 5] & (1u << (pc & 31))) {
+      for (int i = 0; i < bps->num; i++) {
+        mo5_breakpoint_t *bp = &bps->bp[i];
+        if (bp->enabled && (bp->pc == pc) && _mo5_expr_eval(mo5, &bp->cond)) {
+          bp->hits++;
+          stop |= (bp->break_hits == 0) || (bp->hits == bp->break_hits);
+        }
+      }
+    }
+    if (stop) {
+      _mo5_break(bps);
+      return true;
+    }
+  }
+  if (bps->step_out) {
+    bps->returning = _mo5_is_return(mo5, pc);
+  }
+  bps->op_pc = pc;
+  bps->op_cycle = mo5->cycles + c;
+  return false;
+}
+
+static bool _mo5_watch_match(const mo5_watchpoint_t *wp, uint8_t value) {
+  value &= wp->mask;
+  switch (wp->cond) {
+  case MO5_WATCH_EQUAL:
+    return value == wp->value;
+  case MO5_WATCH_NOT_EQUAL:
+    return value != wp->value;
+  case MO5_WATCH_GREATER:
+    return value > wp->value;
+  case MO5_WATCH_LESS:
+    return value < wp->value;
+  default:
+    return true;
+  }
+}
+
+// slow path of an access to a watched page, the first hit of an instruction
+// stops the debug loop before the next one
+static void _mo5_watch_access(mo5_t *mo5, uint16_t address, uint8_t value, bool write) {
+  mo5_breakpoints_t *bps = mo5->breakpoints;
+  if (!bps || !bps->running) {
+    return;
+  }
+  const uint8_t access = write ? MO5_WATCH_WRITE : MO5_WATCH_READ;
+  for (int i = 0; i < bps->num_wp; i++) {
+    mo5_watchpoint_t *wp = &bps->wp[i];
+    if (wp->enabled && (wp->address == address) && (wp->access & access) && _mo5_watch_match(wp, value)) {
+      if (bps->replay) {
+        bps->watch_stop = true;
+        break;
+      }
+      wp->hits++;
+      if (!bps->watch_stop) {
+        bps->watch_stop = true;
+        bps->watch_hit = (mo5_watch_hit_t){
+            .index = i,
+            .pc = bps->op_pc,
+            .address = address,
+            .value = value,
+            .write = write,
+            .cycle = bps->op_cycle,
+        };
+      }
+    }
+  }
+}
+
+// flag the RAM pages holding an address (both video banks for 0x0000..0x1fff)
+static void _mo5_flag_address(mo5_t *mo5, uint16_t address, uint8_t flag) {
+  if (address < 0x2000) {
+    mo5->mem.page_flags[address >> 12] |= flag;
+  }
+  mo5->mem.page_flags[(address + 0x2000) >> 12] |= flag;
+}
+
+// flag the RAM pages holding a watched address or a patched one
+static void _mo5_flag_pages(mo5_t *mo5) {
+  for (int i = 0; i < MO5_RAM_PAGES; i++) {
+    mo5->mem.page_flags[i] &= ~(MO5_PAGE_WATCHED | MO5_PAGE_PATCHED);
+  }
+  const mo5_breakpoints_t *bps = mo5->breakpoints;
+  for (int i = 0; bps && (i < bps->num_wp); i++) {
+    if (bps->wp[i].enabled) {
+      _mo5_flag_address(mo5, bps->wp[i].address, MO5_PAGE_WATCHED);
+    }
+  }
+  const mo5_cheats_t *cheats = mo5->cheats;
+  for (int i = 0; cheats && (i < cheats->num_patches); i++) {
+    _mo5_flag_address(mo5, cheats->patch[i].address, MO5_PAGE_PATCHED);
+  }
+}
+
+static void _mo5_cheats_unref(mo5_cheats_t *cheats) {
+  if (cheats && (_MO5_ATOMIC_DEC(&cheats->refs) == 0)) {
+    free(cheats->cheat);
+    free(cheats->patch);
+    free(cheats->freeze);
+    free(cheats);
+  }
+}
+
+// cheat table the machine may change: created on first use, copied if it's
+// shared with a fork
+static mo5_cheats_t *_mo5_cheats_own(mo5_t *mo5) {
+  mo5_cheats_t *cheats = mo5->cheats;
+  if (cheats && (_MO5_ATOMIC_LOAD(&cheats->refs) == 1)) {
+    return cheats;
+  }
+  mo5_cheats_t *copy = (mo5_cheats_t *)calloc(1, sizeof(mo5_cheats_t));
+  EMU_ASSERT(copy);
+  copy->refs = 1;
+  if (cheats) {
+    copy->num = copy->cap = cheats->num;
+    copy->cheat = (mo5_cheat_t *)malloc((size_t)cheats->num * sizeof(mo5_cheat_t) + 1);
+    copy->patch = (_mo5_patch_t *)malloc((size_t)cheats->num * 2 * sizeof(_mo5_patch_t) + 1);
+    copy->freeze = (_mo5_patch_t *)malloc((size_t)cheats->num * 2 * sizeof(_mo5_patch_t) + 1);
+    EMU_ASSERT(copy->cheat && copy->patch && copy->freeze);
+    memcpy(copy->cheat, cheats->cheat, (size_t)cheats->num * sizeof(mo5_cheat_t));
+    memcpy(copy->patch, cheats->patch, (size_t)cheats->num_patches * sizeof(_mo5_patch_t));
+    memcpy(copy->freeze, cheats->freeze, (size_t)cheats->num_freezes * sizeof(_mo5_patch_t));
+    copy->num_patches = cheats->num_patches;
+    copy->num_freezes = cheats->num_freezes;
+    _mo5_cheats_unref(cheats);
+  }
+  mo5->cheats = copy;
+  return copy;
+}
+
+// index of the first patch at or after address
+static int _mo5_patch_search(const mo5_cheats_t *cheats, uint16_t address) {
+  int lo = 0;
+  int hi = cheats->num_patches;
+  while (lo < hi) {
+    const int mid = (lo + hi) / 2;
+    if (cheats->patch[mid].address < address) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static void _mo5_patch_insert(mo5_cheats_t *cheats, uint16_t address, uint8_t value) {
+  const int i = _mo5_patch_search(cheats, address);
+  if ((i == cheats->num_patches) || (cheats->patch[i].address != address)) {
+    memmove(&cheats->patch[i + 1], &cheats->patch[i], (size_t)(cheats->num_patches - i) * sizeof(_mo5_patch_t));
+    cheats->num_patches++;
+  }
+  cheats->patch[i] = (_mo5_patch_t){ .address = address, .value = value };
+}
+
+// rebuild the forced bytes of the enabled cheats, and the page flags
+static void _mo5_cheats_update(mo5_t *mo5) {
+  mo5_cheats_t *cheats = mo5->cheats;
+  cheats->num_patches = 0;
+  cheats->num_freezes = 0;
+  for (int i = 0; i < cheats->num; i++) {
+    const mo5_cheat_t *cheat = &cheats->cheat[i];
+    if (!cheat->enabled) {
+      continue;
+    }
+    const int num_bytes = cheat->two_bytes ? 2 : 1;
+    for (int j = 0; j < num_bytes; j++) {
+      const uint16_t address = (uint16_t)(cheat->address + j);
+      const uint8_t value = (uint8_t)(cheat->value >> (8 * (num_bytes - 1 - j)));
+      if (cheat->mode == MO5_CHEAT_PATCH) {
+        _mo5_patch_insert(cheats, address, value);
+      } else {
+        cheats->freeze[cheats->num_freezes++] = (_mo5_patch_t){ .address = address, .value = value };
+      }
+    }
+  }
+  _mo5_flag_pages(mo5);
+  _mo5_history_touch(mo5);
+}
+
+// slow path of a CPU read in a patched page
+static uint8_t _mo5_patch_rd(const mo5_t *mo5, uint16_t address, uint8_t value) {
+  const mo5_cheats_t *cheats = mo5->cheats;
+  if (cheats) {
+    const int i = _mo5_patch_search(cheats, address);
+    if ((i < cheats->num_patches) && (cheats->patch[i].address == address)) {
+      return cheats->patch[i].value;
+    }
+  }
+  return value;
+}
+
+// vertical blank: write the frozen bytes, unchanged ones are left alone so
+// pages shared with forks aren't copied for nothing
+static void _mo5_cheats_freeze(mo5_t *mo5) {
+  const mo5_cheats_t *cheats = mo5->cheats;
+  for (int i = 0; i < cheats->num_freezes; i++) {
+    const uint16_t address = cheats->freeze[i].address;
+    const uint16_t offset = (uint16_t)(address + ((address < 0x2000) ? mo5->mem.video : 0x2000));
+    if (_mo5_ram_rd(mo5, offset) != cheats->freeze[i].value) {
+      _mo5_ram_wr(mo5, offset, cheats->freeze[i].value);
+      mo5->mem.gen[address >> 12]++;
+    }
+  }
+}
+
+// the 5 bytes from pc on, read in place unless they cross a page (then
+// copied into bytes)
+static const uint8_t *_mo5_op_bytes(const mo5_t *mo5, uint8_t *bytes) {
+  const uint16_t pc = mo5->cpu.pc;
+  const uint8_t *src = _mo5_peek_ptr(mo5, pc);
+  if (!src || ((pc & 0xfff) > (0x1000 - 5))) {
+    mo5_mem_peek_range(mo5, pc, bytes, 5);
+    src = bytes;
+  }
+  return src;
+}
+
+#if MO5_TRACE
+// record the instruction at pc
+static void _mo5_trace(const mo5_t *mo5, uint64_t cycle) {
+  uint8_t bytes[5];
+  mo5trace_record(mo5->trace, &mo5->cpu, _mo5_op_bytes(mo5, bytes), cycle);
+}
+#endif
+
+// coverage: mark the bytes of the instruction at pc
+static void _mo5_cover(mo5_t *mo5, uint64_t cycle) {
+  uint8_t bytes[5];
+  mo5cover_op(mo5->coverage, mo5->cpu.pc, _mo5_op_bytes(mo5, bytes), cycle);
+}
+
+// CPU callbacks of the debug loop while coverage is counted
+static int8_t _mo5_cover_mgetc(uint16_t address) {
+  mo5_coverage_t *cover = _mo5_cur->coverage;
+  mo5cover_access(cover, address, false);
+  return cover->mgetc(address);
+}
+
+static void _mo5_cover_mputc(uint16_t address, uint8_t value) {
+  mo5_coverage_t *cover = _mo5_cur->coverage;
+  mo5cover_access(cover, address, true);
+  cover->mputc(address, value);
+}
+
+// true while the debug loop has something to check
+static bool _mo5_debug_armed(const mo5_t *mo5) {
+  const mo5_breakpoints_t *bps = mo5->breakpoints;
+  return (mo5->watch.pc >= 0) || mo5trace_recording(mo5->trace) || mo5->coverage ||
+         (bps && ((bps->num_enabled > 0) || (bps->num_wp > 0) || bps->step || bps->step_out));
+}
+
+// CPU loop, compiled twice: without any check, and with the breakpoint
+// checks for debug runs (see _mo5_step_n and _mo5_step_n_debug)
+static _MO5_FORCE_INLINE void _mo5_run(mo5_t *mo5, uint32_t clock, const bool debug) {
   if (clock != 1) {
     clock -= mo5->clock_excess;
   }
   uint32_t c = 0;
   while (c < clock) {
+    if (debug && _mo5_debug_stop(mo5, c)) {
+      // the rest of the slice is dropped, the machine waits at pc
+      clock = c;
+      break;
+    }
+#if MO5_TRACE
+    if (debug && mo5->trace) {
+      _mo5_trace(mo5, mo5->cycles + c);
+    }
+#endif
+    if (debug && mo5->coverage) {
+      _mo5_cover(mo5, mo5->cycles + c);
+    }
     int result = m6809_run_op(&mo5->cpu);
     if (result < 0) {
       _mo5_step_special_opcode(mo5, -result);
@@ -308,7 +1561,7 @@ static void _mo5_step_n(mo5_t *mo5, uint32_t clock) {
       mo5->audio.buffer[mo5->audio.sample] = (float)mo5->mem.sound / 255.f;
       mo5->audio.sample = (mo5->audio.sample + 1) % n_samples;
       // when buffer is full, send audio buffer to sound card
-      if (mo5->audio.sample == 0) {
+      if ((mo5->audio.sample == 0) && !mo5->audio.muted) {
         mo5->audio.callback.func(mo5->audio.buffer, n_samples, &mo5);
       }
       mo5->clocks -= 45;
@@ -324,9 +1577,117 @@ static void _mo5_step_n(mo5_t *mo5, uint32_t clock) {
     if (mo5->display.line_number < 312)
       continue;
     mo5->display.line_number -= 312;
+    if (mo5->cheats) {
+      _mo5_cheats_freeze(mo5);
+    }
     m6809_irq(&mo5->cpu);
   }
   mo5->clock_excess = c - clock;
+  mo5->cycles += c;
+}
+
+static void _mo5_step_n(mo5_t *mo5, uint32_t clock) {
+  _mo5_run(mo5, clock, false);
+}
+
+static void _mo5_step_n_debug(mo5_t *mo5, uint32_t clock) {
+  if (mo5->breakpoints) {
+    mo5->breakpoints->running = true;
+  }
+  mo5_coverage_t *cover = mo5->coverage;
+  if (cover) {
+    // the wrappers only live for the run, snapshots and states keep the
+    // machine's callbacks
+    _mo5_cur = mo5;
+    cover->mgetc = mo5->cpu.mgetc;
+    cover->mputc = mo5->cpu.mputc;
+    mo5->cpu.mgetc = _mo5_cover_mgetc;
+    mo5->cpu.mputc = _mo5_cover_mputc;
+  }
+  _mo5_run(mo5, clock, true);
+  if (cover) {
+    mo5->cpu.mgetc = cover->mgetc;
+    mo5->cpu.mputc = cover->mputc;
+  }
+  if (mo5->breakpoints) {
+    mo5->breakpoints->running = false;
+  }
+}
+
+static mo5_t *_mo5_history_state(mo5_history_t *history, int index) {
+  return &history->state[(history->first + index) % history->cap];
+}
+
+// newest snapshot before cycle, -1 if there is none
+static int _mo5_history_find(mo5_history_t *history, uint64_t cycle) {
+  int index = history->num - 1;
+  while ((index >= 0) && (_mo5_history_state(history, index)->cycles >= cycle)) {
+    index--;
+  }
+  return index;
+}
+
+static void _mo5_history_destroy(mo5_history_t *history) {
+  if (history) {
+    for (int i = 0; i < history->cap; i++) {
+      mo5_discard(&history->state[i]);
+    }
+    free(history->state);
+    free(history);
+  }
+}
+
+// after a slice: keep the host inputs to spot their changes
+static void _mo5_history_leave(mo5_t *mo5) {
+  mo5_history_t *history = mo5->history;
+  memcpy(&history->cpu, &mo5->cpu, sizeof(history->cpu));
+  memcpy(&history->kbd, &mo5->kbd, sizeof(history->kbd));
+  memcpy(history->input, &mo5->input, sizeof(history->input));
+  history->dirty = false;
+}
+
+// before a slice: drop the snapshots after the current cycle (the machine
+// went back), take a snapshot if the host changed the machine since the
+// last slice or if the newest one is an interval old
+static void _mo5_history_enter(mo5_t *mo5) {
+  mo5_history_t *history = mo5->history;
+  while ((history->num > 0) && (_mo5_history_state(history, history->num - 1)->cycles > mo5->cycles)) {
+    mo5_discard(_mo5_history_state(history, --history->num));
+  }
+  // the keyboard clock runs between slices, only the keys matter
+  history->kbd.cur_time = mo5->kbd.cur_time;
+  const bool changed = history->dirty ||
+                       (0 != memcmp(&history->cpu, &mo5->cpu, sizeof(history->cpu))) ||
+                       (0 != memcmp(&history->kbd, &mo5->kbd, sizeof(history->kbd))) ||
+                       (0 != memcmp(history->input, &mo5->input, sizeof(history->input)));
+  mo5_t *state = (history->num > 0) ? _mo5_history_state(history, history->num - 1) : 0;
+  if (state && !changed && ((mo5->cycles - state->cycles) < MO5_HISTORY_INTERVAL)) {
+    return;
+  }
+  if (!state || (state->cycles != mo5->cycles)) {
+    if (history->num < history->cap) {
+      state = _mo5_history_state(history, history->num++);
+    } else {
+      // the oldest snapshot makes room
+      state = &history->state[history->first];
+      history->first = (history->first + 1) % history->cap;
+    }
+  }
+  mo5_save_snapshot(mo5, state);
+}
+
+static void _mo5_slice(mo5_t *mo5, uint32_t num_ticks, bool armed) {
+  if (mo5->history) {
+    _mo5_history_enter(mo5);
+  }
+  if (armed) {
+    _mo5_step_n_debug(mo5, num_ticks);
+  } else {
+    _mo5_step_n(mo5, num_ticks);
+  }
+  if (mo5->history) {
+    _mo5_history_leave(mo5);
+  }
 }
 
 // keyboard matrix initialization
@@ -406,27 +1767,83 @@ void _mo5_audio_callback_snapshot_onload(chips_audio_callback_t* snapshot, chips
 
 void mo5_init(mo5_t *mo5, const mo5_desc_t *desc) {
   mo5->debug = desc->debug;
+  mo5->display.screen = (uint8_t *)calloc(1, SCREEN_WIDTH * SCREEN_HEIGHT);
+  mo5->tape.media = mo5->disk.media = mo5->cartridge.media = 0;
+  mo5->tape.buf = mo5->disk.buf = 0;
+  mo5->tape.size = mo5->disk.size = 0;
+  mo5->disk.sectors = 0;
+  mo5->disk.overlay = 0;
+  mo5->watch.pc = -1;
+  mo5->watch.reached = false;
+  mo5->breakpoints = 0;
+  mo5->cheats = 0;
+  mo5->trace = 0;
+  mo5->history = 0;
+  mo5->coverage = 0;
+  mo5->cycles = 0;
+  memset(mo5->mem.gen, 0, sizeof(mo5->mem.gen));
+  for (int i = 0; i < MO5_RAM_PAGES; i++) {
+    mo5->mem.page[i] = _mo5_page_alloc();
+    mo5->mem.page_flags[i] = MO5_PAGE_PRIVATE;
+  }
   m6809_init(&mo5->cpu);
   mo5->cpu.mgetc = desc->mgetc;
   mo5->cpu.mputc = desc->mputc;
   mo5->audio.callback = desc->audio_callback;
+  mo5->tape.fast = desc->fast_tape;
+  mo5->tape.out = desc->tape_out;
   mo5_reset(mo5);
   _mo5_init_keymap(mo5);
 }
 
+void mo5_discard(mo5_t *mo5) {
+  EMU_ASSERT(mo5);
+  _mo5_media_unref_all(mo5);
+  mo5->tape.media = mo5->disk.media = mo5->cartridge.media = 0;
+  mo5->disk.overlay = 0;
+  _mo5_pages_unref(mo5);
+  free(mo5->display.screen);
+  mo5->display.screen = 0;
+  free(mo5->breakpoints);
+  mo5->breakpoints = 0;
+  _mo5_cheats_unref(mo5->cheats);
+  mo5->cheats = 0;
+  mo5trace_destroy(mo5->trace);
+  mo5->trace = 0;
+  _mo5_history_destroy(mo5->history);
+  mo5->history = 0;
+  free(mo5->coverage);
+  mo5->coverage = 0;
+}
+
 void mo5_step(mo5_t *mo5, uint32_t micro_seconds) {
   uint32_t num_ticks = clk_us_to_ticks(_MO5_FREQUENCY, micro_seconds);
+  _mo5_cur = mo5;
+  const bool armed = _mo5_debug_armed(mo5);
+  if (mo5->breakpoints) {
+    mo5->breakpoints->hit = false;
+    // the plain loop moves away from the instruction it stopped at
+    mo5->breakpoints->resume &= armed;
+  }
   if (0 == mo5->debug.callback.func) {
     // run without debug hook
-    _mo5_step_n(mo5, num_ticks);
+    _mo5_slice(mo5, num_ticks, armed);
   } else {
     // run with debug hook
     if (!(*mo5->debug.stopped)) {
-        _mo5_step_n(mo5, num_ticks);
+        _mo5_slice(mo5, num_ticks, armed);
         mo5->debug.callback.func(mo5->debug.callback.user_data);
     }
   }
   kbd_update(&mo5->kbd, micro_seconds);
+  // forks have no framebuffer
+  if (mo5->display.screen) {
+    _mo5_screen_draw(mo5);
+  }
+}
+
+void mo5_draw_screen(mo5_t *mo5) {
+  EMU_ASSERT(mo5);
   _mo5_screen_draw(mo5);
 }
 
@@ -434,53 +1851,28 @@ uint8_t _mo5_test_key(mo5_t *mo5, uint8_t key) {
   uint8_t line = (key >> 4) & 0x0F;
   uint8_t col = (key & 0x0F) >> 1;
   uint8_t res = mo5->kbd.scanout_column_masks[line];
-  return (res & (1 << col)) ? 0 : 0x80;
+  // count the scans for input pacing (see keybuf.h)
+  if (res & (1 << col)) {
+    mo5->input.key_scans++;
+    mo5->input.key_idle = 0;
+    return 0;
+  }
+  if (mo5->input.key_idle < UINT32_MAX)
+    mo5->input.key_idle++;
+  return 0x80;
 }
 
 int8_t mo5_mem_read(mo5_t *mo5, uint16_t address) {
   switch (address >> 12) {
   case 0x0:
   case 0x1:
-    return (int8_t)mo5->mem.video[address];
+    return (int8_t)_mo5_cpu_ram_rd(mo5, mo5->mem.video + address, address);
   case 0xa:
-    switch (address) {
-    case 0xa7c0:
-      return mo5->mem.port[0] | _MO5_TAPE_DRIVE_CONNECTED | (mo5->input.penbutton << 5);
-    case 0xa7c1:
+    if (address == 0xa7c1) {
       return (int8_t)(mo5->mem.port[1] |
                       _mo5_test_key(mo5, mo5->mem.port[1] & 0xfe));
-    case 0xa7c2:
-      return (int8_t)mo5->mem.port[2];
-    case 0xa7c3:
-      return (int8_t)(mo5->mem.port[3] | ~_mo5_mem_initN(mo5));
-    case 0xa7cb:
-      return (mo5->cartridge.flags & 0x3f) |
-             ((mo5->cartridge.flags & 0x80) >> 1) |
-             ((mo5->cartridge.flags & 0x40) << 1);
-    case 0xa7cc:
-      return (int8_t)((mo5->mem.port[0x0e] & 4) ? mo5->input.joys_position.value
-                                                : mo5->mem.port[0x0c]);
-    case 0xa7cd:
-      return (int8_t)((mo5->mem.port[0x0f] & 4)
-                          ? mo5->input.joy_action | mo5->mem.sound
-                          : mo5->mem.port[0x0d]);
-    case 0xa7ce:
-      return 4;
-    case 0xa7d8:
-      return ~_mo5_mem_initN(mo5); // disk state byte
-    case 0xa7e1:
-      return (int8_t)0xff; // printer error number 53 occurs when set to 0
-    case 0xa7e6:
-      return _mo5_mem_initLn(mo5) << 1;
-    case 0xa7e7:
-      return _mo5_mem_initN(mo5);
-    default:
-      if (address < 0xa7c0)
-        return (int8_t)(cd90640rom[address & 0x7ff]);
-      if (address < 0xa800)
-        return (int8_t)(mo5->mem.port[address & 0x3f]);
-      return 0;
     }
+    return (int8_t)_mo5_io_read(mo5, address);
   case 0xb:
     _mo5_switch_memo5_bank(mo5, address);
     return (int8_t)mo5->mem.rom_bank[address];
@@ -493,15 +1885,32 @@ int8_t mo5_mem_read(mo5_t *mo5, uint16_t address) {
     return (int8_t)mo5rom[address - 0xc000];
   default:
     EMU_ASSERT(address < 0xa000);
-    return (int8_t)mo5->mem.ram[address + 0x2000];
+    return (int8_t)_mo5_cpu_ram_rd(mo5, address + 0x2000, address);
+  }
+}
+
+// write into cartridge memory, the cartridge image is copied first
+// if it is shared with another machine or a snapshot
+static void _mo5_cartridge_write(mo5_t *mo5, uint16_t a, uint8_t c) {
+  if ((mo5->cartridge.flags & 4) == 0)
+    return;
+  mo5_media_t *media = mo5->cartridge.media;
+  if (!media || (_MO5_ATOMIC_LOAD(&media->refs) > 1)) {
+    const gfx_range_t data = {.ptr = (void *)mo5->mem.cartridge, .size = media ? media->size : 0};
+    _mo5_set_cartridge(mo5, _mo5_media_create(data, MO5_MAX_CARTRIDGE_SIZE));
+    _mo5_rombank(mo5);
+    media = mo5->cartridge.media;
   }
+  media->data[a - 0xb000 + ((mo5->cartridge.flags & 0x03) << 14)] = c;
+  media->modified = true;
 }
 
 void mo5_mem_write(mo5_t *mo5, uint16_t a, uint8_t c) {
+  mo5->mem.gen[a >> 12]++;
   switch (a >> 12) {
   case 0x0:
   case 0x1:
-    mo5->mem.video[a] = c;
+    _mo5_cpu_ram_wr(mo5, mo5->mem.video + a, a, c);
     break;
   case 0xa:
     switch (a) {
@@ -544,16 +1953,65 @@ void mo5_mem_write(mo5_t *mo5, uint16_t a, uint8_t c) {
   case 0xe:
     if (mo5->cartridge.flags & 8)
       if (mo5->cartridge.type == 0)
-        mo5->mem.rom_bank[a] = c;
+        _mo5_cartridge_write(mo5, a, c);
     break;
   case 0xf:
     break;
   default:
     EMU_ASSERT(a < 0xa000);
-    mo5->mem.ram[a + 0x2000] = c;
+    _mo5_cpu_ram_wr(mo5, a + 0x2000, a, c);
+  }
+}
+
+uint8_t mo5_mem_peek(const mo5_t *sys, uint16_t address) {
+  EMU_ASSERT(sys);
+  return _mo5_peek(sys, address);
+}
+
+void mo5_mem_peek_range(const mo5_t *sys, uint16_t address, uint8_t *dst, size_t num) {
+  EMU_ASSERT(sys && dst);
+  while (num > 0) {
+    // up to the end of the 4KB page (RAM page, ROM bank or I/O page)
+    size_t n = 0x1000 - (address & 0xfff);
+    if (n > num) {
+      n = num;
+    }
+    const uint8_t *src = _mo5_peek_ptr(sys, address);
+    if (src) {
+      memcpy(dst, src, n);
+    } else {
+      for (size_t i = 0; i < n; i++) {
+        dst[i] = _mo5_peek(sys, (uint16_t)(address + i));
+      }
+    }
+    address = (uint16_t)(address + n);
+    dst += n;
+    num -= n;
+  }
+}
+
+void mo5_mem_poke(mo5_t *sys, uint16_t address, uint8_t value) {
+  EMU_ASSERT(sys);
+  _mo5_history_touch(sys);
+  sys->mem.gen[address >> 12]++;
+  if (address < 0x2000) {
+    _mo5_ram_wr(sys, sys->mem.video + address, value);
+  } else if (address < 0xa000) {
+    _mo5_ram_wr(sys, address + 0x2000, value);
+  } else if ((address >= 0xb000) && (address < 0xf000)) {
+    if ((sys->cartridge.flags & 8) && (sys->cartridge.type == 0)) {
+      _mo5_cartridge_write(sys, address, value);
+    }
   }
 }
 
+uint32_t mo5_mem_generation(const mo5_t *sys, uint16_t address) {
+  EMU_ASSERT(sys);
+  const uint32_t gen = sys->mem.gen[address >> 12];
+  // I/O registers also change on their own (keyboard, light pen, tape...)
+  return ((address >> 12) == 0xa) ? gen + (uint32_t)sys->cycles : gen;
+}
+
 gfx_display_info_t mo5_display_info(mo5_t *mo5) {
     EMU_ASSERT(mo5);
     const gfx_display_info_t res = {
@@ -588,28 +2046,489 @@ void mo5_key_down(mo5_t *sys, int key_code) {
 
 void mo5_key_up(mo5_t *sys, int key_code) { kbd_key_up(&sys->kbd, key_code); }
 
-bool mo5_insert_tape(mo5_t *sys, gfx_range_t data) {
+void mo5_watch_pc(mo5_t *sys, int pc) {
+  EMU_ASSERT(sys && (pc < 0x10000));
+  sys->watch.pc = (pc < 0) ? -1 : pc;
+  sys->watch.reached = false;
+}
+
+bool mo5_pc_reached(const mo5_t *sys) {
+  EMU_ASSERT(sys);
+  return sys->watch.reached;
+}
+
+static mo5_breakpoints_t *_mo5_breakpoints(mo5_t *sys) {
+  if (!sys->breakpoints) {
+    sys->breakpoints = (mo5_breakpoints_t *)calloc(1, sizeof(mo5_breakpoints_t));
+    EMU_ASSERT(sys->breakpoints);
+  }
+  return sys->breakpoints;
+}
+
+int mo5_add_breakpoint(mo5_t *sys, uint16_t pc, bool temporary, uint32_t break_hits) {
+  EMU_ASSERT(sys);
+  mo5_breakpoints_t *bps = _mo5_breakpoints(sys);
+  if (bps->num == MO5_MAX_BREAKPOINTS) {
+    return -1;
+  }
+  const int index = bps->num++;
+  bps->bp[index] = (mo5_breakpoint_t){
+      .pc = pc, .enabled = true, .temporary = temporary, .break_hits = break_hits};
+  _mo5_breakpoints_update(bps);
+  return index;
+}
+
+void mo5_remove_breakpoint(mo5_t *sys, int index) {
+  EMU_ASSERT(sys && (index >= 0) && (index < mo5_num_breakpoints(sys)));
+  mo5_breakpoints_t *bps = sys->breakpoints;
+  bps->num--;
+  memmove(&bps->bp[index], &bps->bp[index + 1], (size_t)(bps->num - index) * sizeof(mo5_breakpoint_t));
+  _mo5_breakpoints_update(bps);
+}
+
+void mo5_enable_breakpoint(mo5_t *sys, int index, bool enabled) {
+  EMU_ASSERT(sys && (index >= 0) && (index < mo5_num_breakpoints(sys)));
+  sys->breakpoints->bp[index].enabled = enabled;
+  _mo5_breakpoints_update(sys->breakpoints);
+}
+
+bool mo5_set_breakpoint_condition(mo5_t *sys, int index, const char *text) {
+  EMU_ASSERT(sys && text && (index >= 0) && (index < mo5_num_breakpoints(sys)));
+  mo5_breakpoint_t *bp = &sys->breakpoints->bp[index];
+  if ((strlen(text) >= sizeof(bp->condition)) || !mo5expr_compile(text, &bp->cond)) {
+    return false;
+  }
+  strcpy(bp->condition, text);
+  return true;
+}
+
+int mo5_num_breakpoints(const mo5_t *sys) {
+  EMU_ASSERT(sys);
+  return sys->breakpoints ? sys->breakpoints->num : 0;
+}
+
+const mo5_breakpoint_t *mo5_breakpoint(const mo5_t *sys, int index) {
+  EMU_ASSERT(sys && (index >= 0) && (index < mo5_num_breakpoints(sys)));
+  return &sys->breakpoints->bp[index];
+}
+
+// steps run the instruction at pc first, even if it has a breakpoint
+void mo5_step_into(mo5_t *sys) {
+  EMU_ASSERT(sys);
+  mo5_breakpoints_t *bps = _mo5_breakpoints(sys);
+  bps->step = true;
+  bps->resume = true;
+}
+
+// size of the subroutine call at pc, 0 if the instruction isn't a call
+static int _mo5_call_size(mo5_t *sys, uint16_t pc) {
+  switch (_mo5_peek(sys, pc)) {
+  case 0x8d: // BSR
+  case 0x9d: // JSR direct
+    return 2;
+  case 0x17: // LBSR
+  case 0xbd: // JSR extended
+    return 3;
+  case 0x3f: // SWI, the monitor returns after the function byte
+    return 2;
+  case 0xad: { // JSR indexed
+    const uint8_t post = _mo5_peek(sys, (uint16_t)(pc + 1));
+    if (0 == (post & 0x80)) {
+      return 2;
+    }
+    switch (post & 0x0f) {
+    case 0x08: // 8 bit offset
+    case 0x0c: // 8 bit offset from PC
+      return 3;
+    case 0x09: // 16 bit offset
+    case 0x0d: // 16 bit offset from PC
+    case 0x0f: // extended indirect
+      return 4;
+    default:
+      return 2;
+    }
+  }
+  default:
+    return 0;
+  }
+}
+
+void mo5_step_over(mo5_t *sys) {
+  EMU_ASSERT(sys);
+  const int size = _mo5_call_size(sys, sys->cpu.pc);
+  if ((size == 0) || (mo5_add_breakpoint(sys, (uint16_t)(sys->cpu.pc + size), true, 0) < 0)) {
+    mo5_step_into(sys);
+  } else {
+    sys->breakpoints->resume = true;
+  }
+}
+
+void mo5_step_out(mo5_t *sys) {
+  EMU_ASSERT(sys);
+  mo5_breakpoints_t *bps = _mo5_breakpoints(sys);
+  bps->step_out = true;
+  bps->out_s = sys->cpu.s;
+  bps->returning = false;
+  bps->resume = true;
+}
+
+int mo5_add_watchpoint(mo5_t *sys, const mo5_watchpoint_t *wp) {
+  EMU_ASSERT(sys && wp);
+  if (wp->address >= 0xa000) {
+    return -1;
+  }
+  mo5_breakpoints_t *bps = _mo5_breakpoints(sys);
+  if (bps->num_wp == MO5_MAX_WATCHPOINTS) {
+    return -1;
+  }
+  const int index = bps->num_wp++;
+  bps->wp[index] = *wp;
+  bps->wp[index].mask = wp->mask ? wp->mask : 0xff;
+  bps->wp[index].enabled = true;
+  bps->wp[index].hits = 0;
+  _mo5_flag_pages(sys);
+  return index;
+}
+
+void mo5_remove_watchpoint(mo5_t *sys, int index) {
+  EMU_ASSERT(sys && (index >= 0) && (index < mo5_num_watchpoints(sys)));
+  mo5_breakpoints_t *bps = sys->breakpoints;
+  bps->num_wp--;
+  memmove(&bps->wp[index], &bps->wp[index + 1], (size_t)(bps->num_wp - index) * sizeof(mo5_watchpoint_t));
+  _mo5_flag_pages(sys);
+}
+
+void mo5_enable_watchpoint(mo5_t *sys, int index, bool enabled) {
+  EMU_ASSERT(sys && (index >= 0) && (index < mo5_num_watchpoints(sys)));
+  sys->breakpoints->wp[index].enabled = enabled;
+  _mo5_flag_pages(sys);
+}
+
+int mo5_num_watchpoints(const mo5_t *sys) {
+  EMU_ASSERT(sys);
+  return sys->breakpoints ? sys->breakpoints->num_wp : 0;
+}
+
+const mo5_watchpoint_t *mo5_watchpoint(const mo5_t *sys, int index) {
+  EMU_ASSERT(sys && (index >= 0) && (index < mo5_num_watchpoints(sys)));
+  return &sys->breakpoints->wp[index];
+}
+
+bool mo5_watch_hit(const mo5_t *sys, mo5_watch_hit_t *hit) {
+  EMU_ASSERT(sys);
+  const mo5_breakpoints_t *bps = sys->breakpoints;
+  if (!bps || !bps->hit || (bps->watch_hit.index < 0)) {
+    return false;
+  }
+  if (hit) {
+    *hit = bps->watch_hit;
+  }
+  return true;
+}
+
+void mo5_break(mo5_t *sys) {
+  EMU_ASSERT(sys);
+  if (sys->breakpoints) {
+    _mo5_break(sys->breakpoints);
+  }
+}
+
+bool mo5_break_hit(const mo5_t *sys) {
+  EMU_ASSERT(sys);
+  return sys->breakpoints && sys->breakpoints->hit;
+}
+
+void mo5_history_start(mo5_t *sys, size_t size) {
+  EMU_ASSERT(sys);
+  mo5_history_stop(sys);
+  // a snapshot holds at most all the RAM pages
+  int cap = (int)(size / (sizeof(mo5_t) + MO5_RAM_SIZE));
+  if (cap < 2) {
+    cap = 2;
+  }
+  mo5_history_t *history = (mo5_history_t *)calloc(1, sizeof(mo5_history_t));
+  EMU_ASSERT(history);
+  history->state = (mo5_t *)calloc((size_t)cap, sizeof(mo5_t));
+  EMU_ASSERT(history->state);
+  history->cap = cap;
+  history->dirty = true;
+  sys->history = history;
+}
+
+void mo5_history_stop(mo5_t *sys) {
+  EMU_ASSERT(sys);
+  _mo5_history_destroy(sys->history);
+  sys->history = 0;
+}
+
+mo5_history_stats_t mo5_history_stats(const mo5_t *sys) {
+  EMU_ASSERT(sys);
+  mo5_history_stats_t stats = { .first_cycle = sys->cycles };
+  mo5_history_t *history = sys->history;
+  if (history) {
+    stats.num_states = history->num;
+    stats.max_states = history->cap;
+    if (history->num > 0) {
+      stats.first_cycle = _mo5_history_state(history, 0)->cycles;
+    }
+  }
+  return stats;
+}
+
+// load a snapshot of the history, muted for the replay which follows
+static void _mo5_history_load(mo5_t *sys, int index) {
+  mo5_history_t *history = sys->history;
+  // the history isn't told, the snapshot is already in it
+  sys->history = 0;
+  mo5_load_snapshot(sys, EMU_SNAPSHOT_VERSION, _mo5_history_state(history, index));
+  sys->history = history;
+  sys->audio.muted = true;
+}
+
+// run the machine up to the first instruction at or after cycle, the hits
+// on the way are noted in replay_found and replay_hit
+static void _mo5_replay(mo5_t *sys, uint64_t cycle) {
+  mo5_breakpoints_t *bps = _mo5_breakpoints(sys);
+  bps->replay = true;
+  bps->replay_to = cycle;
+  bps->replay_found = false;
+  bps->watch_stop = false;
+  // the coverage counted these instructions already
+  mo5_coverage_t *coverage = sys->coverage;
+  sys->coverage = 0;
+  while (bps->replay) {
+    const uint64_t left = (cycle > sys->cycles) ? (cycle - sys->cycles) : 0;
+    _mo5_step_n_debug(sys, (uint32_t)((left < MO5_HISTORY_INTERVAL) ? left : MO5_HISTORY_INTERVAL) + 64);
+  }
+  sys->coverage = coverage;
+}
+
+// the machine went back: stopped like at a breakpoint, with its new inputs
+static void _mo5_history_done(mo5_t *sys, bool muted, bool stopped) {
+  sys->audio.muted = muted;
+  if (stopped) {
+    _mo5_break(sys->breakpoints);
+  }
+  _mo5_history_leave(sys);
+  if (sys->display.screen) {
+    _mo5_screen_draw(sys);
+  }
+}
+
+bool mo5_step_back(mo5_t *sys) {
+  EMU_ASSERT(sys);
+  if (!sys->history) {
+    return false;
+  }
+  // a change by the host while stopped is kept as a snapshot
+  _mo5_history_enter(sys);
+  const uint64_t cycle = sys->cycles;
+  const int index = _mo5_history_find(sys->history, cycle);
+  if (index < 0) {
+    return false;
+  }
+  const bool muted = sys->audio.muted;
+  // the first replay finds where the previous instruction started
+  _mo5_history_load(sys, index);
+  _mo5_replay(sys, cycle);
+  const uint64_t prev = sys->breakpoints->op_cycle;
+  _mo5_history_load(sys, index);
+  _mo5_replay(sys, prev);
+  _mo5_history_done(sys, muted, true);
+  return true;
+}
+
+bool mo5_reverse_continue(mo5_t *sys) {
+  EMU_ASSERT(sys);
+  mo5_history_t *history = sys->history;
+  if (!history) {
+    return false;
+  }
+  _mo5_history_enter(sys);
+  const uint64_t cycle = sys->cycles;
+  const bool muted = sys->audio.muted;
+  // replay the spans between snapshots from the newest, up to the first
+  // one holding a hit
+  uint64_t end = cycle;
+  for (int i = _mo5_history_find(history, cycle); i >= 0; i--) {
+    _mo5_history_load(sys, i);
+    _mo5_replay(sys, end);
+    if (sys->breakpoints->replay_found) {
+      const uint64_t hit = sys->breakpoints->replay_hit;
+      _mo5_history_load(sys, i);
+      _mo5_replay(sys, hit);
+      _mo5_history_done(sys, muted, true);
+      return true;
+    }
+    end = _mo5_history_state(history, i)->cycles;
+  }
+  // no hit: back to the starting point, the trace is recorded again
+  const int index = _mo5_history_find(history, cycle + 1);
+  if (index >= 0) {
+    _mo5_history_load(sys, index);
+    _mo5_replay(sys, cycle);
+  }
+  _mo5_history_done(sys, muted, false);
+  return false;
+}
+
+int mo5_add_cheat(mo5_t *sys, const mo5_cheat_t *cheat) {
+  EMU_ASSERT(sys && cheat);
+  if ((cheat->address + (cheat->two_bytes ? 1 : 0)) >= 0xa000) {
+    return -1;
+  }
+  mo5_cheats_t *cheats = _mo5_cheats_own(sys);
+  if (cheats->num == cheats->cap) {
+    cheats->cap = cheats->cap ? cheats->cap * 2 : 16;
+    cheats->cheat = (mo5_cheat_t *)realloc(cheats->cheat, (size_t)cheats->cap * sizeof(mo5_cheat_t));
+    cheats->patch = (_mo5_patch_t *)realloc(cheats->patch, (size_t)cheats->cap * 2 * sizeof(_mo5_patch_t));
+    cheats->freeze = (_mo5_patch_t *)realloc(cheats->freeze, (size_t)cheats->cap * 2 * sizeof(_mo5_patch_t));
+    EMU_ASSERT(cheats->cheat && cheats->patch && cheats->freeze);
+  }
+  mo5_cheat_t *dst = &cheats->cheat[cheats->num];
+  *dst = *cheat;
+  dst->name[MO5_CHEAT_NAME_SIZE - 1] = 0;
+  if (!dst->two_bytes) {
+    dst->value &= 0xff;
+  }
+  const int index = cheats->num++;
+  _mo5_cheats_update(sys);
+  return index;
+}
+
+void mo5_remove_cheat(mo5_t *sys, int index) {
+  EMU_ASSERT(sys && (index >= 0) && (index < mo5_num_cheats(sys)));
+  mo5_cheats_t *cheats = _mo5_cheats_own(sys);
+  cheats->num--;
+  memmove(&cheats->cheat[index], &cheats->cheat[index + 1], (size_t)(cheats->num - index) * sizeof(mo5_cheat_t));
+  _mo5_cheats_update(sys);
+}
+
+void mo5_enable_cheat(mo5_t *sys, int index, bool enabled) {
+  EMU_ASSERT(sys && (index >= 0) && (index < mo5_num_cheats(sys)));
+  _mo5_cheats_own(sys)->cheat[index].enabled = enabled;
+  _mo5_cheats_update(sys);
+}
+
+void mo5_clear_cheats(mo5_t *sys) {
+  EMU_ASSERT(sys);
+  _mo5_cheats_unref(sys->cheats);
+  sys->cheats = 0;
+  _mo5_flag_pages(sys);
+  _mo5_history_touch(sys);
+}
+
+int mo5_num_cheats(const mo5_t *sys) {
+  EMU_ASSERT(sys);
+  return sys->cheats ? sys->cheats->num : 0;
+}
+
+const mo5_cheat_t *mo5_cheat(const mo5_t *sys, int index) {
+  EMU_ASSERT(sys && (index >= 0) && (index < mo5_num_cheats(sys)));
+  return &sys->cheats->cheat[index];
+}
+
+// font of the monitor, 8 bytes per character from 0x20, bottom row first
+#define _MO5_FONT_OFFSET (0xfc9e - 0xc000)
+#define _MO5_FONT_CHARS (96)
+
+void mo5_screen_text(mo5_t *sys, char *buf) {
+  EMU_ASSERT(sys && buf);
+  uint64_t glyphs[_MO5_FONT_CHARS];
+  for (int c = 0; c < _MO5_FONT_CHARS; c++) {
+    const uint8_t *rows = &mo5rom[_MO5_FONT_OFFSET + c * 8];
+    uint64_t glyph = 0;
+    for (int y = 0; y < 8; y++)
+      glyph = (glyph << 8) | rows[7 - y];
+    glyphs[c] = glyph;
+  }
+  char *dst = buf;
+  for (int row = 0; row < MO5_SCREEN_ROWS; row++) {
+    for (int col = 0; col < MO5_SCREEN_COLUMNS; col++) {
+      // shape bank of the video RAM
+      uint64_t cell = 0;
+      for (int y = 0; y < 8; y++)
+        cell = (cell << 8) | _mo5_ram_rd(sys, (uint16_t)(0x2000 + (row * 8 + y) * MO5_SCREEN_COLUMNS + col));
+      char c = ' ';
+      for (int i = 0; i < _MO5_FONT_CHARS; i++) {
+        if (glyphs[i] == cell) {
+          c = (char)(0x20 + i);
+          break;
+        }
+      }
+      *dst++ = c;
+    }
+    *dst++ = '\n';
+  }
+  *dst = 0;
+}
+
+static void _mo5_set_tape(mo5_t *sys, mo5_media_t *media) {
   sys->tape.bit = 0;
   sys->tape.pos = -1;
-  size_t size = (data.size < MO5_MAX_TAPE_SIZE) ? data.size : MO5_MAX_TAPE_SIZE;
-  memcpy(sys->tape.buf, data.ptr, size);
+  sys->tape.no_block = SIZE_MAX;
+  _mo5_media_unref(sys->tape.media);
+  sys->tape.media = media;
+  sys->tape.buf = media->ptr;
+  sys->tape.size = media->size;
+  _mo5_history_touch(sys);
+}
+
+static void _mo5_set_disk(mo5_t *sys, mo5_media_t *media) {
+  _mo5_media_unref(sys->disk.media);
+  sys->disk.media = media;
+  _mo5_disk_index(media);
+  sys->disk.buf = media->ptr;
+  sys->disk.size = media->size;
+  sys->disk.sectors = media->sectors;
+  mo5_overlay_release(sys->disk.overlay);
+  sys->disk.overlay = 0;
+  mo5_reset(sys);
+}
+
+bool mo5_insert_tape(mo5_t *sys, gfx_range_t data) {
+  _mo5_set_tape(sys, _mo5_media_create(data, 0));
   return true;
 }
 
 bool mo5_insert_disk(mo5_t *sys, gfx_range_t data) {
-  sys->disk.size =
-      (data.size < MO5_MAX_TAPE_SIZE) ? data.size : MO5_MAX_TAPE_SIZE;
-  memcpy(sys->disk.buf, data.ptr, sys->disk.size);
-  mo5_reset(sys);
+  _mo5_set_disk(sys, _mo5_media_create(data, 0));
+  return true;
+}
+
+bool mo5_attach_tape(mo5_t *sys, const mo5_media_desc_t *desc) {
+  EMU_ASSERT(sys && desc && (desc->ptr || (desc->size == 0)));
+  _mo5_set_tape(sys, _mo5_media_attach(desc));
   return true;
 }
 
+bool mo5_attach_disk(mo5_t *sys, const mo5_media_desc_t *desc) {
+  EMU_ASSERT(sys && desc && (desc->ptr || (desc->size == 0)));
+  _mo5_set_disk(sys, _mo5_media_attach(desc));
+  return true;
+}
+
+mo5_overlay_t *mo5_disk_overlay(const mo5_t *sys) {
+  EMU_ASSERT(sys);
+  return _mo5_overlay_ref(sys->disk.overlay);
+}
+
+void mo5_set_disk_overlay(mo5_t *sys, mo5_overlay_t *overlay) {
+  EMU_ASSERT(sys);
+  _mo5_overlay_ref(overlay);
+  mo5_overlay_release(sys->disk.overlay);
+  sys->disk.overlay = overlay;
+  _mo5_history_touch(sys);
+}
+
 bool mo5_insert_cartridge(mo5_t *sys, gfx_range_t data) {
-  sys->cartridge.size =
-      (data.size < MO5_MAX_CARTRIDGE_SIZE) ? data.size : MO5_MAX_CARTRIDGE_SIZE;
-  memcpy(sys->mem.cartridge, data.ptr, sys->cartridge.size);
-  for (int i = 0; i < 0xc000; i++)
-    sys->mem.ram[i] = -((i & 0x80) >> 7);
+  if (data.size > MO5_MAX_CARTRIDGE_SIZE)
+    data.size = MO5_MAX_CARTRIDGE_SIZE;
+  _mo5_set_cartridge(sys, _mo5_media_create(data, MO5_MAX_CARTRIDGE_SIZE));
+  sys->cartridge.size = data.size;
+  for (uint32_t i = 0; i < MO5_RAM_SIZE; i++)
+    _mo5_ram_wr(sys, (uint16_t)i, -((i & 0x80) >> 7));
+  _mo5_mem_changed(sys);
   sys->cartridge.type = 0; // cartouche <= 16 Ko
   if (sys->cartridge.size > 0x4000)
     sys->cartridge.type = 1; // bank switch system
@@ -618,21 +2537,343 @@ bool mo5_insert_cartridge(mo5_t *sys, gfx_range_t data) {
   return true;
 }
 
+uint64_t mo5_media_hash(mo5_media_t *media) {
+  if (!media || media->modified) {
+    return 0;
+  }
+  // hashed lazily, so attaching a large image doesn't touch all of it, by
+  // whichever thread (machine, fork, snapshot job) asks first
+  if (_MO5_ATOMIC_CAS(&media->hash_state, _MO5_HASH_NONE, _MO5_HASH_COMPUTING)) {
+    media->hash = hash64(media->ptr, media->size, 0);
+    _MO5_ATOMIC_STORE(&media->hash_state, _MO5_HASH_VALID);
+  }
+  while (_MO5_ATOMIC_LOAD(&media->hash_state) != _MO5_HASH_VALID) {
+  }
+  return media->hash;
+}
+
 bool mo5_load_snapshot(mo5_t* sys, uint32_t version, mo5_t* src) {
     EMU_ASSERT(sys && src);
     if (version != EMU_SNAPSHOT_VERSION) {
         return false;
     }
-    static mo5_t im;
-    im = *src;
-    _mo5_audio_callback_snapshot_onload(&im.audio.callback, &sys->audio.callback);
-    *sys = im;
+    // keep the framebuffer, callbacks and debug hooks of the running machine
+    uint8_t* screen = sys->display.screen;
+    chips_audio_callback_t audio_callback = sys->audio.callback;
+    const mo5_tape_out_callback_t tape_out = sys->tape.out;
+    const mo5_debug_t debug = sys->debug;
+    mo5_breakpoints_t* breakpoints = sys->breakpoints;
+    mo5_cheats_t* cheats = sys->cheats;
+    mo5_trace_t* trace = sys->trace;
+    mo5_history_t* history = sys->history;
+    mo5_coverage_t* coverage = sys->coverage;
+    uint32_t gen[16];
+    memcpy(gen, sys->mem.gen, sizeof(gen));
+    int8_t (*mgetc)(uint16_t) = sys->cpu.mgetc;
+    void (*mputc)(uint16_t, uint8_t) = sys->cpu.mputc;
+    _mo5_media_unref_all(sys);
+    _mo5_pages_unref(sys);
+    *sys = *src;
+    _mo5_media_ref_all(sys);
+    _mo5_pages_share(sys, src);
+    _mo5_audio_callback_snapshot_onload(&sys->audio.callback, &audio_callback);
+    sys->tape.out = tape_out;
+    sys->display.screen = screen;
+    sys->debug = debug;
+    sys->breakpoints = breakpoints;
+    sys->cheats = cheats;
+    sys->trace = trace;
+    sys->history = history;
+    sys->coverage = coverage;
+    // generations only go forward, what was decoded before is stale
+    memcpy(sys->mem.gen, gen, sizeof(gen));
+    _mo5_mem_changed(sys);
+    sys->cpu.mgetc = mgetc;
+    sys->cpu.mputc = mputc;
+    if (trace) {
+        mo5trace_rewind(trace, sys->cycles);
+    }
+    _mo5_history_touch(sys);
+    _mo5_flag_pages(sys);
+    _mo5_videoram(sys);
+    _mo5_rombank(sys);
     return true;
 }
 
 uint32_t mo5_save_snapshot(mo5_t* sys, mo5_t* dst) {
     EMU_ASSERT(sys && dst);
+    _mo5_media_unref_all(dst);
+    _mo5_pages_unref(dst);
+    _mo5_cheats_unref(dst->cheats);
     *dst = *sys;
+    _mo5_media_ref_all(dst);
+    _mo5_pages_share(dst, sys);
     _mo5_audio_callback_snapshot_onsave(&dst->audio.callback);
+    dst->tape.out = (mo5_tape_out_callback_t){0};
+    // the framebuffer, the breakpoints, the cheats, the trace, the history
+    // and the coverage are not part of a snapshot
+    dst->display.screen = 0;
+    dst->breakpoints = 0;
+    dst->cheats = 0;
+    dst->trace = 0;
+    dst->history = 0;
+    dst->coverage = 0;
+    _mo5_flag_pages(dst);
     return EMU_SNAPSHOT_VERSION;
 }
+
+void mo5_save_state(const mo5_t* sys, mo5_state_t* dst) {
+    EMU_ASSERT(sys && dst);
+    for (int i = 0; i < MO5_RAM_PAGES; i++) {
+        memcpy(&dst->mem.ram[i * MO5_PAGE_SIZE], sys->mem.page[i]->data, MO5_PAGE_SIZE);
+    }
+    memcpy(dst->mem.port, sys->mem.port, sizeof(dst->mem.port));
+    dst->mem.sound = sys->mem.sound;
+    dst->display.line_cycle = sys->display.line_cycle;
+    dst->display.line_number = sys->display.line_number;
+    dst->tape.bit = sys->tape.bit;
+    dst->tape.pos = sys->tape.pos;
+    dst->cartridge.flags = sys->cartridge.flags;
+    dst->audio.sample = sys->audio.sample;
+    dst->input.joys_position = sys->input.joys_position.value;
+    dst->input.joy_action = sys->input.joy_action;
+    dst->input.xpen = sys->input.xpen;
+    dst->input.ypen = sys->input.ypen;
+    dst->input.penbutton = sys->input.penbutton;
+    dst->input.key_scans = sys->input.key_scans;
+    dst->input.key_idle = sys->input.key_idle;
+    dst->watch.pc = sys->watch.pc;
+    dst->watch.reached = sys->watch.reached;
+    dst->cpu = sys->cpu;
+    dst->kbd = sys->kbd;
+    dst->clocks = sys->clocks;
+    dst->clock_excess = sys->clock_excess;
+    dst->cycles = sys->cycles;
+}
+
+void mo5_load_state(mo5_t* sys, const mo5_state_t* src) {
+    EMU_ASSERT(sys && src);
+    // a state of the recorded past (rewind) is replayed from the history,
+    // a new snapshot is only needed for a state the history didn't see
+    mo5_history_t *history = sys->history;
+    const bool recorded = history && (history->num > 0) &&
+                          (src->cycles >= _mo5_history_state(history, 0)->cycles) && (src->cycles <= sys->cycles);
+    for (int i = 0; i < MO5_RAM_PAGES; i++) {
+        const uint8_t* data = &src->mem.ram[i * MO5_PAGE_SIZE];
+        // unchanged pages stay shared with forks and snapshots
+        if (0 == (sys->mem.page_flags[i] & MO5_PAGE_PRIVATE)) {
+            if (0 == memcmp(sys->mem.page[i]->data, data, MO5_PAGE_SIZE)) {
+                continue;
+            }
+            _mo5_page_own(sys, i);
+        }
+        memcpy(sys->mem.page[i]->data, data, MO5_PAGE_SIZE);
+    }
+    memcpy(sys->mem.port, src->mem.port, sizeof(sys->mem.port));
+    sys->mem.sound = src->mem.sound;
+    sys->display.line_cycle = src->display.line_cycle;
+    sys->display.line_number = src->display.line_number;
+    sys->tape.bit = src->tape.bit;
+    sys->tape.pos = src->tape.pos;
+    sys->cartridge.flags = src->cartridge.flags;
+    sys->audio.sample = src->audio.sample;
+    sys->input.joys_position.value = src->input.joys_position;
+    sys->input.joy_action = src->input.joy_action;
+    sys->input.xpen = src->input.xpen;
+    sys->input.ypen = src->input.ypen;
+    sys->input.penbutton = src->input.penbutton;
+    sys->input.key_scans = src->input.key_scans;
+    sys->input.key_idle = src->input.key_idle;
+    sys->watch.pc = src->watch.pc;
+    sys->watch.reached = src->watch.reached;
+    // keep the memory callbacks of the running machine
+    int8_t (*mgetc)(uint16_t) = sys->cpu.mgetc;
+    void (*mputc)(uint16_t, uint8_t) = sys->cpu.mputc;
+    sys->cpu = src->cpu;
+    sys->cpu.mgetc = mgetc;
+    sys->cpu.mputc = mputc;
+    sys->kbd = src->kbd;
+    sys->clocks = src->clocks;
+    sys->clock_excess = src->clock_excess;
+    sys->cycles = src->cycles;
+    if (sys->trace) {
+        mo5trace_rewind(sys->trace, sys->cycles);
+    }
+    if (recorded) {
+        // its inputs are those the history recorded, not a change
+        _mo5_history_leave(sys);
+    } else {
+        _mo5_history_touch(sys);
+    }
+    _mo5_mem_changed(sys);
+    // pointers derived from port/cartridge registers
+    _mo5_videoram(sys);
+    _mo5_rombank(sys);
+}
+
+// tape output of speculative frames, a missing callback would make the
+// program see an I/O error
+static void _mo5_tape_out_discard(uint8_t byte, void* user_data) {
+    (void)byte;
+    (void)user_data;
+}
+
+bool mo5_speculate_begin(mo5_t* sys, mo5_speculation_t* spec) {
+    EMU_ASSERT(sys && spec);
+    // speculative frames would run through breakpoints and watchpoints and
+    // count their hits
+    const mo5_breakpoints_t *bps = sys->breakpoints;
+    if ((sys->watch.pc >= 0) || (bps && ((bps->num_enabled > 0) || (bps->num_wp > 0) || bps->step || bps->step_out))) {
+        return false;
+    }
+    if (sys->debug.callback.func && *sys->debug.stopped) {
+        return false;
+    }
+    mo5_save_state(sys, &spec->state);
+    // the cartridge is shared, a write makes a copy for the speculative frames
+    spec->cartridge = _mo5_media_ref(sys->cartridge.media);
+    spec->overlay = _mo5_overlay_ref(sys->disk.overlay);
+    spec->tape_out = sys->tape.out;
+    spec->muted = sys->audio.muted;
+    if (sys->tape.out.func) {
+        sys->tape.out = (mo5_tape_out_callback_t){ .func = _mo5_tape_out_discard };
+    }
+    // the debugger doesn't see the speculative instructions, they are not
+    // recorded for reverse execution nor counted by the coverage
+    spec->debug = sys->debug;
+    sys->debug.callback.func = 0;
+    spec->history = sys->history;
+    sys->history = 0;
+    spec->coverage = sys->coverage;
+    sys->coverage = 0;
+    sys->audio.muted = true;
+    return true;
+}
+
+void mo5_speculate_end(mo5_t* sys, mo5_speculation_t* spec) {
+    EMU_ASSERT(sys && spec);
+    // before the state, the cartridge bank is mapped from it
+    _mo5_set_cartridge(sys, spec->cartridge);
+    spec->cartridge = 0;
+    // sectors written meanwhile are dropped, they are never flushed
+    mo5_overlay_release(sys->disk.overlay);
+    sys->disk.overlay = spec->overlay;
+    spec->overlay = 0;
+    // the state is one the history recorded, it isn't a change
+    sys->history = spec->history;
+    spec->history = 0;
+    mo5_load_state(sys, &spec->state);
+    sys->tape.out = spec->tape_out;
+    sys->debug = spec->debug;
+    sys->coverage = spec->coverage;
+    spec->coverage = 0;
+    sys->audio.muted = spec->muted;
+}
+
+// CPU callbacks of forks, they access the machine stepped on the calling thread
+static int8_t _mo5_fork_mgetc(uint16_t address) {
+    EMU_ASSERT(_mo5_cur);
+    return mo5_mem_read(_mo5_cur, address);
+}
+
+static void _mo5_fork_mputc(uint16_t address, uint8_t value) {
+    EMU_ASSERT(_mo5_cur);
+    mo5_mem_write(_mo5_cur, address, value);
+}
+
+uint8_t* mo5_ram_ptr(mo5_t* sys, uint16_t offset, bool for_write) {
+    EMU_ASSERT(sys && (offset < MO5_RAM_SIZE));
+    const int index = offset >> 12;
+    if (for_write) {
+        if (0 == (sys->mem.page_flags[index] & MO5_PAGE_PRIVATE)) {
+            _mo5_page_own(sys, index);
+        }
+        // an edit while stopped must be in the snapshots the history replays
+        _mo5_history_touch(sys);
+        _mo5_mem_changed(sys);
+    }
+    return &sys->mem.page[index]->data[offset & (MO5_PAGE_SIZE - 1)];
+}
+
+void mo5_fork(mo5_t* sys, mo5_t* fork) {
+    EMU_ASSERT(sys && fork && (sys != fork));
+    mo5_discard(fork);
+    *fork = *sys;
+    _mo5_media_ref_all(fork);
+    _mo5_pages_share(fork, sys);
+    fork->display.screen = 0;
+    fork->audio.muted = true;
+    fork->audio.callback = (chips_audio_callback_t){0};
+    fork->tape.out = (mo5_tape_out_callback_t){0};
+    fork->debug = (mo5_debug_t){0};
+    fork->breakpoints = 0;
+    fork->trace = 0;
+    fork->history = 0;
+    fork->coverage = 0;
+    if (fork->cheats) {
+        _MO5_ATOMIC_INC(&fork->cheats->refs);
+    }
+    _mo5_flag_pages(fork);
+    fork->cpu.mgetc = _mo5_fork_mgetc;
+    fork->cpu.mputc = _mo5_fork_mputc;
+}
+
+void mo5_promote(mo5_t* sys, mo5_t* fork) {
+    EMU_ASSERT(sys && fork && (sys != fork));
+    // the fork's page and media references move over to sys
+    uint8_t* screen = sys->display.screen;
+    const bool muted = sys->audio.muted;
+    const chips_audio_callback_t audio_callback = sys->audio.callback;
+    const mo5_tape_out_callback_t tape_out = sys->tape.out;
+    const mo5_debug_t debug = sys->debug;
+    mo5_breakpoints_t* breakpoints = sys->breakpoints;
+    mo5_cheats_t* cheats = sys->cheats;
+    mo5_trace_t* trace = sys->trace;
+    mo5_history_t* history = sys->history;
+    mo5_coverage_t* coverage = sys->coverage;
+    uint32_t gen[16];
+    memcpy(gen, sys->mem.gen, sizeof(gen));
+    int8_t (*mgetc)(uint16_t) = sys->cpu.mgetc;
+    void (*mputc)(uint16_t, uint8_t) = sys->cpu.mputc;
+    _mo5_media_unref_all(sys);
+    _mo5_pages_unref(sys);
+    _mo5_cheats_unref(fork->cheats);
+    *sys = *fork;
+    memset(fork, 0, sizeof(mo5_t));
+    sys->display.screen = screen;
+    sys->audio.muted = muted;
+    sys->audio.callback = audio_callback;
+    sys->tape.out = tape_out;
+    sys->debug = debug;
+    sys->breakpoints = breakpoints;
+    sys->cheats = cheats;
+    sys->trace = trace;
+    sys->history = history;
+    sys->coverage = coverage;
+    // generations only go forward, what was decoded before is stale
+    memcpy(sys->mem.gen, gen, sizeof(gen));
+    _mo5_mem_changed(sys);
+    sys->cpu.mgetc = mgetc;
+    sys->cpu.mputc = mputc;
+    if (trace) {
+        mo5trace_rewind(trace, sys->cycles);
+    }
+    _mo5_history_touch(sys);
+    _mo5_flag_pages(sys);
+    if (screen) {
+        _mo5_screen_draw(sys);
+    }
+}
+
+mo5_page_stats_t mo5_page_stats(const mo5_t* sys) {
+    EMU_ASSERT(sys);
+    mo5_page_stats_t stats = { .total_pages = (int)_MO5_ATOMIC_LOAD(&_mo5_num_pages) };
+    for (int i = 0; i < MO5_RAM_PAGES; i++) {
+        if (sys->mem.page[i] && (_MO5_ATOMIC_LOAD(&sys->mem.page[i]->refs) > 1)) {
+            stats.shared_pages++;
+        } else {
+            stats.private_pages++;
+        }
+    }
+    return stats;
+}
@@ -12,18 +12,51 @@ extern "C" {
 
 #define SCREEN_WIDTH (336)  // screen width = 320 + 2 borders of 8 pixels
 #define SCREEN_HEIGHT (216) // screen height = 200 + 2 boarders of 8 pixels
-// max size of a cassette tape image
-#define MO5_MAX_TAPE_SIZE (512*1024)
 // 4x16KB
 #define MO5_MAX_CARTRIDGE_SIZE (0x10000)
 #define MO5_JOY0_BTN_MASK (0x40)
 #define MO5_JOY1_BTN_MASK (0x80)
+// duration of one video frame (312 lines of 64 cycles at 1MHz)
+#define MO5_FRAME_US (312*64)
+// RAM is split in 4KB pages which are shared copy-on-write between forks
+#define MO5_PAGE_SIZE (0x1000)
+#define MO5_RAM_SIZE (0xc000)
+#define MO5_RAM_PAGES (MO5_RAM_SIZE / MO5_PAGE_SIZE)
+// reverse execution: cycles between two periodic snapshots of the history
+#define MO5_HISTORY_INTERVAL (8*MO5_FRAME_US)
+// page flags: the machine holds the only reference and may write in place
+#define MO5_PAGE_PRIVATE (1<<0)
+// page flags: the page holds a watched address, CPU accesses take the slow path
+#define MO5_PAGE_WATCHED (1<<1)
+// page flags: the page holds an address patched by a cheat, CPU reads take the slow path
+#define MO5_PAGE_PATCHED (1<<2)
+// disk images: 4 drive units (faces) of 80 tracks with 16 sectors of 256 bytes
+#define MO5_DISK_UNITS (4)
+#define MO5_DISK_TRACKS (80)
+#define MO5_DISK_SECTORS (16)
+#define MO5_DISK_SECTOR_SIZE (256)
+#define MO5_DISK_NUM_SECTORS (MO5_DISK_UNITS * MO5_DISK_TRACKS * MO5_DISK_SECTORS)
+// .sap disk images: a header, then records of track, sector, data xored with
+// MO5_SAP_XOR and a CRC
+#define MO5_SAP_HEADER_SIZE (66)
+#define MO5_SAP_RECORD_SIZE (4 + MO5_DISK_SECTOR_SIZE + 2)
+#define MO5_SAP_XOR (0xb3)
+// text screen of the monitor: 40x25 characters of 8x8 pixels
+#define MO5_SCREEN_COLUMNS (40)
+#define MO5_SCREEN_ROWS (25)
+#define MO5_SCREEN_TEXT_SIZE (MO5_SCREEN_ROWS * (MO5_SCREEN_COLUMNS + 1) + 1)
 
 typedef struct {
   void (*func)(const float *samples, int num_samples, void *user_data);
   void *user_data;
 } chips_audio_callback_t;
 
+// receives the bytes the machine writes to tape
+typedef struct {
+  void (*func)(uint8_t byte, void *user_data);
+  void *user_data;
+} mo5_tape_out_callback_t;
+
 typedef void (*mo5_debug_func_t)(void* user_data);
 typedef struct {
     struct {
@@ -33,39 +66,143 @@ typedef struct {
     bool* stopped;
 } mo5_debug_t;
 
+// breakpoint condition compiled by mo5expr_compile() (see mo5expr.h)
+#define MO5_EXPR_MAX_CODE (48)
 typedef struct {
-  struct {
-    uint8_t cartridge[MO5_MAX_CARTRIDGE_SIZE];
-    uint8_t ram[0xc000]; // 48K
-    uint8_t port[0x40];
-    uint8_t *video;
-    uint8_t sound;
-    uint8_t *rom_bank; // rom bank or cartridge bank
-  } mem;
+  uint8_t num;          // bytecode words, 0: no condition
+  uint16_t code[MO5_EXPR_MAX_CODE];
+} mo5_expr_t;
+
+// execution breakpoint, see mo5_add_breakpoint()
+#define MO5_MAX_BREAKPOINTS (64)
+#define MO5_CONDITION_SIZE (64)
+typedef struct {
+  uint16_t pc;
+  bool enabled;
+  bool temporary;       // removed once the machine stops (step over, step out)
+  uint32_t hits;        // times the instruction was reached while enabled and the condition held
+  uint32_t break_hits;  // stop at this hit only (0: at every hit)
+  char condition[MO5_CONDITION_SIZE]; // source of cond, empty if none
+  mo5_expr_t cond;
+} mo5_breakpoint_t;
+// data watchpoint on a RAM address (0x0000..0x9fff, video RAM addresses
+// match in both banks), a CPU access stops the machine after the instruction
+#define MO5_MAX_WATCHPOINTS (16)
+#define MO5_WATCH_READ (1<<0)   // reads, including instruction fetches
+#define MO5_WATCH_WRITE (1<<1)
+// condition on the accessed value (value & mask) against the watchpoint value
+typedef enum {
+  MO5_WATCH_ANY = 0,
+  MO5_WATCH_EQUAL,
+  MO5_WATCH_NOT_EQUAL,
+  MO5_WATCH_GREATER,
+  MO5_WATCH_LESS,
+} mo5_watch_cond_t;
+typedef struct {
+  uint16_t address;
+  uint8_t access;         // MO5_WATCH_READ and/or MO5_WATCH_WRITE
+  mo5_watch_cond_t cond;
+  uint8_t value;
+  uint8_t mask;
+  bool enabled;
+  uint32_t hits;          // accesses which met the condition
+} mo5_watchpoint_t;
+// the access which stopped the machine
+typedef struct {
+  int index;              // watchpoint
+  uint16_t pc;            // instruction which accessed the address
+  uint16_t address;
+  uint8_t value;          // value read or written
+  bool write;
+  uint64_t cycle;         // machine cycle at the start of the instruction
+} mo5_watch_hit_t;
+// breakpoint table of a machine, with a bit per address for the CPU loop
+typedef struct mo5_breakpoints_t mo5_breakpoints_t;
+// cheat: a value forced at a RAM address (0x0000..0x9fff, video RAM addresses
+// are forced in the mapped bank, patched in both banks)
+#define MO5_CHEAT_NAME_SIZE (32)
+typedef enum {
+  MO5_CHEAT_FREEZE = 0,   // written at each vertical blank
+  MO5_CHEAT_PATCH,        // seen by the CPU reads, the RAM keeps the value written
+} mo5_cheat_mode_t;
+typedef struct {
+  uint16_t address;
+  uint16_t value;         // big endian for two bytes
+  bool two_bytes;
+  bool enabled;
+  mo5_cheat_mode_t mode;
+  char name[MO5_CHEAT_NAME_SIZE];
+} mo5_cheat_t;
+// cheat table of a machine, with the forced bytes sorted by address, shared
+// with forks and copied on write
+typedef struct mo5_cheats_t mo5_cheats_t;
+// instruction trace ring buffer, see mo5trace.h
+typedef struct mo5_trace_t mo5_trace_t;
+// past machine states for reverse execution, see mo5_history_start()
+typedef struct mo5_history_t mo5_history_t;
+// per address code and data coverage, see mo5cover.h
+typedef struct mo5_coverage_t mo5_coverage_t;
+
+// a reference counted media image (tape, disk or cartridge), media images
+// live outside of mo5_t and are shared between machines and snapshots
+typedef struct mo5_media_t mo5_media_t;
+// a reference counted 4KB RAM page
+typedef struct mo5_page_t mo5_page_t;
+// reference counted set of disk sectors written by the machine, kept over
+// the read-only disk image and shared copy-on-write like RAM pages
+typedef struct mo5_overlay_t mo5_overlay_t;
+
+typedef struct {
+  // hot state: touched by (almost) every instruction, keep it compact
+  mc6809e_t cpu;
+  int clocks;             // audio sample accumulator
+  uint32_t clock_excess;
+  uint64_t cycles;        // CPU cycles run since init, updated after each mo5_step()
   struct {
     uint8_t line_cycle;   // line count (0-63)
     uint16_t line_number; // video line displayed (0-311)
     uint8_t border_color; // screen border color
-    uint8_t screen[SCREEN_WIDTH * SCREEN_HEIGHT];
+    uint8_t *screen;      // framebuffer, owned by the machine
   } display;
+  struct {
+    uint8_t port[0x40];
+    uint8_t sound;
+    uint16_t video;           // RAM offset of the mapped video bank (0: color, 0x2000: shape)
+    const uint8_t *rom_bank;  // rom bank or cartridge bank
+    const uint8_t *cartridge; // cartridge image (MO5_MAX_CARTRIDGE_SIZE bytes)
+    mo5_page_t *page[MO5_RAM_PAGES];          // 48K RAM in 4K pages
+    uint8_t page_flags[MO5_RAM_PAGES];        // MO5_PAGE_* bits
+    uint32_t gen[16];         // per 4KB page of the CPU address space, see mo5_mem_generation()
+  } mem;
+  struct {
+    int type;  // cartridge type (0=simple 1=switch bank, 2=os-9)
+    int flags; // bits0,1,4=bank, 2=cart-enabled, 3=write-enabled
+    size_t size;
+    mo5_media_t *media;
+  } cartridge;
+  // cold state: media references, audio buffer, keyboard matrix, ...
   struct {
     int bit;
     int pos;
-    uint8_t buf[MO5_MAX_TAPE_SIZE];
+    const uint8_t *buf;
+    size_t size;
+    mo5_media_t *media;
+    bool fast;  // load whole blocks read by the monitor at once
+    size_t no_block; // fast load: no block starts at or after this position
+    mo5_tape_out_callback_t out;
   } tape;
   struct {
+    const uint8_t *buf;
     size_t size;
-    uint8_t buf[MO5_MAX_TAPE_SIZE];
+    const int32_t *sectors; // sector offsets in buf, owned by the media image
+    mo5_media_t *media;
+    mo5_overlay_t *overlay; // written sectors, null until the first write
   } disk;
   struct {
-    int type;  // cartridge type (0=simple 1=switch bank, 2=os-9)
-    int flags; // bits0,1,4=bank, 2=cart-enabled, 3=write-enabled
-    size_t size;
-  } cartridge;
-  struct {
-    float buffer[1024];
     int sample;
+    bool muted; // when set, no audio is sent to the callback (run-ahead)
     chips_audio_callback_t callback;
+    float buffer[1024];
   } audio;
   struct {
     uint8_t key_buffer;
@@ -85,36 +222,270 @@ typedef struct {
     uint8_t joy_action;   // joystick buttons state
     int xpen, ypen;       // lightpen coordinates
     bool penbutton;       // lightpen click
+    uint32_t key_scans;   // keyboard port reads which found a key pressed
+    uint32_t key_idle;    // keyboard port reads since the last one which found a key pressed
   } input;
+  struct {
+    int32_t pc;           // address watched by mo5_watch_pc(), -1 if none
+    bool reached;         // the instruction at pc was executed
+  } watch;
+  kbd_t kbd;
+  mo5_debug_t debug;
+  // null until the first breakpoint is set, kept by the machine over
+  // snapshots and promotions, forks and snapshots have none
+  mo5_breakpoints_t *breakpoints;
+  // null until the first cheat is added, kept by the machine over snapshots
+  // and promotions, shared with forks, snapshots have none
+  mo5_cheats_t *cheats;
+  // set by mo5trace_start(), kept by the machine over snapshots and
+  // promotions, forks and snapshots have none
+  mo5_trace_t *trace;
+  // set by mo5_history_start(), kept by the machine over snapshots and
+  // promotions, forks and snapshots have none
+  mo5_history_t *history;
+  // set by mo5cover_start(), kept by the machine over snapshots and
+  // promotions, forks and snapshots have none
+  mo5_coverage_t *coverage;
+} mo5_t;
+
+// mutable machine state for fast in-memory save/restore (run-ahead, rewind),
+// media images (tape, disk, cartridge) and the framebuffer are not included
+typedef struct {
+  struct {
+    uint8_t ram[MO5_RAM_SIZE];
+    uint8_t port[0x40];
+    uint8_t sound;
+  } mem;
+  struct {
+    uint8_t line_cycle;
+    uint16_t line_number;
+  } display;
+  struct {
+    int bit;
+    int pos;
+  } tape;
+  struct {
+    int flags;
+  } cartridge;
+  struct {
+    int sample;
+  } audio;
+  struct {
+    uint8_t joys_position;
+    uint8_t joy_action;
+    int xpen, ypen;
+    bool penbutton;
+    uint32_t key_scans;
+    uint32_t key_idle;
+  } input;
+  struct {
+    int32_t pc;
+    bool reached;
+  } watch;
   mc6809e_t cpu;
   kbd_t kbd;
   int clocks;
   uint32_t clock_excess;
+  uint64_t cycles;
+} mo5_state_t;
+
+// run-ahead: the state and what the machine sets aside between
+// mo5_speculate_begin() and mo5_speculate_end()
+typedef struct {
+  mo5_state_t state;
+  mo5_media_t *cartridge;   // referenced, cartridge writes go to a copy meanwhile
+  mo5_overlay_t *overlay;   // referenced, disk writes go to a copy meanwhile
+  mo5_tape_out_callback_t tape_out;
   mo5_debug_t debug;
-} mo5_t;
+  mo5_history_t *history;
+  mo5_coverage_t *coverage;
+  bool muted;
+} mo5_speculation_t;
+
+// media image memory owned by the host (e.g. a memory mapped file), release
+// is called once no machine or snapshot references the image anymore
+typedef struct {
+  const void *ptr;
+  size_t size;
+  void (*release)(void *user_data);
+  void *user_data;
+} mo5_media_desc_t;
 
 typedef struct {
   int8_t (*mgetc)(uint16_t);
   void (*mputc)(uint16_t, uint8_t);
   chips_audio_callback_t audio_callback;
+  mo5_tape_out_callback_t tape_out; // without it, writing to tape fails with an I/O error
   mo5_debug_t debug;
+  bool fast_tape; // instant loading of tape blocks read through the monitor
 } mo5_desc_t;
 
 void mo5_init(mo5_t *mo5, const mo5_desc_t *desc);
+// free the framebuffer and release the media images
+void mo5_discard(mo5_t *mo5);
 void mo5_reset(mo5_t *mo5);
 void mo5_prog_init(mo5_t *mo5);
 void mo5_step(mo5_t *mo5, uint32_t micro_seconds);
+// redraw the framebuffer from video RAM (e.g. after mo5_load_state)
+void mo5_draw_screen(mo5_t *mo5);
 int8_t mo5_mem_read(mo5_t *mo5, uint16_t address);
 void mo5_mem_write(mo5_t *mo5, uint16_t address, uint8_t value);
+// debugger access through the current memory mapping, without side effects:
+// no keyboard scan counting, no cartridge bank switch, no watchpoint
+uint8_t mo5_mem_peek(const mo5_t *sys, uint16_t address);
+// read num bytes from address on (wrapping at 0xffff) into dst, RAM and ROM
+// are copied a block at a time
+void mo5_mem_peek_range(const mo5_t *sys, uint16_t address, uint8_t *dst, size_t num);
+// write RAM, or the cartridge when it is write-enabled, ROM and I/O registers
+// are left unchanged
+void mo5_mem_poke(mo5_t *sys, uint16_t address, uint8_t value);
+// generation of the 4KB page holding address: it changes whenever what
+// mo5_mem_peek() returns there may have changed (writes, bank switches,
+// loaded states, the I/O page while running), to cache decoded memory
+uint32_t mo5_mem_generation(const mo5_t *sys, uint16_t address);
 gfx_display_info_t mo5_display_info(mo5_t *mo5);
 void mo5_key_down(mo5_t *sys, int key_code);
 void mo5_key_up(mo5_t *sys, int key_code);
+// watch for the CPU reaching an address (-1: stop watching), mo5_pc_reached()
+// tells whether the instruction at that address was executed since
+void mo5_watch_pc(mo5_t *sys, int pc);
+bool mo5_pc_reached(const mo5_t *sys);
+// Breakpoints are checked before each instruction by a separate CPU loop,
+// which only runs while a breakpoint, a step or a watched address is armed.
+// A stop ends mo5_step() early, before the instruction at the breakpoint,
+// which executes first when the machine runs again.
+// add a breakpoint, returns its index, -1 if the table is full
+int mo5_add_breakpoint(mo5_t *sys, uint16_t pc, bool temporary, uint32_t break_hits);
+void mo5_remove_breakpoint(mo5_t *sys, int index);
+void mo5_enable_breakpoint(mo5_t *sys, int index, bool enabled);
+// compile and set the condition of a breakpoint (empty text: none), returns
+// false and keeps the previous condition if the expression isn't valid
+bool mo5_set_breakpoint_condition(mo5_t *sys, int index, const char *text);
+int mo5_num_breakpoints(const mo5_t *sys);
+const mo5_breakpoint_t *mo5_breakpoint(const mo5_t *sys, int index);
+// stop before the next instruction
+void mo5_step_into(mo5_t *sys);
+// like mo5_step_into(), but a subroutine call (JSR, BSR, LBSR, monitor SWI)
+// runs until it returns
+void mo5_step_over(mo5_t *sys);
+// stop once the current subroutine or interrupt handler returned
+void mo5_step_out(mo5_t *sys);
+// add a data watchpoint (mask 0 is taken as 0xff), returns its index, -1 if the
+// table is full or the address isn't in RAM, watched pages are switched to a
+// checking access path, other pages keep the fast one
+int mo5_add_watchpoint(mo5_t *sys, const mo5_watchpoint_t *wp);
+void mo5_remove_watchpoint(mo5_t *sys, int index);
+void mo5_enable_watchpoint(mo5_t *sys, int index, bool enabled);
+int mo5_num_watchpoints(const mo5_t *sys);
+const mo5_watchpoint_t *mo5_watchpoint(const mo5_t *sys, int index);
+// true if the last mo5_step() stopped at a watchpoint, hit tells which access
+bool mo5_watch_hit(const mo5_t *sys, mo5_watch_hit_t *hit);
+// cancel pending steps and temporary breakpoints (machine stopped by the host)
+void mo5_break(mo5_t *sys);
+// true if the last mo5_step() stopped at a breakpoint or after a step
+bool mo5_break_hit(const mo5_t *sys);
+// Reverse execution: the history keeps snapshots of the machine (RAM pages
+// shared copy-on-write) every MO5_HISTORY_INTERVAL cycles, and whenever the
+// host changed the machine between two mo5_step() (keys, joysticks, lightpen,
+// registers, pokes, media, cheats). Going back loads the newest snapshot
+// before the target and runs the debug loop up to it, the replayed span
+// holds no input change, so no input log is needed. Disk sectors written
+// since are kept, replays use the current cheat table.
+// keep at most size bytes of snapshots (all their RAM pages counted), the
+// history restarts at the current cycle
+void mo5_history_start(mo5_t *sys, size_t size);
+void mo5_history_stop(mo5_t *sys);
+typedef struct {
+  int num_states;       // snapshots in the history
+  int max_states;
+  uint64_t first_cycle; // oldest cycle the machine can go back to
+} mo5_history_stats_t;
+mo5_history_stats_t mo5_history_stats(const mo5_t *sys);
+// go back to the start of the previous instruction, the machine is left
+// stopped there, false if the history doesn't reach it
+bool mo5_step_back(mo5_t *sys);
+// go back to the last breakpoint hit (pc and condition, hit counts are
+// ignored) or the last instruction after a watchpoint hit, false if the
+// history holds none, the machine doesn't move then
+bool mo5_reverse_continue(mo5_t *sys);
+// add a cheat, returns its index, -1 if the address isn't in RAM, the table
+// has no size limit, a byte forced by several cheats takes the latest value
+int mo5_add_cheat(mo5_t *sys, const mo5_cheat_t *cheat);
+void mo5_remove_cheat(mo5_t *sys, int index);
+void mo5_enable_cheat(mo5_t *sys, int index, bool enabled);
+void mo5_clear_cheats(mo5_t *sys);
+int mo5_num_cheats(const mo5_t *sys);
+const mo5_cheat_t *mo5_cheat(const mo5_t *sys, int index);
+// text on screen, matched against the font of the monitor: 25 lines of 40
+// characters, each ended by a newline, cells without a character are spaces,
+// buf needs MO5_SCREEN_TEXT_SIZE bytes (with the terminating zero)
+void mo5_screen_text(mo5_t *sys, char *buf);
+// snapshots share the media images with the machine, dst must be zero-initialized
+// or a previous snapshot, use mo5_discard() to release a snapshot
 bool mo5_load_snapshot(mo5_t* sys, uint32_t version, mo5_t* src);
 uint32_t mo5_save_snapshot(mo5_t* sys, mo5_t* dst);
+// save/restore the mutable machine state only (cheap, no media copies)
+void mo5_save_state(const mo5_t* sys, mo5_state_t* dst);
+void mo5_load_state(mo5_t* sys, const mo5_state_t* src);
+// run frames whose effects are thrown away (run-ahead): begin saves the
+// state and mutes the outputs (audio, tape, debug hook), end puts the
+// machine back as it was, cartridge and disk writes included; begin returns
+// false without changing anything while a breakpoint, watchpoint or step
+// could stop the machine
+bool mo5_speculate_begin(mo5_t* sys, mo5_speculation_t* spec);
+void mo5_speculate_end(mo5_t* sys, mo5_speculation_t* spec);
 // insert tape as .k7 file
 bool mo5_insert_tape(mo5_t* sys, gfx_range_t data);
+// insert disk as .fd or .sap file (.sap sectors are decoded on first read)
 bool mo5_insert_disk(mo5_t* sys, gfx_range_t data);
+// true if the data starts with a .sap header
+bool mo5_is_sap(const uint8_t* data, size_t size);
 bool mo5_insert_cartridge(mo5_t* sys, gfx_range_t data);
+// attach tape or disk images by reference, without copying and without size limit
+bool mo5_attach_tape(mo5_t* sys, const mo5_media_desc_t* desc);
+bool mo5_attach_disk(mo5_t* sys, const mo5_media_desc_t* desc);
+// content hash of a media image (0 if media is null, or if the machine wrote to it)
+uint64_t mo5_media_hash(mo5_media_t* media);
+// Disk sectors are numbered (unit * MO5_DISK_TRACKS + track) * MO5_DISK_SECTORS
+// + sector - 1, which is also their position in a .fd image.
+// take a reference to the disk overlay, null if no sector was written since
+// the disk was inserted, the machine writes to a copy of a referenced overlay
+mo5_overlay_t* mo5_disk_overlay(const mo5_t* sys);
+// replace the disk overlay (e.g. from a snapshot or a sidecar file), adds a
+// reference, null makes the disk clean again
+void mo5_set_disk_overlay(mo5_t* sys, mo5_overlay_t* overlay);
+mo5_overlay_t* mo5_overlay_create(void);
+void mo5_overlay_release(mo5_overlay_t* overlay);
+// write a sector into an overlay which isn't shared yet
+void mo5_overlay_write(mo5_overlay_t* overlay, int sector, const uint8_t* data);
+// sector content, null if the sector wasn't written
+const uint8_t* mo5_overlay_read(const mo5_overlay_t* overlay, int sector);
+// number of sector writes, changes with each write
+uint32_t mo5_overlay_generation(const mo5_overlay_t* overlay);
+// iterate the written sectors, generation tells when a sector was last written
+int mo5_overlay_num_sectors(const mo5_overlay_t* overlay);
+const uint8_t* mo5_overlay_sector(const mo5_overlay_t* overlay, int index, int* sector, uint32_t* generation);
+// pointer to a byte of RAM (offset 0x0000..0xbfff), for_write makes its page private
+// first and tells the history that the host changed the machine
+uint8_t* mo5_ram_ptr(mo5_t* sys, uint16_t offset, bool for_write);
+
+typedef struct {
+  int shared_pages;   // RAM pages shared with forks or snapshots
+  int private_pages;  // RAM pages owned by this machine alone
+  int total_pages;    // RAM pages allocated by all machines
+} mo5_page_stats_t;
+
+// Fork a machine: the fork shares all RAM pages copy-on-write and all media
+// images with sys. A fork has no framebuffer, no audio and no tape output,
+// its CPU callbacks read and write the fork itself, so forks can be stepped
+// with mo5_step() on separate threads. Neither machine may be running while forking, fork
+// must be zero-initialized or discarded, release it with mo5_discard().
+void mo5_fork(mo5_t* sys, mo5_t* fork);
+// make a fork the main machine, sys keeps its framebuffer, callbacks and debug
+// hooks, the fork is discarded
+void mo5_promote(mo5_t* sys, mo5_t* fork);
+// count shared and private RAM pages of a machine
+mo5_page_stats_t mo5_page_stats(const mo5_t* sys);
 
 #ifdef __cplusplus
 } /* extern "C" */
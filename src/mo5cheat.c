@@ -0,0 +1,125 @@
+#include "mo5cheat.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char* _mo5cheat_skip(const char* src, const char* end) {
+    while ((src < end) && ((*src == ' ') || (*src == '\t'))) {
+        src++;
+    }
+    return src;
+}
+
+// end of the word at src
+static const char* _mo5cheat_word(const char* src, const char* end) {
+    while ((src < end) && (*src != ' ') && (*src != '\t')) {
+        src++;
+    }
+    return src;
+}
+
+static bool _mo5cheat_is(const char* src, const char* word_end, const char* word) {
+    const size_t len = strlen(word);
+    return ((size_t)(word_end - src) == len) && (0 == memcmp(src, word, len));
+}
+
+// hex number filling the word, returns its number of digits, 0 if it isn't one
+static int _mo5cheat_hex(const char* src, const char* word_end, uint16_t* value) {
+    if ((src < word_end) && (*src == '$')) {
+        src++;
+    } else if (((word_end - src) > 2) && (src[0] == '0') && ((src[1] == 'x') || (src[1] == 'X'))) {
+        src += 2;
+    }
+    const int num_digits = (int)(word_end - src);
+    if ((num_digits == 0) || (num_digits > 4)) {
+        return 0;
+    }
+    uint16_t v = 0;
+    for (; src < word_end; src++) {
+        if (!isxdigit((unsigned char)*src)) {
+            return 0;
+        }
+        const int c = tolower((unsigned char)*src);
+        v = (uint16_t)((v << 4) | ((c <= '9') ? (c - '0') : (c - 'a' + 10)));
+    }
+    *value = v;
+    return num_digits;
+}
+
+static bool _mo5cheat_line(mo5_t* sys, const char* src, const char* end) {
+    mo5_cheat_t cheat = { .enabled = true, .mode = MO5_CHEAT_FREEZE };
+    const char* word_end = _mo5cheat_word(src, end);
+    if (0 == _mo5cheat_hex(src, word_end, &cheat.address)) {
+        return false;
+    }
+    src = _mo5cheat_skip(word_end, end);
+    word_end = _mo5cheat_word(src, end);
+    const int num_digits = _mo5cheat_hex(src, word_end, &cheat.value);
+    if (0 == num_digits) {
+        return false;
+    }
+    cheat.two_bytes = num_digits > 2;
+    for (;;) {
+        src = _mo5cheat_skip(word_end, end);
+        word_end = _mo5cheat_word(src, end);
+        if (_mo5cheat_is(src, word_end, "freeze")) {
+            cheat.mode = MO5_CHEAT_FREEZE;
+        } else if (_mo5cheat_is(src, word_end, "patch")) {
+            cheat.mode = MO5_CHEAT_PATCH;
+        } else if (_mo5cheat_is(src, word_end, "off")) {
+            cheat.enabled = false;
+        } else {
+            break;
+        }
+    }
+    size_t len = (size_t)(end - src);
+    if (len >= MO5_CHEAT_NAME_SIZE) {
+        len = MO5_CHEAT_NAME_SIZE - 1;
+    }
+    memcpy(cheat.name, src, len);
+    return mo5_add_cheat(sys, &cheat) >= 0;
+}
+
+bool mo5cheat_load(mo5_t* sys, const char* text, size_t size, int* error_line) {
+    const char* end = text + size;
+    const char* src = text;
+    for (int line = 1; src < end; line++) {
+        const char* eol = (const char*) memchr(src, '\n', (size_t)(end - src));
+        if (!eol) {
+            eol = end;
+        }
+        const char* line_end = eol;
+        while ((line_end > src) && ((line_end[-1] == '\r') || (line_end[-1] == ' ') || (line_end[-1] == '\t'))) {
+            line_end--;
+        }
+        src = _mo5cheat_skip(src, line_end);
+        if ((src < line_end) && (*src != '#') && (*src != ';') && !_mo5cheat_line(sys, src, line_end)) {
+            if (error_line) {
+                *error_line = line;
+            }
+            return false;
+        }
+        src = eol + 1;
+    }
+    return true;
+}
+
+size_t mo5cheat_save(const mo5_t* sys, char* buf, size_t size) {
+    size_t len = 0;
+    if (size > 0) {
+        buf[0] = 0;
+    }
+    for (int i = 0; i < mo5_num_cheats(sys); i++) {
+        const mo5_cheat_t* cheat = mo5_cheat(sys, i);
+        const int n = snprintf((len < size) ? (buf + len) : 0, (len < size) ? (size - len) : 0,
+            cheat->two_bytes ? "%04X %04X %s%s%s%s\n" : "%04X %02X %s%s%s%s\n",
+            cheat->address,
+            cheat->value,
+            (cheat->mode == MO5_CHEAT_PATCH) ? "patch" : "freeze",
+            cheat->enabled ? "" : " off",
+            cheat->name[0] ? " " : "",
+            cheat->name);
+        len += (size_t)n;
+    }
+    return len;
+}
@@ -0,0 +1,32 @@
+#pragma once
+/*
+    Cheat files: the cheat table of a machine as text, one cheat per line.
+
+        # lives, frozen at each frame
+        2C10 05 lives
+        2C12 0100 patch off score
+
+    A line holds the address and the value in hex ($ or 0x prefixes are
+    accepted), a value of more than 2 digits forces two bytes (big endian).
+    The optional words "freeze" (default) or "patch" select how the value
+    is forced (see mo5_cheat_mode_t), "off" adds the cheat disabled, the
+    rest of the line names the cheat. Empty lines and lines starting with
+    '#' or ';' are skipped.
+*/
+#include "mo5.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// add the cheats of a cheat file to the machine, returns false on the first
+// line which isn't a valid cheat (the cheats before it are kept), its number
+// goes to error_line (optional)
+bool mo5cheat_load(mo5_t* sys, const char* text, size_t size, int* error_line);
+// write the cheat table as a cheat file, returns the length of the text,
+// which is cut to size like with snprintf
+size_t mo5cheat_save(const mo5_t* sys, char* buf, size_t size);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
@@ -0,0 +1,65 @@
+#include "mo5cover.h"
+#include "mo5trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+void mo5cover_start(mo5_t* sys) {
+    assert(sys);
+    if (!sys->coverage) {
+        sys->coverage = (mo5_coverage_t*) malloc(sizeof(mo5_coverage_t));
+        assert(sys->coverage);
+    }
+    mo5cover_clear(sys->coverage);
+}
+
+void mo5cover_stop(mo5_t* sys) {
+    assert(sys);
+    free(sys->coverage);
+    sys->coverage = 0;
+}
+
+void mo5cover_clear(mo5_coverage_t* cover) {
+    assert(cover);
+    memset(cover, 0, sizeof(mo5_coverage_t));
+}
+
+void mo5cover_op(mo5_coverage_t* cover, uint16_t pc, const uint8_t* bytes, uint64_t cycle) {
+    const int size = mo5trace_op_size(bytes);
+    cover->op_pc = pc;
+    cover->op_size = (uint16_t)size;
+    cover->op_cycle = cycle;
+    cover->flags[pc] |= MO5COVER_OPCODE;
+    cover->hits[pc]++;
+    cover->cycle[pc] = cycle;
+    for (int i = 1; i < size; i++) {
+        const uint16_t address = (uint16_t)(pc + i);
+        cover->flags[address] |= MO5COVER_OPERAND;
+        cover->cycle[address] = cycle;
+    }
+}
+
+int mo5cover_hottest(const mo5_coverage_t* cover, uint16_t* addresses, int num) {
+    assert(cover && addresses);
+    if (num <= 0) {
+        return 0;
+    }
+    int found = 0;
+    for (int address = 0; address < MO5COVER_SIZE; address++) {
+        if (0 == (cover->flags[address] & MO5COVER_OPCODE)) {
+            continue;
+        }
+        const uint32_t hits = cover->hits[address];
+        if ((found == num) && (hits <= cover->hits[addresses[num - 1]])) {
+            continue;
+        }
+        // insertion into the sorted list, the coldest falls off
+        int i = (found < num) ? found++ : (num - 1);
+        while ((i > 0) && (cover->hits[addresses[i - 1]] < hits)) {
+            addresses[i] = addresses[i - 1];
+            i--;
+        }
+        addresses[i] = (uint16_t)address;
+    }
+    return found;
+}
@@ -0,0 +1,67 @@
+#pragma once
+/*
+    Code and data coverage: for each CPU address, whether it was executed as
+    an opcode or as an operand, read or written, how often, and the cycle of
+    its last access. It shows which ROM and cartridge code is hot, which RAM
+    a game uses, and where instructions start for the disassembler.
+
+    Coverage is kept in flat 64KB arrays by the debug CPU loop: the bytes of
+    each instruction are marked before it runs, and the CPU memory callbacks
+    are wrapped during the run to mark the data accesses (reads of the
+    instruction's own bytes are fetches). Machines without coverage run the
+    plain loop and callbacks.
+
+    Addresses are CPU addresses, whatever is mapped there (cartridge bank,
+    video bank). Host accesses (mo5_mem_peek(), mo5_mem_poke()) and the
+    blocks copied by the fast tape loader aren't counted.
+*/
+#include "mo5.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MO5COVER_SIZE (0x10000)
+
+// flags of an address
+#define MO5COVER_OPCODE (1<<0)      // an instruction started here
+#define MO5COVER_OPERAND (1<<1)     // byte of an instruction, after its opcode
+#define MO5COVER_READ (1<<2)
+#define MO5COVER_WRITE (1<<3)
+
+struct mo5_coverage_t {
+    uint8_t flags[MO5COVER_SIZE];
+    uint32_t hits[MO5COVER_SIZE];   // instructions started at an opcode, data accesses elsewhere
+    uint64_t cycle[MO5COVER_SIZE];  // start of the last instruction running or accessing the address
+    // instruction being executed, reads of its bytes are fetches
+    uint16_t op_pc;
+    uint16_t op_size;
+    uint64_t op_cycle;
+    // memory callbacks of the machine, wrapped while the debug loop runs
+    int8_t (*mgetc)(uint16_t);
+    void (*mputc)(uint16_t, uint8_t);
+};
+
+// start counting from scratch (also clears a running coverage)
+void mo5cover_start(mo5_t* sys);
+void mo5cover_stop(mo5_t* sys);
+void mo5cover_clear(mo5_coverage_t* cover);
+// called by the machine before each instruction, bytes holds 5 bytes from
+// pc on
+void mo5cover_op(mo5_coverage_t* cover, uint16_t pc, const uint8_t* bytes, uint64_t cycle);
+// called by the wrapped CPU memory callbacks
+static inline void mo5cover_access(mo5_coverage_t* cover, uint16_t address, bool write) {
+    if (!write && ((uint16_t)(address - cover->op_pc) < cover->op_size)) {
+        return;
+    }
+    cover->flags[address] |= write ? MO5COVER_WRITE : MO5COVER_READ;
+    cover->hits[address]++;
+    cover->cycle[address] = cover->op_cycle;
+}
+// the addresses executed as opcodes with the most hits, the hottest first,
+// returns how many were found (up to num)
+int mo5cover_hottest(const mo5_coverage_t* cover, uint16_t* addresses, int num);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
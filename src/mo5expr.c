@@ -0,0 +1,253 @@
+#include "mo5expr.h"
+#include <ctype.h>
+#include <string.h>
+
+typedef struct {
+    const char* name;
+    int prec;               // binding strength, higher binds tighter
+    mo5expr_op_t op;
+} _mo5expr_binop_t;
+
+// longer operators first, so "<=" isn't read as "<"
+static const _mo5expr_binop_t _mo5expr_binops[] = {
+    { "||", 1, MO5EXPR_OR_ELSE },
+    { "&&", 2, MO5EXPR_AND_ELSE },
+    { "==", 6, MO5EXPR_EQ },
+    { "!=", 6, MO5EXPR_NE },
+    { "<=", 7, MO5EXPR_LE },
+    { ">=", 7, MO5EXPR_GE },
+    { "|", 3, MO5EXPR_BIT_OR },
+    { "^", 4, MO5EXPR_BIT_XOR },
+    { "&", 5, MO5EXPR_BIT_AND },
+    { "<", 7, MO5EXPR_LT },
+    { ">", 7, MO5EXPR_GT },
+    { "+", 8, MO5EXPR_ADD },
+    { "-", 8, MO5EXPR_SUB },
+    { "*", 9, MO5EXPR_MUL },
+    { "/", 9, MO5EXPR_DIV },
+    { "%", 9, MO5EXPR_MOD },
+};
+
+static const struct {
+    const char* name;
+    mo5expr_op_t op;
+} _mo5expr_operands[] = {
+    { "a", MO5EXPR_REG_A },
+    { "b", MO5EXPR_REG_B },
+    { "d", MO5EXPR_REG_D },
+    { "x", MO5EXPR_REG_X },
+    { "y", MO5EXPR_REG_Y },
+    { "u", MO5EXPR_REG_U },
+    { "s", MO5EXPR_REG_S },
+    { "pc", MO5EXPR_REG_PC },
+    { "cc", MO5EXPR_REG_CC },
+    { "dp", MO5EXPR_REG_DP },
+    { "line_number", MO5EXPR_LINE_NUMBER },
+    { "line_cycle", MO5EXPR_LINE_CYCLE },
+};
+
+typedef struct _mo5expr_parser_t _mo5expr_parser_t;
+static void _mo5expr_binary(_mo5expr_parser_t* p, int min_prec);
+
+struct _mo5expr_parser_t {
+    const char* src;
+    mo5_expr_t* expr;
+    int depth;              // evaluation stack depth after the code emitted so far
+    int last;               // start of the last instruction, -1 at a jump target
+    bool error;
+};
+
+static void _mo5expr_emit_word(_mo5expr_parser_t* p, uint16_t word) {
+    if (p->expr->num == MO5_EXPR_MAX_CODE) {
+        p->error = true;
+        return;
+    }
+    p->expr->code[p->expr->num++] = word;
+}
+
+static void _mo5expr_emit(_mo5expr_parser_t* p, mo5expr_op_t op, int depth_change) {
+    p->last = p->expr->num;
+    _mo5expr_emit_word(p, (uint16_t)op);
+    p->depth += depth_change;
+    if (p->depth > MO5EXPR_MAX_DEPTH) {
+        p->error = true;
+    }
+}
+
+// the last instruction pushes a constant, returns its index
+static int _mo5expr_last_push(const _mo5expr_parser_t* p) {
+    if ((p->last >= 0) && ((p->last + 2) == p->expr->num) && (p->expr->code[p->last] == MO5EXPR_PUSH)) {
+        return p->last;
+    }
+    return -1;
+}
+
+// emit an operator which consumes the top of the stack, with a constant
+// operand it is rewritten in place into its immediate form
+static void _mo5expr_emit_op(_mo5expr_parser_t* p, mo5expr_op_t op, int depth_change) {
+    const int k = _mo5expr_last_push(p);
+    if ((k >= 0) && (op == MO5EXPR_PEEK)) {
+        p->expr->code[k] = MO5EXPR_PEEK_K;
+    } else if ((k >= 0) && (op >= MO5EXPR_BIT_OR) && (op <= MO5EXPR_MOD)) {
+        p->expr->code[k] = (uint16_t)(op - MO5EXPR_BIT_OR + MO5EXPR_BIT_OR_K);
+        p->depth--;
+    } else {
+        _mo5expr_emit(p, op, depth_change);
+    }
+}
+
+// the right side of && or ||: a jump over it, patched to the end
+static void _mo5expr_logical(_mo5expr_parser_t* p, mo5expr_op_t op, int prec) {
+    _mo5expr_emit(p, op, -1);
+    const int target = p->expr->num;
+    _mo5expr_emit_word(p, 0);
+    _mo5expr_binary(p, prec + 1);
+    _mo5expr_emit(p, MO5EXPR_BOOL, 0);
+    if (!p->error) {
+        p->expr->code[target] = p->expr->num;
+        p->last = -1;
+    }
+}
+
+static void _mo5expr_skip(_mo5expr_parser_t* p) {
+    while (isspace((unsigned char)*p->src)) {
+        p->src++;
+    }
+}
+
+static bool _mo5expr_accept(_mo5expr_parser_t* p, char c) {
+    _mo5expr_skip(p);
+    if (*p->src == c) {
+        p->src++;
+        return true;
+    }
+    return false;
+}
+
+static void _mo5expr_number(_mo5expr_parser_t* p) {
+    int base = 10;
+    if ((p->src[0] == '0') && ((p->src[1] == 'x') || (p->src[1] == 'X'))) {
+        base = 16;
+        p->src += 2;
+    } else if (p->src[0] == '$') {
+        base = 16;
+        p->src++;
+    }
+    long value = 0;
+    int num_digits = 0;
+    for (;;) {
+        const char c = (char)tolower((unsigned char)*p->src);
+        int digit;
+        if ((c >= '0') && (c <= '9')) {
+            digit = c - '0';
+        } else if ((base == 16) && (c >= 'a') && (c <= 'f')) {
+            digit = c - 'a' + 10;
+        } else {
+            break;
+        }
+        value = value * base + digit;
+        if (value > 0xffff) {
+            p->error = true;
+            return;
+        }
+        num_digits++;
+        p->src++;
+    }
+    if (num_digits == 0) {
+        p->error = true;
+        return;
+    }
+    _mo5expr_emit(p, MO5EXPR_PUSH, 1);
+    _mo5expr_emit_word(p, (uint16_t)value);
+}
+
+static void _mo5expr_operand(_mo5expr_parser_t* p) {
+    const char* start = p->src;
+    while (isalnum((unsigned char)*p->src) || (*p->src == '_')) {
+        p->src++;
+    }
+    const size_t len = (size_t)(p->src - start);
+    const int num_operands = (int)(sizeof(_mo5expr_operands) / sizeof(_mo5expr_operands[0]));
+    for (int i = 0; i < num_operands; i++) {
+        const char* name = _mo5expr_operands[i].name;
+        size_t j = 0;
+        while ((j < len) && name[j] && (tolower((unsigned char)start[j]) == name[j])) {
+            j++;
+        }
+        if ((j == len) && (name[j] == 0)) {
+            _mo5expr_emit(p, _mo5expr_operands[i].op, 1);
+            return;
+        }
+    }
+    p->error = true;
+}
+
+static void _mo5expr_unary(_mo5expr_parser_t* p) {
+    _mo5expr_skip(p);
+    const char c = *p->src;
+    if ((c == '!') || (c == '~') || (c == '-')) {
+        p->src++;
+        _mo5expr_unary(p);
+        _mo5expr_emit_op(p, (c == '!') ? MO5EXPR_NOT : ((c == '~') ? MO5EXPR_COMPL : MO5EXPR_NEG), 0);
+    } else if (c == '(') {
+        p->src++;
+        _mo5expr_binary(p, 1);
+        p->error |= !_mo5expr_accept(p, ')');
+    } else if (c == '[') {
+        p->src++;
+        _mo5expr_binary(p, 1);
+        p->error |= !_mo5expr_accept(p, ']');
+        _mo5expr_emit_op(p, MO5EXPR_PEEK, 0);
+    } else if (isdigit((unsigned char)c) || (c == '$')) {
+        _mo5expr_number(p);
+    } else if (isalpha((unsigned char)c) || (c == '_')) {
+        _mo5expr_operand(p);
+    } else {
+        p->error = true;
+    }
+}
+
+// precedence climbing: operands, then operators binding at least min_prec
+static void _mo5expr_binary(_mo5expr_parser_t* p, int min_prec) {
+    _mo5expr_unary(p);
+    while (!p->error) {
+        _mo5expr_skip(p);
+        const _mo5expr_binop_t* binop = 0;
+        const int num_binops = (int)(sizeof(_mo5expr_binops) / sizeof(_mo5expr_binops[0]));
+        for (int i = 0; i < num_binops; i++) {
+            const size_t len = strlen(_mo5expr_binops[i].name);
+            if (0 == strncmp(p->src, _mo5expr_binops[i].name, len)) {
+                binop = &_mo5expr_binops[i];
+                break;
+            }
+        }
+        if (!binop || (binop->prec < min_prec)) {
+            return;
+        }
+        p->src += strlen(binop->name);
+        if ((binop->op == MO5EXPR_AND_ELSE) || (binop->op == MO5EXPR_OR_ELSE)) {
+            _mo5expr_logical(p, binop->op, binop->prec);
+        } else {
+            _mo5expr_binary(p, binop->prec + 1);
+            _mo5expr_emit_op(p, binop->op, -1);
+        }
+    }
+}
+
+bool mo5expr_compile(const char* text, mo5_expr_t* expr) {
+    mo5_expr_t code = {0};
+    _mo5expr_parser_t p = { .src = text, .expr = &code, .last = -1 };
+    _mo5expr_skip(&p);
+    if (*p.src) {
+        _mo5expr_binary(&p, 1);
+        _mo5expr_skip(&p);
+        if (*p.src) {
+            p.error = true;
+        }
+    }
+    if (p.error) {
+        return false;
+    }
+    *expr = code;
+    return true;
+}
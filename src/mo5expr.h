@@ -0,0 +1,94 @@
+#pragma once
+/*
+    Breakpoint conditions: C-like expressions over the CPU registers, the
+    memory and the video counters, compiled once into a small stack bytecode
+    which the machine evaluates each time the breakpoint is reached.
+
+    Operands:
+        42, 0x2c10, $2c10       numbers (0..65535)
+        A B D X Y U S PC CC DP  CPU registers (case insensitive)
+        [address]               memory byte, read without side effects
+        line_number line_cycle  video counters (0..311, 0..63)
+
+    Operators, by increasing precedence: || && | ^ & == != < <= > >= + -
+    * / % and the unary ! ~ -, with parentheses. Like in C, comparisons
+    give 0 or 1, && and || don't evaluate their right side when the left
+    one decides, any non-zero result stops the machine. Arithmetic is on
+    32-bit signed integers and wraps around on overflow.
+
+    Constant operands are folded into the instruction using them (A==0x20
+    is two instructions, [0x2C10] is one), so a typical condition costs a
+    handful of dispatches when its breakpoint is reached.
+
+    A==0x20 && [0x2C10]>3 && line_number<56
+*/
+#include "mo5.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// deepest evaluation stack of a compiled expression
+#define MO5EXPR_MAX_DEPTH (16)
+
+// bytecode, an operand follows MO5EXPR_PUSH, MO5EXPR_PEEK_K, the jumps
+// (code index) and the *_K forms of the binary operators (right operand)
+typedef enum {
+    MO5EXPR_PUSH = 0,
+    MO5EXPR_REG_A,
+    MO5EXPR_REG_B,
+    MO5EXPR_REG_D,
+    MO5EXPR_REG_X,
+    MO5EXPR_REG_Y,
+    MO5EXPR_REG_U,
+    MO5EXPR_REG_S,
+    MO5EXPR_REG_PC,
+    MO5EXPR_REG_CC,
+    MO5EXPR_REG_DP,
+    MO5EXPR_LINE_NUMBER,
+    MO5EXPR_LINE_CYCLE,
+    MO5EXPR_PEEK,
+    MO5EXPR_PEEK_K,
+    MO5EXPR_NOT,
+    MO5EXPR_COMPL,
+    MO5EXPR_NEG,
+    MO5EXPR_BOOL,           // 0 or 1
+    MO5EXPR_AND_ELSE,       // 0 on the stack: jump, else pop it
+    MO5EXPR_OR_ELSE,        // not 0 on the stack: make it 1 and jump, else pop it
+    MO5EXPR_BIT_OR,
+    MO5EXPR_BIT_XOR,
+    MO5EXPR_BIT_AND,
+    MO5EXPR_EQ,
+    MO5EXPR_NE,
+    MO5EXPR_LT,
+    MO5EXPR_LE,
+    MO5EXPR_GT,
+    MO5EXPR_GE,
+    MO5EXPR_ADD,
+    MO5EXPR_SUB,
+    MO5EXPR_MUL,
+    MO5EXPR_DIV,
+    MO5EXPR_MOD,
+    MO5EXPR_BIT_OR_K,       // same order as MO5EXPR_BIT_OR..MO5EXPR_MOD
+    MO5EXPR_BIT_XOR_K,
+    MO5EXPR_BIT_AND_K,
+    MO5EXPR_EQ_K,
+    MO5EXPR_NE_K,
+    MO5EXPR_LT_K,
+    MO5EXPR_LE_K,
+    MO5EXPR_GT_K,
+    MO5EXPR_GE_K,
+    MO5EXPR_ADD_K,
+    MO5EXPR_SUB_K,
+    MO5EXPR_MUL_K,
+    MO5EXPR_DIV_K,
+    MO5EXPR_MOD_K,
+} mo5expr_op_t;
+
+// compile an expression, an empty text gives an empty expression (always
+// true), returns false on a syntax error or if the expression is too long
+bool mo5expr_compile(const char* text, mo5_expr_t* expr);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
@@ -0,0 +1,129 @@
+#include "mo5search.h"
+#include <string.h>
+#include <assert.h>
+
+// snapshots are taken a RAM page at a time, one extra byte for the low byte
+// of a 16 bits value at the end of the page
+#define _MO5SEARCH_PAGE (0x1000)
+#define _MO5SEARCH_WORDS_PER_PAGE (_MO5SEARCH_PAGE / 64)
+
+static int _mo5search_popcount(uint64_t bits) {
+    bits = bits - ((bits >> 1) & 0x5555555555555555ull);
+    bits = (bits & 0x3333333333333333ull) + ((bits >> 2) & 0x3333333333333333ull);
+    bits = (bits + (bits >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    return (int)((bits * 0x0101010101010101ull) >> 56);
+}
+
+static void _mo5search_count(mo5search_t* search) {
+    int num = 0;
+    for (int i = 0; i < (MO5SEARCH_SIZE / 64); i++) {
+        search->rank[i] = (uint16_t)num;
+        num += _mo5search_popcount(search->candidates[i]);
+    }
+    search->num_candidates = num;
+}
+
+// bit i set where the value at i compares to the reference, the loops have
+// no branch so compilers turn them into vector code
+static uint64_t _mo5search_match(const uint8_t* cur, const uint8_t* prev, bool two_bytes, mo5search_op_t op, mo5search_ref_t ref, int k) {
+    const int mask = two_bytes ? 0xffff : 0xff;
+    const int prev_mask = (ref == MO5SEARCH_PREVIOUS) ? -1 : 0;
+    int value[64];
+    int other[64];
+    if (two_bytes) {
+        for (int i = 0; i < 64; i++) {
+            value[i] = (cur[i] << 8) | cur[i + 1];
+            other[i] = ((((prev[i] << 8) | prev[i + 1]) & prev_mask) + k) & mask;
+        }
+    } else {
+        for (int i = 0; i < 64; i++) {
+            value[i] = cur[i];
+            other[i] = ((prev[i] & prev_mask) + k) & mask;
+        }
+    }
+    uint64_t bits = 0;
+    switch (op) {
+    case MO5SEARCH_EQ:
+        for (int i = 0; i < 64; i++) bits |= (uint64_t)(value[i] == other[i]) << i;
+        break;
+    case MO5SEARCH_NE:
+        for (int i = 0; i < 64; i++) bits |= (uint64_t)(value[i] != other[i]) << i;
+        break;
+    case MO5SEARCH_LT:
+        for (int i = 0; i < 64; i++) bits |= (uint64_t)(value[i] < other[i]) << i;
+        break;
+    case MO5SEARCH_LE:
+        for (int i = 0; i < 64; i++) bits |= (uint64_t)(value[i] <= other[i]) << i;
+        break;
+    case MO5SEARCH_GT:
+        for (int i = 0; i < 64; i++) bits |= (uint64_t)(value[i] > other[i]) << i;
+        break;
+    case MO5SEARCH_GE:
+        for (int i = 0; i < 64; i++) bits |= (uint64_t)(value[i] >= other[i]) << i;
+        break;
+    }
+    return bits;
+}
+
+void mo5search_start(mo5search_t* search, const mo5_t* sys, bool two_bytes) {
+    assert(search && sys);
+    search->started = true;
+    search->two_bytes = two_bytes;
+    mo5_mem_peek_range(sys, 0, search->prev, sizeof(search->prev));
+    memset(search->candidates, 0xff, sizeof(search->candidates));
+    if (two_bytes) {
+        // the low byte at 0xa000 isn't RAM
+        search->candidates[(MO5SEARCH_SIZE / 64) - 1] &= ~(1ull << 63);
+    }
+    _mo5search_count(search);
+}
+
+void mo5search_filter(mo5search_t* search, const mo5_t* sys, mo5search_op_t op, mo5search_ref_t ref, int k) {
+    assert(search && search->started && sys);
+    uint8_t cur[_MO5SEARCH_PAGE + 1];
+    for (int base = 0; base < MO5SEARCH_SIZE; base += _MO5SEARCH_PAGE) {
+        mo5_mem_peek_range(sys, (uint16_t)base, cur, sizeof(cur));
+        uint64_t* candidates = &search->candidates[base / 64];
+        for (int i = 0; i < _MO5SEARCH_WORDS_PER_PAGE; i++) {
+            if (candidates[i]) {
+                candidates[i] &= _mo5search_match(&cur[i * 64], &search->prev[base + i * 64], search->two_bytes, op, ref, k);
+            }
+        }
+        // the extra byte is still the previous value for the next page
+        memcpy(&search->prev[base], cur, _MO5SEARCH_PAGE);
+    }
+    search->prev[MO5SEARCH_SIZE] = cur[_MO5SEARCH_PAGE];
+    _mo5search_count(search);
+}
+
+uint16_t mo5search_candidate(const mo5search_t* search, int n) {
+    assert(search && (n >= 0) && (n < search->num_candidates));
+    // last word with at most n candidates before it
+    int lo = 0;
+    int hi = (MO5SEARCH_SIZE / 64) - 1;
+    while (lo < hi) {
+        const int mid = (lo + hi + 1) / 2;
+        if (search->rank[mid] <= n) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    uint64_t bits = search->candidates[lo];
+    for (int i = n - search->rank[lo]; i > 0; i--) {
+        bits &= bits - 1;
+    }
+    int bit = 0;
+    while (0 == (bits & (1ull << bit))) {
+        bit++;
+    }
+    return (uint16_t)(lo * 64 + bit);
+}
+
+uint16_t mo5search_prev(const mo5search_t* search, uint16_t address) {
+    assert(search && (address < MO5SEARCH_SIZE));
+    if (search->two_bytes) {
+        return (uint16_t)((search->prev[address] << 8) | search->prev[address + 1]);
+    }
+    return search->prev[address];
+}
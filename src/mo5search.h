@@ -0,0 +1,65 @@
+#pragma once
+/*
+    Value search for cheats: find the RAM addresses holding a value (lives,
+    energy, score...) by narrowing down candidates over successive searches.
+
+    A search starts with all CPU RAM addresses (0x0000..0x9fff, video RAM in
+    its mapped bank) as candidates and a snapshot of the RAM. Each filter
+    takes a new snapshot and keeps the candidates whose value compares to a
+    constant, or to the previous snapshot plus a constant:
+
+        changed     MO5SEARCH_NE, MO5SEARCH_PREVIOUS, 0
+        unchanged   MO5SEARCH_EQ, MO5SEARCH_PREVIOUS, 0
+        increased   MO5SEARCH_GT, MO5SEARCH_PREVIOUS, 0
+        one less    MO5SEARCH_EQ, MO5SEARCH_PREVIOUS, -1
+
+    Values are 8 bits or 16 bits big endian, arithmetic wraps around like on
+    the 6809. Candidates are kept as a bitset, with a running count per 64
+    addresses so the n-th one is found quickly by a list showing a window
+    of the results.
+*/
+#include "mo5.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// searched CPU addresses
+#define MO5SEARCH_SIZE (0xa000)
+
+typedef enum {
+    MO5SEARCH_EQ,
+    MO5SEARCH_NE,
+    MO5SEARCH_LT,
+    MO5SEARCH_LE,
+    MO5SEARCH_GT,
+    MO5SEARCH_GE,
+} mo5search_op_t;
+
+// what values are compared to
+typedef enum {
+    MO5SEARCH_CONSTANT,     // k
+    MO5SEARCH_PREVIOUS,     // value at the previous search + k
+} mo5search_ref_t;
+
+typedef struct {
+    bool started;
+    bool two_bytes;
+    int num_candidates;
+    uint8_t prev[MO5SEARCH_SIZE + 1];       // RAM at the last search, +1 for the low byte at 0x9fff
+    uint64_t candidates[MO5SEARCH_SIZE / 64];
+    uint16_t rank[MO5SEARCH_SIZE / 64];     // candidates before each word of the bitset
+} mo5search_t;
+
+// all addresses are candidates, take the first snapshot
+void mo5search_start(mo5search_t* search, const mo5_t* sys, bool two_bytes);
+// keep the candidates matching, the new snapshot becomes the previous one
+void mo5search_filter(mo5search_t* search, const mo5_t* sys, mo5search_op_t op, mo5search_ref_t ref, int k);
+// address of the n-th candidate (0..num_candidates-1)
+uint16_t mo5search_candidate(const mo5search_t* search, int n);
+// value at an address in the last snapshot
+uint16_t mo5search_prev(const mo5search_t* search, uint16_t address);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
@@ -0,0 +1,627 @@
+#include "mo5snap.h"
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#define _MO5SNAP_TAG(a,b,c,d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+#define _MO5SNAP_MAGIC _MO5SNAP_TAG('M','O','5','S')
+#define _MO5SNAP_HEADER_SIZE (8)
+#define _MO5SNAP_ENTRY_SIZE (20)
+#define _MO5SNAP_MAX_CHUNKS (64)
+// chunk flags
+#define _MO5SNAP_COMPRESSED (1<<0)
+// largest decompressed chunk, DWRT with every disk sector written, the size
+// comes from the file and is checked before anything is allocated
+#define _MO5SNAP_MAX_RAW_SIZE (4 + MO5_DISK_NUM_SECTORS * (2 + MO5_DISK_SECTOR_SIZE))
+
+// LZ compression: 4K entry hash table, 64K window, matches of at least 4 bytes
+#define _MO5SNAP_LZ_HASH_BITS (12)
+#define _MO5SNAP_LZ_MIN_MATCH (4)
+#define _MO5SNAP_LZ_MAX_OFFSET (0xffff)
+
+static const struct {
+    uint32_t tag;
+    uint32_t bit;
+} _mo5snap_chunks[] = {
+    { _MO5SNAP_TAG('C','P','U',' '), MO5SNAP_CHUNK_CPU },
+    { _MO5SNAP_TAG('R','A','M',' '), MO5SNAP_CHUNK_RAM },
+    { _MO5SNAP_TAG('P','O','R','T'), MO5SNAP_CHUNK_PORTS },
+    { _MO5SNAP_TAG('D','I','S','P'), MO5SNAP_CHUNK_DISPLAY },
+    { _MO5SNAP_TAG('C','A','R','T'), MO5SNAP_CHUNK_CARTRIDGE },
+    { _MO5SNAP_TAG('C','I','M','G'), MO5SNAP_CHUNK_CARTIMAGE },
+    { _MO5SNAP_TAG('T','A','P','E'), MO5SNAP_CHUNK_TAPE },
+    { _MO5SNAP_TAG('M','E','D','A'), MO5SNAP_CHUNK_MEDIA },
+    { _MO5SNAP_TAG('C','L','C','K'), MO5SNAP_CHUNK_CLOCKS },
+    { _MO5SNAP_TAG('I','N','P','T'), MO5SNAP_CHUNK_INPUT },
+    { _MO5SNAP_TAG('D','W','R','T'), MO5SNAP_CHUNK_DISKWRITE },
+};
+#define _MO5SNAP_NUM_CHUNK_TYPES (sizeof(_mo5snap_chunks) / sizeof(_mo5snap_chunks[0]))
+
+// growable little-endian output buffer
+typedef struct {
+    uint8_t* ptr;
+    size_t size;
+    size_t cap;
+} _mo5snap_writer_t;
+
+static uint8_t* _mo5snap_reserve(_mo5snap_writer_t* w, size_t num) {
+    if ((w->size + num) > w->cap) {
+        size_t cap = w->cap ? w->cap * 2 : 1024;
+        while (cap < (w->size + num)) {
+            cap *= 2;
+        }
+        w->ptr = (uint8_t*) realloc(w->ptr, cap);
+        assert(w->ptr);
+        w->cap = cap;
+    }
+    uint8_t* p = w->ptr + w->size;
+    w->size += num;
+    return p;
+}
+
+static void _mo5snap_put_bytes(_mo5snap_writer_t* w, const void* src, size_t num) {
+    memcpy(_mo5snap_reserve(w, num), src, num);
+}
+
+static void _mo5snap_put8(_mo5snap_writer_t* w, uint8_t v) {
+    *_mo5snap_reserve(w, 1) = v;
+}
+
+static void _mo5snap_put16(_mo5snap_writer_t* w, uint16_t v) {
+    uint8_t* p = _mo5snap_reserve(w, 2);
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void _mo5snap_put32(_mo5snap_writer_t* w, uint32_t v) {
+    uint8_t* p = _mo5snap_reserve(w, 4);
+    for (int i = 0; i < 4; i++) {
+        p[i] = (uint8_t)(v >> (i * 8));
+    }
+}
+
+static void _mo5snap_put64(_mo5snap_writer_t* w, uint64_t v) {
+    _mo5snap_put32(w, (uint32_t)v);
+    _mo5snap_put32(w, (uint32_t)(v >> 32));
+}
+
+static void _mo5snap_patch32(_mo5snap_writer_t* w, size_t pos, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        w->ptr[pos + i] = (uint8_t)(v >> (i * 8));
+    }
+}
+
+// bounds checked little-endian input, reads past the end return zeros and set overflow
+typedef struct {
+    const uint8_t* ptr;
+    size_t size;
+    size_t pos;
+    bool overflow;
+} _mo5snap_reader_t;
+
+static const uint8_t* _mo5snap_consume(_mo5snap_reader_t* r, size_t num) {
+    if ((r->pos + num) > r->size) {
+        r->overflow = true;
+        return 0;
+    }
+    const uint8_t* p = r->ptr + r->pos;
+    r->pos += num;
+    return p;
+}
+
+static void _mo5snap_get_bytes(_mo5snap_reader_t* r, void* dst, size_t num) {
+    const uint8_t* p = _mo5snap_consume(r, num);
+    if (p) {
+        memcpy(dst, p, num);
+    } else {
+        memset(dst, 0, num);
+    }
+}
+
+static uint8_t _mo5snap_get8(_mo5snap_reader_t* r) {
+    const uint8_t* p = _mo5snap_consume(r, 1);
+    return p ? p[0] : 0;
+}
+
+static uint16_t _mo5snap_get16(_mo5snap_reader_t* r) {
+    const uint8_t* p = _mo5snap_consume(r, 2);
+    return p ? (uint16_t)(p[0] | (p[1] << 8)) : 0;
+}
+
+static uint32_t _mo5snap_get32(_mo5snap_reader_t* r) {
+    const uint8_t* p = _mo5snap_consume(r, 4);
+    return p ? ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24)) : 0;
+}
+
+static uint64_t _mo5snap_get64(_mo5snap_reader_t* r) {
+    const uint64_t lo = _mo5snap_get32(r);
+    const uint64_t hi = _mo5snap_get32(r);
+    return lo | (hi << 32);
+}
+
+static inline uint32_t _mo5snap_read32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// write a length continuation (LZ4 style: 255, 255, ..., rest)
+static size_t _mo5snap_lz_put_len(uint8_t* dst, size_t len) {
+    size_t n = 0;
+    while (len >= 255) {
+        dst[n++] = 255;
+        len -= 255;
+    }
+    dst[n++] = (uint8_t)len;
+    return n;
+}
+
+// emit one sequence: [token][literal length][literals][offset][match length],
+// a sequence without match (match_len == 0) ends the block
+static size_t _mo5snap_lz_put_seq(uint8_t* dst, size_t cap, size_t op, const uint8_t* lit, size_t lit_len, size_t offset, size_t match_len) {
+    const size_t worst = 1 + (lit_len / 255 + 1) + lit_len + 2 + (match_len / 255 + 1);
+    if ((op + worst) > cap) {
+        return 0;
+    }
+    uint8_t* token = &dst[op++];
+    const size_t ml = match_len ? (match_len - _MO5SNAP_LZ_MIN_MATCH) : 0;
+    *token = (uint8_t)(((lit_len < 15) ? lit_len : 15) << 4);
+    if (lit_len >= 15) {
+        op += _mo5snap_lz_put_len(&dst[op], lit_len - 15);
+    }
+    memcpy(&dst[op], lit, lit_len);
+    op += lit_len;
+    if (match_len) {
+        *token |= (uint8_t)((ml < 15) ? ml : 15);
+        dst[op++] = (uint8_t)offset;
+        dst[op++] = (uint8_t)(offset >> 8);
+        if (ml >= 15) {
+            op += _mo5snap_lz_put_len(&dst[op], ml - 15);
+        }
+    }
+    return op;
+}
+
+// LZ compress src into dst, returns 0 if the result doesn't fit into cap bytes
+static size_t _mo5snap_lz_compress(const uint8_t* src, size_t num, uint8_t* dst, size_t cap) {
+    uint32_t table[1 << _MO5SNAP_LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+    size_t ip = 0;
+    size_t anchor = 0;
+    size_t op = 0;
+    while ((ip + _MO5SNAP_LZ_MIN_MATCH) <= num) {
+        const uint32_t seq = _mo5snap_read32(&src[ip]);
+        const uint32_t h = (seq * 2654435761u) >> (32 - _MO5SNAP_LZ_HASH_BITS);
+        // table entries are position + 1, 0 means empty
+        const size_t ref = table[h];
+        table[h] = (uint32_t)(ip + 1);
+        if (ref && ((ip - (ref - 1)) <= _MO5SNAP_LZ_MAX_OFFSET) && (_mo5snap_read32(&src[ref - 1]) == seq)) {
+            const size_t match = ref - 1;
+            size_t len = _MO5SNAP_LZ_MIN_MATCH;
+            while (((ip + len) < num) && (src[match + len] == src[ip + len])) {
+                len++;
+            }
+            op = _mo5snap_lz_put_seq(dst, cap, op, &src[anchor], ip - anchor, ip - match, len);
+            if (op == 0) {
+                return 0;
+            }
+            ip += len;
+            anchor = ip;
+        } else {
+            ip++;
+        }
+    }
+    return _mo5snap_lz_put_seq(dst, cap, op, &src[anchor], num - anchor, 0, 0);
+}
+
+static bool _mo5snap_lz_get_len(const uint8_t* src, size_t num, size_t* ip, size_t* len) {
+    uint8_t b;
+    do {
+        if (*ip >= num) {
+            return false;
+        }
+        b = src[(*ip)++];
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+// decompress exactly dst_size bytes, returns false on corrupted input
+static bool _mo5snap_lz_decompress(const uint8_t* src, size_t num, uint8_t* dst, size_t dst_size) {
+    size_t ip = 0;
+    size_t op = 0;
+    while (ip < num) {
+        const uint8_t token = src[ip++];
+        size_t lit_len = token >> 4;
+        if ((lit_len == 15) && !_mo5snap_lz_get_len(src, num, &ip, &lit_len)) {
+            return false;
+        }
+        if ((lit_len > (num - ip)) || (lit_len > (dst_size - op))) {
+            return false;
+        }
+        memcpy(&dst[op], &src[ip], lit_len);
+        ip += lit_len;
+        op += lit_len;
+        if (ip == num) {
+            break;
+        }
+        if ((ip + 2) > num) {
+            return false;
+        }
+        const size_t offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        size_t match_len = token & 15;
+        if ((match_len == 15) && !_mo5snap_lz_get_len(src, num, &ip, &match_len)) {
+            return false;
+        }
+        match_len += _MO5SNAP_LZ_MIN_MATCH;
+        if ((offset == 0) || (offset > op) || (match_len > (dst_size - op))) {
+            return false;
+        }
+        // byte by byte, the match may overlap the output
+        for (size_t i = 0; i < match_len; i++, op++) {
+            dst[op] = dst[op - offset];
+        }
+    }
+    return op == dst_size;
+}
+
+static void _mo5snap_write_chunk(_mo5snap_writer_t* w, uint32_t bit, const mo5snap_image_t* img) {
+    const mo5_state_t* st = &img->state;
+    switch (bit) {
+        case MO5SNAP_CHUNK_CPU:
+            _mo5snap_put32(w, (uint32_t)st->cpu.n);
+            _mo5snap_put8(w, st->cpu.cc);
+            _mo5snap_put16(w, st->cpu.d);
+            _mo5snap_put16(w, st->cpu.x);
+            _mo5snap_put16(w, st->cpu.y);
+            _mo5snap_put16(w, st->cpu.u);
+            _mo5snap_put16(w, st->cpu.s);
+            _mo5snap_put16(w, st->cpu.pc);
+            _mo5snap_put16(w, st->cpu.w);
+            _mo5snap_put16(w, st->cpu.da);
+            break;
+        case MO5SNAP_CHUNK_RAM:
+            _mo5snap_put_bytes(w, st->mem.ram, sizeof(st->mem.ram));
+            break;
+        case MO5SNAP_CHUNK_PORTS:
+            _mo5snap_put_bytes(w, st->mem.port, sizeof(st->mem.port));
+            _mo5snap_put8(w, st->mem.sound);
+            break;
+        case MO5SNAP_CHUNK_DISPLAY:
+            _mo5snap_put8(w, st->display.line_cycle);
+            _mo5snap_put16(w, st->display.line_number);
+            _mo5snap_put16(w, img->video_offset);
+            break;
+        case MO5SNAP_CHUNK_CARTRIDGE:
+            _mo5snap_put8(w, (uint8_t)img->cartridge.type);
+            _mo5snap_put32(w, (uint32_t)st->cartridge.flags);
+            _mo5snap_put32(w, (uint32_t)img->cartridge.size);
+            _mo5snap_put8(w, img->cartridge.rom_source);
+            _mo5snap_put32(w, img->cartridge.rom_offset);
+            break;
+        case MO5SNAP_CHUNK_CARTIMAGE:
+            _mo5snap_put_bytes(w, img->cartridge.image, MO5_MAX_CARTRIDGE_SIZE);
+            break;
+        case MO5SNAP_CHUNK_TAPE:
+            _mo5snap_put32(w, (uint32_t)st->tape.bit);
+            _mo5snap_put32(w, (uint32_t)st->tape.pos);
+            break;
+        case MO5SNAP_CHUNK_MEDIA: {
+            const mo5snap_media_ref_t* refs[3] = { &img->media.tape, &img->media.disk, &img->media.cartridge };
+            for (int i = 0; i < 3; i++) {
+                _mo5snap_put64(w, refs[i]->hash);
+                _mo5snap_put32(w, refs[i]->size);
+            }
+        } break;
+        case MO5SNAP_CHUNK_CLOCKS:
+            _mo5snap_put32(w, (uint32_t)st->clocks);
+            _mo5snap_put32(w, st->clock_excess);
+            _mo5snap_put32(w, (uint32_t)st->audio.sample);
+            break;
+        case MO5SNAP_CHUNK_INPUT:
+            _mo5snap_put8(w, st->input.joys_position);
+            _mo5snap_put8(w, st->input.joy_action);
+            _mo5snap_put32(w, (uint32_t)st->input.xpen);
+            _mo5snap_put32(w, (uint32_t)st->input.ypen);
+            _mo5snap_put8(w, st->input.penbutton);
+            break;
+        case MO5SNAP_CHUNK_DISKWRITE: {
+            const int num = mo5_overlay_num_sectors(img->disk_overlay);
+            _mo5snap_put32(w, (uint32_t)num);
+            for (int i = 0; i < num; i++) {
+                int sector;
+                const uint8_t* data = mo5_overlay_sector(img->disk_overlay, i, &sector, 0);
+                _mo5snap_put16(w, (uint16_t)sector);
+                _mo5snap_put_bytes(w, data, MO5_DISK_SECTOR_SIZE);
+            }
+        } break;
+        default:
+            assert(false);
+            break;
+    }
+}
+
+// chunks may grow in later versions, only the known prefix is read
+static bool _mo5snap_read_chunk(_mo5snap_reader_t* r, uint32_t bit, mo5snap_image_t* img) {
+    mo5_state_t* st = &img->state;
+    switch (bit) {
+        case MO5SNAP_CHUNK_CPU:
+            st->cpu.n = (int)_mo5snap_get32(r);
+            st->cpu.cc = _mo5snap_get8(r);
+            st->cpu.d = _mo5snap_get16(r);
+            st->cpu.x = _mo5snap_get16(r);
+            st->cpu.y = _mo5snap_get16(r);
+            st->cpu.u = _mo5snap_get16(r);
+            st->cpu.s = _mo5snap_get16(r);
+            st->cpu.pc = _mo5snap_get16(r);
+            st->cpu.w = _mo5snap_get16(r);
+            st->cpu.da = _mo5snap_get16(r);
+            break;
+        case MO5SNAP_CHUNK_RAM:
+            _mo5snap_get_bytes(r, st->mem.ram, sizeof(st->mem.ram));
+            break;
+        case MO5SNAP_CHUNK_PORTS:
+            _mo5snap_get_bytes(r, st->mem.port, sizeof(st->mem.port));
+            st->mem.sound = _mo5snap_get8(r);
+            break;
+        case MO5SNAP_CHUNK_DISPLAY:
+            st->display.line_cycle = _mo5snap_get8(r);
+            st->display.line_number = _mo5snap_get16(r);
+            img->video_offset = _mo5snap_get16(r);
+            break;
+        case MO5SNAP_CHUNK_CARTRIDGE:
+            img->cartridge.type = _mo5snap_get8(r);
+            st->cartridge.flags = (int)_mo5snap_get32(r);
+            img->cartridge.size = _mo5snap_get32(r);
+            img->cartridge.rom_source = _mo5snap_get8(r);
+            img->cartridge.rom_offset = _mo5snap_get32(r);
+            break;
+        case MO5SNAP_CHUNK_CARTIMAGE:
+            free(img->cartridge.image);
+            img->cartridge.image = (uint8_t*) malloc(MO5_MAX_CARTRIDGE_SIZE);
+            if (!img->cartridge.image) {
+                return false;
+            }
+            _mo5snap_get_bytes(r, img->cartridge.image, MO5_MAX_CARTRIDGE_SIZE);
+            break;
+        case MO5SNAP_CHUNK_TAPE:
+            st->tape.bit = (int)_mo5snap_get32(r);
+            st->tape.pos = (int)_mo5snap_get32(r);
+            break;
+        case MO5SNAP_CHUNK_MEDIA: {
+            mo5snap_media_ref_t* refs[3] = { &img->media.tape, &img->media.disk, &img->media.cartridge };
+            for (int i = 0; i < 3; i++) {
+                refs[i]->hash = _mo5snap_get64(r);
+                refs[i]->size = _mo5snap_get32(r);
+            }
+        } break;
+        case MO5SNAP_CHUNK_CLOCKS:
+            st->clocks = (int)_mo5snap_get32(r);
+            st->clock_excess = _mo5snap_get32(r);
+            st->audio.sample = (int)_mo5snap_get32(r);
+            break;
+        case MO5SNAP_CHUNK_INPUT:
+            st->input.joys_position = _mo5snap_get8(r);
+            st->input.joy_action = _mo5snap_get8(r);
+            st->input.xpen = (int)_mo5snap_get32(r);
+            st->input.ypen = (int)_mo5snap_get32(r);
+            st->input.penbutton = _mo5snap_get8(r) != 0;
+            break;
+        case MO5SNAP_CHUNK_DISKWRITE: {
+            const uint32_t num = _mo5snap_get32(r);
+            if (num > MO5_DISK_NUM_SECTORS) {
+                return false;
+            }
+            mo5_overlay_release(img->disk_overlay);
+            img->disk_overlay = num ? mo5_overlay_create() : 0;
+            for (uint32_t i = 0; i < num; i++) {
+                const uint16_t sector = _mo5snap_get16(r);
+                const uint8_t* data = _mo5snap_consume(r, MO5_DISK_SECTOR_SIZE);
+                if (!data || (sector >= MO5_DISK_NUM_SECTORS)) {
+                    return false;
+                }
+                mo5_overlay_write(img->disk_overlay, sector, data);
+            }
+        } break;
+        default:
+            assert(false);
+            break;
+    }
+    return !r->overflow;
+}
+
+void mo5snap_capture(const mo5_t* sys, mo5snap_image_t* dst) {
+    assert(sys && dst);
+    mo5snap_image_discard(dst);
+    dst->chunks = MO5SNAP_CHUNK_MACHINE;
+    mo5_save_state(sys, &dst->state);
+    dst->video_offset = sys->mem.video;
+    dst->cartridge.type = sys->cartridge.type;
+    dst->cartridge.size = sys->cartridge.size;
+    // the bank is mapped from the cartridge flags, see _mo5_rombank()
+    if (0 == (sys->cartridge.flags & 4)) {
+        dst->cartridge.rom_source = 0;
+        dst->cartridge.rom_offset = 0;
+    } else {
+        dst->cartridge.rom_source = 1;
+        dst->cartridge.rom_offset = (uint32_t)(sys->mem.rom_bank - (sys->mem.cartridge - 0xb000));
+    }
+    dst->media.tape = (mo5snap_media_ref_t){ mo5_media_hash(sys->tape.media), (uint32_t)sys->tape.size };
+    dst->media.disk = (mo5snap_media_ref_t){ mo5_media_hash(sys->disk.media), (uint32_t)sys->disk.size };
+    dst->media.cartridge = (mo5snap_media_ref_t){ mo5_media_hash(sys->cartridge.media), sys->cartridge.media ? (uint32_t)sys->cartridge.size : 0 };
+    // a cartridge the machine wrote to can't be referenced by hash
+    if (sys->cartridge.media && (dst->media.cartridge.hash == 0)) {
+        dst->cartridge.image = (uint8_t*) malloc(MO5_MAX_CARTRIDGE_SIZE);
+        memcpy(dst->cartridge.image, sys->mem.cartridge, MO5_MAX_CARTRIDGE_SIZE);
+        dst->chunks |= MO5SNAP_CHUNK_CARTIMAGE;
+    }
+    // always stored, so a clean disk is restored as clean
+    dst->disk_overlay = mo5_disk_overlay(sys);
+    dst->chunks |= MO5SNAP_CHUNK_DISKWRITE;
+}
+
+void mo5snap_image_discard(mo5snap_image_t* img) {
+    assert(img);
+    free(img->cartridge.image);
+    img->cartridge.image = 0;
+    mo5_overlay_release(img->disk_overlay);
+    img->disk_overlay = 0;
+    img->chunks = 0;
+}
+
+mo5snap_data_t mo5snap_encode(const mo5snap_image_t* img) {
+    assert(img);
+    int num_chunks = 0;
+    for (size_t i = 0; i < _MO5SNAP_NUM_CHUNK_TYPES; i++) {
+        if (img->chunks & _mo5snap_chunks[i].bit) {
+            num_chunks++;
+        }
+    }
+    _mo5snap_writer_t out = {0};
+    _mo5snap_put32(&out, _MO5SNAP_MAGIC);
+    _mo5snap_put16(&out, MO5SNAP_VERSION);
+    _mo5snap_put16(&out, (uint16_t)num_chunks);
+    // the chunk table is patched once the chunk sizes are known
+    const size_t table_pos = out.size;
+    _mo5snap_reserve(&out, (size_t)num_chunks * _MO5SNAP_ENTRY_SIZE);
+    _mo5snap_writer_t raw = {0};
+    size_t entry_pos = table_pos;
+    for (size_t i = 0; i < _MO5SNAP_NUM_CHUNK_TYPES; i++) {
+        if (0 == (img->chunks & _mo5snap_chunks[i].bit)) {
+            continue;
+        }
+        raw.size = 0;
+        _mo5snap_write_chunk(&raw, _mo5snap_chunks[i].bit, img);
+        const size_t offset = out.size;
+        // store uncompressed if compression doesn't pay off
+        uint32_t flags = 0;
+        uint8_t* dst = _mo5snap_reserve(&out, raw.size);
+        size_t size = _mo5snap_lz_compress(raw.ptr, raw.size, dst, raw.size - 1);
+        if (size > 0) {
+            flags |= _MO5SNAP_COMPRESSED;
+        } else {
+            memcpy(dst, raw.ptr, raw.size);
+            size = raw.size;
+        }
+        out.size = offset + size;
+        _mo5snap_patch32(&out, entry_pos + 0, _mo5snap_chunks[i].tag);
+        _mo5snap_patch32(&out, entry_pos + 4, flags);
+        _mo5snap_patch32(&out, entry_pos + 8, (uint32_t)offset);
+        _mo5snap_patch32(&out, entry_pos + 12, (uint32_t)size);
+        _mo5snap_patch32(&out, entry_pos + 16, (uint32_t)raw.size);
+        entry_pos += _MO5SNAP_ENTRY_SIZE;
+    }
+    free(raw.ptr);
+    return (mo5snap_data_t){ .ptr = out.ptr, .size = out.size };
+}
+
+mo5snap_result_t mo5snap_decode(const void* data, size_t size, uint32_t chunk_mask, mo5snap_image_t* dst) {
+    assert(data && dst);
+    mo5snap_image_discard(dst);
+    _mo5snap_reader_t hdr = { .ptr = (const uint8_t*)data, .size = size };
+    if (_mo5snap_get32(&hdr) != _MO5SNAP_MAGIC) {
+        return MO5SNAP_ERR_FORMAT;
+    }
+    const uint16_t version = _mo5snap_get16(&hdr);
+    const uint16_t num_chunks = _mo5snap_get16(&hdr);
+    if (version > MO5SNAP_VERSION) {
+        return MO5SNAP_ERR_VERSION;
+    }
+    if ((num_chunks > _MO5SNAP_MAX_CHUNKS) || hdr.overflow) {
+        return MO5SNAP_ERR_FORMAT;
+    }
+    uint8_t* scratch = 0;
+    for (uint16_t c = 0; c < num_chunks; c++) {
+        const uint32_t tag = _mo5snap_get32(&hdr);
+        const uint32_t flags = _mo5snap_get32(&hdr);
+        const uint32_t offset = _mo5snap_get32(&hdr);
+        const uint32_t stored_size = _mo5snap_get32(&hdr);
+        const uint32_t raw_size = _mo5snap_get32(&hdr);
+        if (hdr.overflow || (offset > size) || (stored_size > (size - offset))) {
+            free(scratch);
+            return MO5SNAP_ERR_FORMAT;
+        }
+        uint32_t bit = 0;
+        for (size_t i = 0; i < _MO5SNAP_NUM_CHUNK_TYPES; i++) {
+            if (_mo5snap_chunks[i].tag == tag) {
+                bit = _mo5snap_chunks[i].bit;
+                break;
+            }
+        }
+        // skip unknown and unwanted chunks without decompressing them
+        if ((bit == 0) || (0 == (bit & chunk_mask))) {
+            continue;
+        }
+        _mo5snap_reader_t r = { .ptr = (const uint8_t*)data + offset, .size = stored_size };
+        if (flags & _MO5SNAP_COMPRESSED) {
+            uint8_t* buf = (raw_size <= _MO5SNAP_MAX_RAW_SIZE) ? (uint8_t*) realloc(scratch, raw_size ? raw_size : 1) : 0;
+            if (!buf) {
+                free(scratch);
+                return MO5SNAP_ERR_FORMAT;
+            }
+            scratch = buf;
+            if (!_mo5snap_lz_decompress(r.ptr, stored_size, scratch, raw_size)) {
+                free(scratch);
+                return MO5SNAP_ERR_FORMAT;
+            }
+            r.ptr = scratch;
+            r.size = raw_size;
+        }
+        if (!_mo5snap_read_chunk(&r, bit, dst)) {
+            free(scratch);
+            return MO5SNAP_ERR_FORMAT;
+        }
+        dst->chunks |= bit;
+    }
+    free(scratch);
+    return MO5SNAP_OK;
+}
+
+static bool _mo5snap_media_matches(const mo5snap_media_ref_t* ref, mo5_media_t* media) {
+    return ((ref->size != 0) == (media != 0)) && (ref->hash == mo5_media_hash(media));
+}
+
+mo5snap_result_t mo5snap_apply(mo5_t* sys, const mo5snap_image_t* img) {
+    assert(sys && img);
+    if ((img->chunks & MO5SNAP_CHUNK_MACHINE) != MO5SNAP_CHUNK_MACHINE) {
+        return MO5SNAP_ERR_FORMAT;
+    }
+    // validate the serialized pointers before touching the machine
+    const bool video_valid = (img->video_offset == 0) || (img->video_offset == 0x2000);
+    const bool rom_valid = (img->cartridge.rom_source == 0) ?
+        (img->cartridge.rom_offset == 0) :
+        ((img->cartridge.rom_offset + 0x4000) <= MO5_MAX_CARTRIDGE_SIZE);
+    // the machine only makes types 0 (16KB) and 1 (bank switched), type 2
+    // would map banks past the MO5_MAX_CARTRIDGE_SIZE image
+    const bool cartridge_valid = (img->cartridge.type >= 0) && (img->cartridge.type <= 1) &&
+                                 (img->cartridge.size <= MO5_MAX_CARTRIDGE_SIZE);
+    if (!video_valid || !rom_valid || !cartridge_valid) {
+        return MO5SNAP_ERR_FORMAT;
+    }
+    mo5snap_result_t res = MO5SNAP_OK;
+    if (img->cartridge.image) {
+        mo5_insert_cartridge(sys, (gfx_range_t){ .ptr = img->cartridge.image, .size = MO5_MAX_CARTRIDGE_SIZE });
+    } else if (!_mo5snap_media_matches(&img->media.cartridge, sys->cartridge.media)) {
+        res = MO5SNAP_MEDIA_MISMATCH;
+    }
+    if (!_mo5snap_media_matches(&img->media.tape, sys->tape.media) ||
+        !_mo5snap_media_matches(&img->media.disk, sys->disk.media))
+    {
+        res = MO5SNAP_MEDIA_MISMATCH;
+    }
+    // snapshots written before disks were writable leave the disk as it is
+    if (img->chunks & MO5SNAP_CHUNK_DISKWRITE) {
+        mo5_set_disk_overlay(sys, img->disk_overlay);
+    }
+    // before the state, the cartridge bank is mapped with the type
+    sys->cartridge.type = img->cartridge.type;
+    sys->cartridge.size = img->cartridge.size;
+    const kbd_t kbd = sys->kbd;
+    mo5_load_state(sys, &img->state);
+    sys->kbd = kbd;
+    sys->mem.video = img->video_offset;
+    // mo5_load_state() mapped the BASIC bank from the cartridge flags
+    if (img->cartridge.rom_source != 0) {
+        sys->mem.rom_bank = sys->mem.cartridge - 0xb000 + img->cartridge.rom_offset;
+    }
+    return res;
+}
@@ -0,0 +1,103 @@
+#pragma once
+/*
+    Portable on-disk snapshot format for the MO5.
+
+    A snapshot file is a small header followed by tagged chunks:
+
+        u32 magic 'MO5S'
+        u16 version
+        u16 number of chunks
+        chunk table, per chunk:
+            u32 tag, u32 flags, u32 file offset, u32 stored size, u32 raw size
+        chunk data
+
+    All values are little-endian, host pointers are stored as offsets
+    (video page in RAM, rom bank in monitor ROM or cartridge). Chunks are
+    LZ compressed when that makes them smaller. Media images are not stored,
+    they are referenced by content hash, except for a cartridge image the
+    machine wrote to and the disk sectors the machine wrote. The chunk table
+    lets a loader skip chunks it doesn't need, and unknown chunks from newer
+    versions.
+
+    Saving is split in a cheap capture step on the emulator thread and an
+    encode step which can run on a worker thread, loading is split in a
+    decode step (worker thread) and a cheap apply step.
+*/
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "mo5.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MO5SNAP_VERSION (1)
+
+// chunk selection bits for mo5snap_decode()
+#define MO5SNAP_CHUNK_CPU       (1<<0)
+#define MO5SNAP_CHUNK_RAM       (1<<1)
+#define MO5SNAP_CHUNK_PORTS     (1<<2)
+#define MO5SNAP_CHUNK_DISPLAY   (1<<3)
+#define MO5SNAP_CHUNK_CARTRIDGE (1<<4)
+#define MO5SNAP_CHUNK_CARTIMAGE (1<<5)
+#define MO5SNAP_CHUNK_TAPE      (1<<6)
+#define MO5SNAP_CHUNK_MEDIA     (1<<7)
+#define MO5SNAP_CHUNK_CLOCKS    (1<<8)
+#define MO5SNAP_CHUNK_INPUT     (1<<9)
+#define MO5SNAP_CHUNK_DISKWRITE (1<<10)
+#define MO5SNAP_CHUNK_ALL       (0x7ff)
+// chunks needed by mo5snap_apply() (the cartridge image and written disk sectors are optional)
+#define MO5SNAP_CHUNK_MACHINE   (MO5SNAP_CHUNK_ALL & ~(MO5SNAP_CHUNK_CARTIMAGE | MO5SNAP_CHUNK_DISKWRITE))
+
+typedef enum {
+    MO5SNAP_OK,
+    MO5SNAP_ERR_FORMAT,         // not a snapshot, or corrupted data
+    MO5SNAP_ERR_VERSION,        // written by a newer version
+    MO5SNAP_MEDIA_MISMATCH,     // state was applied, but the inserted media differ
+} mo5snap_result_t;
+
+typedef struct {
+    uint64_t hash;  // content hash (see mo5_media_hash())
+    uint32_t size;  // 0 if no media was inserted
+} mo5snap_media_ref_t;
+
+// decoded snapshot content
+typedef struct {
+    uint32_t chunks;            // MO5SNAP_CHUNK_* bits of the chunks present
+    mo5_state_t state;          // keyboard matrix is host input and not stored
+    uint16_t video_offset;      // RAM offset of the mapped video bank
+    struct {
+        int type;
+        size_t size;
+        uint8_t rom_source;     // rom bank source: 0=monitor ROM, 1=cartridge
+        uint32_t rom_offset;    // rom bank offset in the source
+        uint8_t* image;         // private copy of a modified cartridge, or null
+    } cartridge;
+    struct {
+        mo5snap_media_ref_t tape;
+        mo5snap_media_ref_t disk;
+        mo5snap_media_ref_t cartridge;
+    } media;
+    mo5_overlay_t* disk_overlay;    // written disk sectors (referenced), or null
+} mo5snap_image_t;
+
+typedef struct {
+    void* ptr;      // free with free()
+    size_t size;
+} mo5snap_data_t;
+
+// capture the machine into an image, cheap, dst must be zero-initialized or discarded
+void mo5snap_capture(const mo5_t* sys, mo5snap_image_t* dst);
+// free memory owned by an image
+void mo5snap_image_discard(mo5snap_image_t* img);
+// serialize and compress an image, doesn't touch the machine, may run on any thread
+mo5snap_data_t mo5snap_encode(const mo5snap_image_t* img);
+// decode the chunks in chunk_mask, may run on any thread, dst must be zero-initialized or discarded
+mo5snap_result_t mo5snap_decode(const void* data, size_t size, uint32_t chunk_mask, mo5snap_image_t* dst);
+// apply a decoded image to a machine, the keyboard matrix of the machine is kept
+mo5snap_result_t mo5snap_apply(mo5_t* sys, const mo5snap_image_t* img);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
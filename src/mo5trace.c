@@ -0,0 +1,588 @@
+#include "mo5trace.h"
+#include <string.h>
+#include <assert.h>
+
+_Static_assert(sizeof(mo5trace_chunk_t) == MO5TRACE_CHUNK_SIZE, "trace chunk size");
+
+// largest record: tag, 64 bits cycle count, jump with DP, 5 bytes, registers
+#define _MO5TRACE_MAX_RECORD (1 + 10 + 3 + 1 + 5 + 3 + 4 * 3)
+
+#define _MO5TRACE_JUMP (1<<0)
+#define _MO5TRACE_CC (1<<1)
+#define _MO5TRACE_A (1<<2)
+#define _MO5TRACE_B (1<<3)
+#define _MO5TRACE_X (1<<4)
+#define _MO5TRACE_Y (1<<5)
+#define _MO5TRACE_U (1<<6)
+#define _MO5TRACE_S (1<<7)
+
+struct mo5_trace_t {
+    mo5trace_chunk_t* chunk;
+    int num_chunks;
+    int first;              // the oldest chunk
+    int count;              // chunks in use
+    mo5trace_chunk_t* cur;  // the newest chunk, null once all chunks were dropped
+    uint64_t total_ops;
+    bool recording;
+    mo5trace_op_t last;     // the last recorded instruction, the next record is encoded against it
+};
+
+// length of the indexed addressing postbyte operand
+static int _mo5trace_indexed(uint8_t postbyte) {
+    if (0 == (postbyte & 0x80)) {
+        return 0;
+    }
+    switch (postbyte & 0x0f) {
+    case 0x8: case 0xc: return 1;
+    case 0x9: case 0xd: case 0xf: return 2;
+    default: return 0;
+    }
+}
+
+int mo5trace_op_size(const uint8_t* bytes) {
+    const uint8_t op = bytes[0];
+    if ((op == 0x10) || (op == 0x11)) {
+        const uint8_t op2 = bytes[1];
+        if ((op2 & 0xf0) == 0x20) {
+            return 4;
+        }
+        if (op2 < 0x80) {
+            return 2;
+        }
+        switch (op2 & 0x30) {
+        case 0x00: return 4;
+        case 0x10: return 3;
+        case 0x20: return 3 + _mo5trace_indexed(bytes[2]);
+        default: return 4;
+        }
+    }
+    if (op < 0x10) {
+        return 2;
+    }
+    if (op < 0x20) {
+        switch (op) {
+        case 0x16: case 0x17: return 3;
+        case 0x1a: case 0x1c: case 0x1e: case 0x1f: return 2;
+        default: return 1;
+        }
+    }
+    if (op < 0x30) {
+        return 2;
+    }
+    if (op < 0x40) {
+        if (op < 0x34) {
+            return 2 + _mo5trace_indexed(bytes[1]);
+        }
+        return ((op < 0x38) || (op == 0x3c)) ? 2 : 1;
+    }
+    if (op < 0x60) {
+        return 1;
+    }
+    if (op < 0x70) {
+        return 2 + _mo5trace_indexed(bytes[1]);
+    }
+    if (op < 0x80) {
+        return 3;
+    }
+    switch (op & 0x30) {
+    case 0x00: {
+        // immediate, 16 bits for SUBD ADDD CMPX LDD LDX LDU
+        const uint8_t col = op & 0x0f;
+        return ((col == 0x3) || (col == 0xc) || (col == 0xe)) ? 3 : 2;
+    }
+    case 0x10: return 2;
+    case 0x20: return 2 + _mo5trace_indexed(bytes[1]);
+    default: return 3;
+    }
+}
+
+static uint8_t* _mo5trace_put(uint8_t* dst, uint64_t value) {
+    while (value >= 0x80) {
+        *dst++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *dst++ = (uint8_t)value;
+    return dst;
+}
+
+static const uint8_t* _mo5trace_get(const uint8_t* src, uint64_t* value) {
+    uint64_t v = 0;
+    for (int shift = 0; ; shift += 7) {
+        const uint8_t byte = *src++;
+        v |= (uint64_t)(byte & 0x7f) << shift;
+        if (0 == (byte & 0x80)) {
+            break;
+        }
+    }
+    *value = v;
+    return src;
+}
+
+// 16 bits difference, small values of both signs take few bits
+static uint32_t _mo5trace_zigzag(uint16_t delta) {
+    const int d = (int16_t)delta;
+    return (uint16_t)(((uint32_t)d << 1) ^ (uint32_t)(d >> 15));
+}
+
+static uint16_t _mo5trace_unzigzag(uint64_t value) {
+    return (uint16_t)((value >> 1) ^ (0 - (value & 1)));
+}
+
+static mo5trace_op_t _mo5trace_chunk_op(const mo5trace_chunk_t* chunk) {
+    return (mo5trace_op_t){
+        .cycle = chunk->cycle,
+        .pc = chunk->pc,
+        .cc = chunk->cc, .a = chunk->a, .b = chunk->b, .dp = chunk->dp,
+        .x = chunk->x, .y = chunk->y, .u = chunk->u, .s = chunk->s,
+    };
+}
+
+// decode the record at src, op holds the instruction before it
+static const uint8_t* _mo5trace_decode(const uint8_t* src, mo5trace_op_t* op) {
+    const uint8_t tag = *src++;
+    uint64_t value;
+    src = _mo5trace_get(src, &value);
+    op->cycle += value;
+    op->pc = (uint16_t)(op->pc + op->num_bytes);
+    if (tag & _MO5TRACE_JUMP) {
+        src = _mo5trace_get(src, &value);
+        op->pc = (uint16_t)(op->pc + _mo5trace_unzigzag(value >> 1));
+        if (value & 1) {
+            op->dp = *src++;
+        }
+    }
+    op->num_bytes = mo5trace_op_size(src);
+    memcpy(op->bytes, src, (size_t)op->num_bytes);
+    src += op->num_bytes;
+    if (tag & _MO5TRACE_CC) {
+        op->cc = *src++;
+    }
+    if (tag & _MO5TRACE_A) {
+        op->a = *src++;
+    }
+    if (tag & _MO5TRACE_B) {
+        op->b = *src++;
+    }
+    uint16_t* regs[4] = { &op->x, &op->y, &op->u, &op->s };
+    for (int i = 0; i < 4; i++) {
+        if (tag & (_MO5TRACE_X << i)) {
+            src = _mo5trace_get(src, &value);
+            *regs[i] = (uint16_t)(*regs[i] + _mo5trace_unzigzag(value));
+        }
+    }
+    return src;
+}
+
+static mo5trace_chunk_t* _mo5trace_chunk_start(mo5_trace_t* trace, const mc6809e_t* cpu, uint64_t cycle) {
+    if (trace->count == trace->num_chunks) {
+        trace->first = (trace->first + 1) % trace->num_chunks;
+        trace->count--;
+    }
+    mo5trace_chunk_t* chunk = &trace->chunk[(trace->first + trace->count) % trace->num_chunks];
+    trace->count++;
+    chunk->cycle = cycle;
+    chunk->num_ops = 0;
+    chunk->size = 0;
+    chunk->pc = cpu->pc;
+    chunk->x = cpu->x;
+    chunk->y = cpu->y;
+    chunk->u = cpu->u;
+    chunk->s = cpu->s;
+    chunk->cc = cpu->cc;
+    chunk->a = (uint8_t)cpu->a;
+    chunk->b = (uint8_t)cpu->b;
+    chunk->dp = (uint8_t)cpu->dp;
+    trace->cur = chunk;
+    trace->last = _mo5trace_chunk_op(chunk);
+    return chunk;
+}
+
+void mo5trace_record(mo5_trace_t* trace, const mc6809e_t* cpu, const uint8_t* bytes, uint64_t cycle) {
+    if (!trace->recording) {
+        return;
+    }
+    mo5trace_chunk_t* chunk = trace->cur;
+    if (!chunk || (chunk->size > (sizeof(chunk->data) - _MO5TRACE_MAX_RECORD))) {
+        chunk = _mo5trace_chunk_start(trace, cpu, cycle);
+    }
+    // registers in locals, the byte stores below could alias them, no arrays
+    // or struct copies: the compiler would merge the loads of the next call
+    // into wider ones, which can't be forwarded from these stores
+    mo5trace_op_t* last = &trace->last;
+    const uint16_t pc = cpu->pc;
+    const uint8_t dp = (uint8_t)cpu->dp;
+    const uint8_t cc = cpu->cc;
+    const uint8_t a = (uint8_t)cpu->a;
+    const uint8_t b = (uint8_t)cpu->b;
+    const uint16_t x = cpu->x;
+    const uint16_t y = cpu->y;
+    const uint16_t u = cpu->u;
+    const uint16_t s = cpu->s;
+    const int num_bytes = mo5trace_op_size(bytes);
+    uint8_t* tag = &chunk->data[chunk->size];
+    uint8_t* dst = _mo5trace_put(tag + 1, cycle - last->cycle);
+    uint8_t flags = 0;
+    const uint16_t expected = (uint16_t)(last->pc + last->num_bytes);
+    if ((pc != expected) || (dp != last->dp)) {
+        flags |= _MO5TRACE_JUMP;
+        dst = _mo5trace_put(dst, (_mo5trace_zigzag((uint16_t)(pc - expected)) << 1) | (dp != last->dp));
+        if (dp != last->dp) {
+            *dst++ = dp;
+        }
+    }
+    memcpy(dst, bytes, 5);
+    dst += num_bytes;
+    // CC A B are stored in any case and kept when changed
+    *dst = cc;
+    dst += (cc != last->cc);
+    *dst = a;
+    dst += (a != last->a);
+    *dst = b;
+    dst += (b != last->b);
+    flags |= (uint8_t)(((cc != last->cc) ? _MO5TRACE_CC : 0) | ((a != last->a) ? _MO5TRACE_A : 0) | ((b != last->b) ? _MO5TRACE_B : 0));
+    if (x != last->x) {
+        flags |= _MO5TRACE_X;
+        dst = _mo5trace_put(dst, _mo5trace_zigzag((uint16_t)(x - last->x)));
+    }
+    if (y != last->y) {
+        flags |= _MO5TRACE_Y;
+        dst = _mo5trace_put(dst, _mo5trace_zigzag((uint16_t)(y - last->y)));
+    }
+    if (u != last->u) {
+        flags |= _MO5TRACE_U;
+        dst = _mo5trace_put(dst, _mo5trace_zigzag((uint16_t)(u - last->u)));
+    }
+    if (s != last->s) {
+        flags |= _MO5TRACE_S;
+        dst = _mo5trace_put(dst, _mo5trace_zigzag((uint16_t)(s - last->s)));
+    }
+    *tag = flags;
+    chunk->size = (uint16_t)(dst - chunk->data);
+    chunk->num_ops++;
+    trace->total_ops++;
+    last->cycle = cycle;
+    last->pc = pc;
+    last->dp = dp;
+    last->cc = cc;
+    last->a = a;
+    last->b = b;
+    last->x = x;
+    last->y = y;
+    last->u = u;
+    last->s = s;
+    last->num_bytes = num_bytes;
+}
+
+void mo5trace_rewind(mo5_trace_t* trace, uint64_t cycle) {
+    if (!trace->cur || (trace->last.cycle < cycle)) {
+        return;
+    }
+    // drop the chunks started at or after cycle
+    while (trace->count > 0) {
+        mo5trace_chunk_t* chunk = &trace->chunk[(trace->first + trace->count - 1) % trace->num_chunks];
+        if (chunk->cycle < cycle) {
+            break;
+        }
+        trace->total_ops -= chunk->num_ops;
+        trace->count--;
+    }
+    if (trace->count == 0) {
+        trace->cur = 0;
+        return;
+    }
+    // cut the newest chunk after the last instruction before cycle
+    mo5trace_chunk_t* chunk = &trace->chunk[(trace->first + trace->count - 1) % trace->num_chunks];
+    mo5trace_op_t op = _mo5trace_chunk_op(chunk);
+    const uint8_t* src = chunk->data;
+    uint32_t num_ops = 0;
+    while (num_ops < chunk->num_ops) {
+        mo5trace_op_t next = op;
+        const uint8_t* next_src = _mo5trace_decode(src, &next);
+        if (next.cycle >= cycle) {
+            break;
+        }
+        op = next;
+        src = next_src;
+        num_ops++;
+    }
+    trace->total_ops -= chunk->num_ops - num_ops;
+    chunk->num_ops = num_ops;
+    chunk->size = (uint16_t)(src - chunk->data);
+    trace->cur = chunk;
+    trace->last = op;
+}
+
+bool mo5trace_start(mo5_t* sys, size_t size) {
+    assert(sys);
+#if MO5_TRACE
+    mo5trace_destroy(sys->trace);
+    int num_chunks = (int)(size / MO5TRACE_CHUNK_SIZE);
+    if (num_chunks < 2) {
+        num_chunks = 2;
+    }
+    mo5_trace_t* trace = (mo5_trace_t*) calloc(1, sizeof(mo5_trace_t));
+    assert(trace);
+    trace->chunk = (mo5trace_chunk_t*) malloc((size_t)num_chunks * sizeof(mo5trace_chunk_t));
+    assert(trace->chunk);
+    trace->num_chunks = num_chunks;
+    trace->recording = true;
+    sys->trace = trace;
+    return true;
+#else
+    (void)size;
+    return false;
+#endif
+}
+
+void mo5trace_stop(mo5_t* sys) {
+    assert(sys);
+    if (sys->trace) {
+        sys->trace->recording = false;
+    }
+}
+
+bool mo5trace_recording(const mo5_trace_t* trace) {
+    return trace && trace->recording;
+}
+
+void mo5trace_destroy(mo5_trace_t* trace) {
+    if (trace) {
+        free(trace->chunk);
+        free(trace);
+    }
+}
+
+uint32_t mo5trace_num_ops(const mo5_trace_t* trace) {
+    uint32_t num = 0;
+    for (int i = 0; trace && (i < trace->count); i++) {
+        num += trace->chunk[(trace->first + i) % trace->num_chunks].num_ops;
+    }
+    return num;
+}
+
+uint64_t mo5trace_total_ops(const mo5_trace_t* trace) {
+    return trace ? trace->total_ops : 0;
+}
+
+size_t mo5trace_num_bytes(const mo5_trace_t* trace) {
+    size_t num = 0;
+    for (int i = 0; trace && (i < trace->count); i++) {
+        num += trace->chunk[(trace->first + i) % trace->num_chunks].size;
+    }
+    return num;
+}
+
+static const mo5trace_chunk_t* _mo5trace_iter_chunk(const mo5trace_iter_t* iter) {
+    const mo5_trace_t* trace = iter->trace;
+    return &trace->chunk[(trace->first + iter->chunk) % trace->num_chunks];
+}
+
+bool mo5trace_first(const mo5_trace_t* trace, mo5trace_iter_t* iter) {
+    assert(iter);
+    *iter = (mo5trace_iter_t){ .trace = trace, .chunk = -1 };
+    if (!trace) {
+        return false;
+    }
+    return mo5trace_next(iter);
+}
+
+bool mo5trace_seek(const mo5_trace_t* trace, mo5trace_iter_t* iter, uint32_t index) {
+    assert(iter);
+    *iter = (mo5trace_iter_t){ .trace = trace, .chunk = -1 };
+    if (!trace) {
+        return false;
+    }
+    int chunk = 0;
+    while ((chunk < trace->count) && (index >= trace->chunk[(trace->first + chunk) % trace->num_chunks].num_ops)) {
+        index -= trace->chunk[(trace->first + chunk) % trace->num_chunks].num_ops;
+        chunk++;
+    }
+    if (chunk == trace->count) {
+        return false;
+    }
+    iter->chunk = chunk;
+    const mo5trace_chunk_t* c = _mo5trace_iter_chunk(iter);
+    iter->op = _mo5trace_chunk_op(c);
+    iter->pos = (size_t)(_mo5trace_decode(c->data, &iter->op) - c->data);
+    for (uint32_t i = 0; i < index; i++) {
+        mo5trace_next(iter);
+    }
+    return true;
+}
+
+bool mo5trace_next(mo5trace_iter_t* iter) {
+    assert(iter && iter->trace);
+    const mo5trace_chunk_t* chunk = (iter->chunk < 0) ? 0 : _mo5trace_iter_chunk(iter);
+    iter->index++;
+    while (!chunk || (iter->index >= chunk->num_ops)) {
+        if (++iter->chunk >= iter->trace->count) {
+            return false;
+        }
+        chunk = _mo5trace_iter_chunk(iter);
+        iter->op = _mo5trace_chunk_op(chunk);
+        iter->index = 0;
+        iter->pos = 0;
+    }
+    iter->pos = (size_t)(_mo5trace_decode(&chunk->data[iter->pos], &iter->op) - chunk->data);
+    return true;
+}
+
+bool mo5trace_ea(const mo5trace_op_t* op, uint16_t* ea, bool* indirect) {
+    assert(op && ea && indirect);
+    *indirect = false;
+    const uint8_t* bytes = op->bytes;
+    int code = bytes[0];
+    if ((code == 0x10) || (code == 0x11)) {
+        code = bytes[1];
+        bytes++;
+    }
+    int mode;
+    if (code < 0x10) {
+        mode = 0x10;
+    } else if ((code >= 0x30) && (code < 0x34)) {
+        mode = 0x20;
+    } else if ((code >= 0x60) && (code < 0x80)) {
+        mode = (code < 0x70) ? 0x20 : 0x30;
+    } else if (code >= 0x80) {
+        mode = code & 0x30;
+    } else {
+        return false;
+    }
+    switch (mode) {
+    case 0x10:
+        *ea = (uint16_t)((op->dp << 8) | bytes[1]);
+        return true;
+    case 0x30:
+        *ea = (uint16_t)((bytes[1] << 8) | bytes[2]);
+        return true;
+    case 0x20:
+        break;
+    default:
+        return false;
+    }
+    // indexed
+    const uint8_t postbyte = bytes[1];
+    const uint16_t regs[4] = { op->x, op->y, op->u, op->s };
+    const uint16_t r = regs[(postbyte >> 5) & 3];
+    const uint16_t next_pc = (uint16_t)(op->pc + op->num_bytes);
+    if (0 == (postbyte & 0x80)) {
+        *ea = (uint16_t)(r + ((postbyte & 0x10) ? (postbyte & 0x1f) - 0x20 : (postbyte & 0x1f)));
+        return true;
+    }
+    *indirect = 0 != (postbyte & 0x10);
+    switch (postbyte & 0x0f) {
+    case 0x0: case 0x1: case 0x4: *ea = r; break;
+    case 0x2: *ea = (uint16_t)(r - 1); break;
+    case 0x3: *ea = (uint16_t)(r - 2); break;
+    case 0x5: *ea = (uint16_t)(r + (int8_t)op->b); break;
+    case 0x6: *ea = (uint16_t)(r + (int8_t)op->a); break;
+    case 0x8: *ea = (uint16_t)(r + (int8_t)bytes[2]); break;
+    case 0x9: *ea = (uint16_t)(r + ((bytes[2] << 8) | bytes[3])); break;
+    case 0xb: *ea = (uint16_t)(r + ((op->a << 8) | op->b)); break;
+    case 0xc: *ea = (uint16_t)(next_pc + (int8_t)bytes[2]); break;
+    case 0xd: *ea = (uint16_t)(next_pc + ((bytes[2] << 8) | bytes[3])); break;
+    case 0xf: *ea = (uint16_t)((bytes[2] << 8) | bytes[3]); break;
+    default: return false;
+    }
+    return true;
+}
+
+typedef struct {
+    const mo5trace_op_t* op;
+    int pos;
+    char* dst;
+    int len;
+    int size;
+} _mo5trace_dasm_t;
+
+static uint8_t _mo5trace_dasm_in(void* user_data) {
+    _mo5trace_dasm_t* dasm = (_mo5trace_dasm_t*) user_data;
+    return (dasm->pos < dasm->op->num_bytes) ? dasm->op->bytes[dasm->pos++] : 0;
+}
+
+static void _mo5trace_dasm_out(char c, void* user_data) {
+    _mo5trace_dasm_t* dasm = (_mo5trace_dasm_t*) user_data;
+    if (dasm->len < (dasm->size - 1)) {
+        dasm->dst[dasm->len++] = c;
+        dasm->dst[dasm->len] = 0;
+    }
+}
+
+bool mo5trace_write_text(const mo5_trace_t* trace, FILE* fp, mo5trace_dasm_t dasm, uint32_t last) {
+    assert(fp);
+    const uint32_t num_ops = mo5trace_num_ops(trace);
+    const uint32_t skip = (last && (num_ops > last)) ? (num_ops - last) : 0;
+    mo5trace_iter_t iter;
+    for (bool ok = mo5trace_seek(trace, &iter, skip); ok; ok = mo5trace_next(&iter)) {
+        const mo5trace_op_t* op = &iter.op;
+        char hex[16] = { 0 };
+        for (int i = 0; i < op->num_bytes; i++) {
+            snprintf(&hex[i * 3], sizeof(hex) - (size_t)(i * 3), "%02X ", op->bytes[i]);
+        }
+        char text[32] = { 0 };
+        if (dasm) {
+            _mo5trace_dasm_t ctx = { .op = op, .dst = text, .size = (int)sizeof(text) };
+            dasm(op->pc, _mo5trace_dasm_in, _mo5trace_dasm_out, &ctx);
+        }
+        char ea_text[16] = { 0 };
+        uint16_t ea;
+        bool indirect;
+        if (mo5trace_ea(op, &ea, &indirect)) {
+            snprintf(ea_text, sizeof(ea_text), indirect ? " EA=[%04X]" : " EA=%04X", ea);
+        }
+        if (fprintf(fp, "%10llu %04X  %-15s %-20s CC=%02X A=%02X B=%02X DP=%02X X=%04X Y=%04X U=%04X S=%04X%s\n",
+            (unsigned long long)op->cycle, op->pc, hex, text,
+            op->cc, op->a, op->b, op->dp, op->x, op->y, op->u, op->s, ea_text) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void _mo5trace_put16(uint8_t* dst, uint16_t value) {
+    dst[0] = (uint8_t)value;
+    dst[1] = (uint8_t)(value >> 8);
+}
+
+static void _mo5trace_put32(uint8_t* dst, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        dst[i] = (uint8_t)(value >> (i * 8));
+    }
+}
+
+bool mo5trace_write_binary(const mo5_trace_t* trace, FILE* fp) {
+    assert(fp);
+    const int count = trace ? trace->count : 0;
+    uint8_t header[20] = { 'M', 'O', '5', 'T', 'R', 'A', 'C', 'E' };
+    _mo5trace_put32(&header[8], MO5TRACE_VERSION);
+    _mo5trace_put32(&header[12], MO5TRACE_CHUNK_SIZE);
+    _mo5trace_put32(&header[16], (uint32_t)count);
+    if (fwrite(header, sizeof(header), 1, fp) != 1) {
+        return false;
+    }
+    // the records past size were never written, they aren't dumped
+    for (int i = 0; i < count; i++) {
+        const mo5trace_chunk_t* chunk = &trace->chunk[(trace->first + i) % trace->num_chunks];
+        uint8_t fields[28];
+        _mo5trace_put32(&fields[0], (uint32_t)chunk->cycle);
+        _mo5trace_put32(&fields[4], (uint32_t)(chunk->cycle >> 32));
+        _mo5trace_put32(&fields[8], chunk->num_ops);
+        _mo5trace_put16(&fields[12], chunk->size);
+        _mo5trace_put16(&fields[14], chunk->pc);
+        _mo5trace_put16(&fields[16], chunk->x);
+        _mo5trace_put16(&fields[18], chunk->y);
+        _mo5trace_put16(&fields[20], chunk->u);
+        _mo5trace_put16(&fields[22], chunk->s);
+        fields[24] = chunk->cc;
+        fields[25] = chunk->a;
+        fields[26] = chunk->b;
+        fields[27] = chunk->dp;
+        if (fwrite(fields, sizeof(fields), 1, fp) != 1) {
+            return false;
+        }
+        if ((chunk->size > 0) && (fwrite(chunk->data, chunk->size, 1, fp) != 1)) {
+            return false;
+        }
+    }
+    return true;
+}
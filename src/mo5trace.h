@@ -0,0 +1,118 @@
+#pragma once
+/*
+    Instruction trace: the machine records each instruction it runs into a
+    ring buffer, to look back at what led to a crash long after its cause.
+
+    The ring is made of 4KB chunks. A chunk starts with the registers and
+    the cycle count before its first instruction, followed by one record
+    per instruction, each holding what changed since the previous one:
+
+        tag         bit 0: PC jumped or DP changed, bits 1..7: CC A B X Y U S changed
+        cycles      varint, cycles since the previous instruction
+        [jump]      varint, zigzag(PC - expected PC) << 1 | DP changed, then [DP]
+        bytes       the instruction bytes (opcode, postbyte, operands)
+        registers   CC A B as bytes, X Y U S as zigzag varint differences
+
+    A record takes 4 to 6 bytes for most code, the registers before each
+    instruction are rebuilt from the start of its chunk, so the effective
+    address of an instruction is computed when the trace is read. Once the
+    ring is full the oldest chunk is dropped.
+
+    Recording runs in the debug CPU loop, for a few ns per instruction. Loading
+    an older state (rewind, run-ahead) drops what was recorded after it. The
+    recorder is compiled in debug builds, release builds get it with
+    MO5_TRACE=1.
+
+    Binary dumps hold a header ("MO5TRACE", then the version, the chunk size
+    and the number of chunks as 32 bits little endian) and the chunks, the
+    oldest first: the fields of mo5trace_chunk_t in order (28 bytes, little
+    endian) followed by the size bytes of records.
+*/
+#include <stdio.h>
+#include "mo5.h"
+
+#if !defined(MO5_TRACE)
+    #if defined(NDEBUG)
+        #define MO5_TRACE (0)
+    #else
+        #define MO5_TRACE (1)
+    #endif
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MO5TRACE_CHUNK_SIZE (4096)
+#define MO5TRACE_VERSION (2)
+
+// an instruction with the registers before it
+typedef struct {
+    uint64_t cycle;
+    uint16_t pc;
+    uint8_t cc, a, b, dp;
+    uint16_t x, y, u, s;
+    uint8_t bytes[5];
+    int num_bytes;
+} mo5trace_op_t;
+
+typedef struct {
+    uint64_t cycle;         // before the first instruction
+    uint32_t num_ops;
+    uint16_t size;          // bytes of records in data
+    uint16_t pc, x, y, u, s;
+    uint8_t cc, a, b, dp;
+    uint8_t data[MO5TRACE_CHUNK_SIZE - 28];
+} mo5trace_chunk_t;
+
+// walks the recorded instructions, the oldest first
+typedef struct {
+    const mo5_trace_t* trace;
+    int chunk;              // chunks walked
+    uint32_t index;         // instruction in the chunk
+    size_t pos;             // next record in the chunk
+    mo5trace_op_t op;
+} mo5trace_iter_t;
+
+// disassembler, m6809dasm_op() fits
+typedef void (*mo5trace_dasm_t)(uint16_t pc, uint8_t (*in_cb)(void* user_data), void (*out_cb)(char c, void* user_data), void* user_data);
+
+// start a new recording in a ring of size bytes, returns false if the
+// recorder isn't compiled in
+bool mo5trace_start(mo5_t* sys, size_t size);
+// stop recording, the trace stays in the machine until the next start
+void mo5trace_stop(mo5_t* sys);
+bool mo5trace_recording(const mo5_trace_t* trace);
+
+// called by the machine: record the instruction about to run (bytes holds 5
+// bytes from PC on), forget what was recorded from cycle on (a state was
+// loaded), free the trace
+void mo5trace_record(mo5_trace_t* trace, const mc6809e_t* cpu, const uint8_t* bytes, uint64_t cycle);
+void mo5trace_rewind(mo5_trace_t* trace, uint64_t cycle);
+void mo5trace_destroy(mo5_trace_t* trace);
+
+// instructions in the ring, and since the recording started
+uint32_t mo5trace_num_ops(const mo5_trace_t* trace);
+uint64_t mo5trace_total_ops(const mo5_trace_t* trace);
+// bytes of records in the ring
+size_t mo5trace_num_bytes(const mo5_trace_t* trace);
+// first recorded instruction, false if there is none
+bool mo5trace_first(const mo5_trace_t* trace, mo5trace_iter_t* iter);
+// instruction index of the ring (0: the oldest), false if there is none,
+// the chunks before it aren't decoded
+bool mo5trace_seek(const mo5_trace_t* trace, mo5trace_iter_t* iter, uint32_t index);
+bool mo5trace_next(mo5trace_iter_t* iter);
+// size of the instruction at bytes, only reads the bytes which are part of it
+int mo5trace_op_size(const uint8_t* bytes);
+// effective address of a direct, extended or indexed instruction, false if
+// it has none, indirect modes give the address of the pointer (*indirect set)
+bool mo5trace_ea(const mo5trace_op_t* op, uint16_t* ea, bool* indirect);
+// one line per instruction: cycle, PC, bytes, disassembly (if dasm isn't
+// null), registers before the instruction and effective address, only the
+// last instructions if last isn't 0
+bool mo5trace_write_text(const mo5_trace_t* trace, FILE* fp, mo5trace_dasm_t dasm, uint32_t last);
+bool mo5trace_write_binary(const mo5_trace_t* trace, FILE* fp);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
@@ -0,0 +1,230 @@
+#include "rewind.h"
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+
+// minimal number of unchanged bytes which end a literal run
+#define REWIND_MIN_ZERO_RUN (4)
+
+typedef struct {
+    uint32_t offset;    // offset of the compressed entry in the ring buffer
+    uint32_t size;      // compressed size in bytes
+    uint32_t key;       // sequence number of the entry's keyframe
+} rewind_entry_t;
+
+typedef struct {
+    bool valid;
+    rewind_desc_t desc;
+    uint8_t* buf;               // ring buffer with compressed entries
+    uint8_t* keyframe;          // uncompressed state of the current keyframe
+    uint8_t* scratch;           // encoder output
+    rewind_entry_t* entries;
+    uint32_t head;              // sequence number of the oldest entry
+    uint32_t tail;              // sequence number one past the newest entry
+    uint32_t key;               // sequence number of the current keyframe
+    bool need_key;
+    size_t write_pos;
+    size_t used;
+    size_t last_size;
+} rewind_state_t;
+static rewind_state_t state;
+
+static rewind_entry_t* _rewind_entry(uint32_t seq) {
+    return &state.entries[seq % (uint32_t)state.desc.max_entries];
+}
+
+static size_t _rewind_put_varint(uint8_t* dst, size_t val) {
+    size_t n = 0;
+    while (val >= 0x80) {
+        dst[n++] = (uint8_t)(val | 0x80);
+        val >>= 7;
+    }
+    dst[n++] = (uint8_t)val;
+    return n;
+}
+
+static size_t _rewind_get_varint(const uint8_t* src, size_t* val) {
+    size_t n = 0;
+    int shift = 0;
+    *val = 0;
+    uint8_t b;
+    do {
+        b = src[n++];
+        *val |= (size_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    return n;
+}
+
+// encode src XOR ref (ref may be null) as a sequence of
+// [zero run length][literal length][literal bytes]
+static size_t _rewind_encode(const uint8_t* src, const uint8_t* ref, size_t num, uint8_t* dst) {
+    size_t pos = 0;
+    size_t i = 0;
+    while (i < num) {
+        size_t zeros = 0;
+        while ((i + zeros < num) && ((src[i + zeros] ^ (ref ? ref[i + zeros] : 0)) == 0)) {
+            zeros++;
+        }
+        i += zeros;
+        size_t lit = 0;
+        size_t run = 0;
+        while ((i + lit + run < num) && (run < REWIND_MIN_ZERO_RUN)) {
+            const size_t k = i + lit + run;
+            if ((src[k] ^ (ref ? ref[k] : 0)) == 0) {
+                run++;
+            } else {
+                lit += run + 1;
+                run = 0;
+            }
+        }
+        pos += _rewind_put_varint(&dst[pos], zeros);
+        pos += _rewind_put_varint(&dst[pos], lit);
+        for (size_t k = 0; k < lit; k++) {
+            dst[pos++] = src[i + k] ^ (ref ? ref[i + k] : 0);
+        }
+        i += lit;
+    }
+    return pos;
+}
+
+// apply an encoded entry to dst with XOR
+static void _rewind_decode(const uint8_t* src, size_t size, uint8_t* dst, size_t num) {
+    size_t pos = 0;
+    size_t i = 0;
+    while (pos < size) {
+        size_t zeros, lit;
+        pos += _rewind_get_varint(&src[pos], &zeros);
+        pos += _rewind_get_varint(&src[pos], &lit);
+        i += zeros;
+        assert((i + lit) <= num);
+        for (size_t k = 0; k < lit; k++) {
+            dst[i++] ^= src[pos++];
+        }
+    }
+    (void)num;
+}
+
+// drop the oldest entry, and all following entries which depend on it
+static void _rewind_drop_oldest(void) {
+    do {
+        state.used -= _rewind_entry(state.head)->size;
+        state.head++;
+    } while ((state.head != state.tail) && (_rewind_entry(state.head)->key != state.head));
+    if ((int32_t)(state.key - state.head) < 0) {
+        state.need_key = true;
+    }
+}
+
+void rewind_init(const rewind_desc_t* desc) {
+    assert(desc && (desc->state_size > 0) && (desc->budget > 0) && (desc->max_entries > 0));
+    rewind_discard();
+    state.desc = *desc;
+    if (state.desc.keyframe_interval <= 0) {
+        state.desc.keyframe_interval = 1;
+    }
+    state.buf = (uint8_t*) malloc(desc->budget);
+    state.keyframe = (uint8_t*) malloc(desc->state_size);
+    state.scratch = (uint8_t*) malloc(desc->state_size * 2 + 16);
+    state.entries = (rewind_entry_t*) calloc((size_t)desc->max_entries, sizeof(rewind_entry_t));
+    state.valid = true;
+    rewind_clear();
+}
+
+void rewind_discard(void) {
+    if (state.valid) {
+        free(state.buf);
+        free(state.keyframe);
+        free(state.scratch);
+        free(state.entries);
+    }
+    memset(&state, 0, sizeof(state));
+}
+
+void rewind_clear(void) {
+    assert(state.valid);
+    state.head = state.tail = 0;
+    state.need_key = true;
+    state.write_pos = 0;
+    state.used = 0;
+    state.last_size = 0;
+}
+
+void rewind_push(const void* src) {
+    assert(state.valid && src);
+    if ((state.tail - state.head) >= (uint32_t)state.desc.max_entries) {
+        _rewind_drop_oldest();
+    }
+    const bool is_key = state.need_key || ((state.tail - state.key) >= (uint32_t)state.desc.keyframe_interval);
+    const size_t size = _rewind_encode((const uint8_t*)src, is_key ? 0 : state.keyframe, state.desc.state_size, state.scratch);
+    if (size > state.desc.budget) {
+        rewind_clear();
+        return;
+    }
+    // make room in the ring buffer, entries ahead of the write position are the oldest
+    size_t pos = state.write_pos;
+    if ((pos + size) > state.desc.budget) {
+        while ((state.head != state.tail) && (_rewind_entry(state.head)->offset >= pos)) {
+            _rewind_drop_oldest();
+        }
+        pos = 0;
+    }
+    while ((state.head != state.tail) &&
+           (_rewind_entry(state.head)->offset >= pos) &&
+           (_rewind_entry(state.head)->offset < (pos + size)))
+    {
+        _rewind_drop_oldest();
+    }
+    if (is_key) {
+        // the history may have been emptied by dropping entries
+        if (state.head == state.tail) {
+            pos = 0;
+        }
+        memcpy(state.keyframe, src, state.desc.state_size);
+        state.key = state.tail;
+        state.need_key = false;
+    } else if (state.need_key) {
+        // our keyframe was dropped to make room, start over with a keyframe
+        rewind_push(src);
+        return;
+    }
+    memcpy(&state.buf[pos], state.scratch, size);
+    rewind_entry_t* entry = _rewind_entry(state.tail++);
+    entry->offset = (uint32_t)pos;
+    entry->size = (uint32_t)size;
+    entry->key = state.key;
+    state.write_pos = pos + size;
+    state.used += size;
+    state.last_size = size;
+}
+
+bool rewind_pop(void* dst) {
+    assert(state.valid && dst);
+    if (state.head == state.tail) {
+        return false;
+    }
+    const rewind_entry_t* entry = _rewind_entry(--state.tail);
+    const rewind_entry_t* key = _rewind_entry(entry->key);
+    memset(dst, 0, state.desc.state_size);
+    _rewind_decode(&state.buf[key->offset], key->size, (uint8_t*)dst, state.desc.state_size);
+    if (entry != key) {
+        _rewind_decode(&state.buf[entry->offset], entry->size, (uint8_t*)dst, state.desc.state_size);
+    }
+    state.used -= entry->size;
+    state.write_pos = entry->offset;
+    // continue with a new keyframe on the next push
+    state.need_key = true;
+    return true;
+}
+
+rewind_stats_t rewind_stats(void) {
+    assert(state.valid);
+    return (rewind_stats_t) {
+        .num_entries = (int)(state.tail - state.head),
+        .used_bytes = state.used,
+        .budget = state.desc.budget,
+        .last_size = state.last_size,
+    };
+}
@@ -0,0 +1,51 @@
+#pragma once
+/*
+    Rewind history for emulator states.
+
+    Machine states are pushed once per frame (or every N frames) into a
+    ring buffer with a fixed memory budget. Every few entries a keyframe
+    is stored, all other entries are stored as XOR delta against their
+    keyframe, compressed with a zero-run length encoding. When the budget
+    is exhausted the oldest entries are dropped.
+
+    Popping an entry decodes a keyframe and one delta, so stepping back
+    costs the same as a plain state copy, no matter how far back it goes.
+*/
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    size_t state_size;      // size of one state in bytes
+    size_t budget;          // memory budget for the compressed history in bytes
+    int max_entries;        // maximum number of states kept in the history
+    int keyframe_interval;  // store a full keyframe every N entries
+} rewind_desc_t;
+
+typedef struct {
+    int num_entries;        // number of states in the history
+    size_t used_bytes;      // compressed bytes used by the history
+    size_t budget;          // memory budget in bytes
+    size_t last_size;       // compressed size of the last pushed entry
+} rewind_stats_t;
+
+// initialize the rewind history, allocates the ring buffer
+void rewind_init(const rewind_desc_t* desc);
+// free the ring buffer
+void rewind_discard(void);
+// drop all entries
+void rewind_clear(void);
+// push a new state into the history
+void rewind_push(const void* state);
+// pop the newest state from the history, returns false if the history is empty
+bool rewind_pop(void* state);
+// get the current memory usage
+rewind_stats_t rewind_stats(void);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
@@ -0,0 +1,175 @@
+#include "tapeout.h"
+#include "worker.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+// block parser, follows the monitor's block write routine
+typedef enum {
+    TAPEOUT_LEADER,     // counting 0x01 bytes
+    TAPEOUT_SYNC,       // got 0x3C after the leader, expecting 0x5A
+    TAPEOUT_TYPE,
+    TAPEOUT_LENGTH,
+    TAPEOUT_DATA,
+} tapeout_parse_t;
+
+typedef struct {
+    bool valid;
+    char path[1024];
+    int idle_frames;
+    uint8_t* buf;           // pending bytes
+    size_t size;
+    size_t cap;
+    size_t complete;        // end of the last complete block in buf
+    tapeout_parse_t parse;
+    int leader;             // leader bytes seen
+    int remaining;          // data bytes left in the current block
+    bool active;            // bytes were put since the last update
+    int idle;               // updates without output
+    struct {
+        worker_t* worker;
+        uint8_t* data;      // bytes being written, swapped with buf
+        size_t size;
+        size_t cap;
+    } job;
+} tapeout_state_t;
+static tapeout_state_t state;
+
+static void _tapeout_reserve(uint8_t** buf, size_t* cap, size_t size) {
+    if (size > *cap) {
+        size_t new_cap = *cap ? *cap : 4096;
+        while (new_cap < size) {
+            new_cap *= 2;
+        }
+        *buf = (uint8_t*) realloc(*buf, new_cap);
+        *cap = new_cap;
+    }
+}
+
+static void _tapeout_write(void* user_data) {
+    (void)user_data;
+    FILE* fp = fopen(state.path, "ab");
+    if (fp) {
+        fwrite(state.job.data, 1, state.job.size, fp);
+        fclose(fp);
+    }
+}
+
+static void _tapeout_job_finish(void) {
+    state.job.size = 0;
+    state.job.worker = 0;
+}
+
+// hand the first num pending bytes over to the worker
+static void _tapeout_flush(size_t num) {
+    assert(!state.job.worker && (num <= state.size));
+    uint8_t* data = state.buf;
+    const size_t cap = state.cap;
+    state.buf = state.job.data;
+    state.cap = state.job.cap;
+    state.job.data = data;
+    state.job.cap = cap;
+    state.job.size = num;
+    const size_t tail = state.size - num;
+    _tapeout_reserve(&state.buf, &state.cap, tail);
+    if (tail > 0) {
+        memcpy(state.buf, &data[num], tail);
+    }
+    state.size = tail;
+    state.complete = (state.complete > num) ? (state.complete - num) : 0;
+    state.job.worker = worker_start(_tapeout_write, 0);
+    if (!state.job.worker) {
+        _tapeout_write(0);
+        _tapeout_job_finish();
+    }
+}
+
+static void _tapeout_job_wait(void) {
+    if (state.job.worker) {
+        worker_join(state.job.worker);
+        _tapeout_job_finish();
+    }
+}
+
+void tapeout_init(const tapeout_desc_t* desc) {
+    assert(desc && desc->path);
+    tapeout_discard();
+    snprintf(state.path, sizeof(state.path), "%s", desc->path);
+    state.idle_frames = (desc->idle_frames > 0) ? desc->idle_frames : 1;
+    state.valid = true;
+}
+
+void tapeout_discard(void) {
+    if (state.valid) {
+        _tapeout_job_wait();
+        if (state.size > 0) {
+            _tapeout_flush(state.size);
+            _tapeout_job_wait();
+        }
+        free(state.buf);
+        free(state.job.data);
+    }
+    memset(&state, 0, sizeof(state));
+}
+
+void tapeout_put(uint8_t byte, void* user_data) {
+    (void)user_data;
+    assert(state.valid);
+    _tapeout_reserve(&state.buf, &state.cap, state.size + 1);
+    state.buf[state.size++] = byte;
+    state.active = true;
+    bool end_of_block = false;
+    switch (state.parse) {
+        case TAPEOUT_LEADER:
+            if (byte == 0x01) {
+                state.leader++;
+            } else if ((byte == 0x3c) && (state.leader > 0)) {
+                state.parse = TAPEOUT_SYNC;
+            } else {
+                state.leader = 0;
+            }
+            break;
+        case TAPEOUT_SYNC:
+            state.parse = (byte == 0x5a) ? TAPEOUT_TYPE : TAPEOUT_LEADER;
+            state.leader = (byte == 0x01) ? 1 : 0;
+            break;
+        case TAPEOUT_TYPE:
+            state.parse = TAPEOUT_LENGTH;
+            break;
+        case TAPEOUT_LENGTH:
+            // the length counts itself, 0 means 256
+            state.remaining = (uint8_t)(byte - 1);
+            state.parse = TAPEOUT_DATA;
+            end_of_block = (state.remaining == 0);
+            break;
+        case TAPEOUT_DATA:
+            end_of_block = (--state.remaining == 0);
+            break;
+    }
+    if (end_of_block) {
+        state.complete = state.size;
+        state.parse = TAPEOUT_LEADER;
+        state.leader = 0;
+    }
+}
+
+void tapeout_update(void) {
+    assert(state.valid);
+    if (state.job.worker) {
+        if (!worker_done(state.job.worker)) {
+            return;
+        }
+        _tapeout_job_wait();
+    }
+    if (state.active) {
+        state.active = false;
+        state.idle = 0;
+    } else if (state.idle < state.idle_frames) {
+        state.idle++;
+    }
+    const size_t num = (state.idle >= state.idle_frames) ? state.size : state.complete;
+    if (num > 0) {
+        _tapeout_flush(num);
+    }
+}
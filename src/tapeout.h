@@ -0,0 +1,38 @@
+#pragma once
+/*
+    Streaming .k7 output for the bytes the machine writes to tape.
+
+    Bytes are collected in a growable buffer on the emulator thread. The
+    buffer follows the block structure written by the monitor (a leader of
+    0x01 bytes, the 0x3C 0x5A sync, the block type, a length byte and the
+    data), and each complete block is appended to the .k7 file on a worker
+    thread. Bytes which don't make a complete block are written once the
+    tape has been idle for a while, so custom save routines are captured
+    too. Nothing on the emulator thread waits for file IO, except
+    tapeout_discard().
+*/
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    const char* path;       // .k7 file the output is appended to
+    int idle_frames;        // write incomplete blocks after this many frames without output
+} tapeout_desc_t;
+
+// start a new output stream, bytes are appended to the file, which is created on the first write
+void tapeout_init(const tapeout_desc_t* desc);
+// write all pending bytes and wait for it
+void tapeout_discard(void);
+// append a byte, signature matches mo5_tape_out_callback_t
+void tapeout_put(uint8_t byte, void* user_data);
+// call once per frame, starts writing complete blocks in the background
+void tapeout_update(void);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
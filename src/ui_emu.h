@@ -2,6 +2,10 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "mo5rom.h"
+#include "mo5cover.h"
+#include "mo5search.h"
+#include "mo5trace.h"
+#include "rewind.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -21,47 +25,47 @@ typedef struct {
     bool open;
 } ui_emu_video_t;
 
-typedef enum {
-    SEARCH_LOWER,
-    SEARCH_LOWER_OR_EQUALS,
-    SEARCH_GREATER,
-    SEARCH_GREATER_OR_EQUALS,
-    SEARCH_EQUALS,
-    SEARCH_NOT_EQUALS
-} ui_emu_cheats_search_op_t;
+typedef struct {
+    int* frames;            /* number of frames to run ahead, owned by the host */
+    int max_frames;
+    const float* cost_ms;   /* measured host time spent on run-ahead per frame */
+} ui_emu_runahead_t;
+
+typedef struct {
+    const bool* enabled;            /* rewind recording on/off, owned by the host */
+    const rewind_stats_t* stats;    /* rewind history memory usage */
+    const float* cost_ms;           /* measured host time spent on recording per frame */
+} ui_emu_rewind_t;
 
 typedef struct {
     int x, y;
     int w, h;
     bool open;
     bool two_bytes;
-    ui_emu_cheats_search_op_t search_op;
-    uint16_t value;
-    uint16_t addresses[32256];
-    uint16_t num_addresses;
+    mo5search_op_t op;
+    mo5search_ref_t ref;
+    int value;              /* constant, or difference to the previous value */
+    mo5search_t search;
 } ui_emu_cheats_search_t;
 
 typedef struct {
     int x, y;
     int w, h;
     bool open;
-    uint16_t address;
-    bool two_bytes;
-    uint16_t value;
+    mo5_cheat_t cheat;      /* cheat to add */
 } ui_emu_cheats_add_t;
 
 typedef struct {
-    uint16_t address;
-    uint16_t value;
-    bool two_bytes;
-} ui_emu_cheat_t;
+    const char* path;       /* cheat file, owned by the host */
+    bool (*save_cb)(void);  /* write the cheat table to the cheat file (optional) */
+} ui_emu_cheat_file_t;
 
 typedef struct {
     int x, y;
     int w, h;
     bool open;
-    ui_emu_cheat_t cheats[10];
-    uint8_t num_cheats;
+    ui_emu_cheat_file_t file;
+    bool save_failed;
 } ui_emu_cheat_list_t;
 
 /* user-defined hotkeys (all strings must be static) */
@@ -74,10 +78,15 @@ typedef struct ui_dbg_keys_desc_t {
     ui_dbg_key_desc_t cont;
     ui_dbg_key_desc_t stop;
     ui_dbg_key_desc_t step_over;
+    ui_dbg_key_desc_t step_into;
+    ui_dbg_key_desc_t step_out;
 } ui_dbg_keys_desc_t;
 
 typedef struct {
     mo5_t* mo5;
+    ui_emu_runahead_t runahead;     // run-ahead settings (optional)
+    ui_emu_rewind_t rewind;         // rewind history info (optional)
+    ui_emu_cheat_file_t cheats;     // cheat file (optional)
     ui_snapshot_desc_t snapshot;    // snapshot ui setup params
     ui_dbg_keys_desc_t dbg_keys;        // user-defined hotkeys
 } ui_emu_desc_t;
@@ -96,6 +105,17 @@ typedef struct ui_dbg_t {
     bool open;
     bool stopped;
     int step_mode;
+    uint16_t bp_addr;       // breakpoint to add
+    uint32_t bp_hits;       // stop at this hit only (0: every hit)
+    int bad_condition;      // breakpoint whose last condition didn't compile, -1 if none
+    uint16_t bad_condition_pc;
+    int num_breakpoints;    // when bad_condition was set, a change moves the indices
+    mo5_watchpoint_t wp;    // watchpoint to add
+    int wp_access;          // 0: write, 1: read, 2: read/write
+    bool trace_on_break;    // write the end of the trace as text when the machine stops
+    const char* trace_file; // last trace written, null if none
+    bool trace_failed;
+    bool history_end;       // the last step back went past the history
 } ui_dbg_t;
 
 typedef struct {
@@ -104,6 +124,8 @@ typedef struct {
     ui_kbd_t                kbd;
     ui_display_t            display;
     ui_emu_video_t          video;
+    ui_emu_runahead_t       runahead;
+    ui_emu_rewind_t         rewind;
     ui_emu_cheats_search_t  cheats_search;
     ui_emu_cheats_add_t     cheats_add;
     ui_emu_cheat_list_t     cheat_list;
@@ -167,6 +189,24 @@ static void _ui_emu_draw_menu(ui_emu_t* ui) {
             }
             ImGui::Separator();
             ui_snapshot_menus(&ui->snapshot);
+            if (ui->runahead.frames) {
+                ImGui::Separator();
+                if (ImGui::BeginMenu("Run-ahead")) {
+                    ImGui::SliderInt("Frames", ui->runahead.frames, 0, ui->runahead.max_frames);
+                    ImGui::Text("Cost: %.2f ms/frame", *ui->runahead.cost_ms);
+                    ImGui::EndMenu();
+                }
+            }
+            if (ui->rewind.stats && *ui->rewind.enabled) {
+                if (ImGui::BeginMenu("Rewind (hold F9)")) {
+                    const rewind_stats_t* stats = ui->rewind.stats;
+                    ImGui::Text("History: %d frames (%.1f s)", stats->num_entries, stats->num_entries / 60.0f);
+                    ImGui::Text("Memory: %u / %u KB", (unsigned)(stats->used_bytes / 1024), (unsigned)(stats->budget / 1024));
+                    ImGui::Text("Last entry: %u bytes", (unsigned)stats->last_size);
+                    ImGui::Text("Cost: %.3f ms/frame", *ui->rewind.cost_ms);
+                    ImGui::EndMenu();
+                }
+            }
             ImGui::EndMenu();
         }
         if (ImGui::BeginMenu("Info")) {
@@ -247,40 +287,9 @@ static void _ui_emu_draw_video(ui_emu_t* ui) {
     ImGui::End();
 }
 
-static bool _ui_emu_cheats_search_addr(ui_emu_t* ui, uint16_t address) {
-    const uint16_t data = ui->cheats_search.two_bytes ? (mo5_mem_read(ui->mo5, address) << 8) | (mo5_mem_read(ui->mo5, address + 1) & 0xff) : (uint8_t)mo5_mem_read(ui->mo5, address);
-    switch(ui->cheats_search.search_op) {
-        case SEARCH_LOWER:
-        return data < ui->cheats_search.value;
-        case SEARCH_LOWER_OR_EQUALS:
-        return (data <= ui->cheats_search.value);
-        case SEARCH_GREATER:
-        return (data > ui->cheats_search.value);
-        case SEARCH_GREATER_OR_EQUALS:
-        return (data >= ui->cheats_search.value);
-        case SEARCH_EQUALS:
-        return (data == ui->cheats_search.value);
-        case SEARCH_NOT_EQUALS:
-        return (data != ui->cheats_search.value);
-    }
-    return false;
-}
-
-static void _ui_emu_cheats_search_go(ui_emu_t* ui) {
-    if(ui->cheats_search.num_addresses == 0) {
-        for(int address = 0x2200; address < 0xa000; address++) {
-            if(_ui_emu_cheats_search_addr(ui, address)) {
-                ui->cheats_search.addresses[ui->cheats_search.num_addresses++] = address;
-            }
-        }
-    } else {
-        int count = 0;
-        for(int i = 0; i < ui->cheats_search.num_addresses; i++) {
-            if(_ui_emu_cheats_search_addr(ui, ui->cheats_search.addresses[i])) {
-                ui->cheats_search.addresses[count++] = ui->cheats_search.addresses[i];
-            }
-        }
-        ui->cheats_search.num_addresses = count;
+static void _ui_emu_cheats_search_op(ui_emu_t* ui, const char* label, mo5search_op_t op) {
+    if (ImGui::RadioButton(label, ui->cheats_search.op == op)) {
+        ui->cheats_search.op = op;
     }
 }
 
@@ -291,6 +300,7 @@ static void _ui_emu_draw_cheats_search(ui_emu_t* ui) {
     ImGui::SetNextWindowPos(ImVec2((float)ui->cheats_search.x, (float)ui->cheats_search.y), ImGuiCond_FirstUseEver);
     ImGui::SetNextWindowSize(ImVec2((float)ui->cheats_search.w, (float)ui->cheats_search.h), ImGuiCond_FirstUseEver);
     if (ImGui::Begin("Cheats search", &ui->cheats_search.open)) {
+        mo5search_t* search = &ui->cheats_search.search;
         ImGui::Text("Size");
         if(ImGui::RadioButton("1 byte  [0..255]", !ui->cheats_search.two_bytes)) {
             ui->cheats_search.two_bytes = false;
@@ -300,47 +310,84 @@ static void _ui_emu_draw_cheats_search(ui_emu_t* ui) {
         }
         ImGui::Separator();
         ImGui::Text("Operator");
-        if(ImGui::RadioButton("< ", ui->cheats_search.search_op == SEARCH_LOWER)) {
-            ui->cheats_search.search_op = SEARCH_LOWER;
-        }
+        _ui_emu_cheats_search_op(ui, "< ", MO5SEARCH_LT);
         ImGui::SameLine();
-        if(ImGui::RadioButton("<=", ui->cheats_search.search_op == SEARCH_LOWER_OR_EQUALS)) {
-            ui->cheats_search.search_op = SEARCH_LOWER_OR_EQUALS;
+        _ui_emu_cheats_search_op(ui, "<=", MO5SEARCH_LE);
+        _ui_emu_cheats_search_op(ui, "> ", MO5SEARCH_GT);
+        ImGui::SameLine();
+        _ui_emu_cheats_search_op(ui, ">=", MO5SEARCH_GE);
+        _ui_emu_cheats_search_op(ui, "==", MO5SEARCH_EQ);
+        ImGui::SameLine();
+        _ui_emu_cheats_search_op(ui, "!=", MO5SEARCH_NE);
+        ImGui::Separator();
+        ImGui::Text("Compare to");
+        if(ImGui::RadioButton("Specific value", ui->cheats_search.ref == MO5SEARCH_CONSTANT)) {
+            ui->cheats_search.ref = MO5SEARCH_CONSTANT;
         }
-        if(ImGui::RadioButton("> ", ui->cheats_search.search_op == SEARCH_GREATER)) {
-            ui->cheats_search.search_op = SEARCH_GREATER;
+        if(ImGui::RadioButton("Previous value +", ui->cheats_search.ref == MO5SEARCH_PREVIOUS)) {
+            ui->cheats_search.ref = MO5SEARCH_PREVIOUS;
         }
-        ImGui::SameLine();
-        if(ImGui::RadioButton(">=", ui->cheats_search.search_op == SEARCH_GREATER_OR_EQUALS)) {
-            ui->cheats_search.search_op = SEARCH_GREATER_OR_EQUALS;
+        ImGui::InputInt("##value", &ui->cheats_search.value);
+        // a size change starts over, the previous values are of the other size
+        const bool restart = !search->started || (search->two_bytes != ui->cheats_search.two_bytes);
+        if (ImGui::Button("New search")) {
+            mo5search_start(search, ui->mo5, ui->cheats_search.two_bytes);
         }
-        if(ImGui::RadioButton("==", ui->cheats_search.search_op == SEARCH_EQUALS)) {
-            ui->cheats_search.search_op = SEARCH_EQUALS;
+        ImGui::SameLine();
+        if (ImGui::Button("Search")) {
+            if (restart) {
+                mo5search_start(search, ui->mo5, ui->cheats_search.two_bytes);
+            }
+            // against the previous values, the first search only takes a snapshot
+            if (!restart || (ui->cheats_search.ref == MO5SEARCH_CONSTANT)) {
+                mo5search_filter(search, ui->mo5, ui->cheats_search.op, ui->cheats_search.ref, ui->cheats_search.value);
+            }
         }
         ImGui::SameLine();
-        if(ImGui::RadioButton("!=", ui->cheats_search.search_op == SEARCH_NOT_EQUALS)) {
-            ui->cheats_search.search_op = SEARCH_NOT_EQUALS;
+        if(ImGui::Button("Clear")) {
+            search->started = false;
         }
-        ImGui::Separator();
-        ImGui::Text("Compare to");
-        uint16_t max = ui->cheats_search.two_bytes ? 0xFFFF: 0xFF;
-        ImGui::DragScalar("Specific value", ImGuiDataType_U16, &ui->cheats_search.value, 1.0f, 0, &max);
-        if(ImGui::Button("Search")) {
-            _ui_emu_cheats_search_go(ui);
-        }
-        ImGui::Text("%u results", ui->cheats_search.num_addresses);
-        if (ui->cheats_search.num_addresses < 5) {
-            if (ImGui::BeginListBox("results")) {
-                for(int i = 0; i < ui->cheats_search.num_addresses; i++) {
-                    ImGui::Text("0x%4x", ui->cheats_search.addresses[i]);
+        if (search->started) {
+            ImGui::Text("%d results", search->num_candidates);
+            // only the visible rows are drawn
+            if (ImGui::BeginTable("##results", 4, ImGuiTableFlags_ScrollY | ImGuiTableFlags_RowBg)) {
+                ImGui::TableSetupScrollFreeze(0, 1);
+                ImGui::TableSetupColumn("Address");
+                ImGui::TableSetupColumn("Value");
+                ImGui::TableSetupColumn("Previous");
+                ImGui::TableSetupColumn("");
+                ImGui::TableHeadersRow();
+                ImGuiListClipper clipper;
+                clipper.Begin(search->num_candidates);
+                while (clipper.Step()) {
+                    for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+                        const uint16_t address = mo5search_candidate(search, i);
+                        uint16_t value = mo5_mem_peek(ui->mo5, address);
+                        if (search->two_bytes) {
+                            value = (uint16_t)((value << 8) | mo5_mem_peek(ui->mo5, address + 1));
+                        }
+                        ImGui::PushID(i);
+                        ImGui::TableNextRow();
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%04X", address);
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%u", value);
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%u", mo5search_prev(search, address));
+                        ImGui::TableNextColumn();
+                        if (ImGui::SmallButton("Add")) {
+                            ui->cheats_add.cheat.address = address;
+                            ui->cheats_add.cheat.value = value;
+                            ui->cheats_add.cheat.two_bytes = search->two_bytes;
+                            ui->cheats_add.open = true;
+                        }
+                        ImGui::PopID();
+                    }
                 }
-              ImGui::EndListBox();
+                clipper.End();
+                ImGui::EndTable();
             }
         }
-        if(ImGui::Button("Clear")) {
-            ui->cheats_search.num_addresses = 0;
-        }
-
     }
     ImGui::End();
 }
@@ -352,36 +399,32 @@ static void _ui_emu_draw_cheats_add(ui_emu_t* ui) {
     ImGui::SetNextWindowPos(ImVec2((float)ui->cheats_add.x, (float)ui->cheats_add.y), ImGuiCond_FirstUseEver);
     ImGui::SetNextWindowSize(ImVec2((float)ui->cheats_add.w, (float)ui->cheats_add.h), ImGuiCond_FirstUseEver);
     if (ImGui::Begin("Add cheats", &ui->cheats_add.open)) {
-        ImGui::InputScalar("Address", ImGuiDataType_U16, &ui->cheats_add.address, 0, 0, "%04X", ImGuiInputTextFlags_CharsHexadecimal);
-        if(ImGui::RadioButton("1 byte  [0..255]", !ui->cheats_add.two_bytes)) {
-            ui->cheats_add.two_bytes = false;
+        mo5_cheat_t* cheat = &ui->cheats_add.cheat;
+        ImGui::InputScalar("Address", ImGuiDataType_U16, &cheat->address, 0, 0, "%04X", ImGuiInputTextFlags_CharsHexadecimal);
+        if(ImGui::RadioButton("1 byte  [0..255]", !cheat->two_bytes)) {
+            cheat->two_bytes = false;
         }
-        if(ImGui::RadioButton("2 bytes [0..65535]", ui->cheats_add.two_bytes)) {
-            ui->cheats_add.two_bytes = true;
+        if(ImGui::RadioButton("2 bytes [0..65535]", cheat->two_bytes)) {
+            cheat->two_bytes = true;
         }
         ImGui::Separator();
-        ImGui::InputScalar("Value", ImGuiDataType_U16, &ui->cheats_add.value);
-        if(ImGui::Button("Add") && ui->cheat_list.num_cheats < 10) {
-            ui->cheat_list.cheats[ui->cheat_list.num_cheats].address = ui->cheats_add.address;
-            ui->cheat_list.cheats[ui->cheat_list.num_cheats].value = ui->cheats_add.value;
-            ui->cheat_list.cheats[ui->cheat_list.num_cheats].two_bytes = ui->cheats_add.two_bytes;
-            ui->cheat_list.num_cheats++;
+        ImGui::InputScalar("Value", ImGuiDataType_U16, &cheat->value);
+        if(ImGui::RadioButton("Freeze at each frame", cheat->mode == MO5_CHEAT_FREEZE)) {
+            cheat->mode = MO5_CHEAT_FREEZE;
+        }
+        if(ImGui::RadioButton("Patch CPU reads", cheat->mode == MO5_CHEAT_PATCH)) {
+            cheat->mode = MO5_CHEAT_PATCH;
+        }
+        ImGui::InputText("Name", cheat->name, sizeof(cheat->name));
+        if(ImGui::Button("Add")) {
+            cheat->enabled = true;
+            mo5_add_cheat(ui->mo5, cheat);
         }
     }
     ImGui::End();
 }
 
 static void _ui_emu_draw_cheats_list(ui_emu_t* ui) {
-    for (int i=0; i<ui->cheat_list.num_cheats; i++) {
-        const ui_emu_cheat_t *cheat = &ui->cheat_list.cheats[i];
-        if(cheat->two_bytes) {
-            mo5_mem_write(ui->mo5, cheat->address, (cheat->value >> 8) & 0xFF);
-            mo5_mem_write(ui->mo5, cheat->address + 1, cheat->value & 0xFF);
-        } else {
-            mo5_mem_write(ui->mo5, cheat->address, cheat->value & 0xFF);
-        }
-    }
-
     if (!ui->cheat_list.open) {
         return;
     }
@@ -389,28 +432,43 @@ static void _ui_emu_draw_cheats_list(ui_emu_t* ui) {
     ImGui::SetNextWindowPos(ImVec2((float)ui->cheat_list.x, (float)ui->cheat_list.y), ImGuiCond_FirstUseEver);
     ImGui::SetNextWindowSize(ImVec2((float)ui->cheat_list.w, (float)ui->cheat_list.h), ImGuiCond_FirstUseEver);
     if (ImGui::Begin("Cheat list", &ui->cheat_list.open)) {
-        if (ImGui::BeginTable("Cheats", 3, 0)) {
+        if (ImGui::BeginTable("Cheats", 6, 0)) {
             int del_index = -1;
-            for (int i=0; i<ui->cheat_list.num_cheats; i++) {
-                const ui_emu_cheat_t *cheat = &ui->cheat_list.cheats[i];
+            for (int i=0; i<mo5_num_cheats(ui->mo5); i++) {
+                const mo5_cheat_t *cheat = mo5_cheat(ui->mo5, i);
+                ImGui::PushID(i);
                 ImGui::TableNextRow();
                 ImGui::TableNextColumn();
+                bool enabled = cheat->enabled;
+                if (ImGui::Checkbox("##enabled", &enabled)) {
+                    mo5_enable_cheat(ui->mo5, i, enabled);
+                }
+                ImGui::TableNextColumn();
                 ImGui::Text("%04X", cheat->address);
                 ImGui::TableNextColumn();
                 ImGui::Text("%u", cheat->value);
                 ImGui::TableNextColumn();
+                ImGui::Text("%s", (cheat->mode == MO5_CHEAT_PATCH) ? "patch" : "freeze");
+                ImGui::TableNextColumn();
+                ImGui::Text("%s", cheat->name);
+                ImGui::TableNextColumn();
                 if(ImGui::SmallButton("Del")) {
-                    del_index =  1;
+                    del_index = i;
                 }
+                ImGui::PopID();
             }
             ImGui::EndTable();
             if(del_index != -1) {
-                // remove deleted cheat
-                ui->cheat_list.num_cheats--;
-                for (int i=del_index; i<ui->cheat_list.num_cheats; i++) {
-                    ui->cheat_list.cheats[i] = ui->cheat_list.cheats[i+1];
-                }
+                mo5_remove_cheat(ui->mo5, del_index);
+            }
+        }
+        if (ui->cheat_list.file.save_cb) {
+            ImGui::Separator();
+            if (ImGui::Button("Save")) {
+                ui->cheat_list.save_failed = !ui->cheat_list.file.save_cb();
             }
+            ImGui::SameLine();
+            ImGui::Text("%s%s", ui->cheat_list.save_failed ? "Can't write " : "", ui->cheat_list.file.path);
         }
     }
     ImGui::End();
@@ -427,31 +485,55 @@ static inline const char* _ui_dbg_str_or_def(const char* str, const char* def) {
 static void _ui_dbg_break(ui_emu_t* ui) {
     ui->dbg.stopped = true;
     ui->dbg.step_mode = UI_DBG_STEPMODE_NONE;
+    mo5_break(ui->mo5);
 }
 
 static void _ui_dbg_continue(ui_emu_t* ui) {
     ui->dbg.stopped = false;
     ui->dbg.step_mode = UI_DBG_STEPMODE_NONE;
+    ui->dbg.history_end = false;
+}
+
+static void _ui_dbg_step_into(ui_emu_t* ui) {
+    ui->dbg.stopped = false;
+    ui->dbg.step_mode = UI_DBG_STEPMODE_INTO;
+    mo5_step_into(ui->mo5);
+}
+
+static void _ui_dbg_step_over(ui_emu_t* ui) {
+    ui->dbg.stopped = false;
+    ui->dbg.step_mode = UI_DBG_STEPMODE_OVER;
+    mo5_step_over(ui->mo5);
 }
 
-static void _ui_dbg_step(ui_emu_t* ui) {
+static void _ui_dbg_step_out(ui_emu_t* ui) {
     ui->dbg.stopped = false;
     ui->dbg.step_mode = UI_DBG_STEPMODE_OVER;
+    mo5_step_out(ui->mo5);
+}
+
+/* run one video frame */
+static void _ui_dbg_step_frame(ui_emu_t* ui) {
+    ui->dbg.stopped = false;
+    ui->dbg.step_mode = UI_DBG_STEPMODE_TICK;
+}
+
+static bool _ui_dbg_key_pressed(const ui_dbg_key_desc_t* key) {
+    return (0 != key->keycode) && ImGui::IsKeyPressed((ImGuiKey)key->keycode);
 }
 
 /* handle keyboard input, the debug window must be focused for hotkeys to work! */
 static void _ui_dbg_handle_input(ui_emu_t* ui) {
     /* unused hotkeys are defined as 0 and will never be triggered */
     if (ui->dbg.stopped) {
-        if (0 != ui->keys.cont.keycode) {
-            if (ImGui::IsKeyPressed((ImGuiKey)ui->keys.cont.keycode)) {
-                _ui_dbg_continue(ui);
-            }
-        }
-        if (0 != ui->keys.step_over.keycode) {
-            if (ImGui::IsKeyPressed((ImGuiKey)ui->keys.step_over.keycode)) {
-                _ui_dbg_step(ui);
-            }
+        if (_ui_dbg_key_pressed(&ui->keys.cont)) {
+            _ui_dbg_continue(ui);
+        } else if (_ui_dbg_key_pressed(&ui->keys.step_over)) {
+            _ui_dbg_step_over(ui);
+        } else if (_ui_dbg_key_pressed(&ui->keys.step_into)) {
+            _ui_dbg_step_into(ui);
+        } else if (_ui_dbg_key_pressed(&ui->keys.step_out)) {
+            _ui_dbg_step_out(ui);
         }
     } else {
         if (ImGui::IsKeyPressed((ImGuiKey)ui->keys.stop.keycode)) {
@@ -460,6 +542,263 @@ static void _ui_dbg_handle_input(ui_emu_t* ui) {
     }
 }
 
+static void _ui_dbg_draw_breakpoints(ui_emu_t* ui) {
+    mo5_t* mo5 = ui->mo5;
+    ImGui::SetNextItemWidth(48);
+    ImGui::InputScalar("##bp_addr", ImGuiDataType_U16, &ui->dbg.bp_addr, 0, 0, "%04X", ImGuiInputTextFlags_CharsHexadecimal);
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(48);
+    ImGui::InputScalar("Hit##bp_hits", ImGuiDataType_U32, &ui->dbg.bp_hits);
+    ImGui::SameLine();
+    if (ImGui::Button("Add") && (mo5_num_breakpoints(mo5) < MO5_MAX_BREAKPOINTS)) {
+        mo5_add_breakpoint(mo5, ui->dbg.bp_addr, false, ui->dbg.bp_hits);
+    }
+    // breakpoints are also added and removed by the debugger (step over)
+    if (mo5_num_breakpoints(mo5) != ui->dbg.num_breakpoints) {
+        ui->dbg.bad_condition = -1;
+    }
+    if (ImGui::BeginTable("##breakpoints", 5)) {
+        ImGui::TableSetupColumn("", ImGuiTableColumnFlags_WidthFixed);
+        ImGui::TableSetupColumn("", ImGuiTableColumnFlags_WidthFixed);
+        ImGui::TableSetupColumn("", ImGuiTableColumnFlags_WidthFixed);
+        ImGui::TableSetupColumn("", ImGuiTableColumnFlags_WidthStretch);
+        ImGui::TableSetupColumn("", ImGuiTableColumnFlags_WidthFixed);
+        int del_index = -1;
+        for (int i = 0; i < mo5_num_breakpoints(mo5); i++) {
+            const mo5_breakpoint_t* bp = mo5_breakpoint(mo5, i);
+            if (bp->temporary) {
+                continue;
+            }
+            ImGui::PushID(i);
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            bool enabled = bp->enabled;
+            if (ImGui::Checkbox("##enabled", &enabled)) {
+                mo5_enable_breakpoint(mo5, i, enabled);
+            }
+            ImGui::TableNextColumn();
+            ImGui::Text("%04X", bp->pc);
+            ImGui::TableNextColumn();
+            if (bp->break_hits) {
+                ImGui::Text("%u/%u", bp->hits, bp->break_hits);
+            } else {
+                ImGui::Text("%u", bp->hits);
+            }
+            ImGui::TableNextColumn();
+            // condition, compiled when Enter is pressed, an invalid one stays red
+            char condition[MO5_CONDITION_SIZE];
+            snprintf(condition, sizeof(condition), "%s", bp->condition);
+            const bool invalid = (ui->dbg.bad_condition == i) && (ui->dbg.bad_condition_pc == bp->pc);
+            if (invalid) {
+                ImGui::PushStyleColor(ImGuiCol_FrameBg, 0xFF000080);
+            }
+            ImGui::SetNextItemWidth(-1);
+            if (ImGui::InputTextWithHint("##cond", "condition", condition, sizeof(condition), ImGuiInputTextFlags_EnterReturnsTrue)) {
+                ui->dbg.bad_condition = mo5_set_breakpoint_condition(mo5, i, condition) ? -1 : i;
+                ui->dbg.bad_condition_pc = bp->pc;
+                ui->dbg.num_breakpoints = mo5_num_breakpoints(mo5);
+            }
+            if (invalid) {
+                ImGui::PopStyleColor();
+            }
+            ImGui::TableNextColumn();
+            if (ImGui::SmallButton("Del")) {
+                del_index = i;
+            }
+            ImGui::PopID();
+        }
+        ImGui::EndTable();
+        if (del_index != -1) {
+            mo5_remove_breakpoint(mo5, del_index);
+            ui->dbg.bad_condition = -1;
+        }
+    }
+}
+
+static void _ui_dbg_draw_watchpoints(ui_emu_t* ui) {
+    static const char* access_names[] = { "W", "R", "RW" };
+    static const uint8_t access_flags[] = { MO5_WATCH_WRITE, MO5_WATCH_READ, MO5_WATCH_READ | MO5_WATCH_WRITE };
+    static const char* cond_names[] = { "any", "==", "!=", ">", "<" };
+    mo5_t* mo5 = ui->mo5;
+    mo5_watchpoint_t* wp = &ui->dbg.wp;
+    ImGui::SetNextItemWidth(48);
+    ImGui::InputScalar("##wp_addr", ImGuiDataType_U16, &wp->address, 0, 0, "%04X", ImGuiInputTextFlags_CharsHexadecimal);
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(48);
+    ImGui::Combo("##wp_access", &ui->dbg.wp_access, access_names, 3);
+    ImGui::SameLine();
+    int cond = (int)wp->cond;
+    ImGui::SetNextItemWidth(48);
+    if (ImGui::Combo("##wp_cond", &cond, cond_names, 5)) {
+        wp->cond = (mo5_watch_cond_t)cond;
+    }
+    if (wp->cond != MO5_WATCH_ANY) {
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(32);
+        ImGui::InputScalar("##wp_value", ImGuiDataType_U8, &wp->value, 0, 0, "%02X", ImGuiInputTextFlags_CharsHexadecimal);
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(32);
+        ImGui::InputScalar("Mask##wp_mask", ImGuiDataType_U8, &wp->mask, 0, 0, "%02X", ImGuiInputTextFlags_CharsHexadecimal);
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Watch")) {
+        wp->access = access_flags[ui->dbg.wp_access];
+        mo5_add_watchpoint(mo5, wp);
+    }
+    mo5_watch_hit_t hit;
+    if (ui->dbg.stopped && mo5_watch_hit(mo5, &hit)) {
+        ImGui::Text("%s %04X=%02X at PC %04X, cycle %llu", hit.write ? "write" : "read",
+            hit.address, hit.value, hit.pc, (unsigned long long)hit.cycle);
+    }
+    if (ImGui::BeginTable("##watchpoints", 4)) {
+        int del_index = -1;
+        for (int i = 0; i < mo5_num_watchpoints(mo5); i++) {
+            const mo5_watchpoint_t* w = mo5_watchpoint(mo5, i);
+            ImGui::PushID(i);
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            bool enabled = w->enabled;
+            if (ImGui::Checkbox("##enabled", &enabled)) {
+                mo5_enable_watchpoint(mo5, i, enabled);
+            }
+            ImGui::TableNextColumn();
+            const int access = (w->access == MO5_WATCH_WRITE) ? 0 : ((w->access == MO5_WATCH_READ) ? 1 : 2);
+            if (w->cond == MO5_WATCH_ANY) {
+                ImGui::Text("%04X %s", w->address, access_names[access]);
+            } else {
+                ImGui::Text("%04X %s &%02X %s %02X", w->address, access_names[access], w->mask, cond_names[w->cond], w->value);
+            }
+            ImGui::TableNextColumn();
+            ImGui::Text("%u", w->hits);
+            ImGui::TableNextColumn();
+            if (ImGui::SmallButton("Del")) {
+                del_index = i;
+            }
+            ImGui::PopID();
+        }
+        ImGui::EndTable();
+        if (del_index != -1) {
+            mo5_remove_watchpoint(mo5, del_index);
+        }
+    }
+}
+
+#define _UI_DBG_TRACE_SIZE (16 * 1024 * 1024)
+// instructions written on a break, the whole ring takes seconds to disassemble
+#define _UI_DBG_TRACE_ON_BREAK (4096)
+// snapshots for Back and Reverse continue, up to 50 s of emulation
+#define _UI_DBG_HISTORY_SIZE (16 * 1024 * 1024)
+#define _UI_DBG_TRACE_TEXT "mo5-trace.txt"
+#define _UI_DBG_TRACE_BINARY "mo5-trace.bin"
+
+// last: number of instructions written as text, 0 for all
+static void _ui_dbg_write_trace(ui_emu_t* ui, bool binary, uint32_t last) {
+    const char* path = binary ? _UI_DBG_TRACE_BINARY : _UI_DBG_TRACE_TEXT;
+    FILE* fp = fopen(path, "wb");
+    bool success = false;
+    if (fp) {
+        if (binary) {
+            success = mo5trace_write_binary(ui->mo5->trace, fp);
+        } else {
+            success = mo5trace_write_text(ui->mo5->trace, fp, m6809dasm_op, last);
+        }
+        success &= (0 == fclose(fp));
+    }
+    ui->dbg.trace_file = path;
+    ui->dbg.trace_failed = !success;
+}
+
+static void _ui_dbg_draw_trace(ui_emu_t* ui) {
+    mo5_t* mo5 = ui->mo5;
+    if (!MO5_TRACE) {
+        ImGui::TextDisabled("No instruction trace in this build");
+        return;
+    }
+    bool recording = mo5trace_recording(mo5->trace);
+    if (ImGui::Checkbox("Trace", &recording)) {
+        if (recording) {
+            mo5trace_start(mo5, _UI_DBG_TRACE_SIZE);
+        } else {
+            mo5trace_stop(mo5);
+        }
+    }
+    ImGui::SameLine();
+    ImGui::Checkbox("Write on break", &ui->dbg.trace_on_break);
+    const uint32_t num_ops = mo5trace_num_ops(mo5->trace);
+    if (num_ops > 0) {
+        ImGui::Text("%u instructions, %.1f bytes each", num_ops, (double)mo5trace_num_bytes(mo5->trace) / num_ops);
+        if (ImGui::Button("Write text")) {
+            _ui_dbg_write_trace(ui, false, 0);
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Write binary")) {
+            _ui_dbg_write_trace(ui, true, 0);
+        }
+    }
+    if (ui->dbg.trace_file) {
+        ImGui::Text("%s%s", ui->dbg.trace_failed ? "Can't write " : "", ui->dbg.trace_file);
+    }
+}
+
+static void _ui_dbg_step_back(ui_emu_t* ui, bool reverse_continue) {
+    mo5_t* mo5 = ui->mo5;
+    ui->dbg.history_end = !(reverse_continue ? mo5_reverse_continue(mo5) : mo5_step_back(mo5));
+}
+
+static void _ui_dbg_draw_history(ui_emu_t* ui) {
+    mo5_t* mo5 = ui->mo5;
+    bool recording = mo5->history != 0;
+    if (ImGui::Checkbox("History", &recording)) {
+        if (recording) {
+            mo5_history_start(mo5, _UI_DBG_HISTORY_SIZE);
+        } else {
+            mo5_history_stop(mo5);
+        }
+        ui->dbg.history_end = false;
+    }
+    if (recording) {
+        const mo5_history_stats_t stats = mo5_history_stats(mo5);
+        ImGui::SameLine();
+        ImGui::Text("%.1f s back, %d/%d states", (double)(mo5->cycles - stats.first_cycle) / 1000000.0, stats.num_states, stats.max_states);
+        if (ui->dbg.history_end) {
+            ImGui::Text("Nothing found in the history");
+        }
+    }
+}
+
+static void _ui_dbg_draw_coverage(ui_emu_t* ui) {
+    mo5_t* mo5 = ui->mo5;
+    bool counting = mo5->coverage != 0;
+    if (ImGui::Checkbox("Coverage", &counting)) {
+        if (counting) {
+            mo5cover_start(mo5);
+        } else {
+            mo5cover_stop(mo5);
+        }
+    }
+    const mo5_coverage_t* cover = mo5->coverage;
+    if (!cover) {
+        return;
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Clear")) {
+        mo5cover_clear(mo5->coverage);
+    }
+    int num_executed = 0, num_read = 0, num_written = 0;
+    for (int addr = 0; addr < MO5COVER_SIZE; addr++) {
+        const uint8_t flags = cover->flags[addr];
+        num_executed += (flags & (MO5COVER_OPCODE | MO5COVER_OPERAND)) ? 1 : 0;
+        num_read += (flags & MO5COVER_READ) ? 1 : 0;
+        num_written += (flags & MO5COVER_WRITE) ? 1 : 0;
+    }
+    ImGui::Text("%d executed, %d read, %d written", num_executed, num_read, num_written);
+    uint16_t hottest[8];
+    const int num_hottest = mo5cover_hottest(cover, hottest, 8);
+    for (int i = 0; i < num_hottest; i++) {
+        ImGui::Text("%04X  %u", hottest[i], cover->hits[hottest[i]]);
+    }
+}
+
 void _ui_dbg_draw_cpu(ui_emu_t* ui) {
     if (!ui->dbg.open) {
         return;
@@ -511,9 +850,32 @@ void _ui_dbg_draw_cpu(ui_emu_t* ui) {
                 _ui_dbg_continue(ui);
             }
             ImGui::SameLine();
-            snprintf(str, sizeof(str), "Step (%s)", _ui_dbg_str_or_def(ui->keys.step_over.name, "-"));
+            snprintf(str, sizeof(str), "Over (%s)", _ui_dbg_str_or_def(ui->keys.step_over.name, "-"));
             if (ImGui::Button(str)) {
-                _ui_dbg_step(ui);
+                _ui_dbg_step_over(ui);
+            }
+            ImGui::SameLine();
+            snprintf(str, sizeof(str), "Into (%s)", _ui_dbg_str_or_def(ui->keys.step_into.name, "-"));
+            if (ImGui::Button(str)) {
+                _ui_dbg_step_into(ui);
+            }
+            ImGui::SameLine();
+            snprintf(str, sizeof(str), "Out (%s)", _ui_dbg_str_or_def(ui->keys.step_out.name, "-"));
+            if (ImGui::Button(str)) {
+                _ui_dbg_step_out(ui);
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Frame")) {
+                _ui_dbg_step_frame(ui);
+            }
+            if (ui->mo5->history) {
+                if (ImGui::Button("Back")) {
+                    _ui_dbg_step_back(ui, false);
+                }
+                ImGui::SameLine();
+                if (ImGui::Button("Reverse continue")) {
+                    _ui_dbg_step_back(ui, true);
+                }
             }
         } else {
             snprintf(str, sizeof(str), "Break (%s)", _ui_dbg_str_or_def(ui->keys.stop.name, "-"));
@@ -521,6 +883,16 @@ void _ui_dbg_draw_cpu(ui_emu_t* ui) {
                 _ui_dbg_break(ui);
             }
         }
+        ImGui::Separator();
+        _ui_dbg_draw_breakpoints(ui);
+        ImGui::Separator();
+        _ui_dbg_draw_watchpoints(ui);
+        ImGui::Separator();
+        _ui_dbg_draw_trace(ui);
+        ImGui::Separator();
+        _ui_dbg_draw_history(ui);
+        ImGui::Separator();
+        _ui_dbg_draw_coverage(ui);
     }
     ImGui::End();
 }
@@ -529,7 +901,7 @@ static const uint8_t* _ui_mo5_rd_memptr(mo5_t* mo5, int layer, uint16_t addr) {
     EMU_ASSERT((layer >= _UI_MO5_MEMLAYER_BASIC) && (layer < _UI_MO5_MEMLAYER_NUM));
     if (layer == _UI_MO5_MEMLAYER_VIDEO) {
         if (addr < 0x2000) {
-            return mo5->mem.video + addr;
+            return mo5_ram_ptr(mo5, mo5->mem.video + addr, false);
         }
     } else if (layer == _UI_MO5_MEMLAYER_BASIC) {
         if (addr >= 0xc000 && addr < 0xf000) {
@@ -543,7 +915,7 @@ static const uint8_t* _ui_mo5_rd_memptr(mo5_t* mo5, int layer, uint16_t addr) {
         }
     } else if (layer == _UI_MO5_MEMLAYER_RAM) {
         if (addr >= 0x2000 && addr < 0xa000) {
-            return &mo5->mem.ram[addr + 0x2000];
+            return mo5_ram_ptr(mo5, addr + 0x2000, false);
         }
     }
     /* fallthrough: address isn't mapped to physical RAM */
@@ -554,11 +926,11 @@ static uint8_t* _ui_mo5_memptr(mo5_t* mo5, int layer, uint16_t addr) {
     EMU_ASSERT((layer >= _UI_MO5_MEMLAYER_BASIC) && (layer < _UI_MO5_MEMLAYER_NUM));
     if (layer == _UI_MO5_MEMLAYER_VIDEO) {
         if (addr < 0x2000) {
-            return &mo5->mem.video[addr];
+            return mo5_ram_ptr(mo5, mo5->mem.video + addr, true);
         }
     } else if (layer == _UI_MO5_MEMLAYER_RAM) {
         if (addr >= 0x2000 && addr < 0xa000) {
-            return &mo5->mem.ram[addr + 0x2000];
+            return mo5_ram_ptr(mo5, addr + 0x2000, true);
         }
     }
     /* fallthrough: address isn't mapped to physical RAM */
@@ -570,8 +942,7 @@ static uint8_t _ui_mo5_mem_read(int layer, uint16_t addr, void* user_data) {
     ui_emu_t* ui = (ui_emu_t*) user_data;
     mo5_t* mo5 = ui->mo5;
     if (layer == _UI_MO5_MEMLAYER_CPU) {
-        /* TODO: MO5 mapped RAM layer */
-        // return mem_rd(&mo5->mem, addr);
+        return mo5_mem_peek(mo5, addr);
     } else {
         const uint8_t* ptr = _ui_mo5_rd_memptr(mo5, layer, addr);
         if (ptr) {
@@ -589,7 +960,7 @@ static void _ui_mo5_mem_write(int layer, uint16_t addr, uint8_t data, void* user
     ui_emu_t* ui = (ui_emu_t*) user_data;
     mo5_t* mo5 = ui->mo5;
     if (layer == _UI_MO5_MEMLAYER_CPU) {
-        // TODO: mem_wr(&mo5->mem, addr, data);
+        mo5_mem_poke(mo5, addr, data);
     } else {
         uint8_t* ptr = _ui_mo5_memptr(mo5, layer, addr);
         if (ptr) {
@@ -598,11 +969,58 @@ static void _ui_mo5_mem_write(int layer, uint16_t addr, uint8_t data, void* user
     }
 }
 
+// cycles over which the heat map fades out
+#define _UI_MO5_HEAT_CYCLES (2000000)
+
+/* coverage heat map: the kind of the last accesses, brighter when recent */
+static uint32_t _ui_mo5_heat(int layer, uint16_t addr, void* user_data) {
+    CHIPS_ASSERT(user_data);
+    ui_emu_t* ui = (ui_emu_t*) user_data;
+    mo5_t* mo5 = ui->mo5;
+    const mo5_coverage_t* cover = mo5->coverage;
+    /* coverage is by CPU address, the video layer isn't mapped there */
+    if (!cover || (layer == _UI_MO5_MEMLAYER_VIDEO) || ((layer != _UI_MO5_MEMLAYER_CPU) && !_ui_mo5_rd_memptr(mo5, layer, addr))) {
+        return 0;
+    }
+    const uint8_t flags = cover->flags[addr];
+    if (!flags) {
+        return 0;
+    }
+    const uint64_t age = mo5->cycles - cover->cycle[addr];
+    const uint32_t alpha = 48 + ((age < _UI_MO5_HEAT_CYCLES) ? (uint32_t)(160 * (_UI_MO5_HEAT_CYCLES - age) / _UI_MO5_HEAT_CYCLES) : 0);
+    if (flags & (MO5COVER_OPCODE | MO5COVER_OPERAND)) {
+        return IM_COL32(255, 64, 32, alpha);
+    } else if (flags & MO5COVER_WRITE) {
+        return IM_COL32(64, 128, 255, alpha);
+    }
+    return IM_COL32(64, 255, 64, alpha);
+}
+
+static bool _ui_mo5_is_opcode(int layer, uint16_t addr, void* user_data) {
+    CHIPS_ASSERT(user_data);
+    ui_emu_t* ui = (ui_emu_t*) user_data;
+    const mo5_coverage_t* cover = ui->mo5->coverage;
+    return cover && (layer != _UI_MO5_MEMLAYER_VIDEO) && (cover->flags[addr] & MO5COVER_OPCODE);
+}
+
+/* the RAM, video and ROM layers show the bytes of the CPU pages at the same addresses */
+static uint32_t _ui_mo5_mem_gen(int layer, uint16_t addr, void* user_data) {
+    CHIPS_ASSERT(user_data);
+    ui_emu_t* ui = (ui_emu_t*) user_data;
+    (void)layer;
+    return mo5_mem_generation(ui->mo5, addr);
+}
+
 void ui_emu_init(ui_emu_t* ui, const ui_emu_desc_t* ui_desc) {
     EMU_ASSERT(ui && ui_desc);
     EMU_ASSERT(ui_desc->mo5);
     ui->mo5 = ui_desc->mo5;
     ui->keys = ui_desc->dbg_keys;
+    ui->dbg.wp.mask = 0xff;
+    ui->dbg.bad_condition = -1;
+    ui->runahead = ui_desc->runahead;
+    ui->rewind = ui_desc->rewind;
+    ui->cheat_list.file = ui_desc->cheats;
     ui_snapshot_init(&ui->snapshot, &ui_desc->snapshot);
     int x = 20, y = 20, dx = 10, dy = 10;
     {
@@ -615,15 +1033,15 @@ void ui_emu_init(ui_emu_t* ui, const ui_emu_desc_t* ui_desc) {
     {
         ui->cheats_search.x = x;
         ui->cheats_search.y = y;
-        ui->cheats_search.w = 200;
-        ui->cheats_search.h = 100;
+        ui->cheats_search.w = 260;
+        ui->cheats_search.h = 400;
     }
     x += dx; y += dy;
     {
         ui->cheats_add.x = x;
         ui->cheats_add.y = y;
         ui->cheats_add.w = 200;
-        ui->cheats_add.h = 100;
+        ui->cheats_add.h = 200;
     }
     x += dx; y += dy;
     {
@@ -671,6 +1089,7 @@ void ui_emu_init(ui_emu_t* ui, const ui_emu_desc_t* ui_desc) {
         }
         desc.read_cb = _ui_mo5_mem_read;
         desc.write_cb = _ui_mo5_mem_write;
+        desc.color_cb = _ui_mo5_heat;
         desc.user_data = ui;
         static const char* titles[] = { "Memory Editor #1", "Memory Editor #2", "Memory Editor #3", "Memory Editor #4" };
         for (int i = 0; i < 4; i++) {
@@ -689,6 +1108,9 @@ void ui_emu_init(ui_emu_t* ui, const ui_emu_desc_t* ui_desc) {
         desc.read_cb = _ui_mo5_mem_read;
         desc.jump_tgt_cb = m6809_jump_tgt;
         desc.dasm_cb = m6809dasm_op;
+        desc.color_cb = _ui_mo5_heat;
+        desc.opcode_cb = _ui_mo5_is_opcode;
+        desc.gen_cb = _ui_mo5_mem_gen;
         desc.user_data = ui;
         static const char* titles[4] = { "Disassembler #1", "Disassembler #2", "Disassembler #2", "Dissassembler #3" };
         for (int i = 0; i < 4; i++) {
@@ -766,9 +1188,15 @@ void ui_emu_load_settings(ui_emu_t* ui, const ui_settings_t* settings) {
     }
 }
 
+/* called after each frame the machine ran, breakpoints and steps stop it mid-frame */
 static void _ui_dbg_tick(ui_emu_t* ui) {
-    if(ui->dbg.step_mode == UI_DBG_STEPMODE_OVER) {
+    if (mo5_break_hit(ui->mo5) || (ui->dbg.step_mode == UI_DBG_STEPMODE_TICK)) {
+        // steps stop the machine too, only breakpoints write the trace
+        if (ui->dbg.trace_on_break && (ui->dbg.step_mode == UI_DBG_STEPMODE_NONE) && (mo5trace_num_ops(ui->mo5->trace) > 0)) {
+            _ui_dbg_write_trace(ui, false, _UI_DBG_TRACE_ON_BREAK);
+        }
         ui->dbg.stopped = true;
+        ui->dbg.step_mode = UI_DBG_STEPMODE_NONE;
     }
 }
 
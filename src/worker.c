@@ -0,0 +1,117 @@
+#include "worker.h"
+#include <stdlib.h>
+#include <assert.h>
+
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+    #define WORKER_NO_THREADS (1)
+#elif defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <pthread.h>
+#endif
+
+struct worker_t {
+    worker_func_t func;
+    void* user_data;
+    #if defined(WORKER_NO_THREADS)
+    #elif defined(_WIN32)
+    HANDLE thread;
+    #else
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    bool done;
+    #endif
+};
+
+#if defined(WORKER_NO_THREADS)
+worker_t* worker_start(worker_func_t func, void* user_data) {
+    assert(func);
+    worker_t* worker = (worker_t*) calloc(1, sizeof(worker_t));
+    worker->func = func;
+    worker->user_data = user_data;
+    func(user_data);
+    return worker;
+}
+
+bool worker_done(worker_t* worker) {
+    assert(worker);
+    (void)worker;
+    return true;
+}
+
+void worker_join(worker_t* worker) {
+    free(worker);
+}
+#elif defined(_WIN32)
+static DWORD WINAPI _worker_main(LPVOID arg) {
+    worker_t* worker = (worker_t*) arg;
+    worker->func(worker->user_data);
+    return 0;
+}
+
+worker_t* worker_start(worker_func_t func, void* user_data) {
+    assert(func);
+    worker_t* worker = (worker_t*) calloc(1, sizeof(worker_t));
+    worker->func = func;
+    worker->user_data = user_data;
+    worker->thread = CreateThread(NULL, 0, _worker_main, worker, 0, NULL);
+    if (worker->thread == NULL) {
+        free(worker);
+        return 0;
+    }
+    return worker;
+}
+
+bool worker_done(worker_t* worker) {
+    assert(worker);
+    return WaitForSingleObject(worker->thread, 0) == WAIT_OBJECT_0;
+}
+
+void worker_join(worker_t* worker) {
+    if (worker) {
+        WaitForSingleObject(worker->thread, INFINITE);
+        CloseHandle(worker->thread);
+        free(worker);
+    }
+}
+#else
+static void* _worker_main(void* arg) {
+    worker_t* worker = (worker_t*) arg;
+    worker->func(worker->user_data);
+    pthread_mutex_lock(&worker->mutex);
+    worker->done = true;
+    pthread_mutex_unlock(&worker->mutex);
+    return 0;
+}
+
+worker_t* worker_start(worker_func_t func, void* user_data) {
+    assert(func);
+    worker_t* worker = (worker_t*) calloc(1, sizeof(worker_t));
+    worker->func = func;
+    worker->user_data = user_data;
+    pthread_mutex_init(&worker->mutex, 0);
+    if (0 != pthread_create(&worker->thread, 0, _worker_main, worker)) {
+        pthread_mutex_destroy(&worker->mutex);
+        free(worker);
+        return 0;
+    }
+    return worker;
+}
+
+bool worker_done(worker_t* worker) {
+    assert(worker);
+    pthread_mutex_lock(&worker->mutex);
+    const bool done = worker->done;
+    pthread_mutex_unlock(&worker->mutex);
+    return done;
+}
+
+void worker_join(worker_t* worker) {
+    if (worker) {
+        pthread_join(worker->thread, 0);
+        pthread_mutex_destroy(&worker->mutex);
+        free(worker);
+    }
+}
+#endif
@@ -0,0 +1,27 @@
+#pragma once
+/*
+    Run a function on a background thread.
+
+    Uses pthreads on POSIX platforms and win32 threads on Windows. On
+    platforms without threads (emscripten without pthread support) the
+    function runs synchronously inside worker_start().
+*/
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct worker_t worker_t;
+typedef void (*worker_func_t)(void* user_data);
+
+// start func(user_data) on a new thread, returns 0 if the thread could not be created
+worker_t* worker_start(worker_func_t func, void* user_data);
+// true once the function has returned
+bool worker_done(worker_t* worker);
+// wait for the function to return and free the worker
+void worker_join(worker_t* worker);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif